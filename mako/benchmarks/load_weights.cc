@@ -0,0 +1,427 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <absl/log/log.h>
+#include <absl/strings/match.h>
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_format.h>
+#include <absl/strings/str_split.h>
+#include <absl/strings/strip.h>
+#include <nlohmann/json.hpp>
+#include <torch/torch.h>
+
+#include "mako/utils/flags.h"
+#include "mako/utils/huggingface/transformers.h"
+
+namespace fs = std::filesystem;
+
+using json = nlohmann::json;
+
+using mako::utils::double_flag;
+using mako::utils::int_flag;
+using mako::utils::parse_flags;
+using mako::utils::string_flag;
+
+static constexpr char usage[] = R"(Usage: load_weights_benchmark [--FLAG=VALUE]...
+
+Generates a synthetic checkpoint of a Llama model in each load format and measures how fast weight_iterator loads
+it, both cold, i.e., with the checkpoint out of the page cache, and warm. The page cache is dropped through
+/proc/sys/vm/drop_caches if permitted, or else by posix_fadvise on each file of the checkpoint.
+
+The auto and npcache formats load pytorch_model-*.bin archives, while pt loads *.pt archives and safetensors loads
+*.safetensors files; npcache converts the archives into its cache once, which is measured separately.
+
+Flags:
+  --formats            load formats to measure, separated by commas (default: auto,safetensors,pt,npcache)
+  --size-gb            approximate size of the checkpoint in GB (default: 2)
+  --num-shards         files to split the checkpoint into (default: 2)
+  --hidden-size        hidden size of the model (default: 4096)
+  --intermediate-size  intermediate size of the model (default: 11008)
+  --vocab-size         vocabulary size of the model (default: 32000)
+  --dtype              float32, bfloat16, or float16 to store the weights in (default: bfloat16)
+  --load-dtype         float32, bfloat16, or float16 to convert the weights to while loading (default: none)
+  --num-workers        threads to load the weights with (default: 1)
+  --warm-runs          warm loads to measure per format (default: 1)
+  --dir                directory to generate the checkpoints in (default: a temporary directory)
+  --keep               true to keep the checkpoints, and reuse them if generated with the same flags (default: false)
+)";
+
+/// \brief Reads a dtype flag.
+/// \param __flags The values of the flags by their names.
+/// \param __name The name of the flag.
+/// \param __default The value if the flag is not given, or ``"none"`` for no dtype.
+/// \return The dtype, if any.
+static inline std::optional<torch::Dtype> dtype_flag(
+  const std::map<std::string, std::string> &__flags,
+  const std::string &__name,
+  const std::string &__default) {
+  std::map<std::string, torch::Dtype> dtypes = {
+    {"float32",  torch::kFloat32 },
+    {"bfloat16", torch::kBFloat16},
+    {"float16",  torch::kFloat16 },
+  };
+  auto value = string_flag(__flags, __name, __default);
+  if (value == "none") {
+    return std::nullopt;
+  }
+  auto it = dtypes.find(value);
+  if (it == dtypes.end()) {
+    LOG(FATAL) << "Unknown dtype for --" << __name << ": " << value;
+  }
+  return it->second;
+}
+
+/// \brief The weights of a synthetic Llama model, split into shards.
+/// \param __size The approximate size of the model in bytes, which is rounded to whole layers.
+/// \param __num_shards The number of shards.
+/// \param __config The sizes of the model, i.e., ``hidden_size``, ``intermediate_size``, and ``vocab_size``.
+/// \param __dtype The dtype of the weights.
+/// \return The names and shapes of the weights of each shard.
+static inline std::vector<std::vector<std::pair<std::string, std::vector<int64_t>>>> llama_shards(
+  double __size,
+  int64_t __num_shards,
+  const std::map<std::string, int64_t> &__config,
+  torch::Dtype __dtype) {
+  auto hidden_size       = __config.at("hidden_size");
+  auto intermediate_size = __config.at("intermediate_size");
+  auto vocab_size        = __config.at("vocab_size");
+  auto element_size      = static_cast<double>(c10::elementSize(__dtype));
+
+  auto embedding_bytes = 2.0 * vocab_size * hidden_size * element_size;
+  auto layer_bytes     = (4.0 * hidden_size * hidden_size + 3.0 * hidden_size * intermediate_size + 2.0 * hidden_size) *
+                     element_size;
+  auto num_layers = std::max<int64_t>(std::llround((__size - embedding_bytes) / layer_bytes), 1);
+
+  std::vector<std::pair<std::string, std::vector<int64_t>>> weights;
+  weights.emplace_back("model.embed_tokens.weight", std::vector<int64_t>{vocab_size, hidden_size});
+  for (int64_t layer = 0; layer < num_layers; ++layer) {
+    auto prefix = absl::StrFormat("model.layers.%d.", layer);
+    for (auto proj : {"q_proj", "k_proj", "v_proj", "o_proj"}) {
+      weights.emplace_back(prefix + "self_attn." + proj + ".weight", std::vector<int64_t>{hidden_size, hidden_size});
+    }
+    for (auto proj : {"gate_proj", "up_proj"}) {
+      weights.emplace_back(prefix + "mlp." + proj + ".weight", std::vector<int64_t>{intermediate_size, hidden_size});
+    }
+    weights.emplace_back(prefix + "mlp.down_proj.weight", std::vector<int64_t>{hidden_size, intermediate_size});
+    weights.emplace_back(prefix + "input_layernorm.weight", std::vector<int64_t>{hidden_size});
+    weights.emplace_back(prefix + "post_attention_layernorm.weight", std::vector<int64_t>{hidden_size});
+  }
+  weights.emplace_back("model.norm.weight", std::vector<int64_t>{hidden_size});
+  weights.emplace_back("lm_head.weight", std::vector<int64_t>{vocab_size, hidden_size});
+
+  // The weights are assigned to the shards in order, moving on to the next shard once one is full.
+  auto total_bytes = embedding_bytes + num_layers * layer_bytes;
+  std::vector<std::vector<std::pair<std::string, std::vector<int64_t>>>> shards(__num_shards);
+  double offset = 0;
+  for (auto &weight : weights) {
+    auto shard = std::min<int64_t>(static_cast<int64_t>(offset / total_bytes * __num_shards), __num_shards - 1);
+    auto numel = std::accumulate(weight.second.begin(), weight.second.end(), int64_t{1}, std::multiplies<>());
+    offset += numel * element_size;
+    shards[shard].push_back(std::move(weight));
+  }
+  return shards;
+}
+
+/// \brief The name of a safetensors dtype.
+static inline std::string safetensors_dtype(torch::Dtype __dtype) {
+  switch (__dtype) {
+    case torch::kFloat32:
+      return "F32";
+    case torch::kBFloat16:
+      return "BF16";
+    case torch::kFloat16:
+      return "F16";
+    default:
+      throw std::invalid_argument(absl::StrFormat("Unsupported dtype: %s", c10::toString(__dtype)));
+  }
+}
+
+/// \brief Writes tensors into a safetensors file.
+/// \param __filename The path to the file.
+/// \param __tensors The names and contiguous tensors to write.
+static inline void save_safetensors(
+  const fs::path &__filename,
+  const std::vector<std::pair<std::string, torch::Tensor>> &__tensors) {
+  auto header   = json::object();
+  size_t offset = 0;
+  for (const auto &[name, tensor] : __tensors) {
+    header[name] = {
+      {"dtype",        safetensors_dtype(tensor.scalar_type())},
+      {"shape",        tensor.sizes().vec()                   },
+      {"data_offsets", {offset, offset + tensor.nbytes()}     },
+    };
+    offset += tensor.nbytes();
+  }
+  header["__metadata__"] = {
+    {"format", "pt"}
+  };
+
+  // The header is padded with spaces so that the data is aligned to 8 bytes.
+  auto contents = header.dump();
+  contents.resize((contents.size() + 7) / 8 * 8, ' ');
+  auto header_size = static_cast<uint64_t>(contents.size());
+
+  std::ofstream stream(__filename, std::ios::binary);
+  stream.write(reinterpret_cast<const char *>(&header_size), sizeof(header_size));
+  stream.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+  for (const auto &[name, tensor] : __tensors) {
+    stream.write(static_cast<const char *>(tensor.data_ptr()), static_cast<std::streamsize>(tensor.nbytes()));
+  }
+}
+
+/// \brief Writes tensors into a ``torch.save`` archive.
+/// \param __filename The path to the file.
+/// \param __tensors The names and tensors to write.
+static inline void save_pickle(
+  const fs::path &__filename,
+  const std::vector<std::pair<std::string, torch::Tensor>> &__tensors) {
+  c10::Dict<std::string, torch::Tensor> state_dict;
+  for (const auto &[name, tensor] : __tensors) {
+    state_dict.insert(name, tensor);
+  }
+  auto buf = torch::pickle_save(state_dict);
+  std::ofstream(__filename, std::ios::binary).write(buf.data(), static_cast<std::streamsize>(buf.size()));
+}
+
+/// \brief Generates the checkpoint of each format, one directory per format.
+/// \param __dir The directory to generate the checkpoints in.
+/// \param __formats The load formats.
+/// \param __shards The names and shapes of the weights of each shard.
+/// \param __dtype The dtype of the weights.
+static inline void generate(
+  const fs::path &__dir,
+  const std::vector<std::string> &__formats,
+  const std::vector<std::vector<std::pair<std::string, std::vector<int64_t>>>> &__shards,
+  torch::Dtype __dtype) {
+  for (const auto &format : __formats) {
+    fs::remove_all(__dir / format);
+    fs::create_directories(__dir / format);
+  }
+
+  // Each shard is generated once and written in every format, so that only one shard is in memory at a time.
+  for (size_t i = 0; i < __shards.size(); ++i) {
+    std::vector<std::pair<std::string, torch::Tensor>> tensors;
+    for (const auto &[name, shape] : __shards[i]) {
+      tensors.emplace_back(name, torch::randn(shape, torch::kFloat32).to(__dtype));
+    }
+    auto stem = absl::StrFormat("%05d-of-%05d", i + 1, __shards.size());
+    for (const auto &format : __formats) {
+      if (format == "safetensors") {
+        save_safetensors(__dir / format / absl::StrFormat("model-%s.safetensors", stem), tensors);
+      } else if (format == "pt") {
+        save_pickle(__dir / format / absl::StrFormat("model-%s.pt", stem), tensors);
+      } else {
+        save_pickle(__dir / format / absl::StrFormat("pytorch_model-%s.bin", stem), tensors);
+      }
+    }
+  }
+}
+
+/// \brief Evicts the files under ``__dir`` from the page cache.
+/// \return How the page cache was dropped.
+static inline std::string drop_page_cache(const fs::path &__dir) {
+  sync();
+  {
+    // Dropping the whole page cache also evicts the dentries and inodes, but requires root.
+    std::ofstream drop_caches("/proc/sys/vm/drop_caches");
+    if (drop_caches << "3" << std::flush) {
+      return "drop_caches";
+    }
+  }
+
+  // Clean pages of a file are evicted on advice, which any process that can open the file may give.
+  for (const auto &entry : fs::recursive_directory_iterator(__dir)) {
+    if (!entry.is_regular_file()) {
+      continue;
+    }
+    auto fd = open(entry.path().c_str(), O_RDONLY);
+    if (fd < 0) {
+      continue;
+    }
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+  return "fadvise";
+}
+
+/// \brief Resets the peak resident set size of this process, if the kernel allows.
+static inline void reset_peak_rss() {
+  std::ofstream("/proc/self/clear_refs") << "5";
+}
+
+/// \brief The peak resident set size of this process in bytes, since the last reset.
+static inline double peak_rss() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    absl::string_view value = line;
+    if (absl::ConsumePrefix(&value, "VmHWM:")) {
+      int64_t kilobytes = 0;
+      absl::SimpleAtoi(absl::StripSuffix(absl::StripAsciiWhitespace(value), " kB"), &kilobytes);
+      return static_cast<double>(kilobytes) * 1024;
+    }
+  }
+  return 0;
+}
+
+/// \brief Measurements of a load.
+struct measurement {
+  size_t num_tensors  = 0;
+  double bytes        = 0;
+  double seconds      = 0;
+  double first_tensor = 0;
+  double peak_rss     = 0;
+};
+
+/// \brief Loads a checkpoint through ``weight_iterator``, copying each weight as a model would.
+/// \param __dir The directory of the checkpoint.
+/// \param __format The load format.
+/// \param __options Options to load the weights with.
+/// \return The measurements of the load.
+static inline measurement load(
+  const fs::path &__dir,
+  const std::string &__format,
+  const mako::utils::load_options &__options) {
+  reset_peak_rss();
+  measurement result;
+  auto start = std::chrono::steady_clock::now();
+  for (const auto &[name, weight] :
+       mako::utils::weight_iterator(__dir.string(), std::nullopt, __format, false, std::nullopt, __options)) {
+    if (result.num_tensors++ == 0) {
+      result.first_tensor = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    // The copy reads every byte, like loading into the parameters of a model, but is dropped right away so that the
+    // peak RSS reflects the loader rather than the model.
+    torch::empty_like(weight).copy_(weight);
+    result.bytes += static_cast<double>(weight.nbytes());
+  }
+  result.seconds  = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  result.peak_rss = peak_rss();
+  return result;
+}
+
+/// \brief Prints a row of the report.
+static inline void report(const std::string &__format, const std::string &__run, const measurement &__result) {
+  std::cout << absl::StrFormat(
+                 "%-12s %-8s %8d %9.3f %9.3f %9.3f %12.2f %10.3f",
+                 __format,
+                 __run,
+                 __result.num_tensors,
+                 __result.bytes / 1e9,
+                 __result.seconds,
+                 __result.bytes / 1e9 / __result.seconds,
+                 __result.first_tensor * 1e3,
+                 __result.peak_rss / 1e9)
+            << std::endl;
+}
+
+int main(int argc, char **argv) {
+  std::vector<std::string> positional;
+  auto flags = parse_flags(argc, argv, positional);
+  if (flags.count("help") != 0 || !positional.empty()) {
+    std::cerr << usage;
+    return positional.empty() ? 0 : 1;
+  }
+
+  std::vector<std::string> formats =
+    absl::StrSplit(string_flag(flags, "formats", "auto,safetensors,pt,npcache"), ',', absl::SkipEmpty());
+  for (const auto &format : formats) {
+    if (format != "auto" && format != "safetensors" && format != "pt" && format != "npcache") {
+      LOG(FATAL) << "Unknown load format: " << format;
+    }
+  }
+  std::map<std::string, int64_t> config = {
+    {"hidden_size",       int_flag(flags, "hidden-size", 4096)      },
+    {"intermediate_size", int_flag(flags, "intermediate-size", 11008)},
+    {"vocab_size",        int_flag(flags, "vocab-size", 32000)      },
+  };
+  auto size       = double_flag(flags, "size-gb", 2) * 1e9;
+  auto num_shards = int_flag(flags, "num-shards", 2);
+  auto dtype      = *dtype_flag(flags, "dtype", "bfloat16");
+  auto warm_runs  = int_flag(flags, "warm-runs", 1);
+  auto keep       = string_flag(flags, "keep", "false") == "true";
+  auto dir        = fs::path(string_flag(flags, "dir", (fs::temp_directory_path() / "mako_load_weights").string()));
+
+  mako::utils::load_options options;
+  options.num_workers = static_cast<size_t>(int_flag(flags, "num-workers", 1));
+  options.dtype       = dtype_flag(flags, "load-dtype", "none");
+
+  // The checkpoints are reused only if they were generated with the same flags.
+  auto shards   = llama_shards(size, num_shards, config, dtype);
+  json manifest = {
+    {"formats", formats             },
+    {"shards",  shards              },
+    {"dtype",   c10::toString(dtype)},
+  };
+  auto manifest_file = dir / "manifest.json";
+  if (!keep || !fs::exists(manifest_file) || json::parse(std::ifstream(manifest_file)) != manifest) {
+    LOG(INFO) << "Generating the checkpoints in " << dir;
+    fs::create_directories(dir);
+    fs::remove(manifest_file);
+    generate(dir, formats, shards, dtype);
+    std::ofstream(manifest_file) << manifest;
+  }
+
+  std::cout << absl::StrFormat(
+                 "%-12s %-8s %8s %9s %9s %9s %12s %10s",
+                 "format",
+                 "run",
+                 "tensors",
+                 "GB",
+                 "seconds",
+                 "GB/s",
+                 "first (ms)",
+                 "RSS (GB)")
+            << std::endl;
+  for (const auto &format : formats) {
+    auto format_dir = dir / format;
+    if (format == "npcache") {
+      // The first load converts the archives into the cache, which later loads read instead.
+      fs::remove_all(format_dir / "np");
+      drop_page_cache(format_dir);
+      report(format, "convert", load(format_dir, format, options));
+    }
+
+    auto method = drop_page_cache(format_dir);
+    report(format, "cold", load(format_dir, format, options));
+    for (int64_t run = 0; run < warm_runs; ++run) {
+      report(format, "warm", load(format_dir, format, options));
+    }
+    LOG(INFO) << "Dropped the page cache for " << format << " by " << method;
+  }
+
+  if (!keep) {
+    fs::remove_all(dir);
+  }
+  return 0;
+}
@@ -0,0 +1,648 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <absl/log/log.h>
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_split.h>
+#include <absl/strings/strip.h>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <nlohmann/json.hpp>
+#include <torch/torch.h>
+
+#include "mako/engine/engine.h"
+#include "mako/nn/modules/llama.h"
+#include "mako/utils/bounded_queue.h"
+#include "mako/utils/flags.h"
+#include "mako/utils/huggingface/hub.h"
+#include "mako/utils/huggingface/transformers.h"
+
+namespace beast_http = boost::beast::http;
+namespace fs         = std::filesystem;
+
+using json = nlohmann::json;
+using tcp  = boost::asio::ip::tcp;
+
+using mako::utils::double_flag;
+using mako::utils::int_flag;
+using mako::utils::parse_flags;
+using mako::utils::string_flag;
+
+static constexpr char usage[] = R"(Usage: serving_benchmark [MODEL] [--FLAG=VALUE]...
+
+Sends a synthetic workload of random prompts, arriving as a Poisson process or in bursts, and measures the throughput
+and the latencies of serving it: the time to first token (TTFT), the time per output token after the first (TPOT), the
+latency between consecutive outputs of a request (ITL), and the end-to-end latency of a request (E2EL).
+
+With MODEL, a Llama model on Hugging Face Hub or in a local directory, the benchmark drives an engine in-process, which
+excludes the server from the measurements. With --port instead, it streams the completions of a running server, e.g.,
+`mako MODEL --port=8000`, over HTTP.
+
+The workload is run once for each value of --max-concurrency, with prompts of its own generated from a seed derived
+from --seed, so that no run hits the prefix cache of the ones before it, and the results are written as JSON, so that
+runs can be compared across commits.
+
+Flags:
+  --num-prompts             prompts to send per run (default: 200)
+  --input-len               mean length of the prompts in tokens (default: 256)
+  --output-len              mean length of the outputs in tokens (default: 128)
+  --length-distribution     fixed, uniform, or exponential lengths around the means (default: fixed)
+  --range-ratio             half the width of uniform lengths relative to the means (default: 0.5)
+  --request-rate            requests per second, or inf to send all at once (default: inf)
+  --arrival                 poisson or burst, i.e., Poisson arrivals of --burst-size requests at once (default: poisson)
+  --burst-size              requests per burst (default: 8)
+  --max-concurrency         requests in flight at a time, or 0 for no limit, separated by commas to sweep (default: 0)
+  --temperature             temperature to sample with, or 0 for greedy decoding (default: 1.0)
+  --seed                    seed to generate the workload and sample with (default: 0)
+  --output                  file to write the results to (default: the standard output)
+  --label                   label of the results, e.g., the commit (default: none)
+  --host                    address of the server with --port (default: 127.0.0.1)
+  --port                    port of the server
+  --vocab-size              vocabulary size of the model served with --port (default: 32000)
+  --dtype                   float32, bfloat16, or float16 with MODEL (default: bfloat16)
+  --load-format             auto, safetensors, pt, or npcache with MODEL (default: auto)
+  --random-weights          true not to load the weights of MODEL but its configuration only (default: false)
+  --num-blocks              blocks in the KV cache with MODEL (default: 1024)
+  --block-size              tokens per block with MODEL (default: 16)
+  --max-num-seqs            sequences per step with MODEL (default: 256)
+  --max-num-batched-tokens  tokens per step with MODEL (default: 2048)
+  --prefill-chunk-size      prompt tokens to prefill per step with MODEL, or 0 not to chunk prompts (default: 0)
+  --enable-prefix-caching   true to share the KV cache of common prompt prefixes with MODEL (default: false)
+)";
+
+/// \brief Parameters of a synthetic workload.
+struct workload_config {
+  int64_t num_prompts             = 200;
+  int64_t input_len               = 256;
+  int64_t output_len              = 128;
+  std::string length_distribution = "fixed";
+  double range_ratio              = 0.5;
+  double request_rate             = std::numeric_limits<double>::infinity();
+  std::string arrival             = "poisson";
+  int64_t burst_size              = 8;
+  double temperature              = 1.0;
+  uint64_t seed                   = 0;
+};
+
+/// \brief A request of a workload.
+struct request_spec {
+  /// \brief The time the request arrives at, in seconds since the start of the run.
+  double arrival;
+
+  std::vector<int64_t> prompt_token_ids;
+
+  int64_t max_tokens;
+
+  uint64_t seed;
+};
+
+/// \brief Measurements of a request.
+struct request_result {
+  bool success = false;
+
+  /// \brief The error the request failed with, if any.
+  std::string error;
+
+  int64_t output_tokens = 0;
+
+  /// \brief The time to the first output, in seconds since the request was sent.
+  double ttft = 0;
+
+  /// \brief The end-to-end latency, in seconds since the request was sent.
+  double latency = 0;
+
+  /// \brief The latencies between consecutive outputs, in seconds.
+  std::vector<double> itl;
+};
+
+/// \brief Samples a length around ``__mean`` from the distribution of the workload.
+static inline int64_t sample_length(const workload_config &__workload, int64_t __mean, std::mt19937_64 &__generator) {
+  if (__workload.length_distribution == "uniform") {
+    auto low  = std::max<int64_t>(std::llround(__mean * (1 - __workload.range_ratio)), 1);
+    auto high = std::max<int64_t>(std::llround(__mean * (1 + __workload.range_ratio)), low);
+    return std::uniform_int_distribution<int64_t>(low, high)(__generator);
+  }
+  if (__workload.length_distribution == "exponential") {
+    auto length = std::exponential_distribution<double>(1.0 / static_cast<double>(__mean))(__generator);
+    return std::max<int64_t>(std::llround(length), 1);
+  }
+  return __mean;
+}
+
+/// \brief Generates the requests of a workload, in the order of their arrivals.
+/// \param __workload The parameters of the workload.
+/// \param __vocab_size The size of the vocabulary, whose first three tokens are left out of the prompts as special.
+/// \return The requests.
+static inline std::vector<request_spec> generate_requests(const workload_config &__workload, int64_t __vocab_size) {
+  std::mt19937_64 generator(__workload.seed);
+  std::uniform_int_distribution<int64_t> token(std::min<int64_t>(3, __vocab_size - 1), __vocab_size - 1);
+
+  // A burst is a Poisson arrival of several requests, so that the rate of requests stays the same.
+  auto burst_size = __workload.arrival == "burst" ? std::max<int64_t>(__workload.burst_size, 1) : 1;
+  std::exponential_distribution<double> interval(__workload.request_rate / static_cast<double>(burst_size));
+
+  std::vector<request_spec> requests;
+  double arrival = 0;
+  for (int64_t i = 0; i < __workload.num_prompts; ++i) {
+    if (i % burst_size == 0 && i != 0 && std::isfinite(__workload.request_rate)) {
+      arrival += interval(generator);
+    }
+    std::vector<int64_t> prompt_token_ids(sample_length(__workload, __workload.input_len, generator));
+    for (auto &token_id : prompt_token_ids) {
+      token_id = token(generator);
+    }
+    auto max_tokens = sample_length(__workload, __workload.output_len, generator);
+    requests.push_back({arrival, std::move(prompt_token_ids), max_tokens, __workload.seed + static_cast<uint64_t>(i)});
+  }
+  return requests;
+}
+
+/// \brief Runs the requests on an engine in-process, admitting them as they arrive.
+/// \param __engine The engine, which has no unfinished requests.
+/// \param __requests The requests, in the order of their arrivals.
+/// \param __workload The parameters of the workload.
+/// \param __max_concurrency The maximum number of requests in the engine at a time, or ``0`` for no limit.
+/// \param __results Receives the measurements of each request.
+/// \return The duration of the run in seconds.
+static inline double run_engine(
+  mako::engine::llm_engine &__engine,
+  const std::vector<request_spec> &__requests,
+  const workload_config &__workload,
+  size_t __max_concurrency,
+  std::vector<request_result> &__results) {
+  using clock = std::chrono::steady_clock;
+
+  __results.assign(__requests.size(), request_result());
+  std::vector<double> sent(__requests.size());
+  std::vector<double> last(__requests.size());
+  std::deque<size_t> waiting;
+  size_t next      = 0;
+  size_t in_flight = 0;
+  size_t completed = 0;
+
+  auto start   = clock::now();
+  auto elapsed = [&] { return std::chrono::duration<double>(clock::now() - start).count(); };
+  while (completed < __requests.size()) {
+    auto now = elapsed();
+    while (next < __requests.size() && __requests[next].arrival <= now) {
+      waiting.push_back(next++);
+    }
+    while (!waiting.empty() && (__max_concurrency == 0 || in_flight < __max_concurrency)) {
+      auto i = waiting.front();
+      waiting.pop_front();
+
+      mako::engine::sampling_params params;
+      params.max_tokens  = __requests[i].max_tokens;
+      params.temperature = __workload.temperature;
+      params.seed        = __requests[i].seed;
+      sent[i]            = elapsed();
+      try {
+        __engine.add_request(std::to_string(i), __requests[i].prompt_token_ids, std::move(params));
+        ++in_flight;
+      } catch (const std::invalid_argument &e) {
+        __results[i].error = e.what();
+        ++completed;
+      }
+    }
+
+    if (!__engine.has_unfinished_requests()) {
+      if (next < __requests.size()) {
+        std::this_thread::sleep_until(start + std::chrono::duration<double>(__requests[next].arrival));
+      }
+      continue;
+    }
+
+    for (const auto &output : __engine.step()) {
+      auto now     = elapsed();
+      auto i       = std::stoul(output.request_id);
+      auto &result = __results[i];
+      if (!output.token_ids.empty()) {
+        if (result.output_tokens == 0) {
+          result.ttft = now - sent[i];
+        } else {
+          result.itl.push_back(now - last[i]);
+        }
+        last[i]               = now;
+        result.output_tokens += static_cast<int64_t>(output.token_ids.size());
+      }
+      if (output.finished) {
+        result.success = true;
+        result.latency = now - sent[i];
+        --in_flight;
+        ++completed;
+      }
+    }
+  }
+  return elapsed();
+}
+
+/// \brief Streams the completion of a request from a server.
+/// \param __host The address of the server.
+/// \param __port The port of the server.
+/// \param __request The request.
+/// \param __workload The parameters of the workload.
+/// \return The measurements of the request.
+static inline request_result send_request(
+  const std::string &__host,
+  const std::string &__port,
+  const request_spec &__request,
+  const workload_config &__workload) {
+  using clock = std::chrono::steady_clock;
+
+  request_result result;
+  json body = {
+    {"prompt",         __request.prompt_token_ids     },
+    {"max_tokens",     __request.max_tokens           },
+    {"temperature",    __workload.temperature         },
+    {"seed",           __request.seed                 },
+    {"ignore_eos",     true                           },
+    {"stream",         true                           },
+    {"stream_options", {{"include_usage", true}}},
+  };
+  beast_http::request<beast_http::string_body> req(beast_http::verb::post, "/v1/completions", 11);
+  req.set(beast_http::field::host, __host);
+  req.set(beast_http::field::content_type, "application/json");
+  req.body() = body.dump();
+  req.prepare_payload();
+
+  auto sent          = clock::now();
+  auto last          = sent;
+  size_t num_outputs = 0;
+  try {
+    boost::asio::io_context context;
+    tcp::resolver resolver(context);
+    tcp::socket socket(context);
+    boost::asio::connect(socket, resolver.resolve(__host, __port));
+    beast_http::write(socket, req);
+
+    boost::beast::flat_buffer buffer;
+    beast_http::response_parser<beast_http::string_body> parser;
+    beast_http::read_header(socket, buffer, parser);
+    if (parser.get().result() != beast_http::status::ok) {
+      beast_http::read(socket, buffer, parser);
+      result.error = parser.get().body();
+      return result;
+    }
+
+    // Each event is timed as its chunk arrives, so events are parsed while the response is being read.
+    std::string events;
+    auto on_chunk_body = [&](uint64_t, boost::beast::string_view __body, boost::beast::error_code &) {
+      auto now = clock::now();
+      events.append(__body.data(), __body.size());
+      for (auto end = events.find("\n\n"); end != std::string::npos; end = events.find("\n\n")) {
+        absl::string_view data(events.data(), end);
+        if (absl::ConsumePrefix(&data, "data: ") && data != "[DONE]") {
+          auto chunk = json::parse(data);
+          if (chunk.contains("usage")) {
+            // The usage follows the last output, and counts the tokens that completed no text as well.
+            result.output_tokens = chunk["usage"]["completion_tokens"].get<int64_t>();
+          } else {
+            if (num_outputs++ == 0) {
+              result.ttft = std::chrono::duration<double>(now - sent).count();
+            } else {
+              result.itl.push_back(std::chrono::duration<double>(now - last).count());
+            }
+            last = now;
+          }
+        }
+        events.erase(0, end + 2);
+      }
+      return __body.size();
+    };
+    parser.on_chunk_body(on_chunk_body);
+    beast_http::read(socket, buffer, parser);
+  } catch (const std::exception &e) {
+    result.error = e.what();
+    return result;
+  }
+  result.success = num_outputs != 0;
+  result.latency = std::chrono::duration<double>(clock::now() - sent).count();
+  if (!result.success) {
+    result.error = "no completion";
+  }
+  return result;
+}
+
+/// \brief Runs the requests on a server, sending them as they arrive.
+/// \param __host The address of the server.
+/// \param __port The port of the server.
+/// \param __requests The requests, in the order of their arrivals.
+/// \param __workload The parameters of the workload.
+/// \param __max_concurrency The maximum number of requests in flight at a time, or ``0`` for no limit.
+/// \param __results Receives the measurements of each request.
+/// \return The duration of the run in seconds.
+static inline double run_http(
+  const std::string &__host,
+  const std::string &__port,
+  const std::vector<request_spec> &__requests,
+  const workload_config &__workload,
+  size_t __max_concurrency,
+  std::vector<request_result> &__results) {
+  using clock = std::chrono::steady_clock;
+
+  // Each client sends one request at a time, so the number of clients bounds the requests in flight, while the
+  // arrivals wait in the queue for a client.
+  __results.assign(__requests.size(), request_result());
+  mako::utils::bounded_queue<size_t> arrivals(__requests.size());
+  auto num_clients = __max_concurrency == 0 ? __requests.size() : std::min(__max_concurrency, __requests.size());
+
+  auto start = clock::now();
+  std::vector<std::thread> clients;
+  for (size_t i = 0; i < num_clients; ++i) {
+    clients.emplace_back([&] {
+      while (auto request = arrivals.pop()) {
+        __results[*request] = send_request(__host, __port, __requests[*request], __workload);
+      }
+    });
+  }
+  for (size_t i = 0; i < __requests.size(); ++i) {
+    std::this_thread::sleep_until(start + std::chrono::duration<double>(__requests[i].arrival));
+    arrivals.push(i);
+  }
+  arrivals.close();
+  for (auto &client : clients) {
+    client.join();
+  }
+  return std::chrono::duration<double>(clock::now() - start).count();
+}
+
+/// \brief Summarizes latencies in milliseconds.
+static inline json summarize_latencies(std::vector<double> __latencies) {
+  if (__latencies.empty()) {
+    return nullptr;
+  }
+  std::sort(__latencies.begin(), __latencies.end());
+  auto percentile = [&](double __p) {
+    auto rank  = __p / 100 * static_cast<double>(__latencies.size() - 1);
+    auto lower = static_cast<size_t>(rank);
+    auto upper = std::min(lower + 1, __latencies.size() - 1);
+    return 1e3 * (__latencies[lower] + (rank - static_cast<double>(lower)) * (__latencies[upper] - __latencies[lower]));
+  };
+  double sum = 0;
+  for (auto latency : __latencies) {
+    sum += latency;
+  }
+  return {
+    {"mean", 1e3 * sum / static_cast<double>(__latencies.size())},
+    {"p50",  percentile(50)                                      },
+    {"p90",  percentile(90)                                      },
+    {"p95",  percentile(95)                                      },
+    {"p99",  percentile(99)                                      },
+    {"max",  1e3 * __latencies.back()                            },
+  };
+}
+
+/// \brief Summarizes a run.
+/// \param __requests The requests of the run.
+/// \param __results The measurements of each request.
+/// \param __duration The duration of the run in seconds.
+/// \return The metrics of the run.
+static inline json summarize(
+  const std::vector<request_spec> &__requests,
+  const std::vector<request_result> &__results,
+  double __duration) {
+  int64_t completed     = 0;
+  int64_t input_tokens  = 0;
+  int64_t output_tokens = 0;
+  std::vector<double> ttft;
+  std::vector<double> tpot;
+  std::vector<double> itl;
+  std::vector<double> e2el;
+  std::string error;
+  for (size_t i = 0; i < __results.size(); ++i) {
+    const auto &result = __results[i];
+    if (!result.success) {
+      error = error.empty() ? result.error : error;
+      continue;
+    }
+    ++completed;
+    input_tokens  += static_cast<int64_t>(__requests[i].prompt_token_ids.size());
+    output_tokens += result.output_tokens;
+    ttft.push_back(result.ttft);
+    if (1 < result.output_tokens) {
+      tpot.push_back((result.latency - result.ttft) / static_cast<double>(result.output_tokens - 1));
+    }
+    itl.insert(itl.end(), result.itl.begin(), result.itl.end());
+    e2el.push_back(result.latency);
+  }
+  if (!error.empty()) {
+    LOG(WARNING) << __results.size() - completed << " requests failed, e.g., with: " << error;
+  }
+
+  return {
+    {"completed",              completed                                                 },
+    {"failed",                 static_cast<int64_t>(__results.size()) - completed        },
+    {"duration_s",             __duration                                                },
+    {"input_tokens",           input_tokens                                              },
+    {"output_tokens",          output_tokens                                             },
+    {"request_throughput",     static_cast<double>(completed) / __duration               },
+    {"output_throughput",      static_cast<double>(output_tokens) / __duration           },
+    {"total_token_throughput", static_cast<double>(input_tokens + output_tokens) / __duration},
+    {"ttft_ms",                summarize_latencies(std::move(ttft))                      },
+    {"tpot_ms",                summarize_latencies(std::move(tpot))                      },
+    {"itl_ms",                 summarize_latencies(std::move(itl))                       },
+    {"e2el_ms",                summarize_latencies(std::move(e2el))                      },
+  };
+}
+
+/// \brief Resolves a model on Hugging Face Hub or in a local directory to its local directory.
+/// \param __model_name_or_path The model.
+/// \return The directory with the configuration of the model.
+static inline std::string model_folder(const std::string &__model_name_or_path) {
+  if (fs::is_directory(__model_name_or_path)) {
+    return __model_name_or_path;
+  }
+  return mako::utils::snapshot_download(__model_name_or_path, std::nullopt, std::nullopt, {"*.json"});
+}
+
+int main(int argc, char **argv) {
+  std::vector<std::string> positional;
+  auto flags = parse_flags(argc, argv, positional);
+  if (flags.count("help") != 0 || positional.size() + flags.count("port") != 1) {
+    std::cerr << usage;
+    return flags.count("help") != 0 ? 0 : 1;
+  }
+
+  workload_config workload;
+  workload.num_prompts         = int_flag(flags, "num-prompts", workload.num_prompts);
+  workload.input_len           = int_flag(flags, "input-len", workload.input_len);
+  workload.output_len          = int_flag(flags, "output-len", workload.output_len);
+  workload.length_distribution = string_flag(flags, "length-distribution", workload.length_distribution);
+  workload.range_ratio         = double_flag(flags, "range-ratio", workload.range_ratio);
+  workload.request_rate        = double_flag(flags, "request-rate", workload.request_rate);
+  workload.arrival             = string_flag(flags, "arrival", workload.arrival);
+  workload.burst_size          = int_flag(flags, "burst-size", workload.burst_size);
+  workload.temperature         = double_flag(flags, "temperature", workload.temperature);
+  workload.seed                = static_cast<uint64_t>(int_flag(flags, "seed", 0));
+  if (workload.length_distribution != "fixed" && workload.length_distribution != "uniform" &&
+      workload.length_distribution != "exponential") {
+    LOG(FATAL) << "Unknown length distribution: " << workload.length_distribution;
+  }
+  if (workload.arrival != "poisson" && workload.arrival != "burst") {
+    LOG(FATAL) << "Unknown arrival: " << workload.arrival;
+  }
+  if (workload.num_prompts <= 0 || workload.input_len <= 0 || workload.output_len <= 0 ||
+      workload.request_rate <= 0) {
+    LOG(FATAL) << "--num-prompts, --input-len, --output-len, and --request-rate must be positive";
+  }
+
+  std::vector<size_t> max_concurrencies;
+  for (auto value : absl::StrSplit(string_flag(flags, "max-concurrency", "0"), ',', absl::SkipEmpty())) {
+    int64_t max_concurrency;
+    if (!absl::SimpleAtoi(value, &max_concurrency) || max_concurrency < 0) {
+      LOG(FATAL) << "Invalid value for --max-concurrency: " << value;
+    }
+    max_concurrencies.push_back(static_cast<size_t>(max_concurrency));
+  }
+
+  // Either runner takes the requests and the limit on concurrency, so the sweep is the same for both.
+  std::function<double(const std::vector<request_spec> &, size_t, std::vector<request_result> &)> run;
+  std::optional<mako::engine::llm_engine> engine;
+  int64_t vocab_size = int_flag(flags, "vocab-size", 32000);
+  std::string mode   = "http";
+  if (!positional.empty()) {
+    std::map<std::string, torch::Dtype> dtypes = {
+      {"float32",  torch::kFloat32 },
+      {"bfloat16", torch::kBFloat16},
+      {"float16",  torch::kFloat16 },
+    };
+    auto dtype = dtypes.find(string_flag(flags, "dtype", "bfloat16"));
+    if (dtype == dtypes.end()) {
+      LOG(FATAL) << "Unknown dtype: " << flags.at("dtype");
+    }
+
+    const auto &model_name_or_path = positional.front();
+    auto config                    = mako::nn::llama_config::from_pretrained(model_folder(model_name_or_path));
+    mako::nn::llama_for_causal_lm model(config);
+    model->to(dtype->second);
+    if (string_flag(flags, "random-weights", "false") != "true") {
+      mako::utils::load_options load_options;
+      load_options.dtype = dtype->second;
+      LOG(INFO) << "Loading " << model_name_or_path;
+      for (const auto &[name, weight] : mako::utils::weight_iterator(
+             model_name_or_path,
+             std::nullopt,
+             string_flag(flags, "load-format", "auto"),
+             true,
+             std::nullopt,
+             load_options)) {
+        model->load_weight(name, weight);
+      }
+    }
+
+    mako::engine::engine_config engine_config;
+    engine_config.num_blocks                       = int_flag(flags, "num-blocks", 1024);
+    engine_config.block_size                       = int_flag(flags, "block-size", 16);
+    engine_config.scheduler.max_num_seqs           = int_flag(flags, "max-num-seqs", 256);
+    engine_config.scheduler.max_num_batched_tokens = int_flag(flags, "max-num-batched-tokens", 2048);
+    engine_config.scheduler.prefill_chunk_size     = int_flag(flags, "prefill-chunk-size", 0);
+    engine_config.scheduler.enable_prefix_caching  = string_flag(flags, "enable-prefix-caching", "false") == "true";
+    engine.emplace(model, engine_config);
+
+    vocab_size = config.vocab_size;
+    mode       = "engine";
+
+    run = [&](const std::vector<request_spec> &requests, size_t max_concurrency, std::vector<request_result> &results) {
+      return run_engine(*engine, requests, workload, max_concurrency, results);
+    };
+  } else {
+    auto host = string_flag(flags, "host", "127.0.0.1");
+    auto port = flags.at("port");
+
+    run = [&, host, port](
+            const std::vector<request_spec> &requests,
+            size_t max_concurrency,
+            std::vector<request_result> &results) {
+      return run_http(host, port, requests, workload, max_concurrency, results);
+    };
+  }
+
+  // Each run takes requests of its own, and so does the warmup, as if it were one more run. Their prompts share no
+  // prefix, so a run never hits the prefix cache left by the ones before it, and the seeds of the requests of a run
+  // follow the ones of the run before it.
+  auto generate = [&](size_t index) {
+    auto run_workload = workload;
+    run_workload.seed = workload.seed + index * static_cast<uint64_t>(workload.num_prompts);
+    return generate_requests(run_workload, vocab_size);
+  };
+
+  // A request ahead of the runs warms up the model, e.g., allocating the workspaces of its kernels.
+  std::vector<request_result> results;
+  auto warmup    = generate(max_concurrencies.size()).front();
+  warmup.arrival = 0;
+  run({warmup}, 1, results);
+  if (!results.front().success) {
+    LOG(FATAL) << "The warmup request failed: " << results.front().error;
+  }
+
+  json report = {
+    {"label", string_flag(flags, "label", "")},
+    {"mode",  mode                           },
+    {"workload",
+     {
+       {"num_prompts", workload.num_prompts},
+       {"input_len", workload.input_len},
+       {"output_len", workload.output_len},
+       {"length_distribution", workload.length_distribution},
+       {"range_ratio", workload.range_ratio},
+       {"request_rate", std::isfinite(workload.request_rate) ? json(workload.request_rate) : json("inf")},
+       {"arrival", workload.arrival},
+       {"burst_size", workload.burst_size},
+       {"temperature", workload.temperature},
+       {"seed", workload.seed},
+     }},
+    {"runs",  json::array()                  },
+  };
+  for (size_t i = 0; i < max_concurrencies.size(); ++i) {
+    auto max_concurrency       = max_concurrencies[i];
+    auto requests              = generate(i);
+    auto duration              = run(requests, max_concurrency, results);
+    auto summary               = summarize(requests, results, duration);
+    summary["max_concurrency"] = max_concurrency;
+    summary["seed"]            = requests.front().seed;
+    LOG(INFO) << "max_concurrency=" << max_concurrency << ": " << summary["output_throughput"].get<double>()
+              << " output tokens/s, " << summary["completed"].get<int64_t>() << " of " << requests.size()
+              << " requests completed";
+    report["runs"].push_back(std::move(summary));
+  }
+
+  if (flags.count("output") != 0) {
+    std::ofstream(flags.at("output")) << report.dump(2) << std::endl;
+  } else {
+    std::cout << report.dump(2) << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,533 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/engine/engine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <utility>
+
+#include <absl/strings/str_format.h>
+
+#include "mako/engine/sampler.h"
+#include "mako/utils/metrics.h"
+
+namespace metrics = mako::utils::metrics;
+
+using clock_type = std::chrono::steady_clock;
+
+/// \brief Checks the options of speculative decoding, and reserves the lookahead slots for the draft tokens.
+/// \param __config Options to control the engine.
+/// \param __model The model.
+/// \param __draft_model The draft model, if any.
+/// \return The options with the lookahead slots set.
+static inline mako::engine::engine_config prepare_config(
+  mako::engine::engine_config __config,
+  const mako::nn::llama_for_causal_lm &__model,
+  const mako::nn::llama_for_causal_lm &__draft_model) {
+  const auto &speculative = __config.speculative;
+  if (speculative.method == mako::engine::speculative_method::none) {
+    __config.scheduler.num_lookahead_slots = 0;
+    return __config;
+  }
+  if (speculative.num_speculative_tokens < 1) {
+    throw std::invalid_argument(absl::StrFormat(
+      "num_speculative_tokens must be at least 1, but got %d", speculative.num_speculative_tokens));
+  }
+  if (speculative.method == mako::engine::speculative_method::ngram &&
+      (speculative.prompt_lookup_min < 1 || speculative.prompt_lookup_max < speculative.prompt_lookup_min)) {
+    throw std::invalid_argument(absl::StrFormat(
+      "The n-gram lengths must satisfy 1 <= prompt_lookup_min <= prompt_lookup_max, but got %d and %d",
+      speculative.prompt_lookup_min,
+      speculative.prompt_lookup_max));
+  }
+  if (speculative.method == mako::engine::speculative_method::draft_model) {
+    if (__draft_model.is_empty()) {
+      throw std::invalid_argument("Speculative decoding with a draft model requires the draft model");
+    }
+    if (__draft_model->config().vocab_size != __model->config().vocab_size) {
+      throw std::invalid_argument(absl::StrFormat(
+        "The draft model has a vocabulary of %d tokens, while the model has %d tokens",
+        __draft_model->config().vocab_size,
+        __model->config().vocab_size));
+    }
+    // The swap space holds the cache of the model alone.
+    if (__config.scheduler.preemption == mako::engine::preemption_mode::swap) {
+      throw std::invalid_argument("Speculative decoding with a draft model supports only preemption by recomputation");
+    }
+  }
+  __config.scheduler.num_lookahead_slots = speculative.num_speculative_tokens;
+  return __config;
+}
+
+/// \brief Creates the swap space in host memory, with the same layout as the cache.
+/// \param __config The configuration of the model.
+/// \param __engine_config Options with the preemption mode and the number of blocks in the swap space.
+/// \param __kv_cache The cache.
+/// \return The swap space, or ``std::nullopt`` if sequences are not to be swapped.
+static inline std::optional<mako::nn::paged_kv_cache> make_swap_cache(
+  const mako::nn::llama_config &__config,
+  const mako::engine::engine_config &__engine_config,
+  const mako::nn::paged_kv_cache &__kv_cache) {
+  if (__engine_config.scheduler.preemption != mako::engine::preemption_mode::swap ||
+      __engine_config.num_swap_blocks <= 0) {
+    return std::nullopt;
+  }
+  return mako::nn::paged_kv_cache(
+    __config.num_hidden_layers,
+    __engine_config.num_swap_blocks,
+    __engine_config.block_size,
+    __config.num_key_value_heads,
+    __config.head_dim(),
+    __kv_cache.key_cache(0).options().device(torch::Device(torch::kCPU)));
+}
+
+/// \brief The metrics of the engines of the process, registered to ``metrics::registry::global``.
+struct engine_instruments {
+  metrics::counter &prompt_tokens;
+  metrics::counter &generation_tokens;
+  metrics::counter &finished_requests;
+  metrics::counter &draft_tokens;
+  metrics::counter &accepted_tokens;
+  metrics::gauge &num_waiting;
+  metrics::gauge &num_running;
+  metrics::gauge &num_swapped;
+  metrics::gauge &kv_cache_usage;
+  metrics::histogram &batch_seqs;
+  metrics::histogram &batch_tokens;
+  metrics::histogram &prefill_step_seconds;
+  metrics::histogram &decode_step_seconds;
+  metrics::histogram &time_to_first_token_seconds;
+  metrics::histogram &inter_token_latency_seconds;
+};
+
+/// \brief The metrics of the engines, which are registered on first use.
+static inline engine_instruments &get_instruments() {
+  auto &registry = metrics::registry::global();
+  static engine_instruments instruments{
+    registry.add_counter("mako_prompt_tokens_total", "Number of prompt tokens of the requests added."),
+    registry.add_counter("mako_generation_tokens_total", "Number of tokens generated."),
+    registry.add_counter("mako_requests_finished_total", "Number of requests finished, not counting aborted ones."),
+    registry.add_counter("mako_spec_decode_draft_tokens_total", "Number of draft tokens verified by the model."),
+    registry.add_counter("mako_spec_decode_accepted_tokens_total", "Number of draft tokens accepted by the model."),
+    registry.add_gauge("mako_num_requests_waiting", "Number of requests waiting to be scheduled."),
+    registry.add_gauge("mako_num_requests_running", "Number of requests in the running batch."),
+    registry.add_gauge("mako_num_requests_swapped", "Number of requests swapped out to host memory."),
+    registry.add_gauge("mako_kv_cache_usage_ratio", "Fraction of the blocks of the KV cache in use."),
+    registry.add_histogram(
+      "mako_batch_size_sequences",
+      "Number of sequences scheduled per step.",
+      metrics::histogram::exponential_buckets(1, 2, 11)),
+    registry.add_histogram(
+      "mako_batch_size_tokens",
+      "Number of tokens processed per step.",
+      metrics::histogram::exponential_buckets(1, 2, 15)),
+    registry.add_histogram(
+      "mako_prefill_step_seconds",
+      "Duration of the steps processing any prompt tokens.",
+      metrics::histogram::exponential_buckets(0.0005, 2, 16)),
+    registry.add_histogram(
+      "mako_decode_step_seconds",
+      "Duration of the steps processing generated tokens only.",
+      metrics::histogram::exponential_buckets(0.0005, 2, 16)),
+    registry.add_histogram(
+      "mako_time_to_first_token_seconds",
+      "Time from adding a request to generating its first token.",
+      metrics::histogram::exponential_buckets(0.001, 2, 17)),
+    registry.add_histogram(
+      "mako_inter_token_latency_seconds",
+      "Time between consecutive steps generating tokens for a request.",
+      metrics::histogram::exponential_buckets(0.0005, 2, 14)),
+  };
+  return instruments;
+}
+
+/// \brief Records the number of requests in each queue of the scheduler and the usage of the cache.
+static inline void record_queues(
+  const mako::engine::scheduler &__scheduler,
+  const mako::nn::paged_kv_cache &__kv_cache) {
+  auto &instruments = get_instruments();
+  instruments.num_waiting.set(static_cast<double>(__scheduler.num_waiting_seqs()));
+  instruments.num_running.set(static_cast<double>(__scheduler.num_running_seqs()));
+  instruments.num_swapped.set(static_cast<double>(__scheduler.num_swapped_seqs()));
+  const auto &allocator = __kv_cache.allocator();
+  instruments.kv_cache_usage.set(
+    static_cast<double>(allocator.num_used_blocks()) / static_cast<double>(allocator.num_blocks()));
+}
+
+/// \brief Inputs of a forward pass, gathered sequence by sequence.
+struct model_input {
+  std::vector<int64_t> input_ids;
+  std::vector<int64_t> positions;
+  std::vector<int64_t> slot_mapping;
+  std::vector<const std::vector<int64_t> *> block_tables;
+  std::vector<int64_t> query_lens;
+  std::vector<int64_t> context_lens;
+
+  /// \brief The tokens whose hidden states to compute the logits of.
+  std::vector<int64_t> sample_indices;
+
+  /// \brief The sequences that sample a token, in order.
+  std::vector<mako::engine::sequence *> sample_seqs;
+
+  /// \brief The index of each sequence that samples a token in the scheduled batch.
+  std::vector<size_t> sampled;
+};
+
+/// \brief Appends consecutive tokens of a sequence to the inputs.
+/// \param __input The inputs.
+/// \param __seq The sequence.
+/// \param __token_ids The tokens.
+/// \param __begin The position of the first token.
+/// \param __num_tokens The number of tokens.
+/// \param __block_size The number of tokens per block.
+static inline void add_tokens(
+  model_input &__input,
+  const mako::engine::sequence &__seq,
+  const int64_t *__token_ids,
+  int64_t __begin,
+  int64_t __num_tokens,
+  int64_t __block_size) {
+  for (int64_t i = 0; i < __num_tokens; ++i) {
+    auto pos = __begin + i;
+    __input.input_ids.push_back(__token_ids[i]);
+    __input.positions.push_back(pos);
+    auto block = __seq.block_table[pos / __block_size];
+    __input.slot_mapping.push_back(block * __block_size + pos % __block_size);
+  }
+  __input.block_tables.push_back(&__seq.block_table);
+  __input.query_lens.push_back(__num_tokens);
+  __input.context_lens.push_back(__begin + __num_tokens);
+}
+
+/// \brief Gathers the scheduled tokens of a step into one batch, each sequence followed by its draft tokens.
+/// \param __output The output of the scheduler for the step.
+/// \param __draft_token_ids The draft tokens of each scheduled sequence, or empty for none.
+/// \param __block_size The number of tokens per block.
+/// \return The inputs, which sample at the last token and at each draft token of every sequence that has computed
+///  all of its tokens.
+static inline model_input make_input(
+  const mako::engine::scheduler_output &__output,
+  const std::vector<std::vector<int64_t>> &__draft_token_ids,
+  int64_t __block_size) {
+  model_input input;
+  for (size_t i = 0; i < __output.scheduled.size(); ++i) {
+    auto &seq  = *__output.scheduled[i].seq;
+    auto begin = seq.num_computed_tokens;
+    auto end   = begin + __output.scheduled[i].num_tokens;
+    if (end < seq.num_tokens() || __draft_token_ids.empty() || __draft_token_ids[i].empty()) {
+      add_tokens(input, seq, seq.token_ids.data() + begin, begin, end - begin, __block_size);
+    } else {
+      // The draft tokens follow the last token in the same query, as if they were part of the sequence.
+      std::vector<int64_t> token_ids(seq.token_ids.begin() + begin, seq.token_ids.end());
+      token_ids.insert(token_ids.end(), __draft_token_ids[i].begin(), __draft_token_ids[i].end());
+      add_tokens(input, seq, token_ids.data(), begin, static_cast<int64_t>(token_ids.size()), __block_size);
+    }
+
+    // A sequence samples its next token only once the last of its tokens is computed.
+    if (end == seq.num_tokens()) {
+      auto num_samples = __draft_token_ids.empty() ? 1 : __draft_token_ids[i].size() + 1;
+      auto num_tokens  = static_cast<int64_t>(input.input_ids.size());
+      for (auto index = num_tokens - static_cast<int64_t>(num_samples); index < num_tokens; ++index) {
+        input.sample_indices.push_back(index);
+      }
+      input.sample_seqs.push_back(&seq);
+      input.sampled.push_back(i);
+    }
+  }
+  return input;
+}
+
+/// \brief Runs a model over the inputs.
+/// \param __model The model.
+/// \param __kv_cache The cache of the model.
+/// \param __input The inputs.
+/// \return The hidden states of all the tokens.
+static inline torch::Tensor forward(
+  mako::nn::llama_for_causal_lm &__model,
+  mako::nn::paged_kv_cache &__kv_cache,
+  const model_input &__input) {
+  size_t max_num_blocks = 0;
+  for (const auto *block_table : __input.block_tables) {
+    max_num_blocks = std::max(max_num_blocks, block_table->size());
+  }
+  std::vector<int64_t> block_tables;
+  for (const auto *block_table : __input.block_tables) {
+    block_tables.insert(block_tables.end(), block_table->begin(), block_table->end());
+    block_tables.insert(block_tables.end(), max_num_blocks - block_table->size(), 0);
+  }
+
+  auto options = torch::TensorOptions().dtype(torch::kInt64).device(__kv_cache.key_cache(0).device());
+  mako::nn::attention_metadata metadata;
+  metadata.slot_mapping = torch::tensor(__input.slot_mapping, options);
+  metadata.block_tables =
+    torch::tensor(block_tables, options).view({static_cast<int64_t>(__input.block_tables.size()), -1});
+  metadata.query_lens   = __input.query_lens;
+  metadata.context_lens = __input.context_lens;
+
+  return __model->forward(
+    torch::tensor(__input.input_ids, options),
+    torch::tensor(__input.positions, options),
+    __kv_cache,
+    metadata);
+}
+
+/// \brief Computes the logits of the tokens to sample at.
+/// \param __model The model.
+/// \param __hidden_states The hidden states of all the tokens.
+/// \param __sample_indices The tokens to sample at.
+/// \return The logits, which only the hidden states to sample from go through the language modeling head for.
+static inline torch::Tensor compute_logits(
+  mako::nn::llama_for_causal_lm &__model,
+  const torch::Tensor &__hidden_states,
+  const std::vector<int64_t> &__sample_indices) {
+  auto indices = torch::tensor(__sample_indices, torch::TensorOptions().dtype(torch::kInt64));
+  return __model->compute_logits(__hidden_states.index_select(0, indices.to(__hidden_states.device())));
+}
+
+/// \brief Proposes draft tokens by prompt lookup: the tokens that followed the latest earlier occurrence of the
+/// longest n-gram ending the sequence.
+/// \param __seq The sequence.
+/// \param __num_tokens The maximum number of tokens to propose.
+/// \param __min_n The length of the shortest n-gram to look up.
+/// \param __max_n The length of the longest n-gram to look up.
+/// \return The draft tokens, which are empty if no n-gram recurs.
+static inline std::vector<int64_t> lookup_ngram(
+  const mako::engine::sequence &__seq,
+  int64_t __num_tokens,
+  int64_t __min_n,
+  int64_t __max_n) {
+  const auto &token_ids = __seq.token_ids;
+  auto size             = static_cast<int64_t>(token_ids.size());
+  for (auto n = std::min(__max_n, size - 1); __min_n <= n; --n) {
+    auto suffix = token_ids.end() - n;
+    for (auto begin = size - n - 1; 0 <= begin; --begin) {
+      if (std::equal(suffix, token_ids.end(), token_ids.begin() + begin)) {
+        auto first = token_ids.begin() + begin + n;
+        return std::vector<int64_t>(first, first + std::min(__num_tokens, size - begin - n));
+      }
+    }
+  }
+  return {};
+}
+
+mako::engine::llm_engine::llm_engine(
+  nn::llama_for_causal_lm model,
+  engine_config config,
+  nn::llama_for_causal_lm draft_model)
+    : config_(prepare_config(std::move(config), model, draft_model)),
+      model_(std::move(model)),
+      draft_model_(std::move(draft_model)),
+      kv_cache_(model_->make_kv_cache(config_.num_blocks, config_.block_size)),
+      swap_cache_(make_swap_cache(model_->config(), config_, kv_cache_)),
+      scheduler_(
+        config_.scheduler,
+        kv_cache_.allocator(),
+        swap_cache_ ? &swap_cache_->allocator() : nullptr,
+        config_.block_size) {
+  // The draft model shares the block tables of the model, so its cache has the same blocks.
+  if (config_.speculative.method == speculative_method::draft_model) {
+    draft_kv_cache_.emplace(draft_model_->make_kv_cache(config_.num_blocks, config_.block_size));
+  }
+}
+
+void mako::engine::llm_engine::add_request(
+  std::string request_id,
+  std::vector<int64_t> prompt_token_ids,
+  sampling_params params) {
+  verify(params);
+  auto num_prompt_tokens = static_cast<double>(prompt_token_ids.size());
+  scheduler_.add(std::make_shared<sequence>(std::move(request_id), std::move(prompt_token_ids), std::move(params)));
+  get_instruments().prompt_tokens.inc(num_prompt_tokens);
+  record_queues(scheduler_, kv_cache_);
+}
+
+bool mako::engine::llm_engine::abort_request(absl::string_view request_id) {
+  auto aborted = scheduler_.abort(request_id);
+  record_queues(scheduler_, kv_cache_);
+  return aborted;
+}
+
+torch::Tensor mako::engine::llm_engine::propose(
+  const scheduler_output &output,
+  std::vector<std::vector<int64_t>> &draft_token_ids) {
+  // The draft model computes the scheduled tokens as well, including prompts, so that its cache holds every token
+  // the cache of the model does.
+  auto input         = make_input(output, {}, config_.block_size);
+  auto hidden_states = forward(draft_model_, *draft_kv_cache_, input);
+
+  // The sequences to propose for, along with their number of tokens before the drafts.
+  std::vector<size_t> proposing;
+  std::vector<int64_t> sample_indices;
+  std::vector<sequence *> seqs;
+  std::vector<int64_t> num_tokens;
+  for (size_t i = 0; i < input.sample_seqs.size(); ++i) {
+    if (0 < output.scheduled[input.sampled[i]].num_lookahead_slots) {
+      proposing.push_back(input.sampled[i]);
+      sample_indices.push_back(input.sample_indices[i]);
+      seqs.push_back(input.sample_seqs[i]);
+      num_tokens.push_back(seqs.back()->num_tokens());
+    }
+  }
+  if (proposing.empty()) {
+    return torch::Tensor();
+  }
+
+  // Each draft token is sampled with the parameters of its sequence, conditioned on the draft tokens before it, and
+  // then run through the draft model to propose the next one. The last draft token is run too, so that the cache of
+  // the draft model is complete even if all the draft tokens are accepted.
+  std::vector<torch::Tensor> probs;
+  std::vector<std::vector<int64_t>> rows(proposing.size());
+  int64_t num_rows = 0;
+  for (int64_t j = 0;; ++j) {
+    auto logits = compute_logits(draft_model_, hidden_states, sample_indices);
+    probs.emplace_back();
+    auto tokens = sample(logits, seqs, &probs.back());
+
+    model_input next;
+    std::vector<int64_t> next_indices;
+    std::vector<sequence *> next_seqs;
+    // The sequences sampled in this round are the ones with more than ``j`` lookahead slots, in order.
+    for (size_t i = 0, k = 0; i < proposing.size(); ++i) {
+      auto num_lookahead = output.scheduled[proposing[i]].num_lookahead_slots;
+      if (num_lookahead <= j) {
+        continue;
+      }
+      auto *seq  = seqs[k];
+      auto token = tokens[k++];
+      draft_token_ids[proposing[i]].push_back(token);
+      seq->token_ids.push_back(token);
+      rows[i].push_back(num_rows++);
+      add_tokens(next, *seq, &token, num_tokens[i] + j, 1, config_.block_size);
+      if (j + 1 < num_lookahead) {
+        next_indices.push_back(static_cast<int64_t>(next.input_ids.size()) - 1);
+        next_seqs.push_back(seq);
+      }
+    }
+    hidden_states = forward(draft_model_, *draft_kv_cache_, next);
+    if (next_seqs.empty()) {
+      break;
+    }
+    sample_indices = std::move(next_indices);
+    seqs           = std::move(next_seqs);
+  }
+
+  // The draft tokens are not part of the sequences until the model accepts them.
+  std::vector<int64_t> order;
+  for (size_t i = 0; i < proposing.size(); ++i) {
+    auto &seq = *output.scheduled[proposing[i]].seq;
+    seq.token_ids.resize(num_tokens[i]);
+    order.insert(order.end(), rows[i].begin(), rows[i].end());
+  }
+  return torch::cat(probs).index_select(0, torch::tensor(order, torch::TensorOptions().dtype(torch::kInt64)));
+}
+
+std::vector<mako::engine::request_output> mako::engine::llm_engine::step() {
+  auto start  = clock_type::now();
+  auto output = scheduler_.schedule();
+  if (output.scheduled.empty()) {
+    return {};
+  }
+
+  // Swapping out comes first, as the blocks it frees may be the very blocks swapped into.
+  if (swap_cache_) {
+    kv_cache_.copy_blocks(*swap_cache_, output.blocks_to_swap_out);
+    swap_cache_->copy_blocks(kv_cache_, output.blocks_to_swap_in);
+  }
+
+  std::vector<std::vector<int64_t>> draft_token_ids(output.scheduled.size());
+  torch::Tensor draft_probs;
+  const auto &speculative = config_.speculative;
+  if (speculative.method == speculative_method::draft_model) {
+    draft_probs = propose(output, draft_token_ids);
+  } else if (speculative.method == speculative_method::ngram) {
+    for (size_t i = 0; i < output.scheduled.size(); ++i) {
+      const auto &scheduled = output.scheduled[i];
+      if (0 < scheduled.num_lookahead_slots) {
+        draft_token_ids[i] = lookup_ngram(
+          *scheduled.seq,
+          scheduled.num_lookahead_slots,
+          speculative.prompt_lookup_min,
+          speculative.prompt_lookup_max);
+      }
+    }
+  }
+
+  // The model verifies the draft tokens in the same run as it computes the scheduled tokens.
+  auto input         = make_input(output, draft_token_ids, config_.block_size);
+  auto hidden_states = forward(model_, kv_cache_, input);
+
+  std::vector<std::vector<int64_t>> sampled_token_ids(output.scheduled.size());
+  if (!input.sample_seqs.empty()) {
+    std::vector<std::vector<int64_t>> sample_draft_token_ids;
+    for (auto i : input.sampled) {
+      sample_draft_token_ids.push_back(std::move(draft_token_ids[i]));
+    }
+    auto logits    = compute_logits(model_, hidden_states, input.sample_indices);
+    auto token_ids = rejection_sample(logits, input.sample_seqs, sample_draft_token_ids, draft_probs);
+    // Each sequence takes the accepted draft tokens followed by one token of the model's own.
+    auto &instruments = get_instruments();
+    for (size_t i = 0; i < input.sampled.size(); ++i) {
+      if (!sample_draft_token_ids[i].empty()) {
+        instruments.draft_tokens.inc(static_cast<double>(sample_draft_token_ids[i].size()));
+        instruments.accepted_tokens.inc(static_cast<double>(token_ids[i].size() - 1));
+      }
+      sampled_token_ids[input.sampled[i]] = std::move(token_ids[i]);
+    }
+  }
+
+  std::vector<size_t> num_tokens;
+  auto prefill = false;
+  for (const auto &scheduled : output.scheduled) {
+    num_tokens.push_back(scheduled.seq->token_ids.size());
+    // A decoding sequence computes its last token only, besides its draft tokens.
+    prefill |= scheduled.seq->num_computed_tokens + 1 < scheduled.seq->num_tokens();
+  }
+  scheduler_.update(output, sampled_token_ids);
+
+  // The tokens after a stop token are dropped by the scheduler, so the outputs are taken from the sequences.
+  auto now          = clock_type::now();
+  auto &instruments = get_instruments();
+  std::vector<request_output> outputs;
+  for (size_t i = 0; i < output.scheduled.size(); ++i) {
+    if (!sampled_token_ids[i].empty()) {
+      const auto &seq = output.scheduled[i].seq;
+      outputs.push_back(
+        {seq->request_id,
+         std::vector<int64_t>(seq->token_ids.begin() + num_tokens[i], seq->token_ids.end()),
+         seq->status == sequence_status::finished});
+
+      instruments.generation_tokens.inc(static_cast<double>(outputs.back().token_ids.size()));
+      if (num_tokens[i] == static_cast<size_t>(seq->num_prompt_tokens)) {
+        instruments.time_to_first_token_seconds.observe(
+          std::chrono::duration<double>(now - seq->arrival_time).count());
+      } else {
+        instruments.inter_token_latency_seconds.observe(
+          std::chrono::duration<double>(now - seq->last_token_time).count());
+      }
+      seq->last_token_time = now;
+      if (outputs.back().finished) {
+        instruments.finished_requests.inc();
+      }
+    }
+  }
+
+  auto &step_seconds = prefill ? instruments.prefill_step_seconds : instruments.decode_step_seconds;
+  step_seconds.observe(std::chrono::duration<double>(now - start).count());
+  instruments.batch_seqs.observe(static_cast<double>(output.scheduled.size()));
+  instruments.batch_tokens.observe(static_cast<double>(output.num_batched_tokens));
+  record_queues(scheduler_, kv_cache_);
+  return outputs;
+}
@@ -0,0 +1,143 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <absl/strings/string_view.h>
+
+#include "mako/engine/scheduler.h"
+#include "mako/engine/sequence.h"
+#include "mako/nn/kv_cache.h"
+#include "mako/nn/modules/llama.h"
+#include "mako/utils/export.h"
+
+namespace mako {
+namespace engine {
+/// \brief Ways to propose the draft tokens of speculative decoding, which the model then verifies all at once.
+enum class speculative_method {
+  /// \brief Decodes one token per step.
+  none,
+
+  /// \brief Finds the latest n-gram of a sequence earlier in the sequence and proposes the tokens that followed it,
+  /// which costs no computation and pays off when the output repeats the prompt, e.g., in summarization or code
+  /// editing.
+  ngram,
+
+  /// \brief Proposes the tokens a smaller draft model decodes, which must share the vocabulary of the model.
+  draft_model,
+};
+
+/// \brief Options for speculative decoding.
+struct MAKO_API speculative_config {
+  speculative_method method = speculative_method::none;
+
+  /// \brief The maximum number of draft tokens to propose for a sequence in a step.
+  int64_t num_speculative_tokens = 4;
+
+  /// \brief The length of the longest n-gram to look up, with ``speculative_method::ngram``.
+  int64_t prompt_lookup_max = 4;
+
+  /// \brief The length of the shortest n-gram to look up, with ``speculative_method::ngram``.
+  int64_t prompt_lookup_min = 1;
+};
+
+/// \brief Options to control the engine.
+struct MAKO_API engine_config {
+  scheduler_config scheduler;
+
+  speculative_config speculative;
+
+  /// \brief The number of blocks in the cache.
+  int64_t num_blocks = 1024;
+
+  /// \brief The number of tokens per block.
+  int64_t block_size = 16;
+
+  /// \brief The number of blocks in the swap space in host memory, used only with ``preemption_mode::swap``.
+  int64_t num_swap_blocks = 0;
+};
+
+/// \brief Tokens generated for a request in a step.
+struct MAKO_API request_output {
+  std::string request_id;
+
+  /// \brief The tokens generated in the step.
+  std::vector<int64_t> token_ids;
+
+  /// \brief Whether the request has finished.
+  bool finished;
+};
+
+/// \brief Engine serving requests on a model with continuous batching.
+///
+/// Each call to ``step`` runs the model once over the batch the scheduler forms for it, so new requests start being
+/// served in the very next step after they are added. With speculative decoding, the model verifies the draft tokens
+/// of each decoding sequence in that same run, so a step may generate several tokens per request.
+class MAKO_API llm_engine {
+ public:
+  /// \param model The model, whose weights have been loaded.
+  /// \param config Options to control the engine.
+  /// \param draft_model The draft model for ``speculative_method::draft_model``, whose weights have been loaded.
+  /// \throw std::invalid_argument If the options of speculative decoding are inconsistent.
+  llm_engine(nn::llama_for_causal_lm model, engine_config config, nn::llama_for_causal_lm draft_model = nullptr);
+  llm_engine(const llm_engine &)            = delete;
+  llm_engine &operator=(const llm_engine &) = delete;
+
+  /// \brief Queues a request.
+  /// \param request_id The identifier of the request, unique among the unfinished requests.
+  /// \param prompt_token_ids The tokens of the prompt.
+  /// \param params Parameters to control the generation.
+  /// \throw std::invalid_argument If the parameters are out of range or the prompt could never be scheduled.
+  void add_request(std::string request_id, std::vector<int64_t> prompt_token_ids, sampling_params params);
+
+  /// \brief Stops serving a request, e.g., as its client has gone.
+  /// \return ``false`` if no unfinished request has the identifier.
+  bool abort_request(absl::string_view request_id);
+
+  /// \brief Runs one iteration of the model over the scheduled batch.
+  /// \return The tokens generated in the step, one output per request that has generated any token.
+  std::vector<request_output> step();
+
+  bool has_unfinished_requests() const {
+    return scheduler_.has_unfinished_seqs();
+  }
+
+  const nn::paged_kv_cache &kv_cache() const {
+    return kv_cache_;
+  }
+
+ private:
+  /// \brief Runs the draft model over the scheduled batch, keeping its cache in step with the cache of the model,
+  /// and then decodes the draft tokens of the sequences given lookahead slots.
+  /// \param output The output of the scheduler for the step.
+  /// \param draft_token_ids Receives the draft tokens of each scheduled sequence.
+  /// \return The probabilities the draft tokens were sampled from, in the order of the draft tokens.
+  torch::Tensor propose(const scheduler_output &output, std::vector<std::vector<int64_t>> &draft_token_ids);
+
+  engine_config config_;
+  nn::llama_for_causal_lm model_;
+  nn::llama_for_causal_lm draft_model_;
+  nn::paged_kv_cache kv_cache_;
+  std::optional<nn::paged_kv_cache> draft_kv_cache_;
+  std::optional<nn::paged_kv_cache> swap_cache_;
+  scheduler scheduler_;
+};
+} // namespace engine
+} // namespace mako
@@ -0,0 +1,238 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/engine/engine.h"
+
+#include <map>
+#include <string>
+
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_split.h>
+#include <absl/strings/strip.h>
+#include <gtest/gtest.h>
+
+#include "mako/utils/metrics.h"
+
+/// \brief A configuration small enough to run in a test, with grouped-query attention.
+static inline mako::nn::llama_config tiny_config() {
+  mako::nn::llama_config config;
+  config.vocab_size          = 64;
+  config.hidden_size         = 32;
+  config.intermediate_size   = 48;
+  config.num_hidden_layers   = 2;
+  config.num_attention_heads = 4;
+  config.num_key_value_heads = 2;
+  return config;
+}
+
+/// \brief Generates greedily for the prompts until all of them finish.
+/// \param __engine The engine.
+/// \param __prompts The prompts.
+/// \return The generated tokens of each prompt.
+static inline std::vector<std::vector<int64_t>> generate(
+  mako::engine::llm_engine &__engine,
+  const std::vector<std::vector<int64_t>> &__prompts) {
+  mako::engine::sampling_params params;
+  params.max_tokens  = 8;
+  params.temperature = 0.0;
+  for (size_t i = 0; i < __prompts.size(); ++i) {
+    __engine.add_request(std::to_string(i), __prompts[i], params);
+  }
+
+  std::vector<std::vector<int64_t>> outputs(__prompts.size());
+  while (__engine.has_unfinished_requests()) {
+    for (const auto &output : __engine.step()) {
+      auto &tokens = outputs[std::stoul(output.request_id)];
+      tokens.insert(tokens.end(), output.token_ids.begin(), output.token_ids.end());
+    }
+  }
+  return outputs;
+}
+
+/// \brief Reads a sample of the metrics of the process.
+/// \param __name The name of the sample, e.g., ``mako_generation_tokens_total``.
+/// \return The value of the sample, or ``0`` if it has not been registered.
+static inline double metric_value(absl::string_view __name) {
+  auto text = mako::utils::metrics::registry::global().expose();
+  for (absl::string_view line : absl::StrSplit(text, '\n')) {
+    if (absl::ConsumePrefix(&line, __name) && absl::ConsumePrefix(&line, " ")) {
+      double value;
+      return absl::SimpleAtod(line, &value) ? value : 0;
+    }
+  }
+  return 0;
+}
+
+TEST(LLMEngineTest, BatchingInvariance) {
+  // Whether a prompt is served alone or along with others, preempted or not, its greedy generation is the same.
+  mako::nn::llama_for_causal_lm model(tiny_config());
+
+  std::vector<std::vector<int64_t>> prompts = {
+    {1, 2,  3,  4,  5},
+    {6, 7,  8},
+    {9, 10, 11, 12, 13, 14, 15},
+  };
+
+  mako::engine::engine_config alone_config;
+  alone_config.block_size = 4;
+  std::vector<std::vector<int64_t>> expected;
+  for (const auto &prompt : prompts) {
+    mako::engine::llm_engine engine(model, alone_config);
+    expected.push_back(generate(engine, {prompt}).front());
+    EXPECT_EQ(expected.back().size(), 8);
+  }
+
+  for (auto preemption : {mako::engine::preemption_mode::recompute, mako::engine::preemption_mode::swap}) {
+    // The cache holds only two of the sequences at their full lengths.
+    mako::engine::engine_config engine_config;
+    engine_config.block_size           = 4;
+    engine_config.num_blocks           = 8;
+    engine_config.num_swap_blocks      = 8;
+    engine_config.scheduler.preemption = preemption;
+    mako::engine::llm_engine engine(model, engine_config);
+    EXPECT_EQ(generate(engine, prompts), expected);
+    EXPECT_EQ(engine.kv_cache().allocator().num_used_blocks(), 0);
+  }
+
+  // The prompts are prefilled in chunks, each sharing a step with decoding sequences.
+  mako::engine::engine_config chunked_config;
+  chunked_config.block_size                       = 4;
+  chunked_config.scheduler.max_num_batched_tokens = 4;
+  chunked_config.scheduler.prefill_chunk_size     = 3;
+  mako::engine::llm_engine engine(model, chunked_config);
+  EXPECT_EQ(generate(engine, prompts), expected);
+}
+
+TEST(LLMEngineTest, PrefixCaching) {
+  // Prompts sharing a prefix generate the same tokens whether or not the prefix is computed again.
+  mako::nn::llama_for_causal_lm model(tiny_config());
+
+  std::vector<std::vector<int64_t>> prompts = {
+    {1, 2, 3, 4, 5, 6, 7, 8, 9},
+    {1, 2, 3, 4, 5, 6, 7, 8, 10, 11},
+    {1, 2, 3, 4, 5, 6, 7, 8},
+  };
+
+  mako::engine::engine_config engine_config;
+  engine_config.block_size = 4;
+  std::vector<std::vector<int64_t>> expected;
+  {
+    mako::engine::llm_engine engine(model, engine_config);
+    for (const auto &prompt : prompts) {
+      expected.push_back(generate(engine, {prompt}).front());
+    }
+  }
+
+  engine_config.scheduler.enable_prefix_caching = true;
+  mako::engine::llm_engine engine(model, engine_config);
+  for (size_t i = 0; i < prompts.size(); ++i) {
+    EXPECT_EQ(generate(engine, {prompts[i]}).front(), expected[i]);
+  }
+  EXPECT_LT(0, engine.kv_cache().allocator().num_cached_blocks());
+}
+
+TEST(LLMEngineTest, SpeculativeDecoding) {
+  // Under greedy sampling, speculative decoding generates exactly the tokens of decoding one token at a time.
+  auto config = tiny_config();
+  mako::nn::llama_for_causal_lm model(config);
+
+  std::vector<std::vector<int64_t>> prompts = {
+    {1, 2, 3, 1, 2, 3, 1, 2},
+    {6, 7, 8},
+    {9, 10, 9, 10, 9, 10, 9},
+  };
+
+  mako::engine::engine_config engine_config;
+  engine_config.block_size = 4;
+  std::vector<std::vector<int64_t>> expected;
+  {
+    mako::engine::llm_engine engine(model, engine_config);
+    expected = generate(engine, prompts);
+  }
+
+  engine_config.speculative.method                 = mako::engine::speculative_method::ngram;
+  engine_config.speculative.num_speculative_tokens = 3;
+  {
+    mako::engine::llm_engine engine(model, engine_config);
+    EXPECT_EQ(generate(engine, prompts), expected);
+  }
+
+  // A draft model identical to the model has all of its tokens accepted, while a different one has some rejected.
+  config.num_hidden_layers = 1;
+  mako::nn::llama_for_causal_lm draft_model(config);
+  engine_config.speculative.method = mako::engine::speculative_method::draft_model;
+  EXPECT_THROW(mako::engine::llm_engine(model, engine_config), std::invalid_argument);
+  for (const auto &draft : {model, draft_model}) {
+    auto draft_tokens    = metric_value("mako_spec_decode_draft_tokens_total");
+    auto accepted_tokens = metric_value("mako_spec_decode_accepted_tokens_total");
+    mako::engine::llm_engine engine(model, engine_config, draft);
+    EXPECT_EQ(generate(engine, prompts), expected);
+    EXPECT_EQ(engine.kv_cache().allocator().num_used_blocks(), 0);
+
+    draft_tokens    = metric_value("mako_spec_decode_draft_tokens_total") - draft_tokens;
+    accepted_tokens = metric_value("mako_spec_decode_accepted_tokens_total") - accepted_tokens;
+    EXPECT_LT(0, draft_tokens);
+    if (draft.ptr() == model.ptr()) {
+      EXPECT_EQ(accepted_tokens, draft_tokens);
+    } else {
+      EXPECT_LT(accepted_tokens, draft_tokens);
+    }
+  }
+
+  // The draft model keeps up with preemption by recomputation, as its cache shares the blocks of the model.
+  engine_config.num_blocks = 8;
+  mako::engine::llm_engine engine(model, engine_config, draft_model);
+  EXPECT_EQ(generate(engine, prompts), expected);
+}
+
+TEST(LLMEngineTest, Metrics) {
+  mako::nn::llama_for_causal_lm model(tiny_config());
+
+  mako::engine::engine_config engine_config;
+  engine_config.block_size = 4;
+  mako::engine::llm_engine engine(model, engine_config);
+
+  std::map<std::string, double> before;
+  std::vector<std::string> names = {
+    "mako_prompt_tokens_total",
+    "mako_generation_tokens_total",
+    "mako_requests_finished_total",
+    "mako_time_to_first_token_seconds_count",
+    "mako_inter_token_latency_seconds_count",
+    "mako_batch_size_sequences_count",
+  };
+  for (const auto &name : names) {
+    before[name] = metric_value(name);
+  }
+  generate(engine, {{1, 2, 3, 4, 5}, {6, 7, 8}});
+
+  // Each prompt generates its first token and then seven more, one per step.
+  EXPECT_EQ(metric_value("mako_prompt_tokens_total") - before["mako_prompt_tokens_total"], 8);
+  EXPECT_EQ(metric_value("mako_generation_tokens_total") - before["mako_generation_tokens_total"], 16);
+  EXPECT_EQ(metric_value("mako_requests_finished_total") - before["mako_requests_finished_total"], 2);
+  EXPECT_EQ(
+    metric_value("mako_time_to_first_token_seconds_count") - before["mako_time_to_first_token_seconds_count"],
+    2);
+  EXPECT_EQ(
+    metric_value("mako_inter_token_latency_seconds_count") - before["mako_inter_token_latency_seconds_count"],
+    14);
+  EXPECT_EQ(metric_value("mako_batch_size_sequences_count") - before["mako_batch_size_sequences_count"], 8);
+  EXPECT_EQ(metric_value("mako_num_requests_running"), 0);
+  EXPECT_EQ(metric_value("mako_kv_cache_usage_ratio"), 0);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,317 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/engine/sampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <absl/strings/str_format.h>
+
+void mako::engine::verify(const sampling_params &params) {
+  if (params.max_tokens < 1) {
+    throw std::invalid_argument(absl::StrFormat("max_tokens must be at least 1, but got %d", params.max_tokens));
+  }
+  if (params.temperature < 0) {
+    throw std::invalid_argument(absl::StrFormat("temperature must be non-negative, but got %f", params.temperature));
+  }
+  if (params.top_k < 0) {
+    throw std::invalid_argument(absl::StrFormat("top_k must be non-negative, but got %d", params.top_k));
+  }
+  if (params.top_p <= 0 || 1 < params.top_p) {
+    throw std::invalid_argument(absl::StrFormat("top_p must be in (0, 1], but got %f", params.top_p));
+  }
+  if (params.min_p < 0 || 1 < params.min_p) {
+    throw std::invalid_argument(absl::StrFormat("min_p must be in [0, 1], but got %f", params.min_p));
+  }
+  if (params.repetition_penalty <= 0) {
+    throw std::invalid_argument(
+      absl::StrFormat("repetition_penalty must be positive, but got %f", params.repetition_penalty));
+  }
+}
+
+/// \brief Penalizes the tokens a sequence has seen, in place.
+/// \param __logits The logits of the sequence.
+/// \param __seq The sequence.
+static inline void apply_penalties(float *__logits, const mako::engine::sequence &__seq) {
+  const auto &params = __seq.params;
+  if (params.repetition_penalty != 1.0) {
+    std::unordered_set<int64_t> seen(__seq.token_ids.begin(), __seq.token_ids.end());
+    auto penalty = static_cast<float>(params.repetition_penalty);
+    for (auto token : seen) {
+      auto &logit = __logits[token];
+      logit       = 0 < logit ? logit / penalty : logit * penalty;
+    }
+  }
+
+  if (params.frequency_penalty != 0.0 || params.presence_penalty != 0.0) {
+    std::unordered_map<int64_t, int64_t> counts;
+    for (auto it = __seq.token_ids.begin() + __seq.num_prompt_tokens; it != __seq.token_ids.end(); ++it) {
+      ++counts[*it];
+    }
+    for (const auto &[token, count] : counts) {
+      __logits[token] -= static_cast<float>(params.frequency_penalty * count + params.presence_penalty);
+    }
+  }
+}
+
+/// \brief Turns one row of logits into the probabilities to sample the next token from, in place.
+///
+/// The tokens left out by top-k, top-p, or min-p get the probability of zero, and greedy sampling puts all the
+/// probability on the most likely token.
+/// \param __logits The logits of the sequence, which are overwritten with the probabilities.
+/// \param __vocab_size The size of the vocabulary.
+/// \param __seq The sequence.
+static inline void to_probs(float *__logits, int64_t __vocab_size, const mako::engine::sequence &__seq) {
+  const auto &params = __seq.params;
+  apply_penalties(__logits, __seq);
+  if (params.temperature == 0.0) {
+    auto argmax = std::max_element(__logits, __logits + __vocab_size) - __logits;
+    std::fill(__logits, __logits + __vocab_size, 0.0F);
+    __logits[argmax] = 1;
+    return;
+  }
+
+  // The weights are relative to the most likely token, so that the exponentials never overflow.
+  auto max_logit   = *std::max_element(__logits, __logits + __vocab_size);
+  auto temperature = static_cast<float>(params.temperature);
+  auto *weights    = __logits;
+  for (int64_t i = 0; i < __vocab_size; ++i) {
+    weights[i] = std::exp((__logits[i] - max_logit) / temperature);
+  }
+
+  std::vector<int32_t> candidates(__vocab_size);
+  std::iota(candidates.begin(), candidates.end(), 0);
+  auto by_weight = [&](int32_t a, int32_t b) {
+    return weights[a] > weights[b];
+  };
+
+  // The top-k tokens are moved to the front, in no particular order.
+  auto top_k = 0 < params.top_k ? std::min(params.top_k, __vocab_size) : __vocab_size;
+  if (top_k < __vocab_size) {
+    std::nth_element(candidates.begin(), candidates.begin() + top_k - 1, candidates.end(), by_weight);
+  }
+  auto num_candidates = top_k;
+
+  if (params.top_p < 1.0) {
+    double total = 0;
+    for (int64_t i = 0; i < top_k; ++i) {
+      total += weights[candidates[i]];
+    }
+
+    // The nucleus is the fewest most likely tokens whose probability reaches top_p, always including the first. Only
+    // a window of the most likely tokens is sorted, starting from one that holds the nucleus of a typical
+    // distribution, and doubled until it does.
+    int64_t window = std::min<int64_t>(top_k, 64);
+    for (;;) {
+      std::nth_element(candidates.begin(), candidates.begin() + window - 1, candidates.begin() + top_k, by_weight);
+      std::sort(candidates.begin(), candidates.begin() + window, by_weight);
+
+      num_candidates    = window;
+      double cumulative = 0;
+      for (int64_t i = 0; i < window; ++i) {
+        cumulative += weights[candidates[i]];
+        if (params.top_p * total <= cumulative) {
+          num_candidates = i + 1;
+          break;
+        }
+      }
+      if (num_candidates < window || window == top_k) {
+        break;
+      }
+      window = std::min(2 * window, top_k);
+    }
+  }
+
+  // The most likely token has the weight of 1, which min_p is relative to.
+  auto min_weight = static_cast<float>(params.min_p);
+  double total    = 0;
+  for (int64_t i = 0; i < num_candidates; ++i) {
+    auto &weight = weights[candidates[i]];
+    if (weight < min_weight) {
+      weight = 0;
+    }
+    total += weight;
+  }
+
+  // The weights are normalized in place, so that the draft tokens of speculative decoding can be checked against them.
+  for (auto i = num_candidates; i < __vocab_size; ++i) {
+    weights[candidates[i]] = 0;
+  }
+  for (int64_t i = 0; i < num_candidates; ++i) {
+    weights[candidates[i]] /= static_cast<float>(total);
+  }
+}
+
+/// \brief Draws a token in proportion to the given weights.
+/// \param __weights The non-negative weights, which need not sum to 1.
+/// \param __vocab_size The size of the vocabulary.
+/// \param __generator The generator to draw from.
+/// \return The token.
+static inline int64_t draw(const float *__weights, int64_t __vocab_size, std::mt19937_64 &__generator) {
+  auto total = std::accumulate(__weights, __weights + __vocab_size, 0.0);
+  if (total <= 0) {
+    return std::max_element(__weights, __weights + __vocab_size) - __weights;
+  }
+
+  auto target  = std::uniform_real_distribution<double>(0, total)(__generator);
+  int64_t last = 0;
+  for (int64_t i = 0; i < __vocab_size; ++i) {
+    if (__weights[i] == 0) {
+      continue;
+    }
+    last = i;
+    target -= __weights[i];
+    if (target < 0) {
+      return last;
+    }
+  }
+  // Rounding may leave a sliver of the total, which goes to the last token with a weight.
+  return last;
+}
+
+/// \brief Accepts a prefix of the draft tokens of one sequence by rejection sampling, and samples one more token.
+/// \param __target The rows of target logits at the last token and at each draft token, which are overwritten.
+/// \param __draft The rows of probabilities the draft tokens were sampled from, or ``nullptr`` if each draft token
+///  was proposed with certainty.
+/// \param __vocab_size The size of the vocabulary.
+/// \param __draft_tokens The draft tokens.
+/// \param __seq The sequence, whose token ids are restored on return.
+/// \return The accepted draft tokens followed by the sampled token.
+static inline std::vector<int64_t> accept_row(
+  float *__target,
+  const float *__draft,
+  int64_t __vocab_size,
+  const std::vector<int64_t> &__draft_tokens,
+  mako::engine::sequence &__seq) {
+  auto num_tokens = __seq.token_ids.size();
+  std::vector<int64_t> tokens;
+  std::uniform_real_distribution<double> uniform(0, 1);
+
+  for (size_t j = 0;; ++j) {
+    // The probabilities at each position are conditioned on the draft tokens accepted before it, so that the
+    // penalties see them.
+    auto *probs = __target + j * __vocab_size;
+    to_probs(probs, __vocab_size, __seq);
+    if (j == __draft_tokens.size()) {
+      tokens.push_back(draw(probs, __vocab_size, __seq.generator));
+      break;
+    }
+
+    // The draft token is accepted with the probability of min(1, p / q).
+    auto token   = __draft_tokens[j];
+    auto *q      = __draft == nullptr ? nullptr : __draft + j * __vocab_size;
+    auto q_token = q == nullptr ? 1.0F : q[token];
+    if (uniform(__seq.generator) * q_token < probs[token]) {
+      tokens.push_back(token);
+      __seq.token_ids.push_back(token);
+      continue;
+    }
+
+    // Otherwise, the token is resampled from max(0, p - q), which makes up for the draft exactly.
+    if (q == nullptr) {
+      probs[token] = 0;
+    } else {
+      for (int64_t i = 0; i < __vocab_size; ++i) {
+        probs[i] = std::max(probs[i] - q[i], 0.0F);
+      }
+    }
+    tokens.push_back(draw(probs, __vocab_size, __seq.generator));
+    break;
+  }
+
+  __seq.token_ids.resize(num_tokens);
+  return tokens;
+}
+
+/// \brief Copies logits to host memory in float32, where they are overwritten as scratch space.
+/// \param __logits The logits.
+/// \return The copy.
+static inline torch::Tensor to_scratch(const torch::Tensor &__logits) {
+  auto rows = __logits.to(torch::Device(torch::kCPU), torch::kFloat32, /*non_blocking=*/false, /*copy=*/true);
+  return rows.contiguous();
+}
+
+std::vector<int64_t> mako::engine::sample(
+  const torch::Tensor &logits, const std::vector<sequence *> &seqs, torch::Tensor *probs) {
+  if (logits.size(0) != static_cast<int64_t>(seqs.size())) {
+    throw std::invalid_argument(
+      absl::StrFormat("Got %d rows of logits for %d sequences", logits.size(0), seqs.size()));
+  }
+
+  auto rows       = to_scratch(logits);
+  auto vocab_size = rows.size(1);
+  auto *data      = rows.data_ptr<float>();
+
+  std::vector<int64_t> tokens(seqs.size());
+  at::parallel_for(0, static_cast<int64_t>(seqs.size()), 1, [&](int64_t begin, int64_t end) {
+    for (auto i = begin; i < end; ++i) {
+      to_probs(data + i * vocab_size, vocab_size, *seqs[i]);
+      tokens[i] = draw(data + i * vocab_size, vocab_size, seqs[i]->generator);
+    }
+  });
+  if (probs != nullptr) {
+    *probs = rows;
+  }
+  return tokens;
+}
+
+std::vector<std::vector<int64_t>> mako::engine::rejection_sample(
+  const torch::Tensor &logits,
+  const std::vector<sequence *> &seqs,
+  const std::vector<std::vector<int64_t>> &draft_token_ids,
+  const torch::Tensor &draft_probs) {
+  if (draft_token_ids.size() != seqs.size()) {
+    throw std::invalid_argument(
+      absl::StrFormat("Got draft tokens of %d sequences for %d sequences", draft_token_ids.size(), seqs.size()));
+  }
+  std::vector<int64_t> offsets(seqs.size() + 1);
+  for (size_t i = 0; i < seqs.size(); ++i) {
+    offsets[i + 1] = offsets[i] + static_cast<int64_t>(draft_token_ids[i].size());
+  }
+  auto num_drafts = offsets.back();
+  if (logits.size(0) != num_drafts + static_cast<int64_t>(seqs.size())) {
+    throw std::invalid_argument(absl::StrFormat(
+      "Got %d rows of logits for %d sequences with %d draft tokens", logits.size(0), seqs.size(), num_drafts));
+  }
+  if (draft_probs.defined() && draft_probs.size(0) != num_drafts) {
+    throw std::invalid_argument(
+      absl::StrFormat("Got %d rows of draft probabilities for %d draft tokens", draft_probs.size(0), num_drafts));
+  }
+
+  auto rows       = to_scratch(logits);
+  auto vocab_size = rows.size(1);
+  auto *data      = rows.data_ptr<float>();
+
+  torch::Tensor draft_rows;
+  const float *draft_data = nullptr;
+  if (draft_probs.defined()) {
+    draft_rows = draft_probs.to(torch::Device(torch::kCPU), torch::kFloat32).contiguous();
+    draft_data = draft_rows.data_ptr<float>();
+  }
+
+  std::vector<std::vector<int64_t>> tokens(seqs.size());
+  at::parallel_for(0, static_cast<int64_t>(seqs.size()), 1, [&](int64_t begin, int64_t end) {
+    for (auto i = begin; i < end; ++i) {
+      auto *target = data + (offsets[i] + i) * vocab_size;
+      auto *draft  = draft_data == nullptr ? nullptr : draft_data + offsets[i] * vocab_size;
+      tokens[i]    = accept_row(target, draft, vocab_size, draft_token_ids[i], *seqs[i]);
+    }
+  });
+  return tokens;
+}
@@ -0,0 +1,69 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <torch/torch.h>
+
+#include "mako/engine/sequence.h"
+#include "mako/utils/export.h"
+
+namespace mako {
+namespace engine {
+/// \brief Checks that sampling parameters are within their ranges.
+/// \param params The parameters.
+/// \throw std::invalid_argument If any of the parameters is out of its range.
+void MAKO_API verify(const sampling_params &params);
+
+/// \brief Samples the next token of each sequence from its logits, following the parameters of the sequence.
+///
+/// Each row is processed on its own, in parallel with the others: the penalties touch only the tokens the sequence
+/// has seen, and the most likely tokens for top-k and top-p are found by partial selection, which is linear in the
+/// size of the vocabulary, rather than by sorting the whole vocabulary; only the selected candidates are sorted, and
+/// their number is doubled until their probability reaches ``top_p``.
+/// \param logits The logits of shape ``[num_seqs, vocab_size]``, which are left as is.
+/// \param seqs The sequences in the order of the rows, whose generators are advanced.
+/// \param probs If given, receives the probabilities of shape ``[num_seqs, vocab_size]`` on the CPU that the tokens
+///  were sampled from, e.g., to verify the tokens of a draft model later on.
+/// \return The sampled token of each sequence.
+std::vector<int64_t> MAKO_API
+sample(const torch::Tensor &logits, const std::vector<sequence *> &seqs, torch::Tensor *probs = nullptr);
+
+/// \brief Verifies the draft tokens of speculative decoding against the logits of the target model.
+///
+/// Each draft token is accepted with the probability of ``min(1, p / q)``, where ``p`` and ``q`` are the probabilities
+/// of the token under the target and the draft, both processed by the sampling parameters of the sequence. The first
+/// rejected token is resampled from ``max(0, p - q)``, and if all of them are accepted, a bonus token is sampled from
+/// the target, so that the tokens follow exactly the distribution of sampling from the target alone, as described in
+/// https://arxiv.org/abs/2211.17192. Under greedy sampling, this accepts the draft tokens as long as they are the most
+/// likely tokens of the target.
+///
+/// The rows of each sequence come in the order of the sequences: the row at the last token, and then a row at each
+/// draft token.
+/// \param logits The logits of the target of shape ``[num_seqs + num_draft_tokens, vocab_size]``.
+/// \param seqs The sequences, whose generators are advanced.
+/// \param draft_token_ids The draft tokens of each sequence, which may be empty.
+/// \param draft_probs The probabilities of shape ``[num_draft_tokens, vocab_size]`` that the draft tokens were sampled
+///  from, or an undefined tensor if each draft token was proposed with certainty, e.g., by n-gram lookup.
+/// \return The accepted draft tokens followed by one sampled token, for each sequence.
+std::vector<std::vector<int64_t>> MAKO_API rejection_sample(
+  const torch::Tensor &logits,
+  const std::vector<sequence *> &seqs,
+  const std::vector<std::vector<int64_t>> &draft_token_ids,
+  const torch::Tensor &draft_probs = torch::Tensor());
+} // namespace engine
+} // namespace mako
@@ -0,0 +1,195 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/engine/sampler.h"
+
+#include <cmath>
+#include <memory>
+#include <random>
+
+#include <gtest/gtest.h>
+
+/// \brief Creates a sequence that samples with the parameters.
+static inline std::unique_ptr<mako::engine::sequence> make_sequence(
+  mako::engine::sampling_params __params,
+  std::vector<int64_t> __prompt_token_ids = {}) {
+  return std::make_unique<mako::engine::sequence>("seq", std::move(__prompt_token_ids), std::move(__params));
+}
+
+/// \brief Counts how often each token is sampled from the probabilities.
+/// \param __probs The probabilities of the tokens.
+/// \param __params The parameters to sample with.
+/// \param __num_samples The number of samples.
+/// \return The frequency of each token.
+static inline std::vector<double> frequencies(
+  const std::vector<float> &__probs,
+  const mako::engine::sampling_params &__params,
+  int __num_samples = 4000) {
+  auto logits = torch::tensor(__probs).log().unsqueeze(0);
+  auto seq    = make_sequence(__params);
+  std::vector<double> counts(__probs.size());
+  for (int i = 0; i < __num_samples; ++i) {
+    counts[mako::engine::sample(logits, {seq.get()}).front()] += 1.0 / __num_samples;
+  }
+  return counts;
+}
+
+TEST(SamplerTest, Greedy) {
+  auto logits = torch::tensor({0.1f, 2.0f, -1.0f, 1.5f, 3.0f, 2.0f, 1.0f, 0.0f}).view({2, 4});
+  mako::engine::sampling_params greedy;
+  greedy.temperature = 0.0;
+  mako::engine::sampling_params top_1;
+  top_1.top_k = 1;
+  auto a      = make_sequence(greedy);
+  auto b      = make_sequence(top_1);
+  EXPECT_EQ(mako::engine::sample(logits, {a.get(), b.get()}), std::vector<int64_t>({1, 0}));
+  EXPECT_THROW(mako::engine::sample(logits, {a.get()}), std::invalid_argument);
+}
+
+TEST(SamplerTest, Seed) {
+  // Sequences with the same seed sample the same tokens, whichever rows they are in.
+  auto logits = torch::zeros({2, 1000});
+  mako::engine::sampling_params params;
+  params.seed = 42;
+  auto a      = make_sequence(params);
+  auto b      = make_sequence(params);
+  for (int i = 0; i < 8; ++i) {
+    auto tokens = mako::engine::sample(logits, {a.get(), b.get()});
+    EXPECT_EQ(tokens[0], tokens[1]);
+  }
+}
+
+TEST(SamplerTest, Truncation) {
+  std::vector<float> probs = {0.5f, 0.25f, 0.15f, 0.1f};
+
+  mako::engine::sampling_params params;
+  auto counts = frequencies(probs, params);
+  for (size_t i = 0; i < probs.size(); ++i) {
+    EXPECT_NEAR(counts[i], probs[i], 0.05);
+  }
+
+  // Only the two most likely tokens are kept, and renormalized.
+  params.top_k = 2;
+  counts       = frequencies(probs, params);
+  EXPECT_NEAR(counts[0], 2.0 / 3, 0.05);
+  EXPECT_EQ(counts[2] + counts[3], 0.0);
+
+  // The nucleus of 0.8 takes the three most likely tokens.
+  params.top_k = 0;
+  params.top_p = 0.8;
+  counts       = frequencies(probs, params);
+  EXPECT_EQ(counts[3], 0.0);
+  EXPECT_LT(0.0, counts[2]);
+
+  // Tokens below 0.4 times the most likely one are dropped.
+  params.top_p = 1.0;
+  params.min_p = 0.4;
+  counts       = frequencies(probs, params);
+  EXPECT_LT(0.0, counts[1]);
+  EXPECT_EQ(counts[2] + counts[3], 0.0);
+
+  // A low temperature sharpens the distribution.
+  params.min_p       = 0.0;
+  params.temperature = 0.1;
+  counts             = frequencies(probs, params);
+  EXPECT_LT(0.99, counts[0]);
+}
+
+TEST(SamplerTest, NucleusBeyondWindow) {
+  // A flat distribution needs most of the vocabulary for its nucleus, more than the first window of candidates.
+  mako::engine::sampling_params params;
+  params.top_p = 0.5;
+  std::vector<float> probs(1000, 0.001f);
+  auto counts  = frequencies(probs, params, 2000);
+  auto sampled = std::count_if(counts.begin(), counts.end(), [](double count) { return count > 0; });
+  EXPECT_LT(300, sampled);
+  EXPECT_GE(500, sampled);
+}
+
+TEST(SamplerTest, Penalties) {
+  auto logits = torch::tensor({2.0f, 1.9f, 1.2f, -1.0f}).unsqueeze(0);
+  mako::engine::sampling_params params;
+  params.temperature = 0.0;
+
+  // The most likely token is in the prompt, so the repetition penalty hands the lead to the next one.
+  params.repetition_penalty = 1.2;
+  auto seq                  = make_sequence(params, {0, 3});
+  EXPECT_EQ(mako::engine::sample(logits, {seq.get()}).front(), 1);
+
+  // The frequency and presence penalties apply only to the output.
+  params.repetition_penalty = 1.0;
+  params.frequency_penalty  = 0.5;
+  params.presence_penalty   = 0.5;
+  seq                       = make_sequence(params, {0});
+  EXPECT_EQ(mako::engine::sample(logits, {seq.get()}).front(), 0);
+  seq->token_ids.push_back(0);
+  EXPECT_EQ(mako::engine::sample(logits, {seq.get()}).front(), 1);
+  seq->token_ids.push_back(1);
+  EXPECT_EQ(mako::engine::sample(logits, {seq.get()}).front(), 2);
+}
+
+TEST(SamplerTest, RejectionSample) {
+  // Under greedy sampling, the draft tokens are accepted as long as they are the most likely tokens of the target; the
+  // first one that is not is replaced by the most likely token, and a bonus token follows when all are accepted.
+  auto logits = torch::tensor({
+                                0.0f, 2.0f, 0.0f, 0.0f,
+                                0.0f, 0.0f, 0.0f, 2.0f,
+                                2.0f, 0.0f, 0.0f, 0.0f,
+                                0.0f, 0.0f, 2.0f, 0.0f,
+                              })
+                  .view({4, 4});
+  mako::engine::sampling_params greedy;
+  greedy.temperature = 0.0;
+  auto a             = make_sequence(greedy, {0});
+  auto b             = make_sequence(greedy, {0});
+  using token_ids    = std::vector<std::vector<int64_t>>;
+  EXPECT_EQ(mako::engine::rejection_sample(logits, {a.get(), b.get()}, {{1, 2}, {}}), token_ids({{1, 3}, {2}}));
+  EXPECT_EQ(mako::engine::rejection_sample(logits.narrow(0, 0, 3), {a.get()}, {{1, 3}}), token_ids({{1, 3, 0}}));
+  EXPECT_EQ(a->token_ids, std::vector<int64_t>({0}));
+  EXPECT_THROW(mako::engine::rejection_sample(logits, {a.get(), b.get()}, {{1}, {}}), std::invalid_argument);
+
+  // Whether the draft token comes from a distribution or with certainty, the tokens follow the target.
+  std::vector<float> probs       = {0.5f, 0.3f, 0.2f};
+  std::vector<float> draft_probs = {0.1f, 0.2f, 0.7f};
+  auto target                    = torch::tensor(probs).log().unsqueeze(0);
+  auto draft                     = torch::tensor(draft_probs).unsqueeze(0);
+  auto seq                       = make_sequence(mako::engine::sampling_params());
+  std::discrete_distribution<int64_t> propose(draft_probs.begin(), draft_probs.end());
+  std::vector<double> counts(probs.size());
+  std::vector<double> certain_counts(probs.size());
+  for (int i = 0; i < 4000; ++i) {
+    auto token = propose(seq->generator);
+    counts[mako::engine::rejection_sample(torch::cat({target, target}), {seq.get()}, {{token}}, draft)[0][0]] += 1.0;
+    certain_counts[mako::engine::rejection_sample(torch::cat({target, target}), {seq.get()}, {{2}})[0][0]] += 1.0;
+  }
+  for (size_t i = 0; i < probs.size(); ++i) {
+    EXPECT_NEAR(counts[i] / 4000, probs[i], 0.05);
+    EXPECT_NEAR(certain_counts[i] / 4000, probs[i], 0.05);
+  }
+}
+
+TEST(SamplerTest, Verify) {
+  mako::engine::sampling_params params;
+  mako::engine::verify(params);
+  params.top_p = 0.0;
+  EXPECT_THROW(mako::engine::verify(params), std::invalid_argument);
+  params.top_p       = 1.0;
+  params.temperature = -1.0;
+  EXPECT_THROW(mako::engine::verify(params), std::invalid_argument);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
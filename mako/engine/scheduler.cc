@@ -0,0 +1,288 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/engine/scheduler.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <absl/strings/str_format.h>
+
+mako::engine::scheduler::scheduler(
+  scheduler_config config,
+  nn::block_allocator &allocator,
+  nn::block_allocator *swap_allocator,
+  int64_t block_size)
+    : config_(config), allocator_(allocator), swap_allocator_(swap_allocator), block_size_(block_size) {
+  if (0 < config_.prefill_chunk_size && config_.max_num_batched_tokens <= config_.prefill_chunk_size) {
+    throw std::invalid_argument(absl::StrFormat(
+      "The prefill chunk size %d must be less than the %d tokens of a step, to leave room for decoding sequences",
+      config_.prefill_chunk_size,
+      config_.max_num_batched_tokens));
+  }
+}
+
+void mako::engine::scheduler::add(std::shared_ptr<sequence> seq) {
+  auto num_tokens = seq->num_tokens() + seq->params.max_tokens;
+  if (config_.prefill_chunk_size <= 0 && config_.max_num_batched_tokens < seq->num_tokens()) {
+    throw std::invalid_argument(absl::StrFormat(
+      "The prompt of %s has %d tokens, more than the %d tokens of a step",
+      seq->request_id,
+      seq->num_tokens(),
+      config_.max_num_batched_tokens));
+  }
+  if (allocator_.num_blocks() * block_size_ < num_tokens) {
+    throw std::invalid_argument(absl::StrFormat(
+      "%s may take up %d tokens, more than the %d tokens the cache can hold",
+      seq->request_id,
+      num_tokens,
+      allocator_.num_blocks() * block_size_));
+  }
+  seq->status = sequence_status::waiting;
+  waiting_.push_back(std::move(seq));
+}
+
+bool mako::engine::scheduler::abort(absl::string_view request_id) {
+  for (auto *queue : {&waiting_, &running_, &swapped_}) {
+    auto it = std::find_if(queue->begin(), queue->end(), [&](const auto &seq) {
+      return seq->request_id == request_id;
+    });
+    if (it != queue->end()) {
+      free(**it);
+      (*it)->status = sequence_status::finished;
+      queue->erase(it);
+      return true;
+    }
+  }
+  return false;
+}
+
+int64_t mako::engine::scheduler::limit_prefill(int64_t num_tokens, int64_t token_budget) const {
+  if (config_.prefill_chunk_size <= 0) {
+    return num_tokens;
+  }
+  return std::min({num_tokens, config_.prefill_chunk_size, token_budget});
+}
+
+bool mako::engine::scheduler::allocate_slots(sequence &seq, int64_t num_tokens) {
+  auto num_blocks = (seq.num_computed_tokens + num_tokens + block_size_ - 1) / block_size_;
+  auto required   = num_blocks - static_cast<int64_t>(seq.block_table.size());
+  if (allocator_.num_free_blocks() < required) {
+    return false;
+  }
+  for (int64_t i = 0; i < required; ++i) {
+    seq.block_table.push_back(allocator_.allocate());
+  }
+  return true;
+}
+
+void mako::engine::scheduler::match_prefix(sequence &seq) {
+  // The last token is computed in any case, as the next token is sampled from its hidden state.
+  auto num_blocks = (seq.num_tokens() - 1) / block_size_;
+  size_t hash     = 0;
+  for (int64_t i = 0; i < num_blocks; ++i) {
+    hash       = nn::block_allocator::hash_block(hash, seq.token_ids.data() + i * block_size_, block_size_);
+    auto block = allocator_.lookup(hash);
+    if (!block) {
+      break;
+    }
+    seq.block_table.push_back(*block);
+    seq.block_hashes.push_back(hash);
+    seq.num_computed_tokens += block_size_;
+  }
+}
+
+void mako::engine::scheduler::commit_blocks(sequence &seq) {
+  auto num_blocks = static_cast<size_t>(seq.num_computed_tokens / block_size_);
+  for (auto i = seq.block_hashes.size(); i < num_blocks; ++i) {
+    auto parent_hash = seq.block_hashes.empty() ? 0 : seq.block_hashes.back();
+    auto hash = nn::block_allocator::hash_block(parent_hash, seq.token_ids.data() + i * block_size_, block_size_);
+    allocator_.commit(seq.block_table[i], hash);
+    seq.block_hashes.push_back(hash);
+  }
+}
+
+void mako::engine::scheduler::preempt(const std::shared_ptr<sequence> &seq, scheduler_output &output) {
+  auto swappable = config_.preemption == preemption_mode::swap && swap_allocator_ != nullptr &&
+                   static_cast<size_t>(swap_allocator_->num_free_blocks()) >= seq->block_table.size();
+  // The blocks stay cached under their hashes, and are committed again once the sequence is resumed.
+  seq->block_hashes.clear();
+  if (swappable) {
+    for (auto &block : seq->block_table) {
+      auto swap_block = swap_allocator_->allocate();
+      output.blocks_to_swap_out.emplace_back(block, swap_block);
+      allocator_.free(block);
+      block = swap_block;
+    }
+    seq->status = sequence_status::swapped;
+    swapped_.push_front(seq);
+  } else {
+    for (auto block : seq->block_table) {
+      allocator_.free(block);
+    }
+    seq->block_table.clear();
+    seq->num_computed_tokens = 0;
+    seq->status              = sequence_status::waiting;
+    waiting_.push_front(seq);
+  }
+}
+
+void mako::engine::scheduler::free(sequence &seq) {
+  auto &allocator = seq.status == sequence_status::swapped ? *swap_allocator_ : allocator_;
+  for (auto block : seq.block_table) {
+    allocator.free(block);
+  }
+  seq.block_table.clear();
+  seq.block_hashes.clear();
+}
+
+mako::engine::scheduler_output mako::engine::scheduler::schedule() {
+  scheduler_output output;
+  auto token_budget = config_.max_num_batched_tokens;
+  auto preempted    = false;
+
+  // Running sequences come first, decoding ones before those prefilling a chunk of their prompts, so that a long
+  // prompt never takes the budget of the sequences generating tokens; each group goes in order of arrival.
+  std::vector<std::shared_ptr<sequence>> running(running_.begin(), running_.end());
+  std::stable_partition(running.begin(), running.end(), [](const auto &seq) {
+    return seq->num_tokens() - seq->num_computed_tokens == 1;
+  });
+
+  // The latest running sequences not yet scheduled make room for the others if need be.
+  auto is_scheduled = [&](const std::shared_ptr<sequence> &seq) {
+    return std::any_of(output.scheduled.begin(), output.scheduled.end(), [&](const auto &scheduled) {
+      return scheduled.seq == seq;
+    });
+  };
+  for (const auto &seq : running) {
+    if (token_budget <= 0) {
+      break;
+    }
+    if (seq->status != sequence_status::running) {
+      continue;
+    }
+    auto remaining  = seq->num_tokens() - seq->num_computed_tokens;
+    auto num_tokens = std::min(limit_prefill(remaining, token_budget), token_budget);
+    // A decoding sequence gets room for draft tokens, as far as the budget and its remaining tokens allow.
+    int64_t num_lookahead_slots = 0;
+    if (remaining == 1) {
+      num_lookahead_slots = std::min(
+        {config_.num_lookahead_slots, token_budget - 1, seq->params.max_tokens - seq->num_output_tokens() - 1});
+      num_lookahead_slots = std::max<int64_t>(num_lookahead_slots, 0);
+    }
+    auto scheduled = true;
+    while (!allocate_slots(*seq, num_tokens + num_lookahead_slots)) {
+      auto it     = std::find_if_not(running_.rbegin(), running_.rend(), is_scheduled);
+      auto victim = *it;
+      running_.erase(std::next(it).base());
+      preempt(victim, output);
+      preempted = true;
+      if (victim == seq) {
+        scheduled = false;
+        break;
+      }
+    }
+    if (!scheduled) {
+      continue;
+    }
+    output.scheduled.push_back({seq, num_tokens, num_lookahead_slots});
+    token_budget -= num_tokens + num_lookahead_slots;
+  }
+
+  // Swapped sequences are resumed before any new prompt, but not in a step that has just preempted.
+  while (!preempted && !swapped_.empty() && running_.size() < static_cast<size_t>(config_.max_num_seqs)) {
+    auto seq        = swapped_.front();
+    auto num_tokens = limit_prefill(seq->num_tokens() - seq->num_computed_tokens, token_budget);
+    auto num_blocks = (seq->num_computed_tokens + num_tokens + block_size_ - 1) / block_size_;
+    if (num_tokens <= 0 || token_budget < num_tokens || allocator_.num_free_blocks() < num_blocks) {
+      break;
+    }
+    swapped_.pop_front();
+    for (auto &block : seq->block_table) {
+      auto device_block = allocator_.allocate();
+      output.blocks_to_swap_in.emplace_back(block, device_block);
+      swap_allocator_->free(block);
+      block = device_block;
+    }
+    allocate_slots(*seq, num_tokens);
+    seq->status = sequence_status::running;
+    running_.push_back(seq);
+    output.scheduled.push_back({seq, num_tokens});
+    token_budget -= num_tokens;
+  }
+
+  // New prompts are admitted only once every preempted sequence has been resumed, so that none starves.
+  while (!preempted && swapped_.empty() && !waiting_.empty() &&
+         running_.size() < static_cast<size_t>(config_.max_num_seqs)) {
+    auto seq = waiting_.front();
+    if (config_.enable_prefix_caching) {
+      match_prefix(*seq);
+    }
+    auto num_tokens = limit_prefill(seq->num_tokens() - seq->num_computed_tokens, token_budget);
+    // Without chunks, a sequence preempted by recomputation may have outgrown the budget with its generated tokens,
+    // and is then allowed to run alone lest it starve.
+    auto fits = 0 < num_tokens && (num_tokens <= token_budget || output.scheduled.empty());
+    if (!fits || !allocate_slots(*seq, num_tokens)) {
+      // The cached blocks are given back, to be looked up again when the sequence is next considered.
+      free(*seq);
+      seq->num_computed_tokens = 0;
+      break;
+    }
+    waiting_.pop_front();
+    seq->status = sequence_status::running;
+    running_.push_back(seq);
+    output.scheduled.push_back({seq, num_tokens});
+    token_budget -= num_tokens;
+  }
+
+  for (const auto &scheduled : output.scheduled) {
+    output.num_batched_tokens += scheduled.num_tokens + scheduled.num_lookahead_slots;
+  }
+  return output;
+}
+
+std::vector<std::shared_ptr<mako::engine::sequence>> mako::engine::scheduler::update(
+  const scheduler_output &output,
+  const std::vector<std::vector<int64_t>> &sampled_token_ids) {
+  std::vector<std::shared_ptr<sequence>> finished;
+  for (size_t i = 0; i < output.scheduled.size(); ++i) {
+    const auto &seq = output.scheduled[i].seq;
+    seq->num_computed_tokens += output.scheduled[i].num_tokens;
+
+    auto stopped               = false;
+    const auto &stop_token_ids = seq->params.stop_token_ids;
+    for (auto token_id : sampled_token_ids[i]) {
+      seq->token_ids.push_back(token_id);
+      if (seq->params.max_tokens <= seq->num_output_tokens() ||
+          std::find(stop_token_ids.begin(), stop_token_ids.end(), token_id) != stop_token_ids.end()) {
+        stopped = true;
+        break;
+      }
+    }
+    // The accepted draft tokens have been computed along with the scheduled tokens, while the last token has not.
+    if (!sampled_token_ids[i].empty()) {
+      seq->num_computed_tokens = seq->num_tokens() - 1;
+    }
+    if (config_.enable_prefix_caching) {
+      commit_blocks(*seq);
+    }
+    if (stopped) {
+      free(*seq);
+      seq->status = sequence_status::finished;
+      running_.erase(std::find(running_.begin(), running_.end(), seq));
+      finished.push_back(seq);
+    }
+  }
+  return finished;
+}
@@ -0,0 +1,183 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <absl/strings/string_view.h>
+
+#include "mako/engine/sequence.h"
+#include "mako/nn/kv_cache.h"
+#include "mako/utils/export.h"
+
+namespace mako {
+namespace engine {
+/// \brief Ways to free the blocks of a running sequence when the cache runs out of blocks.
+enum class preemption_mode {
+  /// \brief Drops the keys and values, which are computed again once the sequence is rescheduled.
+  recompute,
+
+  /// \brief Moves the keys and values to the swap space, from which they are moved back once the sequence is
+  /// rescheduled; falls back to recomputation if the swap space runs out of blocks.
+  swap,
+};
+
+/// \brief Options to control how the scheduler batches sequences.
+struct MAKO_API scheduler_config {
+  /// \brief The maximum number of sequences in the running batch.
+  int64_t max_num_seqs = 256;
+
+  /// \brief The maximum number of tokens to process in one step, shared by prefills and decodes.
+  int64_t max_num_batched_tokens = 2048;
+
+  /// \brief The maximum number of prompt tokens of a sequence to prefill in one step, or ``0`` to prefill each prompt
+  /// in one step.
+  ///
+  /// A long prompt is then prefilled over several steps, in chunks sharing the batch with decoding sequences, which
+  /// are thus never stalled by more than ``max_num_batched_tokens`` tokens per step; without chunks, a prompt must fit
+  /// in the budget of a step. It must be less than ``max_num_batched_tokens``, whose rest goes to decoding sequences.
+  int64_t prefill_chunk_size = 0;
+
+  preemption_mode preemption = preemption_mode::recompute;
+
+  /// \brief Whether to share the blocks of common prompt prefixes across sequences, so that a prompt skips the
+  /// prefill of its leading blocks cached by an earlier sequence.
+  bool enable_prefix_caching = false;
+
+  /// \brief The number of slots to allocate for a decoding sequence beyond its next token, to hold the draft tokens of
+  /// speculative decoding; they count towards ``max_num_batched_tokens`` as well.
+  int64_t num_lookahead_slots = 0;
+};
+
+/// \brief A sequence scheduled for a step, along with the number of its tokens to process.
+struct MAKO_API scheduled_sequence {
+  std::shared_ptr<sequence> seq;
+
+  /// \brief The number of tokens to process, starting at ``seq->num_computed_tokens``.
+  int64_t num_tokens;
+
+  /// \brief The number of slots allocated beyond the tokens to process, for draft tokens.
+  int64_t num_lookahead_slots = 0;
+};
+
+/// \brief What to do in a step.
+struct MAKO_API scheduler_output {
+  /// \brief The sequences to run, in the order of their tokens in the batch.
+  std::vector<scheduled_sequence> scheduled;
+
+  /// \brief The pairs of block in the cache and block in the swap space to copy before the step.
+  std::vector<std::pair<int64_t, int64_t>> blocks_to_swap_out;
+
+  /// \brief The pairs of block in the swap space and block in the cache to copy before the step, after swapping out.
+  std::vector<std::pair<int64_t, int64_t>> blocks_to_swap_in;
+
+  /// \brief The number of tokens to process in total.
+  int64_t num_batched_tokens = 0;
+};
+
+/// \brief First-come-first-served scheduler with iteration-level continuous batching.
+///
+/// The batch is formed anew at every step: running sequences decode first, then running sequences prefill the next
+/// chunks of their prompts, then swapped sequences are resumed, and then waiting prompts are admitted, as far as the
+/// token budget, the number of sequences, and the free blocks allow.
+/// A finished sequence leaves the batch, and frees its blocks, as soon as its last token is generated. When a running
+/// sequence has no block for its next token, the latest running sequences are preempted until it has one.
+class MAKO_API scheduler {
+ public:
+  /// \param config Options to control the batching.
+  /// \param allocator The allocator of the blocks in the cache.
+  /// \param swap_allocator The allocator of the blocks in the swap space, if any.
+  /// \param block_size The number of tokens per block.
+  /// \throw std::invalid_argument If the prefill chunk size leaves no budget for decoding sequences.
+  scheduler(
+    scheduler_config config,
+    nn::block_allocator &allocator,
+    nn::block_allocator *swap_allocator,
+    int64_t block_size);
+
+  /// \brief Queues a new sequence.
+  /// \throw std::invalid_argument If the prompt could never be scheduled.
+  void add(std::shared_ptr<sequence> seq);
+
+  /// \brief Finishes a sequence wherever it is, freeing its blocks.
+  /// \return ``false`` if no unfinished sequence has the identifier.
+  bool abort(absl::string_view request_id);
+
+  /// \brief Decides what to run in the next step.
+  scheduler_output schedule();
+
+  /// \brief Records the results of a step.
+  ///
+  /// The scheduled tokens are marked as computed, and each sequence that has computed all of its tokens is given the
+  /// tokens sampled for it, which finishes the sequence at a stop token or at the last token allowed; the tokens after
+  /// it are dropped. All but the last of the tokens are draft tokens accepted in speculative decoding, which the step
+  /// has computed as well.
+  /// \param output The output of ``schedule`` for the step.
+  /// \param sampled_token_ids The tokens sampled for each scheduled sequence, which are empty for a sequence that has
+  ///  yet to compute some of its prompt.
+  /// \return The sequences finished in the step.
+  std::vector<std::shared_ptr<sequence>> update(
+    const scheduler_output &output,
+    const std::vector<std::vector<int64_t>> &sampled_token_ids);
+
+  bool has_unfinished_seqs() const {
+    return !waiting_.empty() || !running_.empty() || !swapped_.empty();
+  }
+
+  size_t num_waiting_seqs() const {
+    return waiting_.size();
+  }
+
+  size_t num_running_seqs() const {
+    return running_.size();
+  }
+
+  size_t num_swapped_seqs() const {
+    return swapped_.size();
+  }
+
+ private:
+  /// \brief Limits the number of tokens of a sequence to process in a step to a chunk, if prefill is chunked.
+  int64_t limit_prefill(int64_t num_tokens, int64_t token_budget) const;
+
+  /// \brief Allocates the blocks for ``num_tokens`` more tokens of ``seq``, if there are enough free blocks.
+  bool allocate_slots(sequence &seq, int64_t num_tokens);
+
+  /// \brief Takes the cached blocks of the longest prefix of a new sequence, marking their tokens as computed.
+  void match_prefix(sequence &seq);
+
+  /// \brief Commits the full blocks of a sequence computed since the last commit to the prefix cache.
+  void commit_blocks(sequence &seq);
+
+  /// \brief Preempts a running sequence, which has been removed from the running batch.
+  void preempt(const std::shared_ptr<sequence> &seq, scheduler_output &output);
+
+  /// \brief Frees the blocks of a finished sequence.
+  void free(sequence &seq);
+
+  scheduler_config config_;
+  nn::block_allocator &allocator_;
+  nn::block_allocator *swap_allocator_;
+  int64_t block_size_;
+  std::deque<std::shared_ptr<sequence>> waiting_;
+  std::deque<std::shared_ptr<sequence>> running_;
+  std::deque<std::shared_ptr<sequence>> swapped_;
+};
+} // namespace engine
+} // namespace mako
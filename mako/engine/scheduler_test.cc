@@ -0,0 +1,280 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/engine/scheduler.h"
+
+#include <gtest/gtest.h>
+
+/// \brief Creates a sequence with a prompt of ``__num_tokens`` tokens.
+static inline std::shared_ptr<mako::engine::sequence> make_sequence(
+  const std::string &__request_id,
+  int64_t __num_tokens,
+  int64_t __max_tokens = 16) {
+  mako::engine::sampling_params params;
+  params.max_tokens = __max_tokens;
+  return std::make_shared<mako::engine::sequence>(__request_id, std::vector<int64_t>(__num_tokens, 1), params);
+}
+
+TEST(SchedulerTest, ContinuousBatching) {
+  mako::nn::block_allocator allocator(16);
+  mako::engine::scheduler_config config;
+  config.max_num_batched_tokens = 16;
+  mako::engine::scheduler scheduler(config, allocator, nullptr, 4);
+
+  auto a = make_sequence("a", 6, 1);
+  auto b = make_sequence("b", 8);
+  scheduler.add(a);
+  scheduler.add(b);
+  EXPECT_THROW(scheduler.add(make_sequence("c", 17)), std::invalid_argument);
+
+  auto output = scheduler.schedule();
+  EXPECT_EQ(output.scheduled.size(), 2);
+  EXPECT_EQ(output.num_batched_tokens, 14);
+  EXPECT_EQ(allocator.num_used_blocks(), 4);
+
+  // The first sequence finishes right away, giving its blocks back.
+  auto finished = scheduler.update(output, {{2}, {3}});
+  ASSERT_EQ(finished.size(), 1);
+  EXPECT_EQ(finished.front(), a);
+  EXPECT_EQ(a->status, mako::engine::sequence_status::finished);
+  EXPECT_EQ(allocator.num_used_blocks(), 2);
+
+  // A new prompt joins the decoding sequence in the next step.
+  auto c = make_sequence("c", 5);
+  scheduler.add(c);
+  output = scheduler.schedule();
+  ASSERT_EQ(output.scheduled.size(), 2);
+  EXPECT_EQ(output.scheduled[0].seq, b);
+  EXPECT_EQ(output.scheduled[0].num_tokens, 1);
+  EXPECT_EQ(output.scheduled[1].seq, c);
+  EXPECT_EQ(output.scheduled[1].num_tokens, 5);
+
+  EXPECT_TRUE(scheduler.abort("b"));
+  EXPECT_FALSE(scheduler.abort("b"));
+  EXPECT_EQ(scheduler.num_running_seqs(), 1);
+}
+
+TEST(SchedulerTest, PreemptByRecomputation) {
+  mako::nn::block_allocator allocator(4);
+  mako::engine::scheduler scheduler(mako::engine::scheduler_config(), allocator, nullptr, 4);
+
+  auto a = make_sequence("a", 8, 8);
+  auto b = make_sequence("b", 8, 8);
+  scheduler.add(a);
+  scheduler.add(b);
+  scheduler.update(scheduler.schedule(), {{1}, {1}});
+
+  // Both sequences need a third block for their ninth tokens, so the later one makes room for the earlier one.
+  auto output = scheduler.schedule();
+  ASSERT_EQ(output.scheduled.size(), 1);
+  EXPECT_EQ(output.scheduled.front().seq, a);
+  EXPECT_EQ(b->status, mako::engine::sequence_status::waiting);
+  EXPECT_EQ(b->num_computed_tokens, 0);
+  EXPECT_TRUE(b->block_table.empty());
+  EXPECT_EQ(scheduler.num_waiting_seqs(), 1);
+}
+
+TEST(SchedulerTest, PreemptBySwapping) {
+  mako::nn::block_allocator allocator(4);
+  mako::nn::block_allocator swap_allocator(4);
+  mako::engine::scheduler_config config;
+  config.preemption = mako::engine::preemption_mode::swap;
+  mako::engine::scheduler scheduler(config, allocator, &swap_allocator, 4);
+
+  auto a = make_sequence("a", 8, 2);
+  auto b = make_sequence("b", 8, 8);
+  scheduler.add(a);
+  scheduler.add(b);
+  scheduler.update(scheduler.schedule(), {{1}, {1}});
+
+  auto device_blocks = b->block_table;
+  auto output        = scheduler.schedule();
+  EXPECT_EQ(b->status, mako::engine::sequence_status::swapped);
+  ASSERT_EQ(output.blocks_to_swap_out.size(), 2);
+  EXPECT_EQ(output.blocks_to_swap_out[0].first, device_blocks[0]);
+  EXPECT_EQ(b->num_computed_tokens, 8);
+  EXPECT_EQ(swap_allocator.num_used_blocks(), 2);
+
+  // Once the earlier sequence finishes, the swapped one is swapped back in and resumes decoding.
+  scheduler.update(output, {{1}});
+  output = scheduler.schedule();
+  ASSERT_EQ(output.scheduled.size(), 1);
+  EXPECT_EQ(output.scheduled.front().seq, b);
+  EXPECT_EQ(output.scheduled.front().num_tokens, 1);
+  EXPECT_EQ(output.blocks_to_swap_in.size(), 2);
+  EXPECT_EQ(swap_allocator.num_used_blocks(), 0);
+  EXPECT_EQ(b->block_table.size(), 3);
+}
+
+TEST(SchedulerTest, ChunkedPrefill) {
+  mako::nn::block_allocator allocator(16);
+  mako::engine::scheduler_config config;
+  config.max_num_batched_tokens = 8;
+  config.prefill_chunk_size     = 6;
+  mako::engine::scheduler scheduler(config, allocator, nullptr, 4);
+
+  // A prompt longer than the budget of a step is accepted, to be prefilled in chunks.
+  auto a = make_sequence("a", 2, 4);
+  auto b = make_sequence("b", 20, 1);
+  scheduler.add(a);
+  scheduler.add(b);
+
+  auto output = scheduler.schedule();
+  ASSERT_EQ(output.scheduled.size(), 2);
+  EXPECT_EQ(output.scheduled[1].num_tokens, 6);
+  EXPECT_EQ(b->block_table.size(), 2);
+  scheduler.update(output, {{1}, {}});
+  EXPECT_EQ(b->num_computed_tokens, 6);
+  EXPECT_EQ(b->num_output_tokens(), 0);
+
+  // The decoding sequence runs at every step while the prompt is prefilled.
+  for (auto num_tokens : {6, 6, 2}) {
+    output = scheduler.schedule();
+    ASSERT_EQ(output.scheduled.size(), 2);
+    EXPECT_EQ(output.scheduled[0].seq, a);
+    EXPECT_EQ(output.scheduled[0].num_tokens, 1);
+    EXPECT_EQ(output.scheduled[1].num_tokens, num_tokens);
+    EXPECT_LE(output.num_batched_tokens, config.max_num_batched_tokens);
+    auto last = b->num_computed_tokens + num_tokens == b->num_tokens();
+    scheduler.update(output, {{1}, last ? std::vector<int64_t>{1} : std::vector<int64_t>{}});
+  }
+  EXPECT_EQ(a->status, mako::engine::sequence_status::finished);
+  EXPECT_EQ(b->status, mako::engine::sequence_status::finished);
+}
+
+TEST(SchedulerTest, DecodeBeforePrefill) {
+  mako::nn::block_allocator allocator(16);
+  mako::engine::scheduler_config config;
+  config.max_num_batched_tokens = 8;
+  config.prefill_chunk_size     = 8;
+  EXPECT_THROW(mako::engine::scheduler(config, allocator, nullptr, 4), std::invalid_argument);
+
+  config.prefill_chunk_size  = 6;
+  config.num_lookahead_slots = 2;
+  mako::engine::scheduler scheduler(config, allocator, nullptr, 4);
+
+  // The long prompt arrives first, and the sequences arriving after it start decoding while it is prefilled.
+  auto a = make_sequence("a", 20, 1);
+  auto b = make_sequence("b", 1);
+  auto c = make_sequence("c", 1);
+  scheduler.add(a);
+  scheduler.add(b);
+  scheduler.add(c);
+  auto output = scheduler.schedule();
+  ASSERT_EQ(output.scheduled.size(), 3);
+  EXPECT_EQ(output.scheduled[0].num_tokens, 6);
+  scheduler.update(output, {{}, {1}, {1}});
+
+  // Both decoding sequences get a token and their draft slots at every step, and the prompt takes what is left.
+  for (auto num_tokens : {2, 2, 2, 2, 2, 2, 2}) {
+    output = scheduler.schedule();
+    ASSERT_EQ(output.scheduled.size(), 3);
+    EXPECT_EQ(output.scheduled[0].seq, b);
+    EXPECT_EQ(output.scheduled[0].num_tokens, 1);
+    EXPECT_EQ(output.scheduled[0].num_lookahead_slots, 2);
+    EXPECT_EQ(output.scheduled[1].seq, c);
+    EXPECT_EQ(output.scheduled[1].num_tokens, 1);
+    EXPECT_EQ(output.scheduled[1].num_lookahead_slots, 2);
+    EXPECT_EQ(output.scheduled[2].seq, a);
+    EXPECT_EQ(output.scheduled[2].num_tokens, num_tokens);
+    EXPECT_EQ(output.num_batched_tokens, config.max_num_batched_tokens);
+    auto last = a->num_computed_tokens + num_tokens == a->num_tokens();
+    scheduler.update(output, {{1}, {1}, last ? std::vector<int64_t>{1} : std::vector<int64_t>{}});
+  }
+  EXPECT_EQ(a->status, mako::engine::sequence_status::finished);
+  EXPECT_EQ(b->num_output_tokens(), 8);
+}
+
+TEST(SchedulerTest, LookaheadSlots) {
+  mako::nn::block_allocator allocator(16);
+  mako::engine::scheduler_config config;
+  config.num_lookahead_slots = 3;
+  mako::engine::scheduler scheduler(config, allocator, nullptr, 4);
+
+  mako::engine::sampling_params params;
+  params.max_tokens     = 6;
+  params.stop_token_ids = {2};
+  auto a                = std::make_shared<mako::engine::sequence>("a", std::vector<int64_t>(3, 1), params);
+  scheduler.add(a);
+
+  // A prefilling sequence gets no lookahead slots.
+  auto output = scheduler.schedule();
+  EXPECT_EQ(output.scheduled.front().num_lookahead_slots, 0);
+  scheduler.update(output, {{5}});
+
+  // A decoding sequence gets slots for its draft tokens, and the accepted ones count as computed.
+  output = scheduler.schedule();
+  EXPECT_EQ(output.scheduled.front().num_lookahead_slots, 3);
+  EXPECT_EQ(output.num_batched_tokens, 4);
+  EXPECT_EQ(a->block_table.size(), 2);
+  scheduler.update(output, {{6, 7, 8}});
+  EXPECT_EQ(a->num_output_tokens(), 4);
+  EXPECT_EQ(a->num_computed_tokens, 6);
+
+  // The slots never go beyond the last token allowed, and the tokens after a stop token are dropped.
+  output = scheduler.schedule();
+  EXPECT_EQ(output.scheduled.front().num_lookahead_slots, 1);
+  auto finished = scheduler.update(output, {{2, 3}});
+  ASSERT_EQ(finished.size(), 1);
+  EXPECT_EQ(a->token_ids, std::vector<int64_t>({1, 1, 1, 5, 6, 7, 8, 2}));
+  EXPECT_EQ(allocator.num_used_blocks(), 0);
+}
+
+TEST(SchedulerTest, PrefixCaching) {
+  mako::nn::block_allocator allocator(8);
+  mako::engine::scheduler_config config;
+  config.enable_prefix_caching = true;
+  mako::engine::scheduler scheduler(config, allocator, nullptr, 4);
+
+  std::vector<int64_t> prefix = {0, 1, 2, 3, 4, 5, 6, 7};
+  mako::engine::sampling_params params;
+  params.max_tokens = 1;
+
+  auto tokens = prefix;
+  tokens.insert(tokens.end(), {8, 9});
+  auto a = std::make_shared<mako::engine::sequence>("a", tokens, params);
+  scheduler.add(a);
+  auto output = scheduler.schedule();
+  auto blocks = a->block_table;
+  scheduler.update(output, {{10}});
+  EXPECT_EQ(allocator.num_used_blocks(), 0);
+  EXPECT_EQ(allocator.num_cached_blocks(), 2);
+
+  // The two full blocks of the finished sequence are reused, leaving only the last token to compute.
+  tokens = prefix;
+  tokens.push_back(42);
+  auto b = std::make_shared<mako::engine::sequence>("b", tokens, params);
+  scheduler.add(b);
+  output = scheduler.schedule();
+  ASSERT_EQ(output.scheduled.size(), 1);
+  EXPECT_EQ(output.scheduled.front().num_tokens, 1);
+  EXPECT_EQ(b->num_computed_tokens, 8);
+  EXPECT_EQ(std::vector<int64_t>(b->block_table.begin(), b->block_table.begin() + 2),
+            std::vector<int64_t>(blocks.begin(), blocks.begin() + 2));
+  scheduler.update(output, {{11}});
+
+  // A prompt made of cached blocks only still computes its last block, to sample from its last token.
+  auto c = std::make_shared<mako::engine::sequence>("c", prefix, params);
+  scheduler.add(c);
+  output = scheduler.schedule();
+  ASSERT_EQ(output.scheduled.size(), 1);
+  EXPECT_EQ(output.scheduled.front().num_tokens, 4);
+  EXPECT_EQ(c->block_table.front(), blocks.front());
+  EXPECT_NE(c->block_table.back(), blocks[1]);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
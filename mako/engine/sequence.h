@@ -0,0 +1,132 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "mako/utils/export.h"
+
+namespace mako {
+namespace engine {
+/// \brief Parameters to control how tokens are generated for a request.
+struct MAKO_API sampling_params {
+  /// \brief The maximum number of tokens to generate.
+  int64_t max_tokens = 16;
+
+  /// \brief The temperature to divide the logits by, or ``0`` to take the most likely token.
+  double temperature = 1.0;
+
+  /// \brief The number of most likely tokens to sample from, or ``0`` for all tokens.
+  int64_t top_k = 0;
+
+  /// \brief The cumulative probability of the most likely tokens to sample from.
+  double top_p = 1.0;
+
+  /// \brief The probability relative to the most likely token below which a token is not sampled.
+  double min_p = 0.0;
+
+  /// \brief The factor to divide the positive logits and multiply the negative logits of the tokens in the prompt or
+  /// the output by, penalizing them if greater than ``1``.
+  double repetition_penalty = 1.0;
+
+  /// \brief The value to subtract from the logit of a token for each time it is in the output.
+  double frequency_penalty = 0.0;
+
+  /// \brief The value to subtract from the logit of a token once it is in the output.
+  double presence_penalty = 0.0;
+
+  /// \brief The seed of the random number generator of the request, which makes the generation reproducible.
+  std::optional<uint64_t> seed;
+
+  /// \brief The tokens that end the generation once generated, e.g., the end-of-sequence token.
+  std::vector<int64_t> stop_token_ids;
+};
+
+/// \brief States of a sequence in the scheduler.
+enum class sequence_status {
+  /// \brief Waiting to be prefilled, either for the first time or after being preempted by recomputation.
+  waiting,
+
+  /// \brief In the running batch, with its keys and values in the cache.
+  running,
+
+  /// \brief Preempted with its keys and values swapped out of the cache.
+  swapped,
+
+  /// \brief Finished or aborted.
+  finished,
+};
+
+/// \brief A request being served, along with its state in the scheduler.
+struct MAKO_API sequence {
+  sequence(std::string request_id, std::vector<int64_t> prompt_token_ids, sampling_params params)
+      : request_id(std::move(request_id)),
+        token_ids(std::move(prompt_token_ids)),
+        num_prompt_tokens(static_cast<int64_t>(token_ids.size())),
+        params(std::move(params)),
+        generator(this->params.seed ? *this->params.seed : std::random_device()()) {}
+
+  /// \brief The number of tokens, both prompted and generated.
+  int64_t num_tokens() const {
+    return static_cast<int64_t>(token_ids.size());
+  }
+
+  /// \brief The number of tokens generated so far.
+  int64_t num_output_tokens() const {
+    return num_tokens() - num_prompt_tokens;
+  }
+
+  /// \brief The identifier of the request.
+  std::string request_id;
+
+  /// \brief The tokens of the prompt followed by the generated ones.
+  std::vector<int64_t> token_ids;
+
+  /// \brief The number of tokens of the prompt.
+  int64_t num_prompt_tokens;
+
+  /// \brief The number of leading tokens whose keys and values are in the cache.
+  int64_t num_computed_tokens = 0;
+
+  /// \brief The blocks holding the keys and values of the sequence in order, in the cache while running or in the
+  /// swap space while swapped.
+  std::vector<int64_t> block_table;
+
+  /// \brief The hashes of the leading full blocks committed to the prefix cache, each chained to the one before it.
+  std::vector<size_t> block_hashes;
+
+  sequence_status status = sequence_status::waiting;
+
+  sampling_params params;
+
+  /// \brief The random number generator of the sequence, which advances only when the sequence samples, so that its
+  /// tokens do not depend on the other sequences in the batch.
+  std::mt19937_64 generator;
+
+  /// \brief The time the request was added, from which its time to first token is measured.
+  std::chrono::steady_clock::time_point arrival_time = std::chrono::steady_clock::now();
+
+  /// \brief The time the latest tokens of the sequence were generated.
+  std::chrono::steady_clock::time_point last_token_time;
+};
+} // namespace engine
+} // namespace mako
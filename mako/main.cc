@@ -0,0 +1,298 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <absl/log/log.h>
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_join.h>
+#include <absl/strings/str_split.h>
+#include <torch/torch.h>
+
+#include "mako/engine/engine.h"
+#include "mako/nn/modules/llama.h"
+#include "mako/server/server.h"
+#include "mako/utils/flags.h"
+#include "mako/utils/huggingface/hub.h"
+#include "mako/utils/huggingface/tokenizers.h"
+#include "mako/utils/huggingface/transformers.h"
+#include "mako/utils/pipeline.h"
+#include "mako/utils/quantization.h"
+
+namespace fs = std::filesystem;
+
+using mako::utils::double_flag;
+using mako::utils::int_flag;
+using mako::utils::parse_flags;
+using mako::utils::string_flag;
+
+static constexpr char usage[] = R"(Usage: mako MODEL [--FLAG=VALUE]...
+
+Serves MODEL, a Llama model on Hugging Face Hub or in a local directory, to the prompts read from the standard input,
+one prompt per line as space-separated token ids, and prints the generated token ids in the same order. With
+--text=true, the prompts and the outputs are text instead, encoded and decoded by the tokenizer of MODEL. With --port,
+serves the completions API of OpenAI over HTTP on the port instead, until interrupted, along with the metrics of the
+engine in the text format of Prometheus at /metrics.
+
+Flags:
+  --dtype                   float32, bfloat16, or float16 (default: bfloat16)
+  --load-format             auto, safetensors, pt, or npcache (default: auto)
+  --num-workers             threads to load the weights with (default: 1)
+  --quantize                none, int8, or int4 to quantize the decoder projections with (default: none)
+  --group-size              input channels sharing a scale with int4 (default: 128)
+  --num-blocks              blocks in the KV cache (default: 1024)
+  --block-size              tokens per block (default: 16)
+  --max-num-seqs            sequences per step (default: 256)
+  --max-num-batched-tokens  tokens per step (default: 2048)
+  --prefill-chunk-size      prompt tokens to prefill per step, or 0 not to chunk prompts (default: 0)
+  --preemption              recompute or swap (default: recompute)
+  --num-swap-blocks         blocks in the swap space (default: 0)
+  --enable-prefix-caching   true to share the KV cache of common prompt prefixes (default: false)
+  --max-tokens              tokens to generate per prompt (default: 16)
+  --temperature             temperature to sample with, or 0 for greedy decoding (default: 1.0)
+  --top-k                   most likely tokens to sample from, or 0 for all (default: 0)
+  --top-p                   cumulative probability of the most likely tokens to sample from (default: 1.0)
+  --min-p                   probability relative to the most likely token to sample above (default: 0.0)
+  --repetition-penalty      penalty on the tokens in the prompt or the output (default: 1.0)
+  --frequency-penalty       penalty on each occurrence of a token in the output (default: 0.0)
+  --presence-penalty        penalty on the tokens in the output (default: 0.0)
+  --seed                    seed to sample each prompt with (default: random)
+  --speculative-method      none, ngram, or draft to propose draft tokens with (default: none)
+  --draft-model             Llama model on Hugging Face Hub or in a local directory to draft tokens with
+  --num-speculative-tokens  draft tokens to propose per step (default: 4)
+  --prompt-lookup-max       longest n-gram to look up with ngram (default: 4)
+  --prompt-lookup-min       shortest n-gram to look up with ngram (default: 1)
+  --text                    true to read and print text rather than token ids (default: false)
+  --host                    address to serve on with --port (default: 0.0.0.0)
+  --port                    port to serve the completions API on
+  --served-model-name       name of the model in the completions API (default: MODEL)
+)";
+
+/// \brief Parses a prompt of space-separated token ids.
+/// \param __text The prompt.
+/// \return The token ids.
+static inline std::vector<int64_t> parse_token_ids(std::string __text) {
+  std::vector<int64_t> token_ids;
+  for (auto token : absl::StrSplit(__text, ' ', absl::SkipWhitespace())) {
+    int64_t token_id;
+    if (!absl::SimpleAtoi(token, &token_id)) {
+      LOG(FATAL) << "Invalid token id: " << token;
+    }
+    token_ids.push_back(token_id);
+  }
+  return token_ids;
+}
+
+/// \brief Resolves a model on Hugging Face Hub or in a local directory to its local directory.
+/// \param __model_name_or_path The model.
+/// \return The directory with the configuration and the tokenizer of the model.
+static inline std::string model_folder(const std::string &__model_name_or_path) {
+  if (fs::is_directory(__model_name_or_path)) {
+    return __model_name_or_path;
+  }
+  return mako::utils::snapshot_download(
+    __model_name_or_path,
+    std::nullopt,
+    std::nullopt,
+    {"*.json", "tokenizer.model"});
+}
+
+/// \brief Loads a Llama model on Hugging Face Hub or in a local directory.
+/// \param __model_name_or_path The model.
+/// \param __load_format The format of the weights.
+/// \param __load_options Options to load the weights with.
+/// \return The model with its weights loaded.
+static inline mako::nn::llama_for_causal_lm load_model(
+  const std::string &__model_name_or_path,
+  const std::string &__load_format,
+  const mako::utils::load_options &__load_options) {
+  auto config       = mako::nn::llama_config::from_pretrained(model_folder(__model_name_or_path));
+  config.quantize   = __load_options.quantize;
+  config.group_size = __load_options.group_size;
+
+  mako::nn::llama_for_causal_lm model(config);
+  model->to(*__load_options.dtype);
+
+  LOG(INFO) << "Loading " << __model_name_or_path;
+  for (const auto &[name, weight] : mako::utils::weight_iterator(
+         __model_name_or_path,
+         std::nullopt,
+         __load_format,
+         true,
+         std::nullopt,
+         __load_options)) {
+    model->load_weight(name, weight);
+  }
+  return model;
+}
+
+int main(int argc, char **argv) {
+  std::vector<std::string> positional;
+  auto flags = parse_flags(argc, argv, positional);
+  if (positional.size() != 1 || flags.count("help") != 0) {
+    std::cerr << usage;
+    return positional.size() == 1 ? 0 : 1;
+  }
+  const auto &model_name_or_path = positional.front();
+
+  std::map<std::string, torch::Dtype> dtypes = {
+    {"float32",  torch::kFloat32 },
+    {"bfloat16", torch::kBFloat16},
+    {"float16",  torch::kFloat16 },
+  };
+  auto dtype = dtypes.find(string_flag(flags, "dtype", "bfloat16"));
+  if (dtype == dtypes.end()) {
+    LOG(FATAL) << "Unknown dtype: " << flags.at("dtype");
+  }
+
+  std::map<std::string, mako::utils::quantization::scheme> schemes = {
+    {"none", mako::utils::quantization::scheme::none},
+    {"int8", mako::utils::quantization::scheme::int8},
+    {"int4", mako::utils::quantization::scheme::int4},
+  };
+  auto scheme = schemes.find(string_flag(flags, "quantize", "none"));
+  if (scheme == schemes.end()) {
+    LOG(FATAL) << "Unknown quantization scheme: " << flags.at("quantize");
+  }
+
+  mako::utils::load_options load_options;
+  load_options.num_workers = static_cast<size_t>(int_flag(flags, "num-workers", 1));
+  load_options.dtype       = dtype->second;
+  load_options.quantize    = scheme->second;
+  load_options.group_size  = int_flag(flags, "group-size", load_options.group_size);
+  auto load_format         = string_flag(flags, "load-format", "auto");
+  auto model               = load_model(model_name_or_path, load_format, load_options);
+
+  mako::engine::engine_config engine_config;
+  engine_config.num_blocks                       = int_flag(flags, "num-blocks", 1024);
+  engine_config.block_size                       = int_flag(flags, "block-size", 16);
+  engine_config.num_swap_blocks                  = int_flag(flags, "num-swap-blocks", 0);
+  engine_config.scheduler.max_num_seqs           = int_flag(flags, "max-num-seqs", 256);
+  engine_config.scheduler.max_num_batched_tokens = int_flag(flags, "max-num-batched-tokens", 2048);
+  engine_config.scheduler.prefill_chunk_size     = int_flag(flags, "prefill-chunk-size", 0);
+  if (string_flag(flags, "preemption", "recompute") == "swap") {
+    engine_config.scheduler.preemption = mako::engine::preemption_mode::swap;
+  }
+  engine_config.scheduler.enable_prefix_caching = string_flag(flags, "enable-prefix-caching", "false") == "true";
+
+  std::map<std::string, mako::engine::speculative_method> speculative_methods = {
+    {"none",  mako::engine::speculative_method::none       },
+    {"ngram", mako::engine::speculative_method::ngram      },
+    {"draft", mako::engine::speculative_method::draft_model},
+  };
+  auto speculative_method = speculative_methods.find(string_flag(flags, "speculative-method", "none"));
+  if (speculative_method == speculative_methods.end()) {
+    LOG(FATAL) << "Unknown speculative method: " << flags.at("speculative-method");
+  }
+  engine_config.speculative.method                 = speculative_method->second;
+  engine_config.speculative.num_speculative_tokens = int_flag(flags, "num-speculative-tokens", 4);
+  engine_config.speculative.prompt_lookup_max      = int_flag(flags, "prompt-lookup-max", 4);
+  engine_config.speculative.prompt_lookup_min      = int_flag(flags, "prompt-lookup-min", 1);
+  mako::nn::llama_for_causal_lm draft_model = nullptr;
+  if (engine_config.speculative.method == mako::engine::speculative_method::draft_model) {
+    if (flags.count("draft-model") == 0) {
+      LOG(FATAL) << "--speculative-method=draft requires --draft-model";
+    }
+    draft_model = load_model(flags.at("draft-model"), load_format, load_options);
+  }
+  mako::engine::llm_engine engine(model, engine_config, draft_model);
+
+  mako::engine::sampling_params params;
+  params.max_tokens         = int_flag(flags, "max-tokens", params.max_tokens);
+  params.temperature        = double_flag(flags, "temperature", params.temperature);
+  params.top_k              = int_flag(flags, "top-k", params.top_k);
+  params.top_p              = double_flag(flags, "top-p", params.top_p);
+  params.min_p              = double_flag(flags, "min-p", params.min_p);
+  params.repetition_penalty = double_flag(flags, "repetition-penalty", params.repetition_penalty);
+  params.frequency_penalty  = double_flag(flags, "frequency-penalty", params.frequency_penalty);
+  params.presence_penalty   = double_flag(flags, "presence-penalty", params.presence_penalty);
+  if (flags.count("seed") != 0) {
+    params.seed = static_cast<uint64_t>(int_flag(flags, "seed", 0));
+  }
+
+  if (flags.count("port") != 0) {
+    auto tokenizer = mako::utils::tokenizer::from_pretrained(model_folder(model_name_or_path));
+    mako::server::server_config server_config;
+    server_config.host              = string_flag(flags, "host", server_config.host);
+    server_config.port              = static_cast<uint16_t>(int_flag(flags, "port", server_config.port));
+    server_config.served_model_name = string_flag(flags, "served-model-name", model_name_or_path);
+    mako::server::api_server server(engine, tokenizer, server_config);
+    LOG(INFO) << "Serving " << server_config.served_model_name << " on " << server_config.host << ":" << server.port();
+    server.run();
+    return 0;
+  }
+
+  // Reading, encoding, and decoding run on threads of their own, so that reading the prompts overlaps with encoding
+  // them, and decoding the outputs is spread over the cores.
+  mako::utils::pipeline::stage_options stage_options;
+  stage_options.num_workers = std::max(std::thread::hardware_concurrency(), 1u);
+  stage_options.capacity    = 4 * stage_options.num_workers;
+
+  mako::utils::pipeline::source<std::string> lines{[](mako::utils::pipeline::sink<std::string> &yield) {
+    std::string line;
+    while (std::getline(std::cin, line)) {
+      yield(std::move(line));
+    }
+  }};
+
+  std::optional<mako::utils::tokenizer> tokenizer;
+  std::function<std::vector<int64_t>(std::string)> encode = parse_token_ids;
+  if (string_flag(flags, "text", "false") == "true") {
+    tokenizer = mako::utils::tokenizer::from_pretrained(model_folder(model_name_or_path));
+    if (tokenizer->eos_token_id().has_value()) {
+      params.stop_token_ids.push_back(*tokenizer->eos_token_id());
+    }
+    encode = [&](std::string text) { return tokenizer->encode(text); };
+  }
+
+  std::vector<std::vector<int64_t>> outputs;
+  auto prompts = mako::utils::pipeline::map(
+    mako::utils::pipeline::prefetch(std::move(lines), stage_options.capacity),
+    encode,
+    stage_options);
+  for (auto &prompt : prompts) {
+    engine.add_request(std::to_string(outputs.size()), std::move(prompt), params);
+    outputs.emplace_back();
+  }
+
+  while (engine.has_unfinished_requests()) {
+    for (const auto &output : engine.step()) {
+      auto &tokens = outputs[std::stoul(output.request_id)];
+      tokens.insert(tokens.end(), output.token_ids.begin(), output.token_ids.end());
+    }
+  }
+
+  mako::utils::pipeline::source<std::vector<int64_t>> completions{
+    [&](mako::utils::pipeline::sink<std::vector<int64_t>> &yield) {
+      for (auto &tokens : outputs) {
+        yield(std::move(tokens));
+      }
+    }};
+  auto decode = [&](std::vector<int64_t> tokens) {
+    return tokenizer.has_value() ? tokenizer->decode(tokens) : absl::StrJoin(tokens, " ");
+  };
+  for (const auto &text : mako::utils::pipeline::map(std::move(completions), decode, stage_options)) {
+    std::cout << text << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,33 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "mako/utils/export.h"
+
+namespace mako {
+namespace nn {
+namespace kernels {
+/// \brief Instruction sets the CPU kernels are specialized for.
+enum class cpu_isa {
+  scalar,
+  avx2,
+  avx512,
+};
+
+/// \brief Detects the widest instruction set of the host CPU that the kernels support, once per process.
+cpu_isa MAKO_API detected_cpu_isa();
+} // namespace kernels
+} // namespace nn
+} // namespace mako
@@ -0,0 +1,339 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/nn/kernels/quantized_linear.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include <absl/strings/str_format.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define MAKO_X86_KERNELS
+#include <immintrin.h>
+
+// Each kernel is compiled for its own instruction set, whatever the flags of the build, and is only called on a CPU
+// supporting it.
+#define MAKO_TARGET_AVX2   __attribute__((target("avx2,fma")))
+#define MAKO_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+/// \brief Computes one output feature for every row of the input.
+/// \param __x The float32 input of shape ``[__num_rows, __in_features]``, laid out as ``vector_width`` tells.
+/// \param __qweight The packed integers of the output feature.
+/// \param __scales The scales of the output feature, one per group.
+/// \param __out The output feature of the first row, whose rows are ``__out_features`` elements apart.
+/// \param __num_rows The number of rows of the input.
+/// \param __in_features The number of input features.
+/// \param __out_features The number of output features.
+/// \param __group_size The number of input features sharing a scale, which is ``__in_features`` for int8.
+using column_kernel = void (*)(
+  const float *__x,
+  const uint8_t *__qweight,
+  const float *__scales,
+  float *__out,
+  int64_t __num_rows,
+  int64_t __in_features,
+  int64_t __out_features,
+  int64_t __group_size);
+
+static void int8_scalar(
+  const float *__x,
+  const uint8_t *__qweight,
+  const float *__scales,
+  float *__out,
+  int64_t __num_rows,
+  int64_t __in_features,
+  int64_t __out_features,
+  int64_t __group_size) {
+  const auto *qweight = reinterpret_cast<const int8_t *>(__qweight);
+  for (int64_t row = 0; row < __num_rows; ++row) {
+    const auto *x = __x + row * __in_features;
+    float sum     = 0;
+    for (int64_t i = 0; i < __in_features; ++i) {
+      sum += x[i] * qweight[i];
+    }
+    __out[row * __out_features] = sum * __scales[0];
+  }
+}
+
+static void int4_scalar(
+  const float *__x,
+  const uint8_t *__qweight,
+  const float *__scales,
+  float *__out,
+  int64_t __num_rows,
+  int64_t __in_features,
+  int64_t __out_features,
+  int64_t __group_size) {
+  for (int64_t row = 0; row < __num_rows; ++row) {
+    const auto *x = __x + row * __in_features;
+    float sum     = 0;
+    for (int64_t group = 0; group * __group_size < __in_features; ++group) {
+      float dot = 0;
+      for (auto i = group * __group_size; i < (group + 1) * __group_size; i += 2) {
+        auto packed = __qweight[i / 2];
+        dot += x[i] * ((packed & 0xf) - 8) + x[i + 1] * ((packed >> 4) - 8);
+      }
+      sum += dot * __scales[group];
+    }
+    __out[row * __out_features] = sum;
+  }
+}
+
+#ifdef MAKO_X86_KERNELS
+// The integers of int4 are unpacked a vector of bytes at a time, the low nibbles into one vector and the high ones
+// into another, so the vector kernels take an input whose blocks of two vectors hold the even features first and the
+// odd ones second, which saves shuffling the integers back into order.
+
+MAKO_TARGET_AVX2 static inline float reduce_add(__m256 __v) {
+  auto sum128 = _mm_add_ps(_mm256_castps256_ps128(__v), _mm256_extractf128_ps(__v, 1));
+  sum128      = _mm_add_ps(sum128, _mm_movehl_ps(sum128, sum128));
+  sum128      = _mm_add_ss(sum128, _mm_shuffle_ps(sum128, sum128, 1));
+  return _mm_cvtss_f32(sum128);
+}
+
+MAKO_TARGET_AVX2 static void int8_avx2(
+  const float *__x,
+  const uint8_t *__qweight,
+  const float *__scales,
+  float *__out,
+  int64_t __num_rows,
+  int64_t __in_features,
+  int64_t __out_features,
+  int64_t __group_size) {
+  constexpr int64_t width = 8;
+  const auto *qweight     = reinterpret_cast<const int8_t *>(__qweight);
+  auto vectorized         = __in_features - __in_features % width;
+  for (int64_t row = 0; row < __num_rows; ++row) {
+    const auto *x = __x + row * __in_features;
+    auto acc      = _mm256_setzero_ps();
+    for (int64_t i = 0; i < vectorized; i += width) {
+      auto bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(qweight + i));
+      acc        = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(bytes)), acc);
+    }
+    float tail = 0;
+    for (auto i = vectorized; i < __in_features; ++i) {
+      tail += x[i] * qweight[i];
+    }
+    __out[row * __out_features] = (reduce_add(acc) + tail) * __scales[0];
+  }
+}
+
+MAKO_TARGET_AVX2 static void int4_avx2(
+  const float *__x,
+  const uint8_t *__qweight,
+  const float *__scales,
+  float *__out,
+  int64_t __num_rows,
+  int64_t __in_features,
+  int64_t __out_features,
+  int64_t __group_size) {
+  constexpr int64_t width = 8;
+  auto mask               = _mm256_set1_epi32(0xf);
+  auto offset             = _mm256_set1_epi32(8);
+  for (int64_t row = 0; row < __num_rows; ++row) {
+    const auto *x = __x + row * __in_features;
+    auto sum      = _mm256_setzero_ps();
+    for (int64_t group = 0; group * __group_size < __in_features; ++group) {
+      auto dot = _mm256_setzero_ps();
+      for (auto i = group * __group_size; i < (group + 1) * __group_size; i += 2 * width) {
+        auto bytes = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(__qweight + i / 2)));
+        auto low   = _mm256_sub_epi32(_mm256_and_si256(bytes, mask), offset);
+        auto high  = _mm256_sub_epi32(_mm256_srli_epi32(bytes, 4), offset);
+        dot        = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_cvtepi32_ps(low), dot);
+        dot        = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + width), _mm256_cvtepi32_ps(high), dot);
+      }
+      sum = _mm256_fmadd_ps(dot, _mm256_set1_ps(__scales[group]), sum);
+    }
+    __out[row * __out_features] = reduce_add(sum);
+  }
+}
+
+MAKO_TARGET_AVX512 static void int8_avx512(
+  const float *__x,
+  const uint8_t *__qweight,
+  const float *__scales,
+  float *__out,
+  int64_t __num_rows,
+  int64_t __in_features,
+  int64_t __out_features,
+  int64_t __group_size) {
+  constexpr int64_t width = 16;
+  const auto *qweight     = reinterpret_cast<const int8_t *>(__qweight);
+  auto vectorized         = __in_features - __in_features % width;
+  for (int64_t row = 0; row < __num_rows; ++row) {
+    const auto *x = __x + row * __in_features;
+    auto acc      = _mm512_setzero_ps();
+    for (int64_t i = 0; i < vectorized; i += width) {
+      auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(qweight + i));
+      acc        = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(bytes)), acc);
+    }
+    float tail = 0;
+    for (auto i = vectorized; i < __in_features; ++i) {
+      tail += x[i] * qweight[i];
+    }
+    __out[row * __out_features] = (_mm512_reduce_add_ps(acc) + tail) * __scales[0];
+  }
+}
+
+MAKO_TARGET_AVX512 static void int4_avx512(
+  const float *__x,
+  const uint8_t *__qweight,
+  const float *__scales,
+  float *__out,
+  int64_t __num_rows,
+  int64_t __in_features,
+  int64_t __out_features,
+  int64_t __group_size) {
+  constexpr int64_t width = 16;
+  auto mask               = _mm512_set1_epi32(0xf);
+  auto offset             = _mm512_set1_epi32(8);
+  for (int64_t row = 0; row < __num_rows; ++row) {
+    const auto *x = __x + row * __in_features;
+    auto sum      = _mm512_setzero_ps();
+    for (int64_t group = 0; group * __group_size < __in_features; ++group) {
+      auto dot = _mm512_setzero_ps();
+      for (auto i = group * __group_size; i < (group + 1) * __group_size; i += 2 * width) {
+        auto bytes = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(__qweight + i / 2)));
+        auto low   = _mm512_sub_epi32(_mm512_and_si512(bytes, mask), offset);
+        auto high  = _mm512_sub_epi32(_mm512_srli_epi32(bytes, 4), offset);
+        dot        = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_cvtepi32_ps(low), dot);
+        dot        = _mm512_fmadd_ps(_mm512_loadu_ps(x + i + width), _mm512_cvtepi32_ps(high), dot);
+      }
+      sum = _mm512_fmadd_ps(dot, _mm512_set1_ps(__scales[group]), sum);
+    }
+    __out[row * __out_features] = _mm512_reduce_add_ps(sum);
+  }
+}
+#endif
+
+/// \return The number of floats in a vector of ``__isa``, ``1`` for the scalar kernels.
+static inline int64_t vector_width(mako::nn::kernels::cpu_isa __isa) {
+  switch (__isa) {
+  case mako::nn::kernels::cpu_isa::avx512:
+    return 16;
+  case mako::nn::kernels::cpu_isa::avx2:
+    return 8;
+  default:
+    return 1;
+  }
+}
+
+/// \brief Selects the kernel for ``__scheme`` and ``__isa``, which the host must support.
+static inline column_kernel select_kernel(
+  mako::utils::quantization::scheme __scheme,
+  mako::nn::kernels::cpu_isa __isa) {
+  auto int8 = __scheme == mako::utils::quantization::scheme::int8;
+  switch (__isa) {
+#ifdef MAKO_X86_KERNELS
+  case mako::nn::kernels::cpu_isa::avx512:
+    return int8 ? &int8_avx512 : &int4_avx512;
+  case mako::nn::kernels::cpu_isa::avx2:
+    return int8 ? &int8_avx2 : &int4_avx2;
+#endif
+  default:
+    return int8 ? &int8_scalar : &int4_scalar;
+  }
+}
+
+/// \brief Checks whether the kernels support the tensors.
+static inline bool is_supported(
+  const torch::Tensor &__x,
+  const torch::Tensor &__qweight,
+  const torch::Tensor &__scales,
+  mako::utils::quantization::scheme __scheme) {
+  auto dtype = __scheme == mako::utils::quantization::scheme::int8 ? torch::kInt8 : torch::kUInt8;
+  if (!__x.device().is_cpu() || !__qweight.device().is_cpu() || !__scales.device().is_cpu()) {
+    return false;
+  }
+  if (__qweight.scalar_type() != dtype || !__qweight.is_contiguous() || __scales.scalar_type() != torch::kFloat32 ||
+      !__scales.is_contiguous()) {
+    return false;
+  }
+  return __x.dim() > 0 && __x.numel() > 0 &&
+         __x.numel() / __x.size(-1) <= mako::nn::kernels::max_quantized_linear_rows;
+}
+
+torch::Tensor mako::nn::kernels::quantized_linear(
+  const torch::Tensor &x,
+  const torch::Tensor &qweight,
+  const torch::Tensor &scales,
+  mako::utils::quantization::scheme scheme) {
+  return quantized_linear(x, qweight, scales, scheme, detected_cpu_isa());
+}
+
+torch::Tensor mako::nn::kernels::quantized_linear(
+  const torch::Tensor &x,
+  const torch::Tensor &qweight,
+  const torch::Tensor &scales,
+  mako::utils::quantization::scheme scheme,
+  mako::nn::kernels::cpu_isa isa) {
+  if (scheme == utils::quantization::scheme::none || !is_supported(x, qweight, scales, scheme)) {
+    return torch::linear(x, utils::quantization::dequantize(qweight, scales, scheme, x.scalar_type()));
+  }
+  if (detected_cpu_isa() < isa) {
+    throw std::invalid_argument("The host CPU does not support the instruction set");
+  }
+
+  auto int4         = scheme == utils::quantization::scheme::int4;
+  auto in_features  = int4 ? qweight.size(1) * 2 : qweight.size(1);
+  auto out_features = qweight.size(0);
+  auto group_size   = int4 ? in_features / scales.size(1) : in_features;
+  if (x.size(-1) != in_features) {
+    throw std::invalid_argument(
+      absl::StrFormat("The input must have %d features, but got %d", in_features, x.size(-1)));
+  }
+
+  auto num_rows = x.numel() / in_features;
+  auto x32      = x.reshape({num_rows, in_features}).to(torch::kFloat32).contiguous();
+  auto width    = vector_width(isa);
+  if (int4 && width > 1) {
+    if (group_size % (2 * width) == 0) {
+      x32 = x32.view({num_rows, in_features / (2 * width), width, 2}).transpose(-1, -2).contiguous();
+    } else {
+      isa = cpu_isa::scalar;
+    }
+  }
+  auto kernel = select_kernel(scheme, isa);
+
+  auto out            = torch::empty({num_rows, out_features}, torch::kFloat32);
+  const auto *input   = x32.data_ptr<float>();
+  const auto *packed  = reinterpret_cast<const uint8_t *>(qweight.data_ptr());
+  const auto *scale   = scales.data_ptr<float>();
+  auto *output        = out.data_ptr<float>();
+  auto row_bytes      = qweight.size(1);
+  auto scales_per_row = scales.numel() / out_features;
+  // A thread takes output features whose integers add up to enough bytes to be worth waking it up for.
+  auto grain_size = std::max<int64_t>(1, 65536 / row_bytes);
+  at::parallel_for(0, out_features, grain_size, [&](int64_t begin, int64_t end) {
+    for (auto feature = begin; feature < end; ++feature) {
+      kernel(
+        input,
+        packed + feature * row_bytes,
+        scale + feature * scales_per_row,
+        output + feature,
+        num_rows,
+        in_features,
+        out_features,
+        group_size);
+    }
+  });
+
+  auto sizes   = x.sizes().vec();
+  sizes.back() = out_features;
+  return out.view(sizes).to(x.scalar_type());
+}
@@ -0,0 +1,62 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+
+#include <torch/torch.h>
+
+#include "mako/nn/kernels/cpu_isa.h"
+#include "mako/utils/export.h"
+#include "mako/utils/quantization.h"
+
+namespace mako {
+namespace nn {
+namespace kernels {
+/// \brief The number of rows up to which an input goes through the kernel of ``quantized_linear``.
+static constexpr int64_t max_quantized_linear_rows = 16;
+
+/// \brief Multiplies ``x`` by the transpose of a quantized weight, as ``torch::linear`` would with the weight
+/// ``utils::quantization::dequantize`` reconstructs.
+///
+/// An input of up to ``max_quantized_linear_rows`` rows on CPU, e.g., of decoding, goes through a kernel for the
+/// instruction set of the host, which reads each integer once and scales the dot products by group; the weight is
+/// never reconstructed, so only the quantized bytes cross the memory bus. A larger input, e.g., of prefill, or one on
+/// another device is bound by compute rather than by memory, and goes through reconstructing the weight in the dtype
+/// of ``x`` and the GEMM of LibTorch, whose cost the rows amortize.
+/// \param x The input of shape ``[..., in_features]``.
+/// \param qweight The packed integers, as laid out by ``utils::quantization::quantize``.
+/// \param scales The float32 scales.
+/// \param scheme The scheme ``qweight`` has been quantized with, which must not be
+///  ``utils::quantization::scheme::none``.
+/// \return The output of shape ``[..., out_features]``, with the same dtype as ``x``.
+torch::Tensor MAKO_API quantized_linear(
+  const torch::Tensor &x,
+  const torch::Tensor &qweight,
+  const torch::Tensor &scales,
+  utils::quantization::scheme scheme);
+
+/// \brief Multiplies as ``quantized_linear`` does, but with the kernel for ``isa`` instead of the widest one of the
+/// host.
+/// \throw std::invalid_argument If the kernel is taken and the host CPU does not support ``isa``.
+torch::Tensor MAKO_API quantized_linear(
+  const torch::Tensor &x,
+  const torch::Tensor &qweight,
+  const torch::Tensor &scales,
+  utils::quantization::scheme scheme,
+  cpu_isa isa);
+} // namespace kernels
+} // namespace nn
+} // namespace mako
@@ -0,0 +1,78 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/nn/kernels/quantized_linear.h"
+
+#include <cstdint>
+#include <stdexcept>
+#include <tuple>
+
+#include <gtest/gtest.h>
+
+namespace quantization = mako::utils::quantization;
+
+TEST(QuantizedLinearTest, Kernels) {
+  namespace kernels = mako::nn::kernels;
+  // Every kernel the host supports is checked against the weight reconstructed by ``dequantize``; the input features
+  // cover a remainder of the vector widths for int8, and the group sizes both a multiple of two vectors and one that
+  // falls back to the scalar kernel for int4.
+  for (auto isa : {kernels::cpu_isa::scalar, kernels::cpu_isa::avx2, kernels::cpu_isa::avx512}) {
+    if (kernels::detected_cpu_isa() < isa) {
+      auto [qweight, scales] = quantization::quantize(torch::randn({8, 64}), quantization::scheme::int8);
+      EXPECT_THROW(
+        kernels::quantized_linear(torch::randn({1, 64}), qweight, scales, quantization::scheme::int8, isa),
+        std::invalid_argument);
+      continue;
+    }
+    for (auto dtype : {torch::kFloat32, torch::kBFloat16}) {
+      for (auto [scheme, in_features, group_size] : {
+             std::make_tuple(quantization::scheme::int8, int64_t{100}, int64_t{128}),
+             std::make_tuple(quantization::scheme::int4, int64_t{128}, int64_t{32}),
+             std::make_tuple(quantization::scheme::int4, int64_t{96}, int64_t{6})}) {
+        auto [qweight, scales] = quantization::quantize(torch::randn({24, in_features}), scheme, group_size);
+        auto weight            = quantization::dequantize(qweight, scales, scheme);
+        // The rows cover decoding a single sequence, a batch of them, and the most the kernel takes.
+        for (auto num_rows : {int64_t{1}, int64_t{5}, kernels::max_quantized_linear_rows}) {
+          auto x         = torch::randn({num_rows, in_features}).to(dtype);
+          auto expected  = torch::linear(x.to(torch::kFloat32), weight);
+          auto output    = kernels::quantized_linear(x, qweight, scales, scheme, isa);
+          auto tolerance = dtype == torch::kFloat32 ? 1e-4 : 5e-2;
+          EXPECT_EQ(output.scalar_type(), dtype);
+          EXPECT_TRUE(torch::allclose(output.to(torch::kFloat32), expected, tolerance, tolerance));
+        }
+      }
+    }
+  }
+}
+
+TEST(QuantizedLinearTest, Fallback) {
+  // An input of more rows than the kernel takes goes through the weight reconstructed in its dtype, as does a weight
+  // whose integers are not contiguous; both keep the leading dimensions of the input.
+  auto [qweight, scales] = quantization::quantize(torch::randn({24, 64}), quantization::scheme::int4, 32);
+  auto weight            = quantization::dequantize(qweight, scales, quantization::scheme::int4);
+  auto x                 = torch::randn({3, mako::nn::kernels::max_quantized_linear_rows, 64});
+  auto output            = mako::nn::kernels::quantized_linear(x, qweight, scales, quantization::scheme::int4);
+  EXPECT_EQ(output.sizes(), torch::IntArrayRef({3, mako::nn::kernels::max_quantized_linear_rows, 24}));
+  EXPECT_TRUE(torch::allclose(output, torch::linear(x, weight), 1e-4, 1e-4));
+
+  auto strided = torch::cat({qweight, qweight}, 1).narrow(1, 0, 32);
+  output       = mako::nn::kernels::quantized_linear(x[0][0], strided, scales, quantization::scheme::int4);
+  EXPECT_EQ(output.sizes(), torch::IntArrayRef({24}));
+  EXPECT_TRUE(torch::allclose(output, torch::linear(x[0][0], weight), 1e-4, 1e-4));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,360 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/nn/kernels/rms_norm.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define MAKO_X86_KERNELS
+#include <immintrin.h>
+
+// The kernels are compiled for their instruction sets regardless of the flags of the build, and only called on a CPU
+// supporting them.
+#define MAKO_TARGET_AVX2   __attribute__((target("avx2,fma,f16c")))
+#define MAKO_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+/// \brief Computes one row, with the residual connection if ``__residual`` is not null.
+/// \tparam T The type of elements.
+/// \param __x The input row.
+/// \param __residual The residual row to add the input to in place, or ``nullptr``.
+/// \param __weight The weight.
+/// \param __out The output row.
+/// \param __hidden_size The number of elements per row.
+/// \param __eps The epsilon added to the mean square.
+template <typename T>
+using row_kernel =
+  void (*)(const T *__x, T *__residual, const T *__weight, T *__out, int64_t __hidden_size, float __eps);
+
+template <typename T>
+static void rms_norm_scalar(
+  const T *__x,
+  T *__residual,
+  const T *__weight,
+  T *__out,
+  int64_t __hidden_size,
+  float __eps) {
+  const T *input = __x;
+  float sum      = 0;
+  if (__residual != nullptr) {
+    // The sum of squares is taken before the residual is rounded to ``T``, as in the vectorized kernels.
+    for (int64_t i = 0; i < __hidden_size; ++i) {
+      auto value    = static_cast<float>(__x[i]) + static_cast<float>(__residual[i]);
+      __residual[i] = static_cast<T>(value);
+      sum += value * value;
+    }
+    input = __residual;
+  } else {
+    for (int64_t i = 0; i < __hidden_size; ++i) {
+      auto value = static_cast<float>(__x[i]);
+      sum += value * value;
+    }
+  }
+
+  auto scale = 1.0f / std::sqrt(sum / __hidden_size + __eps);
+  for (int64_t i = 0; i < __hidden_size; ++i) {
+    __out[i] = static_cast<T>(static_cast<float>(input[i]) * scale * static_cast<float>(__weight[i]));
+  }
+}
+
+#ifdef MAKO_X86_KERNELS
+// bfloat16 is the upper half of float32, so it is widened by a shift and narrowed by rounding to the nearest even
+// upper half; float16 is converted by F16C.
+
+MAKO_TARGET_AVX2 static inline __m256 load8(const float *__p) {
+  return _mm256_loadu_ps(__p);
+}
+
+MAKO_TARGET_AVX2 static inline __m256 load8(const c10::BFloat16 *__p) {
+  auto bits = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(__p)));
+  return _mm256_castsi256_ps(_mm256_slli_epi32(bits, 16));
+}
+
+MAKO_TARGET_AVX2 static inline __m256 load8(const c10::Half *__p) {
+  return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(__p)));
+}
+
+MAKO_TARGET_AVX2 static inline void store8(float *__p, __m256 __v) {
+  _mm256_storeu_ps(__p, __v);
+}
+
+MAKO_TARGET_AVX2 static inline void store8(c10::BFloat16 *__p, __m256 __v) {
+  auto bits    = _mm256_castps_si256(__v);
+  auto odd     = _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1));
+  auto rounded = _mm256_srli_epi32(_mm256_add_epi32(bits, _mm256_add_epi32(odd, _mm256_set1_epi32(0x7fff))), 16);
+  // Packing works within each 128-bit lane, so the lower halves of the lanes are gathered afterwards.
+  auto packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(rounded, rounded), 0b1000);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(__p), _mm256_castsi256_si128(packed));
+}
+
+MAKO_TARGET_AVX2 static inline void store8(c10::Half *__p, __m256 __v) {
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(__p), _mm256_cvtps_ph(__v, _MM_FROUND_TO_NEAREST_INT));
+}
+
+template <typename T>
+MAKO_TARGET_AVX2 static void rms_norm_avx2(
+  const T *__x,
+  T *__residual,
+  const T *__weight,
+  T *__out,
+  int64_t __hidden_size,
+  float __eps) {
+  constexpr int64_t width = 8;
+  auto vectorized         = __hidden_size - __hidden_size % width;
+  auto acc                = _mm256_setzero_ps();
+  float tail              = 0;
+  const T *input          = __x;
+  if (__residual != nullptr) {
+    for (int64_t i = 0; i < vectorized; i += width) {
+      auto value = _mm256_add_ps(load8(__x + i), load8(__residual + i));
+      store8(__residual + i, value);
+      acc = _mm256_fmadd_ps(value, value, acc);
+    }
+    for (int64_t i = vectorized; i < __hidden_size; ++i) {
+      auto value    = static_cast<float>(__x[i]) + static_cast<float>(__residual[i]);
+      __residual[i] = static_cast<T>(value);
+      tail += value * value;
+    }
+    input = __residual;
+  } else {
+    for (int64_t i = 0; i < vectorized; i += width) {
+      auto value = load8(__x + i);
+      acc        = _mm256_fmadd_ps(value, value, acc);
+    }
+    for (int64_t i = vectorized; i < __hidden_size; ++i) {
+      auto value = static_cast<float>(__x[i]);
+      tail += value * value;
+    }
+  }
+
+  auto sum128 = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+  sum128      = _mm_add_ps(sum128, _mm_movehl_ps(sum128, sum128));
+  sum128      = _mm_add_ss(sum128, _mm_shuffle_ps(sum128, sum128, 1));
+  auto sum    = _mm_cvtss_f32(sum128) + tail;
+
+  auto scale  = 1.0f / std::sqrt(sum / __hidden_size + __eps);
+  auto scales = _mm256_set1_ps(scale);
+  for (int64_t i = 0; i < vectorized; i += width) {
+    store8(__out + i, _mm256_mul_ps(_mm256_mul_ps(load8(input + i), scales), load8(__weight + i)));
+  }
+  for (int64_t i = vectorized; i < __hidden_size; ++i) {
+    __out[i] = static_cast<T>(static_cast<float>(input[i]) * scale * static_cast<float>(__weight[i]));
+  }
+}
+
+MAKO_TARGET_AVX512 static inline __m512 load16(const float *__p) {
+  return _mm512_loadu_ps(__p);
+}
+
+MAKO_TARGET_AVX512 static inline __m512 load16(const c10::BFloat16 *__p) {
+  auto bits = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(__p)));
+  return _mm512_castsi512_ps(_mm512_slli_epi32(bits, 16));
+}
+
+MAKO_TARGET_AVX512 static inline __m512 load16(const c10::Half *__p) {
+  return _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(__p)));
+}
+
+MAKO_TARGET_AVX512 static inline void store16(float *__p, __m512 __v) {
+  _mm512_storeu_ps(__p, __v);
+}
+
+MAKO_TARGET_AVX512 static inline void store16(c10::BFloat16 *__p, __m512 __v) {
+  auto bits    = _mm512_castps_si512(__v);
+  auto odd     = _mm512_and_si512(_mm512_srli_epi32(bits, 16), _mm512_set1_epi32(1));
+  auto rounded = _mm512_srli_epi32(_mm512_add_epi32(bits, _mm512_add_epi32(odd, _mm512_set1_epi32(0x7fff))), 16);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(__p), _mm512_cvtepi32_epi16(rounded));
+}
+
+MAKO_TARGET_AVX512 static inline void store16(c10::Half *__p, __m512 __v) {
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(__p), _mm512_cvtps_ph(__v, _MM_FROUND_TO_NEAREST_INT));
+}
+
+template <typename T>
+MAKO_TARGET_AVX512 static void rms_norm_avx512(
+  const T *__x,
+  T *__residual,
+  const T *__weight,
+  T *__out,
+  int64_t __hidden_size,
+  float __eps) {
+  constexpr int64_t width = 16;
+  auto vectorized         = __hidden_size - __hidden_size % width;
+  auto acc                = _mm512_setzero_ps();
+  float tail              = 0;
+  const T *input          = __x;
+  if (__residual != nullptr) {
+    for (int64_t i = 0; i < vectorized; i += width) {
+      auto value = _mm512_add_ps(load16(__x + i), load16(__residual + i));
+      store16(__residual + i, value);
+      acc = _mm512_fmadd_ps(value, value, acc);
+    }
+    for (int64_t i = vectorized; i < __hidden_size; ++i) {
+      auto value    = static_cast<float>(__x[i]) + static_cast<float>(__residual[i]);
+      __residual[i] = static_cast<T>(value);
+      tail += value * value;
+    }
+    input = __residual;
+  } else {
+    for (int64_t i = 0; i < vectorized; i += width) {
+      auto value = load16(__x + i);
+      acc        = _mm512_fmadd_ps(value, value, acc);
+    }
+    for (int64_t i = vectorized; i < __hidden_size; ++i) {
+      auto value = static_cast<float>(__x[i]);
+      tail += value * value;
+    }
+  }
+
+  auto sum = _mm512_reduce_add_ps(acc) + tail;
+
+  auto scale  = 1.0f / std::sqrt(sum / __hidden_size + __eps);
+  auto scales = _mm512_set1_ps(scale);
+  for (int64_t i = 0; i < vectorized; i += width) {
+    store16(__out + i, _mm512_mul_ps(_mm512_mul_ps(load16(input + i), scales), load16(__weight + i)));
+  }
+  for (int64_t i = vectorized; i < __hidden_size; ++i) {
+    __out[i] = static_cast<T>(static_cast<float>(input[i]) * scale * static_cast<float>(__weight[i]));
+  }
+}
+#endif
+
+/// \brief Selects the kernel for ``__isa``, which the host must support.
+template <typename T>
+static inline row_kernel<T> select_kernel(mako::nn::kernels::cpu_isa __isa) {
+  switch (__isa) {
+#ifdef MAKO_X86_KERNELS
+  case mako::nn::kernels::cpu_isa::avx512:
+    return &rms_norm_avx512<T>;
+  case mako::nn::kernels::cpu_isa::avx2:
+    return &rms_norm_avx2<T>;
+#endif
+  default:
+    return &rms_norm_scalar<T>;
+  }
+}
+
+/// \brief Checks whether the kernels support the tensors.
+static inline bool is_supported(
+  const torch::Tensor &__x,
+  const torch::Tensor *__residual,
+  const torch::Tensor &__weight) {
+  auto dtype = __x.scalar_type();
+  if (dtype != torch::kFloat32 && dtype != torch::kBFloat16 && dtype != torch::kFloat16) {
+    return false;
+  }
+  if (!__x.device().is_cpu() || !__weight.device().is_cpu() || __weight.scalar_type() != dtype ||
+      !__weight.is_contiguous() || __weight.numel() != __x.size(-1)) {
+    return false;
+  }
+  // The residual is updated in place, so it must be contiguous as is.
+  return __residual == nullptr || (__residual->device().is_cpu() && __residual->scalar_type() == dtype &&
+                                   __residual->is_contiguous() && __residual->sizes() == __x.sizes());
+}
+
+/// \brief Runs the kernel for ``__isa`` over the rows, in parallel.
+template <typename T>
+static inline void run(
+  const torch::Tensor &__x,
+  torch::Tensor *__residual,
+  const torch::Tensor &__weight,
+  torch::Tensor &__out,
+  float __eps,
+  mako::nn::kernels::cpu_isa __isa) {
+  auto kernel = select_kernel<T>(__isa);
+
+  auto hidden_size = __x.size(-1);
+  auto num_rows    = __x.numel() / hidden_size;
+  const auto *x    = __x.data_ptr<T>();
+  auto *residual   = __residual != nullptr ? __residual->data_ptr<T>() : nullptr;
+  const auto *w    = __weight.data_ptr<T>();
+  auto *out        = __out.data_ptr<T>();
+  // A row is too little work for a thread of its own unless it is long, e.g., when decoding a single sequence.
+  auto grain_size = std::max<int64_t>(1, 16384 / hidden_size);
+  at::parallel_for(0, num_rows, grain_size, [&](int64_t begin, int64_t end) {
+    for (auto row = begin; row < end; ++row) {
+      auto offset = row * hidden_size;
+      kernel(x + offset, residual != nullptr ? residual + offset : nullptr, w, out + offset, hidden_size, __eps);
+    }
+  });
+}
+
+/// \brief Computes the output with the kernel matching the dtype and ``__isa``.
+static inline torch::Tensor dispatch(
+  const torch::Tensor &__x,
+  torch::Tensor *__residual,
+  const torch::Tensor &__weight,
+  double __eps,
+  mako::nn::kernels::cpu_isa __isa) {
+  if (mako::nn::kernels::detected_cpu_isa() < __isa) {
+    throw std::invalid_argument("The host CPU does not support the instruction set");
+  }
+
+  auto x   = __x.contiguous();
+  auto out = torch::empty_like(x);
+  switch (x.scalar_type()) {
+  case torch::kBFloat16:
+    run<c10::BFloat16>(x, __residual, __weight, out, static_cast<float>(__eps), __isa);
+    break;
+  case torch::kFloat16:
+    run<c10::Half>(x, __residual, __weight, out, static_cast<float>(__eps), __isa);
+    break;
+  default:
+    run<float>(x, __residual, __weight, out, static_cast<float>(__eps), __isa);
+    break;
+  }
+  return out;
+}
+
+torch::Tensor mako::nn::kernels::rms_norm(const torch::Tensor &x, const torch::Tensor &weight, double eps) {
+  return rms_norm(x, weight, eps, detected_cpu_isa());
+}
+
+torch::Tensor mako::nn::kernels::rms_norm(
+  const torch::Tensor &x,
+  const torch::Tensor &weight,
+  double eps,
+  mako::nn::kernels::cpu_isa isa) {
+  if (is_supported(x, nullptr, weight)) {
+    return dispatch(x, nullptr, weight, eps, isa);
+  }
+  // The statistics are accumulated in float32, as the sum of squares easily overflows half precision.
+  auto x32 = x.to(torch::kFloat32);
+  return x32.mul(x32.pow(2).mean(-1, /*keepdim=*/true).add_(eps).rsqrt_()).to(x.scalar_type()).mul_(weight);
+}
+
+torch::Tensor mako::nn::kernels::fused_add_rms_norm(
+  const torch::Tensor &x,
+  torch::Tensor &residual,
+  const torch::Tensor &weight,
+  double eps) {
+  return fused_add_rms_norm(x, residual, weight, eps, detected_cpu_isa());
+}
+
+torch::Tensor mako::nn::kernels::fused_add_rms_norm(
+  const torch::Tensor &x,
+  torch::Tensor &residual,
+  const torch::Tensor &weight,
+  double eps,
+  mako::nn::kernels::cpu_isa isa) {
+  if (is_supported(x, &residual, weight)) {
+    return dispatch(x, &residual, weight, eps, isa);
+  }
+  residual.add_(x);
+  return rms_norm(residual, weight, eps, isa);
+}
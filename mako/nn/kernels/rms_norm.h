@@ -0,0 +1,68 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <torch/torch.h>
+
+#include "mako/nn/kernels/cpu_isa.h"
+#include "mako/utils/export.h"
+
+namespace mako {
+namespace nn {
+namespace kernels {
+/// \brief Normalizes the root mean square of each row of ``x`` and scales it by ``weight``.
+///
+/// Contiguous float32, bfloat16, and float16 tensors on CPU go through a kernel for the instruction set of the host,
+/// selected at runtime, which accumulates in float32; others go through LibTorch.
+/// \param x The input of shape ``[..., hidden_size]``.
+/// \param weight The weight of shape ``[hidden_size]``.
+/// \param eps The epsilon added to the mean square.
+/// \return The output, with the same shape and dtype as ``x``.
+torch::Tensor MAKO_API rms_norm(const torch::Tensor &x, const torch::Tensor &weight, double eps);
+
+/// \brief Normalizes as ``rms_norm`` does, but with the kernel for ``isa`` instead of the widest one of the host.
+///
+/// Every kernel the host supports can thus be checked against the others.
+/// \throw std::invalid_argument If the kernel is taken and the host CPU does not support ``isa``.
+torch::Tensor MAKO_API rms_norm(const torch::Tensor &x, const torch::Tensor &weight, double eps, cpu_isa isa);
+
+/// \brief Adds ``x`` to ``residual`` in place and normalizes the sum, as ``rms_norm`` does.
+///
+/// The kernel reads each row of ``x`` and ``residual`` once to update the residual and accumulate its mean square,
+/// and reads the updated row once more, while still in cache, to write the output; i.e., two passes instead of the
+/// four or more of separate LibTorch operators.
+/// \param x The output of the previous sublayer, of shape ``[..., hidden_size]``.
+/// \param residual The residual stream, with the same shape and dtype as ``x``, which is updated to
+///  ``x + residual``.
+/// \param weight The weight of shape ``[hidden_size]``.
+/// \param eps The epsilon added to the mean square.
+/// \return The normalized sum.
+torch::Tensor MAKO_API fused_add_rms_norm(
+  const torch::Tensor &x,
+  torch::Tensor &residual,
+  const torch::Tensor &weight,
+  double eps);
+
+/// \brief Adds and normalizes as ``fused_add_rms_norm`` does, but with the kernel for ``isa``.
+/// \throw std::invalid_argument If the kernel is taken and the host CPU does not support ``isa``.
+torch::Tensor MAKO_API fused_add_rms_norm(
+  const torch::Tensor &x,
+  torch::Tensor &residual,
+  const torch::Tensor &weight,
+  double eps,
+  cpu_isa isa);
+} // namespace kernels
+} // namespace nn
+} // namespace mako
@@ -0,0 +1,76 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/nn/kernels/rms_norm.h"
+
+#include <stdexcept>
+
+#include <gtest/gtest.h>
+
+/// \brief Adds ``__x`` to ``__residual`` and normalizes the sum with separate LibTorch operators.
+static inline torch::Tensor reference(
+  const torch::Tensor &__x,
+  const torch::Tensor &__residual,
+  const torch::Tensor &__weight) {
+  auto sum = __x.to(torch::kFloat32).add(__residual.to(torch::kFloat32));
+  return sum.mul(sum.pow(2).mean(-1, /*keepdim=*/true).add_(1e-6).rsqrt_()).mul_(__weight.to(torch::kFloat32));
+}
+
+TEST(RMSNormTest, FusedAddRMSNorm) {
+  namespace kernels = mako::nn::kernels;
+  // Every kernel the host supports is checked, and the hidden sizes cover both a multiple of the vector widths and a
+  // remainder.
+  for (auto isa : {kernels::cpu_isa::scalar, kernels::cpu_isa::avx2, kernels::cpu_isa::avx512}) {
+    if (kernels::detected_cpu_isa() < isa) {
+      EXPECT_THROW(kernels::rms_norm(torch::randn({1, 16}), torch::randn({16}), 1e-6, isa), std::invalid_argument);
+      continue;
+    }
+    for (auto dtype : {torch::kFloat32, torch::kBFloat16, torch::kFloat16}) {
+      for (int64_t hidden_size : {64, 37}) {
+        auto tolerance = dtype == torch::kFloat32 ? 1e-5 : 2e-2;
+        auto x         = torch::randn({5, hidden_size}).to(dtype);
+        auto residual  = torch::randn({5, hidden_size}).to(dtype);
+        auto weight    = torch::randn({hidden_size}).to(dtype);
+        auto expected  = reference(x, residual, weight);
+        // The residual is rounded from the exact sum by every kernel alike.
+        auto sum       = x.to(torch::kFloat32).add(residual.to(torch::kFloat32)).to(dtype);
+
+        auto output = kernels::fused_add_rms_norm(x, residual, weight, 1e-6, isa);
+        EXPECT_EQ(output.scalar_type(), dtype);
+        EXPECT_TRUE(torch::equal(residual, sum));
+        EXPECT_TRUE(torch::allclose(output.to(torch::kFloat32), expected, tolerance, tolerance));
+
+        output = kernels::rms_norm(residual, weight, 1e-6, isa);
+        EXPECT_TRUE(torch::allclose(output.to(torch::kFloat32), expected, tolerance, tolerance));
+      }
+    }
+  }
+}
+
+TEST(RMSNormTest, Fallback) {
+  // A residual that is not contiguous cannot be updated in place by the kernel, so LibTorch takes over.
+  auto x        = torch::randn({4, 16});
+  auto residual = torch::randn({16, 4}).t();
+  auto weight   = torch::randn({16});
+  auto expected = reference(x, residual, weight);
+  auto sum      = x.add(residual);
+  auto output   = mako::nn::kernels::fused_add_rms_norm(x, residual, weight, 1e-6);
+  EXPECT_TRUE(torch::allclose(output, expected, 1e-5, 1e-5));
+  EXPECT_TRUE(torch::allclose(residual, sum));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
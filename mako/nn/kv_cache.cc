@@ -0,0 +1,274 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/nn/kv_cache.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+#include <absl/hash/hash.h>
+#include <absl/strings/str_format.h>
+#include <absl/types/span.h>
+
+mako::nn::block_allocator::block_allocator(int64_t num_blocks)
+    : free_blocks_(num_blocks),
+      ref_counts_(num_blocks, 0),
+      hashes_(num_blocks),
+      evictable_positions_(num_blocks) {
+  // The free blocks are taken from the back, so the lowest indices come first.
+  std::iota(free_blocks_.rbegin(), free_blocks_.rend(), 0);
+}
+
+int64_t mako::nn::block_allocator::allocate() {
+  int64_t block;
+  if (!free_blocks_.empty()) {
+    block = free_blocks_.back();
+    free_blocks_.pop_back();
+  } else if (!evictable_blocks_.empty()) {
+    block = evictable_blocks_.front();
+    evictable_blocks_.pop_front();
+    cached_blocks_.erase(*hashes_[block]);
+    hashes_[block].reset();
+  } else {
+    throw std::runtime_error("Out of blocks in the cache");
+  }
+  ref_counts_[block] = 1;
+  return block;
+}
+
+void mako::nn::block_allocator::free(int64_t block) {
+  if (block < 0 || num_blocks() <= block || ref_counts_[block] == 0) {
+    throw std::invalid_argument(absl::StrFormat("Block %d is not in use", block));
+  }
+  if (--ref_counts_[block] != 0) {
+    return;
+  }
+  if (hashes_[block]) {
+    evictable_positions_[block] = evictable_blocks_.insert(evictable_blocks_.end(), block);
+  } else {
+    free_blocks_.push_back(block);
+  }
+}
+
+std::optional<int64_t> mako::nn::block_allocator::lookup(size_t hash) {
+  auto it = cached_blocks_.find(hash);
+  if (it == cached_blocks_.end()) {
+    return std::nullopt;
+  }
+  auto block = it->second;
+  if (ref_counts_[block]++ == 0) {
+    evictable_blocks_.erase(evictable_positions_[block]);
+  }
+  return block;
+}
+
+void mako::nn::block_allocator::commit(int64_t block, size_t hash) {
+  if (block < 0 || num_blocks() <= block || ref_counts_[block] == 0) {
+    throw std::invalid_argument(absl::StrFormat("Block %d is not in use", block));
+  }
+  if (hashes_[block] || !cached_blocks_.emplace(hash, block).second) {
+    return;
+  }
+  hashes_[block] = hash;
+}
+
+size_t mako::nn::block_allocator::hash_block(size_t parent_hash, const int64_t *token_ids, int64_t num_tokens) {
+  return absl::HashOf(parent_hash, absl::MakeConstSpan(token_ids, static_cast<size_t>(num_tokens)));
+}
+
+mako::nn::paged_kv_cache::paged_kv_cache(
+  int64_t num_layers,
+  int64_t num_blocks,
+  int64_t block_size,
+  int64_t num_kv_heads,
+  int64_t head_dim,
+  torch::TensorOptions options)
+    : pool_(torch::zeros({num_layers, 2, num_blocks, block_size, num_kv_heads, head_dim}, options)),
+      allocator_(num_blocks),
+      block_size_(block_size) {}
+
+int64_t mako::nn::paged_kv_cache::block_bytes(
+  int64_t num_layers,
+  int64_t block_size,
+  int64_t num_kv_heads,
+  int64_t head_dim,
+  torch::Dtype dtype) {
+  return num_layers * 2 * block_size * num_kv_heads * head_dim * static_cast<int64_t>(c10::elementSize(dtype));
+}
+
+void mako::nn::paged_kv_cache::write(
+  int64_t layer,
+  const torch::Tensor &key,
+  const torch::Tensor &value,
+  const torch::Tensor &slot_mapping) {
+  auto num_kv_heads = key.size(-2);
+  auto head_dim     = key.size(-1);
+  key_cache(layer).view({-1, num_kv_heads, head_dim}).index_copy_(0, slot_mapping, key);
+  value_cache(layer).view({-1, num_kv_heads, head_dim}).index_copy_(0, slot_mapping, value);
+}
+
+void mako::nn::paged_kv_cache::copy_blocks(
+  paged_kv_cache &dst,
+  const std::vector<std::pair<int64_t, int64_t>> &mapping) const {
+  if (mapping.empty()) {
+    return;
+  }
+  std::vector<int64_t> src_blocks;
+  std::vector<int64_t> dst_blocks;
+  for (const auto &[src_block, dst_block] : mapping) {
+    src_blocks.push_back(src_block);
+    dst_blocks.push_back(dst_block);
+  }
+  auto options = torch::TensorOptions().dtype(torch::kInt64);
+  auto src     = torch::tensor(src_blocks, options.device(pool_.device()));
+  auto dst_idx = torch::tensor(dst_blocks, options.device(dst.pool_.device()));
+  dst.pool_.index_copy_(2, dst_idx, pool_.index_select(2, src).to(dst.pool_.device()));
+}
+
+/// \brief Computes attention of the tokens of one sequence over its context.
+/// \param __query The queries of the sequence, of shape ``[query_len, num_heads, head_dim]``.
+/// \param __key_cache The keys of the layer.
+/// \param __value_cache The values of the layer.
+/// \param __block_table The blocks of the sequence.
+/// \param __context_len The number of tokens of the sequence in the cache, the last ``query_len`` of which are the
+///  queries.
+/// \param __scale The factor to scale the attention scores by.
+/// \return The output of shape ``[query_len, num_heads, head_dim]``.
+static inline torch::Tensor attend(
+  const torch::Tensor &__query,
+  const torch::Tensor &__key_cache,
+  const torch::Tensor &__value_cache,
+  const torch::Tensor &__block_table,
+  int64_t __context_len,
+  double __scale) {
+  auto query_len    = __query.size(0);
+  auto num_heads    = __query.size(1);
+  auto head_dim     = __query.size(2);
+  auto block_size   = __key_cache.size(1);
+  auto num_kv_heads = __key_cache.size(2);
+  auto num_blocks   = (__context_len + block_size - 1) / block_size;
+
+  auto blocks = __block_table.narrow(0, 0, num_blocks);
+  auto keys   = __key_cache.index_select(0, blocks).view({-1, num_kv_heads, head_dim}).narrow(0, 0, __context_len);
+  auto values = __value_cache.index_select(0, blocks).view({-1, num_kv_heads, head_dim}).narrow(0, 0, __context_len);
+
+  // The query heads sharing a key-value head are grouped into a dimension of their own, so that the keys and values
+  // are broadcast instead of repeated.
+  auto query  = __query.reshape({query_len, num_kv_heads, num_heads / num_kv_heads, head_dim}).permute({1, 2, 0, 3});
+  auto scores = torch::matmul(query, keys.permute({1, 2, 0}).unsqueeze(1)).to(torch::kFloat32).mul_(__scale);
+
+  // The i-th query is at position context_len - query_len + i and sees no key after it.
+  auto options = __block_table.options();
+  auto future  = torch::arange(__context_len, options)
+                  .gt(torch::arange(__context_len - query_len, __context_len, options).unsqueeze(-1));
+  scores.masked_fill_(future, -std::numeric_limits<float>::infinity());
+
+  auto probs = scores.softmax(-1).to(values.scalar_type());
+  return torch::matmul(probs, values.permute({1, 0, 2}).unsqueeze(1))
+    .permute({2, 0, 1, 3})
+    .reshape({query_len, num_heads, head_dim});
+}
+
+/// \brief Computes attention of sequences decoding a single token each, batched over the sequences.
+/// \param __query The queries of the sequences, of shape ``[num_seqs, num_heads, head_dim]``.
+/// \param __key_cache The keys of the layer.
+/// \param __value_cache The values of the layer.
+/// \param __block_tables The blocks of the sequences.
+/// \param __context_lens The number of tokens of the sequences in the cache.
+/// \param __scale The factor to scale the attention scores by.
+/// \return The output of shape ``[num_seqs, num_heads, head_dim]``.
+static inline torch::Tensor attend_decode(
+  const torch::Tensor &__query,
+  const torch::Tensor &__key_cache,
+  const torch::Tensor &__value_cache,
+  const torch::Tensor &__block_tables,
+  const std::vector<int64_t> &__context_lens,
+  double __scale) {
+  auto num_seqs     = __query.size(0);
+  auto num_heads    = __query.size(1);
+  auto head_dim     = __query.size(2);
+  auto block_size   = __key_cache.size(1);
+  auto num_kv_heads = __key_cache.size(2);
+  auto max_len      = *std::max_element(__context_lens.begin(), __context_lens.end());
+  auto num_blocks   = (max_len + block_size - 1) / block_size;
+
+  // The contexts are padded to the longest one, and the padding is masked out.
+  auto blocks = __block_tables.narrow(1, 0, num_blocks).reshape(-1);
+  auto keys   = __key_cache.index_select(0, blocks).view({num_seqs, -1, num_kv_heads, head_dim});
+  auto values = __value_cache.index_select(0, blocks).view({num_seqs, -1, num_kv_heads, head_dim});
+
+  auto query  = __query.reshape({num_seqs, num_kv_heads, num_heads / num_kv_heads, 1, head_dim});
+  auto scores = torch::matmul(query, keys.permute({0, 2, 3, 1}).unsqueeze(2)).to(torch::kFloat32).mul_(__scale);
+
+  auto options      = __block_tables.options();
+  auto context_lens = torch::tensor(__context_lens, options);
+  auto padding      = torch::arange(keys.size(1), options).ge(context_lens.unsqueeze(-1)).view({num_seqs, 1, 1, 1, -1});
+  scores.masked_fill_(padding, -std::numeric_limits<float>::infinity());
+
+  auto probs = scores.softmax(-1).to(values.scalar_type());
+  return torch::matmul(probs, values.permute({0, 2, 1, 3}).unsqueeze(2)).reshape({num_seqs, num_heads, head_dim});
+}
+
+torch::Tensor mako::nn::paged_kv_cache::attention(
+  int64_t layer,
+  const torch::Tensor &query,
+  const attention_metadata &metadata,
+  double scale) const {
+  auto key_cache   = this->key_cache(layer);
+  auto value_cache = this->value_cache(layer);
+  auto output      = torch::empty_like(query);
+
+  // Decoding sequences attend in one batched GEMM, while each prompt attends on its own to avoid padding the queries.
+  std::vector<int64_t> decode_seqs;
+  std::vector<int64_t> decode_tokens;
+  std::vector<int64_t> decode_context_lens;
+  int64_t start = 0;
+  for (size_t seq = 0; seq < metadata.query_lens.size(); ++seq) {
+    auto query_len   = metadata.query_lens[seq];
+    auto context_len = metadata.context_lens[seq];
+    if (query_len == 1) {
+      decode_seqs.push_back(static_cast<int64_t>(seq));
+      decode_tokens.push_back(start);
+      decode_context_lens.push_back(context_len);
+    } else {
+      output.narrow(0, start, query_len)
+        .copy_(attend(
+          query.narrow(0, start, query_len),
+          key_cache,
+          value_cache,
+          metadata.block_tables[seq],
+          context_len,
+          scale));
+    }
+    start += query_len;
+  }
+
+  if (!decode_seqs.empty()) {
+    auto options = metadata.block_tables.options();
+    auto tokens  = torch::tensor(decode_tokens, options);
+    output.index_copy_(
+      0,
+      tokens,
+      attend_decode(
+        query.index_select(0, tokens),
+        key_cache,
+        value_cache,
+        metadata.block_tables.index_select(0, torch::tensor(decode_seqs, options)),
+        decode_context_lens,
+        scale));
+  }
+  return output;
+}
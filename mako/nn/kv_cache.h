@@ -0,0 +1,202 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <torch/torch.h>
+
+#include "mako/utils/export.h"
+
+namespace mako {
+namespace nn {
+/// \brief Allocator of the fixed-size blocks of a paged cache, with automatic prefix caching.
+///
+/// Blocks are identified by their indices into the pool, and a freed block is handed out again before any block that
+/// has never been used, so that the working set of the pool stays small.
+///
+/// A block full of tokens can be committed under the hash of its tokens chained to the hash of the block before it,
+/// which thus identifies the whole prefix up to the block. Other sequences with the same prefix look the block up and
+/// share it, each holding a reference. A committed block stays cached after its last reference is freed, and is
+/// evicted, least recently used first, only once no block without a hash is free.
+class MAKO_API block_allocator {
+ public:
+  /// \param num_blocks The number of blocks in the pool.
+  explicit block_allocator(int64_t num_blocks);
+
+  /// \brief Takes a free block, evicting a cached one if need be.
+  /// \return The index of the block.
+  /// \throw std::runtime_error If no block is free.
+  int64_t allocate();
+
+  /// \brief Drops a reference to a block taken by ``allocate`` or ``lookup``.
+  /// \param block The index of the block.
+  /// \throw std::invalid_argument If the block is not in use.
+  void free(int64_t block);
+
+  /// \brief Takes a reference to the block committed under a hash, if it is still cached.
+  /// \param hash The hash of the block.
+  /// \return The index of the block, or ``std::nullopt`` if no block is cached under the hash.
+  std::optional<int64_t> lookup(size_t hash);
+
+  /// \brief Caches a block in use under the hash of its tokens.
+  ///
+  /// Nothing happens if the block has already been committed or if another block is cached under the hash.
+  /// \param block The index of the block, whose tokens must all have been written.
+  /// \param hash The hash of the block.
+  /// \throw std::invalid_argument If the block is not in use.
+  void commit(int64_t block, size_t hash);
+
+  /// \brief Computes the hash of a block.
+  /// \param parent_hash The hash of the block before it, or ``0`` for the first block.
+  /// \param token_ids The tokens of the block.
+  /// \param num_tokens The number of tokens of the block.
+  static size_t hash_block(size_t parent_hash, const int64_t *token_ids, int64_t num_tokens);
+
+  int64_t num_blocks() const {
+    return static_cast<int64_t>(ref_counts_.size());
+  }
+
+  /// \brief The number of blocks that can be allocated, including the cached ones no sequence refers to.
+  int64_t num_free_blocks() const {
+    return static_cast<int64_t>(free_blocks_.size() + evictable_blocks_.size());
+  }
+
+  int64_t num_used_blocks() const {
+    return num_blocks() - num_free_blocks();
+  }
+
+  int64_t num_cached_blocks() const {
+    return static_cast<int64_t>(cached_blocks_.size());
+  }
+
+ private:
+  std::vector<int64_t> free_blocks_;
+  std::vector<int64_t> ref_counts_;
+  std::unordered_map<size_t, int64_t> cached_blocks_;
+  std::vector<std::optional<size_t>> hashes_;
+  // The cached blocks no sequence refers to, from the least recently used one.
+  std::list<int64_t> evictable_blocks_;
+  std::vector<std::list<int64_t>::iterator> evictable_positions_;
+};
+
+/// \brief Layout of a batch of sequences in a paged cache.
+///
+/// The tokens of all sequences in a batch are concatenated into one dimension, and each sequence contributes its
+/// ``query_lens[i]`` last tokens, which may be fewer than the ``context_lens[i]`` tokens it has in the cache, e.g.,
+/// a single token when decoding.
+struct MAKO_API attention_metadata {
+  /// \brief The slot of each token in the cache, i.e., ``block * block_size + offset``, of shape ``[num_tokens]``.
+  torch::Tensor slot_mapping;
+
+  /// \brief The blocks of each sequence in order, of shape ``[num_seqs, max_num_blocks]``, padded with any valid block.
+  torch::Tensor block_tables;
+
+  /// \brief The number of tokens of each sequence in the batch.
+  std::vector<int64_t> query_lens;
+
+  /// \brief The number of tokens of each sequence in the cache, including the ones in the batch.
+  std::vector<int64_t> context_lens;
+};
+
+/// \brief Cache of keys and values of all layers, paged into fixed-size blocks of one preallocated pool.
+///
+/// Unlike a contiguous cache per sequence, a sequence occupies only the blocks its tokens fill, so neither padding nor
+/// a reservation for the maximum length is wasted.
+class MAKO_API paged_kv_cache {
+ public:
+  /// \param num_layers The number of attention layers.
+  /// \param num_blocks The number of blocks in the pool.
+  /// \param block_size The number of tokens per block.
+  /// \param num_kv_heads The number of key-value heads.
+  /// \param head_dim The number of channels per head.
+  /// \param options The dtype and device of the pool.
+  paged_kv_cache(
+    int64_t num_layers,
+    int64_t num_blocks,
+    int64_t block_size,
+    int64_t num_kv_heads,
+    int64_t head_dim,
+    torch::TensorOptions options = {});
+
+  /// \brief Computes the number of bytes a block takes up across all layers, e.g., to size the pool to a budget.
+  static int64_t block_bytes(
+    int64_t num_layers,
+    int64_t block_size,
+    int64_t num_kv_heads,
+    int64_t head_dim,
+    torch::Dtype dtype);
+
+  /// \brief Writes the keys and values of a batch of tokens into their slots.
+  /// \param layer The index of the layer.
+  /// \param key The keys of shape ``[num_tokens, num_kv_heads, head_dim]``.
+  /// \param value The values of shape ``[num_tokens, num_kv_heads, head_dim]``.
+  /// \param slot_mapping The slots of the tokens.
+  void write(int64_t layer, const torch::Tensor &key, const torch::Tensor &value, const torch::Tensor &slot_mapping);
+
+  /// \brief Computes causal attention of a batch of tokens over their sequences, gathering keys and values through
+  /// the block tables.
+  ///
+  /// Grouped-query attention is supported; i.e., ``num_heads`` may be any multiple of ``num_kv_heads``.
+  /// \param layer The index of the layer.
+  /// \param query The queries of shape ``[num_tokens, num_heads, head_dim]``.
+  /// \param metadata The layout of the batch, whose keys and values must have been written.
+  /// \param scale The factor to scale the attention scores by.
+  /// \return The output of shape ``[num_tokens, num_heads, head_dim]``.
+  torch::Tensor attention(
+    int64_t layer,
+    const torch::Tensor &query,
+    const attention_metadata &metadata,
+    double scale) const;
+
+  /// \brief Copies blocks of all layers to another cache, e.g., to swap them out of or into host memory.
+  /// \param dst The cache to copy to, with the same layout but possibly on another device.
+  /// \param mapping The pairs of source block and destination block.
+  void copy_blocks(paged_kv_cache &dst, const std::vector<std::pair<int64_t, int64_t>> &mapping) const;
+
+  /// \brief The keys of a layer, of shape ``[num_blocks, block_size, num_kv_heads, head_dim]``.
+  torch::Tensor key_cache(int64_t layer) const {
+    return pool_[layer][0];
+  }
+
+  /// \brief The values of a layer, of shape ``[num_blocks, block_size, num_kv_heads, head_dim]``.
+  torch::Tensor value_cache(int64_t layer) const {
+    return pool_[layer][1];
+  }
+
+  block_allocator &allocator() {
+    return allocator_;
+  }
+
+  const block_allocator &allocator() const {
+    return allocator_;
+  }
+
+  int64_t block_size() const {
+    return block_size_;
+  }
+
+ private:
+  torch::Tensor pool_;
+  block_allocator allocator_;
+  int64_t block_size_;
+};
+} // namespace nn
+} // namespace mako
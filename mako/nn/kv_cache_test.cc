@@ -0,0 +1,116 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/nn/kv_cache.h"
+
+#include <limits>
+
+#include <gtest/gtest.h>
+
+/// \brief Computes causal attention of the last ``query.size(0)`` tokens over contiguous keys and values.
+static inline torch::Tensor reference_attention(
+  const torch::Tensor &query,
+  const torch::Tensor &key,
+  const torch::Tensor &value,
+  double scale) {
+  auto group     = query.size(1) / key.size(1);
+  auto keys      = key.repeat_interleave(group, 1);
+  auto values    = value.repeat_interleave(group, 1);
+  auto scores    = torch::einsum("qhd,khd->hqk", {query, keys}).mul(scale);
+  auto positions = torch::arange(key.size(0) - query.size(0), key.size(0)).unsqueeze(-1);
+  scores.masked_fill_(torch::arange(key.size(0)).gt(positions), -std::numeric_limits<float>::infinity());
+  return torch::einsum("hqk,khd->qhd", {scores.softmax(-1), values});
+}
+
+TEST(BlockAllocatorTest, AllocateFree) {
+  mako::nn::block_allocator allocator(4);
+  for (int64_t block = 0; block < 4; ++block) {
+    EXPECT_EQ(allocator.allocate(), block);
+  }
+  EXPECT_EQ(allocator.num_free_blocks(), 0);
+  EXPECT_EQ(allocator.num_used_blocks(), 4);
+  EXPECT_THROW(allocator.allocate(), std::runtime_error);
+
+  allocator.free(2);
+  EXPECT_EQ(allocator.num_free_blocks(), 1);
+  EXPECT_THROW(allocator.free(2), std::invalid_argument);
+  EXPECT_THROW(allocator.free(4), std::invalid_argument);
+  EXPECT_EQ(allocator.allocate(), 2);
+}
+
+TEST(BlockAllocatorTest, PrefixCaching) {
+  std::vector<int64_t> tokens = {1, 2, 3, 4, 5, 6, 7, 8};
+  auto first_hash             = mako::nn::block_allocator::hash_block(0, tokens.data(), 4);
+  auto second_hash            = mako::nn::block_allocator::hash_block(first_hash, tokens.data() + 4, 4);
+  // The same tokens after another prefix make another block.
+  EXPECT_NE(mako::nn::block_allocator::hash_block(0, tokens.data() + 4, 4), second_hash);
+
+  mako::nn::block_allocator allocator(3);
+  auto first  = allocator.allocate();
+  auto second = allocator.allocate();
+  allocator.commit(first, first_hash);
+  allocator.commit(second, second_hash);
+  EXPECT_EQ(allocator.num_cached_blocks(), 2);
+  EXPECT_THROW(allocator.commit(2, first_hash), std::invalid_argument);
+
+  // A shared block stays in use until its last reference is freed, and stays cached even then.
+  EXPECT_EQ(allocator.lookup(first_hash), first);
+  allocator.free(first);
+  EXPECT_EQ(allocator.num_used_blocks(), 2);
+  allocator.free(first);
+  allocator.free(second);
+  EXPECT_EQ(allocator.num_free_blocks(), 3);
+  EXPECT_EQ(allocator.num_cached_blocks(), 2);
+
+  // Blocks never cached are allocated first, and then the least recently used cached one is evicted.
+  EXPECT_EQ(allocator.allocate(), 2);
+  EXPECT_EQ(allocator.allocate(), first);
+  EXPECT_EQ(allocator.lookup(first_hash), std::nullopt);
+  EXPECT_EQ(allocator.lookup(second_hash), second);
+  EXPECT_EQ(allocator.num_free_blocks(), 0);
+}
+
+TEST(PagedKVCacheTest, Attention) {
+  // A prompt of 6 tokens in blocks 5 and 2, batched with a sequence of 5 tokens in blocks 7 and 0 decoding its last.
+  mako::nn::paged_kv_cache cache(1, 8, 4, 2, 8);
+  auto keys    = torch::randn({11, 2, 8});
+  auto values  = torch::randn({11, 2, 8});
+  auto queries = torch::randn({11, 4, 8});
+  cache.write(0, keys, values, torch::tensor({20, 21, 22, 23, 8, 9, 28, 29, 30, 31, 0}, torch::kInt64));
+
+  mako::nn::attention_metadata metadata;
+  metadata.slot_mapping = torch::tensor({20, 21, 22, 23, 8, 9, 0}, torch::kInt64);
+  metadata.block_tables = torch::tensor({5, 2, 7, 0}, torch::kInt64).view({2, 2});
+  metadata.query_lens   = {6, 1};
+  metadata.context_lens = {6, 5};
+
+  auto query  = torch::cat({queries.narrow(0, 0, 6), queries.narrow(0, 10, 1)});
+  auto output = cache.attention(0, query, metadata, 0.5);
+  EXPECT_EQ(output.sizes(), torch::IntArrayRef({7, 4, 8}));
+  EXPECT_TRUE(torch::allclose(
+    output.narrow(0, 0, 6),
+    reference_attention(queries.narrow(0, 0, 6), keys.narrow(0, 0, 6), values.narrow(0, 0, 6), 0.5),
+    1e-4,
+    1e-5));
+  EXPECT_TRUE(torch::allclose(
+    output.narrow(0, 6, 1),
+    reference_attention(queries.narrow(0, 10, 1), keys.narrow(0, 6, 5), values.narrow(0, 6, 5), 0.5),
+    1e-4,
+    1e-5));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
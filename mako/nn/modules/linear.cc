@@ -0,0 +1,84 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/nn/modules/linear.h"
+
+#include <cmath>
+#include <stdexcept>
+
+#include <absl/strings/str_format.h>
+
+#include "mako/nn/kernels/quantized_linear.h"
+
+mako::nn::linear_impl::linear_impl(
+  int64_t in_features,
+  int64_t out_features,
+  utils::quantization::scheme scheme,
+  int64_t group_size)
+    : scheme_(scheme) {
+  switch (scheme_) {
+  case utils::quantization::scheme::int8:
+    qweight_ = register_parameter(
+      "qweight",
+      torch::zeros({out_features, in_features}, torch::kInt8),
+      /*requires_grad=*/false);
+    scales_ = register_parameter("scales", torch::ones({out_features}, torch::kFloat32), /*requires_grad=*/false);
+    break;
+  case utils::quantization::scheme::int4:
+    if (group_size <= 0 || group_size % 2 != 0 || in_features % group_size != 0) {
+      throw std::invalid_argument(absl::StrFormat(
+        "The group size must be a positive even divisor of the number of input features %d, but got %d",
+        in_features,
+        group_size));
+    }
+    // A zero integer is stored as 8, so the initial weight is zero, as for int8.
+    qweight_ = register_parameter(
+      "qweight",
+      torch::full({out_features, in_features / 2}, 0x88, torch::kUInt8),
+      /*requires_grad=*/false);
+    scales_ = register_parameter(
+      "scales",
+      torch::ones({out_features, in_features / group_size}, torch::kFloat32),
+      /*requires_grad=*/false);
+    break;
+  default: {
+    // The same initialization as ``torch::nn::Linear``, so that an unloaded model computes something meaningful.
+    auto bound = 1.0 / std::sqrt(static_cast<double>(in_features));
+    weight_    = register_parameter("weight", torch::empty({out_features, in_features}).uniform_(-bound, bound));
+    break;
+  }
+  }
+}
+
+torch::Tensor mako::nn::linear_impl::forward(const torch::Tensor &x) {
+  if (scheme_ == utils::quantization::scheme::none) {
+    return torch::linear(x, weight_);
+  }
+  return kernels::quantized_linear(x, qweight_, scales_, scheme_);
+}
+
+void mako::nn::linear_impl::to(torch::Device device, torch::Dtype dtype, bool non_blocking) {
+  to(device, non_blocking);
+  to(dtype, non_blocking);
+}
+
+void mako::nn::linear_impl::to(torch::Dtype dtype, bool non_blocking) {
+  if (weight_.defined()) {
+    weight_.set_data(weight_.to(dtype, non_blocking));
+  }
+}
+
+void mako::nn::linear_impl::to(torch::Device device, bool non_blocking) {
+  torch::nn::Module::to(device, non_blocking);
+}
@@ -0,0 +1,63 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+
+#include <torch/torch.h>
+
+#include "mako/utils/export.h"
+#include "mako/utils/quantization.h"
+
+namespace mako {
+namespace nn {
+/// \brief Linear layer without bias, whose weight may be quantized as ``mako::utils::weight_iterator`` loads it.
+///
+/// A quantized layer holds the packed integers ``qweight`` and the float32 ``scales`` in place of ``weight``, as laid
+/// out by ``utils::quantization::quantize``, and multiplies by them through ``kernels::quantized_linear``, so that
+/// decoding on CPU reads only the quantized weight. Converting the layer to another dtype converts an unquantized
+/// weight only, so the integers and the scales survive a model being cast to half precision.
+class MAKO_API linear_impl : public torch::nn::Module {
+ public:
+  /// \param in_features The number of input features.
+  /// \param out_features The number of output features.
+  /// \param scheme The scheme the weight is quantized with.
+  /// \param group_size The number of input features sharing a scale, used only for
+  ///  ``utils::quantization::scheme::int4``.
+  /// \throw std::invalid_argument If ``group_size`` does not divide ``in_features`` for
+  ///  ``utils::quantization::scheme::int4``.
+  linear_impl(
+    int64_t in_features,
+    int64_t out_features,
+    utils::quantization::scheme scheme = utils::quantization::scheme::none,
+    int64_t group_size                 = 128);
+
+  /// \param x The input of shape ``[..., in_features]``.
+  /// \return The output of shape ``[..., out_features]``.
+  torch::Tensor forward(const torch::Tensor &x);
+
+  void to(torch::Device device, torch::Dtype dtype, bool non_blocking = false) override;
+  void to(torch::Dtype dtype, bool non_blocking = false) override;
+  void to(torch::Device device, bool non_blocking = false) override;
+
+ private:
+  utils::quantization::scheme scheme_;
+  torch::Tensor weight_;
+  torch::Tensor qweight_;
+  torch::Tensor scales_;
+};
+TORCH_MODULE_IMPL(linear, linear_impl);
+} // namespace nn
+} // namespace mako
@@ -0,0 +1,58 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/nn/modules/linear.h"
+
+#include <gtest/gtest.h>
+
+namespace quantization = mako::utils::quantization;
+
+TEST(LinearTest, Quantized) {
+  auto x      = torch::randn({3, 64});
+  auto weight = torch::randn({16, 64});
+  for (auto scheme : {quantization::scheme::int8, quantization::scheme::int4}) {
+    mako::nn::linear layer(64, 16, scheme, 32);
+    auto [qweight, scales] = quantization::quantize(weight, scheme, 32);
+    auto params            = layer->named_parameters();
+    params["qweight"].copy_(qweight);
+    params["scales"].copy_(scales);
+
+    // The layer computes with the weight the integers stand for, which is close to the original one.
+    auto restored = quantization::dequantize(qweight, scales, scheme);
+    EXPECT_TRUE(torch::allclose(layer(x), torch::linear(x, restored), 1e-4, 1e-4));
+    EXPECT_TRUE(torch::allclose(restored, weight, 0, scheme == quantization::scheme::int8 ? 0.05 : 0.4));
+
+    // Casting the layer to half precision keeps the integers and the scales as they are.
+    layer->to(torch::kBFloat16);
+    EXPECT_EQ(params["qweight"].scalar_type(), qweight.scalar_type());
+    EXPECT_EQ(params["scales"].scalar_type(), torch::kFloat32);
+    EXPECT_EQ(layer(x.to(torch::kBFloat16)).scalar_type(), torch::kBFloat16);
+  }
+
+  EXPECT_THROW(mako::nn::linear(64, 16, quantization::scheme::int4, 48), std::invalid_argument);
+}
+
+TEST(LinearTest, Unquantized) {
+  mako::nn::linear layer(64, 16);
+  auto x = torch::randn({3, 64});
+  EXPECT_TRUE(torch::allclose(layer(x), torch::linear(x, layer->named_parameters()["weight"])));
+
+  layer->to(torch::kBFloat16);
+  EXPECT_EQ(layer->named_parameters()["weight"].scalar_type(), torch::kBFloat16);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,342 @@
+// Adapted from https://github.com/vllm-project/vllm/blob/v0.2.7/vllm/model_executor/models/llama.py
+// Copyright 2024 The Mako Authors
+// Copyright 2023 The vLLM team
+// Copyright 2022 EleutherAI and the HuggingFace Inc. team. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/nn/modules/llama.h"
+
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <absl/strings/match.h>
+#include <absl/strings/str_format.h>
+#include <absl/strings/str_replace.h>
+#include <nlohmann/json.hpp>
+
+#include "mako/nn/kernels/rms_norm.h"
+
+namespace fs = std::filesystem;
+
+using nlohmann::json;
+
+mako::nn::llama_config mako::nn::llama_config::from_pretrained(absl::string_view path) {
+  auto filename = fs::path(std::string(path));
+  if (fs::is_directory(filename)) {
+    filename /= fs::path("config.json");
+  }
+  std::ifstream stream(filename);
+  if (!stream) {
+    throw std::runtime_error(absl::StrFormat("Failed to open %s", filename.string()));
+  }
+  auto config = json::parse(stream);
+
+  llama_config llama;
+  llama.vocab_size              = config.value("vocab_size", llama.vocab_size);
+  llama.hidden_size             = config.value("hidden_size", llama.hidden_size);
+  llama.intermediate_size       = config.value("intermediate_size", llama.intermediate_size);
+  llama.num_hidden_layers       = config.value("num_hidden_layers", llama.num_hidden_layers);
+  llama.num_attention_heads     = config.value("num_attention_heads", llama.num_attention_heads);
+  llama.num_key_value_heads     = config.value("num_key_value_heads", llama.num_attention_heads);
+  llama.max_position_embeddings = config.value("max_position_embeddings", llama.max_position_embeddings);
+  llama.rms_norm_eps            = config.value("rms_norm_eps", llama.rms_norm_eps);
+  llama.rope_theta              = config.value("rope_theta", llama.rope_theta);
+  llama.tie_word_embeddings     = config.value("tie_word_embeddings", llama.tie_word_embeddings);
+
+  // Newer versions of Transformers name the type ``rope_type``, and may name no scaling ``default``.
+  auto rope_scaling = config.find("rope_scaling");
+  if (rope_scaling != config.end() && rope_scaling->is_object()) {
+    auto &scaling = llama.rope_scaling;
+    scaling.type  = rope_scaling->value("rope_type", rope_scaling->value("type", ""));
+    if (scaling.type == "default") {
+      scaling.type.clear();
+    }
+    scaling.factor = rope_scaling->value("factor", scaling.factor);
+    scaling.original_max_position_embeddings =
+      rope_scaling->value("original_max_position_embeddings", scaling.original_max_position_embeddings);
+    scaling.extrapolation_factor = rope_scaling->value("extrapolation_factor", scaling.extrapolation_factor);
+    scaling.attn_factor          = rope_scaling->value("attn_factor", scaling.attn_factor);
+    scaling.beta_fast            = rope_scaling->value("beta_fast", scaling.beta_fast);
+    scaling.beta_slow            = rope_scaling->value("beta_slow", scaling.beta_slow);
+  }
+  return llama;
+}
+
+mako::nn::rms_norm_impl::rms_norm_impl(int64_t hidden_size, double eps) : eps_(eps) {
+  weight_ = register_parameter("weight", torch::ones({hidden_size}));
+}
+
+torch::Tensor mako::nn::rms_norm_impl::forward(const torch::Tensor &x) {
+  return kernels::rms_norm(x, weight_, eps_);
+}
+
+torch::Tensor mako::nn::rms_norm_impl::forward(const torch::Tensor &x, torch::Tensor &residual) {
+  return kernels::fused_add_rms_norm(x, residual, weight_, eps_);
+}
+
+mako::nn::llama_mlp_impl::llama_mlp_impl(const llama_config &config) {
+  gate_up_proj_ = register_module(
+    "gate_up_proj",
+    linear(config.hidden_size, 2 * config.intermediate_size, config.quantize, config.group_size));
+  down_proj_ = register_module(
+    "down_proj",
+    linear(config.intermediate_size, config.hidden_size, config.quantize, config.group_size));
+}
+
+torch::Tensor mako::nn::llama_mlp_impl::forward(const torch::Tensor &x) {
+  auto gate_up = gate_up_proj_(x);
+  auto size    = gate_up.size(-1) / 2;
+  // SiLU and the product are done in place on the gate half, so no intermediate of the full width is allocated.
+  auto gate = gate_up.narrow(-1, 0, size);
+  torch::silu_(gate);
+  return down_proj_(gate.mul_(gate_up.narrow(-1, size, size)));
+}
+
+mako::nn::llama_attention_impl::llama_attention_impl(
+  const llama_config &config,
+  int64_t layer_idx,
+  rotary_embedding rotary_emb)
+    : layer_idx_(layer_idx),
+      num_heads_(config.num_attention_heads),
+      num_kv_heads_(config.num_key_value_heads),
+      head_dim_(config.head_dim()),
+      scaling_(1.0 / std::sqrt(static_cast<double>(config.head_dim()))),
+      rotary_emb_(std::move(rotary_emb)) {
+  if (num_heads_ % num_kv_heads_ != 0) {
+    throw std::invalid_argument(absl::StrFormat(
+      "The number of attention heads %d is not a multiple of the number of key-value heads %d",
+      num_heads_,
+      num_kv_heads_));
+  }
+  qkv_proj_ = register_module(
+    "qkv_proj",
+    linear(config.hidden_size, (num_heads_ + 2 * num_kv_heads_) * head_dim_, config.quantize, config.group_size));
+  o_proj_ = register_module(
+    "o_proj",
+    linear(num_heads_ * head_dim_, config.hidden_size, config.quantize, config.group_size));
+}
+
+torch::Tensor mako::nn::llama_attention_impl::forward(
+  const torch::Tensor &positions,
+  const torch::Tensor &hidden_states,
+  paged_kv_cache &kv_cache,
+  const attention_metadata &metadata) {
+  auto num_tokens = hidden_states.size(0);
+
+  auto qkv = qkv_proj_(hidden_states);
+  auto q   = qkv.narrow(-1, 0, num_heads_ * head_dim_).view({num_tokens, num_heads_, head_dim_});
+  auto k   = qkv.narrow(-1, num_heads_ * head_dim_, num_kv_heads_ * head_dim_)
+             .view({num_tokens, num_kv_heads_, head_dim_});
+  auto v   = qkv.narrow(-1, (num_heads_ + num_kv_heads_) * head_dim_, num_kv_heads_ * head_dim_)
+             .view({num_tokens, num_kv_heads_, head_dim_});
+
+  // The queries and keys are rotated in place within the output of the fused projection.
+  rotary_emb_(positions, q, k);
+
+  kv_cache.write(layer_idx_, k, v.contiguous(), metadata.slot_mapping);
+  auto output = kv_cache.attention(layer_idx_, q, metadata, scaling_);
+  return o_proj_(output.view({num_tokens, num_heads_ * head_dim_}));
+}
+
+mako::nn::llama_decoder_layer_impl::llama_decoder_layer_impl(
+  const llama_config &config,
+  int64_t layer_idx,
+  rotary_embedding rotary_emb) {
+  self_attn_       = register_module("self_attn", llama_attention(config, layer_idx, std::move(rotary_emb)));
+  mlp_             = register_module("mlp", llama_mlp(config));
+  input_layernorm_ = register_module("input_layernorm", rms_norm(config.hidden_size, config.rms_norm_eps));
+  post_attention_layernorm_ =
+    register_module("post_attention_layernorm", rms_norm(config.hidden_size, config.rms_norm_eps));
+}
+
+torch::Tensor mako::nn::llama_decoder_layer_impl::forward(
+  const torch::Tensor &positions,
+  const torch::Tensor &hidden_states,
+  torch::Tensor &residual,
+  paged_kv_cache &kv_cache,
+  const attention_metadata &metadata) {
+  torch::Tensor normalized;
+  if (residual.defined()) {
+    normalized = input_layernorm_(hidden_states, residual);
+  } else {
+    residual   = hidden_states.clone();
+    normalized = input_layernorm_(hidden_states);
+  }
+  auto attention = self_attn_(positions, normalized, kv_cache, metadata);
+  return mlp_(post_attention_layernorm_(attention, residual));
+}
+
+mako::nn::llama_model_impl::llama_model_impl(const llama_config &config) {
+  embed_tokens_ = register_module("embed_tokens", torch::nn::Embedding(config.vocab_size, config.hidden_size));
+  // The cache of cosines and sines is computed once and shared by all layers, which hold it without registering it
+  // again.
+  rotary_emb_ = register_module(
+    "rotary_emb",
+    rotary_embedding(config.head_dim(), config.max_position_embeddings, config.rope_theta, config.rope_scaling));
+  auto layers = register_module("layers", torch::nn::ModuleList());
+  for (int64_t i = 0; i < config.num_hidden_layers; ++i) {
+    layers_.emplace_back(config, i, rotary_emb_);
+    layers->push_back(layers_.back());
+  }
+  norm_ = register_module("norm", rms_norm(config.hidden_size, config.rms_norm_eps));
+}
+
+torch::Tensor mako::nn::llama_model_impl::forward(
+  const torch::Tensor &input_ids,
+  const torch::Tensor &positions,
+  paged_kv_cache &kv_cache,
+  const attention_metadata &metadata) {
+  auto hidden_states = embed_tokens_(input_ids);
+  torch::Tensor residual;
+  for (auto &layer : layers_) {
+    hidden_states = layer(positions, hidden_states, residual, kv_cache, metadata);
+  }
+  return norm_(hidden_states, residual);
+}
+
+mako::nn::llama_for_causal_lm_impl::llama_for_causal_lm_impl(const llama_config &config) : config_(config) {
+  model_ = register_module("model", llama_model(config));
+  // A tied language modeling head has no weight of its own but projects onto the token embeddings.
+  if (!config.tie_word_embeddings) {
+    lm_head_ = register_module(
+      "lm_head",
+      torch::nn::Linear(torch::nn::LinearOptions(config.hidden_size, config.vocab_size).bias(false)));
+  }
+
+  // The model only serves inference, so no parameter ever needs a gradient.
+  for (auto &parameter : parameters()) {
+    parameter.set_requires_grad(false);
+  }
+}
+
+torch::Tensor mako::nn::llama_for_causal_lm_impl::forward(
+  const torch::Tensor &input_ids,
+  const torch::Tensor &positions,
+  paged_kv_cache &kv_cache,
+  const attention_metadata &metadata) {
+  torch::InferenceMode guard;
+  return model_(input_ids, positions, kv_cache, metadata);
+}
+
+torch::Tensor mako::nn::llama_for_causal_lm_impl::compute_logits(const torch::Tensor &hidden_states) {
+  torch::InferenceMode guard;
+  if (config_.tie_word_embeddings) {
+    return torch::linear(hidden_states, model_->embedding_weight());
+  }
+  return lm_head_(hidden_states);
+}
+
+mako::nn::paged_kv_cache mako::nn::llama_for_causal_lm_impl::make_kv_cache(
+  int64_t num_blocks,
+  int64_t block_size) const {
+  return paged_kv_cache(
+    config_.num_hidden_layers,
+    num_blocks,
+    block_size,
+    config_.num_key_value_heads,
+    config_.head_dim(),
+    model_->embedding_weight().options());
+}
+
+/// \brief A weight of a checkpoint that is loaded into a part of a fused parameter.
+struct stacked_param {
+  /// \brief The name of the fused parameter, e.g., ``qkv_proj``.
+  absl::string_view param_name;
+
+  /// \brief The name of the weight, e.g., ``q_proj``.
+  absl::string_view weight_name;
+
+  /// \brief The index of the part, e.g., ``0`` for queries.
+  int shard_id;
+};
+
+void mako::nn::llama_for_causal_lm_impl::load_weight(absl::string_view name, const torch::Tensor &weight) {
+  static constexpr stacked_param stacked_params_mapping[] = {
+    {"qkv_proj",     "q_proj",    0},
+    {"qkv_proj",     "k_proj",    1},
+    {"qkv_proj",     "v_proj",    2},
+    {"gate_up_proj", "gate_proj", 0},
+    {"gate_up_proj", "up_proj",   1},
+  };
+
+  // The heads of keys and values follow the ones of queries, and the up projection follows the gate projection.
+  auto q_size      = config_.num_attention_heads * config_.head_dim();
+  auto kv_size     = config_.num_key_value_heads * config_.head_dim();
+  auto offset_of   = [&](absl::string_view param_name, int shard_id) -> int64_t {
+    if (param_name.compare("qkv_proj") == 0) {
+      return shard_id == 0 ? 0 : q_size + (shard_id - 1) * kv_size;
+    }
+    return shard_id * config_.intermediate_size;
+  };
+  auto size_of     = [&](absl::string_view param_name, int shard_id) -> int64_t {
+    if (param_name.compare("qkv_proj") == 0) {
+      return shard_id == 0 ? q_size : kv_size;
+    }
+    return config_.intermediate_size;
+  };
+  auto check_shape = [&](torch::IntArrayRef expected) {
+    if (expected != weight.sizes()) {
+      throw std::invalid_argument(absl::StrFormat(
+        "Shape mismatch for %s: expected %s, but got %s",
+        name,
+        c10::str(expected),
+        c10::str(weight.sizes())));
+    }
+  };
+  auto find_tensor = [&](const std::string &key) {
+    // Moving the model to another dtype or device replaces the data of its parameters in place, so the ones collected
+    // before still refer to them.
+    if (named_parameters_.is_empty()) {
+      named_parameters_ = named_parameters();
+    }
+    if (auto *param = named_parameters_.find(key)) {
+      return *param;
+    }
+    throw std::invalid_argument(absl::StrFormat("Unexpected weight: %s", name));
+  };
+
+  // Some checkpoints carry a copy of the tied embeddings, which are loaded on their own, and the inverse frequencies
+  // of rotary embedding, which are computed into the shared cache instead.
+  if (config_.tie_word_embeddings && name.compare("lm_head.weight") == 0) {
+    return;
+  }
+  if (absl::EndsWith(name, "rotary_emb.inv_freq")) {
+    return;
+  }
+
+  torch::NoGradGuard no_grad;
+  for (const auto &mapping : stacked_params_mapping) {
+    auto pattern = absl::StrFormat(".%s.", mapping.weight_name);
+    if (name.find(pattern) == absl::string_view::npos) {
+      continue;
+    }
+    auto key   = absl::StrReplaceAll(name, {{pattern, absl::StrFormat(".%s.", mapping.param_name)}});
+    // A checkpoint sliced for tensor parallelism, or of another configuration, would otherwise be copied into the
+    // wrong rows of the fused parameter.
+    auto param  = find_tensor(key);
+    auto offset = offset_of(mapping.param_name, mapping.shard_id);
+    auto slice  = param.narrow(0, offset, size_of(mapping.param_name, mapping.shard_id));
+    check_shape(slice.sizes());
+    slice.copy_(weight);
+    return;
+  }
+
+  auto param = find_tensor(std::string(name));
+  check_shape(param.sizes());
+  param.copy_(weight);
+}
@@ -0,0 +1,246 @@
+// Adapted from https://github.com/vllm-project/vllm/blob/v0.2.7/vllm/model_executor/models/llama.py
+// Copyright 2024 The Mako Authors
+// Copyright 2023 The vLLM team
+// Copyright 2022 EleutherAI and the HuggingFace Inc. team. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <absl/strings/string_view.h>
+#include <torch/torch.h>
+
+#include "mako/nn/kv_cache.h"
+#include "mako/nn/modules/linear.h"
+#include "mako/nn/modules/rotary_embedding.h"
+#include "mako/utils/export.h"
+#include "mako/utils/quantization.h"
+
+namespace mako {
+namespace nn {
+/// \brief Configuration of a Llama model, with the same fields as ``LlamaConfig`` of Hugging Face Transformers.
+struct MAKO_API llama_config {
+  int64_t vocab_size              = 32000;
+  int64_t hidden_size             = 4096;
+  int64_t intermediate_size       = 11008;
+  int64_t num_hidden_layers       = 32;
+  int64_t num_attention_heads     = 32;
+  int64_t num_key_value_heads     = 32;
+  int64_t max_position_embeddings = 2048;
+  double rms_norm_eps             = 1e-6;
+  double rope_theta               = 10000.0;
+  bool tie_word_embeddings        = false;
+  rope_scaling_config rope_scaling;
+
+  /// \brief The scheme the projections of the decoder layers are quantized with, which is not read from
+  /// ``config.json`` but must match the ``quantize`` option the weights are loaded with.
+  utils::quantization::scheme quantize = utils::quantization::scheme::none;
+
+  /// \brief The number of input channels sharing a scale, used only for ``utils::quantization::scheme::int4``.
+  int64_t group_size = 128;
+
+  /// \brief Reads the configuration from ``config.json``.
+  /// \param path A path to a directory containing ``config.json``, or to the file itself.
+  /// \return The configuration, with the fields missing from the file left at their defaults.
+  static llama_config from_pretrained(absl::string_view path);
+
+  /// \brief The number of channels of each attention head.
+  int64_t head_dim() const {
+    return hidden_size / num_attention_heads;
+  }
+};
+
+/// \brief Root mean square layer normalization, optionally fused with the residual connection before it.
+class MAKO_API rms_norm_impl : public torch::nn::Module {
+ public:
+  rms_norm_impl(int64_t hidden_size, double eps);
+
+  /// \brief Normalizes ``x``.
+  torch::Tensor forward(const torch::Tensor &x);
+
+  /// \brief Adds ``x`` to ``residual`` in place and normalizes the sum, in one fused kernel on CPU.
+  /// \param x The output of the previous sublayer.
+  /// \param residual The residual stream, which is updated to ``x + residual``.
+  /// \return The normalized sum.
+  torch::Tensor forward(const torch::Tensor &x, torch::Tensor &residual);
+
+ private:
+  torch::Tensor weight_;
+  double eps_;
+};
+TORCH_MODULE_IMPL(rms_norm, rms_norm_impl);
+
+/// \brief Feed-forward network of a decoder layer, with the gate and up projections fused into one GEMM.
+class MAKO_API llama_mlp_impl : public torch::nn::Module {
+ public:
+  explicit llama_mlp_impl(const llama_config &config);
+
+  torch::Tensor forward(const torch::Tensor &x);
+
+ private:
+  linear gate_up_proj_{nullptr};
+  linear down_proj_{nullptr};
+};
+TORCH_MODULE_IMPL(llama_mlp, llama_mlp_impl);
+
+/// \brief Multi-head attention of a decoder layer, with the query, key, and value projections fused into one GEMM.
+///
+/// Grouped-query attention is supported; i.e., ``num_key_value_heads`` may divide ``num_attention_heads``.
+class MAKO_API llama_attention_impl : public torch::nn::Module {
+ public:
+  /// \param config The configuration of the model.
+  /// \param layer_idx The index of the layer, which selects its part of the cache.
+  /// \param rotary_emb The rotary embedding shared by all layers.
+  llama_attention_impl(const llama_config &config, int64_t layer_idx, rotary_embedding rotary_emb);
+
+  /// \param positions The positions of the tokens, of shape ``[num_tokens]``.
+  /// \param hidden_states The input of shape ``[num_tokens, hidden_size]``.
+  /// \param kv_cache The cache, to which the keys and values of the tokens are written.
+  /// \param metadata The layout of the batch in the cache.
+  /// \return The output of shape ``[num_tokens, hidden_size]``.
+  torch::Tensor forward(
+    const torch::Tensor &positions,
+    const torch::Tensor &hidden_states,
+    paged_kv_cache &kv_cache,
+    const attention_metadata &metadata);
+
+ private:
+  int64_t layer_idx_;
+  int64_t num_heads_;
+  int64_t num_kv_heads_;
+  int64_t head_dim_;
+  double scaling_;
+  linear qkv_proj_{nullptr};
+  linear o_proj_{nullptr};
+  rotary_embedding rotary_emb_;
+};
+TORCH_MODULE_IMPL(llama_attention, llama_attention_impl);
+
+/// \brief Decoder layer of Llama, i.e., pre-normalized attention followed by a pre-normalized feed-forward network.
+class MAKO_API llama_decoder_layer_impl : public torch::nn::Module {
+ public:
+  llama_decoder_layer_impl(const llama_config &config, int64_t layer_idx, rotary_embedding rotary_emb);
+
+  /// \param positions The positions of the tokens.
+  /// \param hidden_states The output of the previous layer, which is not yet added to the residual stream.
+  /// \param residual The residual stream, or an undefined tensor for the first layer.
+  /// \param kv_cache The cache.
+  /// \param metadata The layout of the batch in the cache.
+  /// \return The output of this layer, which is not yet added to the updated residual stream.
+  torch::Tensor forward(
+    const torch::Tensor &positions,
+    const torch::Tensor &hidden_states,
+    torch::Tensor &residual,
+    paged_kv_cache &kv_cache,
+    const attention_metadata &metadata);
+
+ private:
+  llama_attention self_attn_{nullptr};
+  llama_mlp mlp_{nullptr};
+  rms_norm input_layernorm_{nullptr};
+  rms_norm post_attention_layernorm_{nullptr};
+};
+TORCH_MODULE_IMPL(llama_decoder_layer, llama_decoder_layer_impl);
+
+/// \brief Stack of decoder layers of Llama between the token embeddings and the final normalization.
+class MAKO_API llama_model_impl : public torch::nn::Module {
+ public:
+  explicit llama_model_impl(const llama_config &config);
+
+  torch::Tensor forward(
+    const torch::Tensor &input_ids,
+    const torch::Tensor &positions,
+    paged_kv_cache &kv_cache,
+    const attention_metadata &metadata);
+
+  /// \brief The token embeddings, which may be shared with the language modeling head.
+  const torch::Tensor &embedding_weight() const {
+    return embed_tokens_->weight;
+  }
+
+ private:
+  torch::nn::Embedding embed_tokens_{nullptr};
+  rotary_embedding rotary_emb_{nullptr};
+  std::vector<llama_decoder_layer> layers_;
+  rms_norm norm_{nullptr};
+};
+TORCH_MODULE_IMPL(llama_model, llama_model_impl);
+
+/// \brief Llama with a language modeling head, which loads the checkpoints of ``LlamaForCausalLM``.
+///
+/// The parameters are named as in Hugging Face Transformers, except that the projections fused at load time are
+/// named ``qkv_proj`` and ``gate_up_proj``; use ``load_weight`` to load the weights of a checkpoint, e.g., as they
+/// stream out of ``mako::utils::weight_iterator``. If ``llama_config::quantize`` is set, the projections of the decoder
+/// layers take the ``qweight`` and ``scales`` the iterator yields when quantizing with the same scheme.
+class MAKO_API llama_for_causal_lm_impl : public torch::nn::Module {
+ public:
+  explicit llama_for_causal_lm_impl(const llama_config &config);
+
+  /// \brief Runs the decoder layers over a batch of tokens.
+  /// \param input_ids The tokens of all sequences in the batch, concatenated into shape ``[num_tokens]``.
+  /// \param positions The positions of the tokens in their sequences, of shape ``[num_tokens]``.
+  /// \param kv_cache The cache, as created by ``make_kv_cache``.
+  /// \param metadata The layout of the batch in the cache.
+  /// \return The hidden states of shape ``[num_tokens, hidden_size]``.
+  torch::Tensor forward(
+    const torch::Tensor &input_ids,
+    const torch::Tensor &positions,
+    paged_kv_cache &kv_cache,
+    const attention_metadata &metadata);
+
+  /// \brief Projects hidden states onto the vocabulary.
+  ///
+  /// This is kept apart from ``forward`` so that only the hidden states to sample from, e.g., the last of each
+  /// prompt, go through the largest GEMM of the model.
+  /// \param hidden_states The hidden states of shape ``[..., hidden_size]``.
+  /// \return The logits of shape ``[..., vocab_size]``.
+  torch::Tensor compute_logits(const torch::Tensor &hidden_states);
+
+  /// \brief Creates a paged cache of keys and values for all layers, with the same dtype and device as the
+  /// parameters.
+  /// \param num_blocks The number of blocks in the pool.
+  /// \param block_size The number of tokens per block.
+  /// \return The cache.
+  paged_kv_cache make_kv_cache(int64_t num_blocks, int64_t block_size = 16) const;
+
+  /// \brief Loads a weight of a Hugging Face checkpoint into the corresponding parameter.
+  ///
+  /// The weights of ``q_proj``, ``k_proj``, and ``v_proj`` are copied into their rows of ``qkv_proj``, and those of
+  /// ``gate_proj`` and ``up_proj`` into their rows of ``gate_up_proj``, and so are their quantized integers and
+  /// scales; the weight is converted to the dtype and device of the parameter on the fly. The inverse frequencies of
+  /// rotary embedding some checkpoints carry for each layer are skipped, as they are computed into the cache of cosines
+  /// and sines shared by all layers.
+  /// \param name The name of the weight in the checkpoint, e.g., ``model.layers.0.self_attn.q_proj.weight``.
+  /// \param weight The weight.
+  void load_weight(absl::string_view name, const torch::Tensor &weight);
+
+  const llama_config &config() const {
+    return config_;
+  }
+
+ private:
+  llama_config config_;
+  llama_model model_{nullptr};
+  torch::nn::Linear lm_head_{nullptr};
+
+  /// \brief The parameters by their names, collected on the first ``load_weight`` rather than for every weight, which
+  /// would take quadratic time in the number of parameters.
+  torch::OrderedDict<std::string, torch::Tensor> named_parameters_;
+};
+TORCH_MODULE_IMPL(llama_for_causal_lm, llama_for_causal_lm_impl);
+} // namespace nn
+} // namespace mako
@@ -0,0 +1,174 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/nn/modules/llama.h"
+
+#include <filesystem>
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+namespace fs = std::filesystem;
+
+/// \brief A configuration small enough to run in a test, with grouped-query attention.
+static inline mako::nn::llama_config tiny_config() {
+  mako::nn::llama_config config;
+  config.vocab_size          = 64;
+  config.hidden_size         = 32;
+  config.intermediate_size   = 48;
+  config.num_hidden_layers   = 2;
+  config.num_attention_heads = 4;
+  config.num_key_value_heads = 2;
+  return config;
+}
+
+TEST(LlamaConfigTest, FromPretrained) {
+  auto filename = fs::temp_directory_path() / fs::path("llama_config_test.json");
+  {
+    std::ofstream stream(filename);
+    stream << R"({"hidden_size":64,"num_attention_heads":4,"rope_theta":500000.0,)"
+           << R"("rope_scaling":{"rope_type":"yarn","factor":4.0,"original_max_position_embeddings":8192}})";
+  }
+
+  auto config = mako::nn::llama_config::from_pretrained(filename.string());
+  EXPECT_EQ(config.head_dim(), 16);
+  EXPECT_EQ(config.num_key_value_heads, 4);
+  EXPECT_EQ(config.rope_theta, 500000.0);
+  EXPECT_EQ(config.rope_scaling.type, "yarn");
+  EXPECT_EQ(config.rope_scaling.factor, 4.0);
+  EXPECT_EQ(config.rope_scaling.original_max_position_embeddings, 8192);
+  fs::remove(filename);
+}
+
+TEST(LlamaTest, LoadWeight) {
+  auto config = tiny_config();
+  mako::nn::llama_for_causal_lm model(config);
+
+  auto q    = torch::randn({32, 32});
+  auto k    = torch::randn({16, 32});
+  auto v    = torch::randn({16, 32});
+  auto gate = torch::randn({48, 32});
+  auto up   = torch::randn({48, 32});
+  model->load_weight("model.layers.1.self_attn.q_proj.weight", q);
+  model->load_weight("model.layers.1.self_attn.k_proj.weight", k);
+  model->load_weight("model.layers.1.self_attn.v_proj.weight", v);
+  model->load_weight("model.layers.1.mlp.gate_proj.weight", gate);
+  model->load_weight("model.layers.1.mlp.up_proj.weight", up);
+  model->load_weight("model.layers.1.self_attn.rotary_emb.inv_freq", torch::ones({4}));
+
+  auto params = model->named_parameters();
+  EXPECT_TRUE(torch::equal(params["model.layers.1.self_attn.qkv_proj.weight"], torch::cat({q, k, v})));
+  EXPECT_TRUE(torch::equal(params["model.layers.1.mlp.gate_up_proj.weight"], torch::cat({gate, up})));
+  // The inverse frequencies are not kept for any layer, but computed into one cache shared by all layers.
+  EXPECT_EQ(model->named_buffers().keys(), std::vector<std::string>({"model.rotary_emb.cos_sin_cache"}));
+  EXPECT_THROW(model->load_weight("model.layers.2.mlp.down_proj.weight", torch::ones({32, 48})), std::invalid_argument);
+  EXPECT_THROW(model->load_weight("model.norm.weight", torch::ones({16})), std::invalid_argument);
+  // A projection sliced for tensor parallelism does not fill its rows of the fused parameter.
+  EXPECT_THROW(model->load_weight("model.layers.1.self_attn.q_proj.weight", q.narrow(0, 0, 16)), std::invalid_argument);
+  EXPECT_THROW(model->load_weight("model.layers.1.mlp.up_proj.weight", up.narrow(1, 0, 16)), std::invalid_argument);
+}
+
+TEST(LlamaTest, LoadQuantizedWeight) {
+  namespace quantization = mako::utils::quantization;
+  auto config            = tiny_config();
+  config.quantize        = quantization::scheme::int4;
+  config.group_size      = 16;
+  mako::nn::llama_for_causal_lm model(config);
+  model->to(torch::kBFloat16);
+
+  auto q = quantization::quantize(torch::randn({32, 32}), config.quantize, config.group_size);
+  auto k = quantization::quantize(torch::randn({16, 32}), config.quantize, config.group_size);
+  auto v = quantization::quantize(torch::randn({16, 32}), config.quantize, config.group_size);
+  auto o = quantization::quantize(torch::randn({32, 32}), config.quantize, config.group_size);
+  model->load_weight("model.layers.0.self_attn.q_proj.qweight", q.first);
+  model->load_weight("model.layers.0.self_attn.q_proj.scales", q.second);
+  model->load_weight("model.layers.0.self_attn.k_proj.qweight", k.first);
+  model->load_weight("model.layers.0.self_attn.k_proj.scales", k.second);
+  model->load_weight("model.layers.0.self_attn.v_proj.qweight", v.first);
+  model->load_weight("model.layers.0.self_attn.v_proj.scales", v.second);
+  model->load_weight("model.layers.0.self_attn.o_proj.qweight", o.first);
+  model->load_weight("model.layers.0.self_attn.o_proj.scales", o.second);
+
+  // The integers and the scales are fused like the weights, and keep their dtypes in a half-precision model.
+  auto params = model->named_parameters();
+  auto qweight = torch::cat({q.first, k.first, v.first});
+  auto scales  = torch::cat({q.second, k.second, v.second});
+  EXPECT_TRUE(torch::equal(params["model.layers.0.self_attn.qkv_proj.qweight"], qweight));
+  EXPECT_TRUE(torch::equal(params["model.layers.0.self_attn.qkv_proj.scales"], scales));
+  EXPECT_TRUE(torch::equal(params["model.layers.0.self_attn.o_proj.qweight"], o.first));
+  EXPECT_EQ(params["model.layers.0.self_attn.o_proj.scales"].scalar_type(), torch::kFloat32);
+  EXPECT_THROW(model->load_weight("model.layers.0.mlp.down_proj.weight", torch::ones({32, 48})), std::invalid_argument);
+}
+
+/// \brief Lays out sequences of consecutive blocks in a paged cache.
+/// \param __blocks The first block of each sequence.
+/// \param __query_lens The number of tokens of each sequence in the batch.
+/// \param __context_lens The number of tokens of each sequence in the cache.
+/// \return The metadata with 4 tokens per block.
+static inline mako::nn::attention_metadata make_metadata(
+  const std::vector<int64_t> &__blocks,
+  const std::vector<int64_t> &__query_lens,
+  const std::vector<int64_t> &__context_lens) {
+  std::vector<int64_t> slots;
+  std::vector<int64_t> tables;
+  for (size_t seq = 0; seq < __blocks.size(); ++seq) {
+    for (auto pos = __context_lens[seq] - __query_lens[seq]; pos < __context_lens[seq]; ++pos) {
+      slots.push_back(__blocks[seq] * 4 + pos);
+    }
+    tables.insert(tables.end(), {__blocks[seq], __blocks[seq] + 1});
+  }
+
+  mako::nn::attention_metadata metadata;
+  metadata.slot_mapping = torch::tensor(slots, torch::kInt64);
+  metadata.block_tables = torch::tensor(tables, torch::kInt64).view({-1, 2});
+  metadata.query_lens   = __query_lens;
+  metadata.context_lens = __context_lens;
+  return metadata;
+}
+
+TEST(LlamaTest, IncrementalDecoding) {
+  // Decoding the last token against the cache must give the same hidden state as running the whole sequence.
+  auto config = tiny_config();
+  mako::nn::llama_for_causal_lm model(config);
+
+  // Two sequences of 6 and 4 tokens, in blocks 0-1 and 2-3.
+  auto input_ids = torch::randint(config.vocab_size, {10}, torch::kInt64);
+  auto positions = torch::tensor({0, 1, 2, 3, 4, 5, 0, 1, 2, 3}, torch::kInt64);
+
+  auto full_cache = model->make_kv_cache(4, 4);
+  auto full       = model->forward(input_ids, positions, full_cache, make_metadata({0, 2}, {6, 4}, {6, 4}));
+
+  auto cache   = model->make_kv_cache(4, 4);
+  auto prefill = torch::tensor({0, 1, 2, 3, 4, 6, 7, 8}, torch::kInt64);
+  model->forward(
+    input_ids.index_select(0, prefill),
+    positions.index_select(0, prefill),
+    cache,
+    make_metadata({0, 2}, {5, 3}, {5, 3}));
+
+  auto decode = torch::tensor({5, 9}, torch::kInt64);
+  auto last   = model->forward(
+    input_ids.index_select(0, decode),
+    positions.index_select(0, decode),
+    cache,
+    make_metadata({0, 2}, {1, 1}, {6, 4}));
+
+  EXPECT_TRUE(torch::allclose(last, full.index_select(0, decode), 1e-4, 1e-4));
+  EXPECT_EQ(model->compute_logits(last).sizes(), torch::IntArrayRef({2, 64}));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
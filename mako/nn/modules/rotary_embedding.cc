@@ -0,0 +1,139 @@
+// Adapted from https://github.com/vllm-project/vllm/blob/v0.2.7/vllm/model_executor/layers/rotary_embedding.py
+// Copyright 2024 The Mako Authors
+// Copyright 2023 The vLLM team
+// Copyright 2022 EleutherAI and the HuggingFace Inc. team. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/nn/modules/rotary_embedding.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <absl/strings/str_format.h>
+
+/// \brief Computes the inverse frequencies of the channel pairs.
+/// \param __head_dim The number of channels per head.
+/// \param __base The base of the frequencies.
+/// \return The inverse frequencies of shape ``[head_dim / 2]``.
+static inline torch::Tensor compute_inv_freq(int64_t __head_dim, double __base) {
+  return torch::pow(__base, torch::arange(0, __head_dim, 2, torch::kFloat32).div(__head_dim)).reciprocal();
+}
+
+/// \brief Finds the channel pair that makes ``__num_rotations`` rotations over the original context.
+static inline double yarn_find_correction_dim(
+  double __num_rotations,
+  int64_t __head_dim,
+  double __base,
+  int64_t __max_position_embeddings) {
+  return __head_dim * std::log(__max_position_embeddings / (__num_rotations * 2 * M_PI)) / (2 * std::log(__base));
+}
+
+/// \brief Computes the inverse frequencies of YaRN, which interpolates the low-frequency channel pairs and
+/// extrapolates the high-frequency ones, with a linear ramp in between.
+/// \param __head_dim The number of channels per head.
+/// \param __base The base of the frequencies.
+/// \param __max_position_embeddings The original context length.
+/// \param __scaling The scaling.
+/// \return The inverse frequencies of shape ``[head_dim / 2]``.
+static inline torch::Tensor yarn_compute_inv_freq(
+  int64_t __head_dim,
+  double __base,
+  int64_t __max_position_embeddings,
+  const mako::nn::rope_scaling_config &__scaling) {
+  auto extrapolation = compute_inv_freq(__head_dim, __base);
+  auto interpolation = extrapolation.div(__scaling.factor);
+
+  auto low  = std::floor(yarn_find_correction_dim(__scaling.beta_fast, __head_dim, __base, __max_position_embeddings));
+  auto high = std::ceil(yarn_find_correction_dim(__scaling.beta_slow, __head_dim, __base, __max_position_embeddings));
+  low       = std::max(low, 0.0);
+  high      = std::min(high, static_cast<double>(__head_dim - 1));
+  if (low == high) {
+    high += 0.001;
+  }
+  auto ramp = torch::arange(__head_dim / 2, torch::kFloat32).sub_(low).div_(high - low).clamp_(0, 1);
+  auto mask = ramp.neg().add_(1).mul_(__scaling.extrapolation_factor);
+  return interpolation.mul(mask.neg().add(1)).add_(extrapolation.mul(mask));
+}
+
+mako::nn::rotary_embedding_impl::rotary_embedding_impl(
+  int64_t head_dim,
+  int64_t max_position_embeddings,
+  double base,
+  const rope_scaling_config &scaling) {
+  auto original_max_position = scaling.original_max_position_embeddings != 0
+                                 ? scaling.original_max_position_embeddings
+                                 : max_position_embeddings;
+
+  torch::Tensor inv_freq;
+  torch::Tensor positions;
+  double mscale = 1.0;
+  if (scaling.type.empty()) {
+    inv_freq  = compute_inv_freq(head_dim, base);
+    positions = torch::arange(max_position_embeddings, torch::kFloat32);
+  } else if (scaling.type == "linear") {
+    // Position interpolation squeezes the extended positions into the original range.
+    auto max_position = static_cast<int64_t>(max_position_embeddings * scaling.factor);
+    inv_freq          = compute_inv_freq(head_dim, base);
+    positions         = torch::arange(max_position, torch::kFloat32).div_(scaling.factor);
+  } else if (scaling.type == "dynamic") {
+    // NTK-aware scaling raises the base instead, which stretches the low frequencies more than the high ones.
+    auto max_position = static_cast<int64_t>(max_position_embeddings * scaling.factor);
+    auto scaled_base  = base * std::pow(
+                                scaling.factor * max_position / max_position_embeddings - (scaling.factor - 1),
+                                static_cast<double>(head_dim) / (head_dim - 2));
+    inv_freq          = compute_inv_freq(head_dim, scaled_base);
+    positions         = torch::arange(max_position, torch::kFloat32);
+  } else if (scaling.type == "yarn") {
+    auto max_position = static_cast<int64_t>(original_max_position * scaling.factor);
+    inv_freq          = yarn_compute_inv_freq(head_dim, base, original_max_position, scaling);
+    positions         = torch::arange(max_position, torch::kFloat32);
+    // The attention is sharpened to make up for the entropy the interpolated channels lose.
+    mscale = (scaling.factor <= 1 ? 1.0 : 0.1 * std::log(scaling.factor) + 1.0) * scaling.attn_factor;
+  } else {
+    throw std::invalid_argument(absl::StrFormat("Unknown RoPE scaling type: %s", scaling.type));
+  }
+
+  auto freqs     = positions.unsqueeze(-1).mul(inv_freq);
+  auto cos_sin   = torch::cat({freqs.cos().mul_(mscale), freqs.sin().mul_(mscale)}, -1);
+  cos_sin_cache_ = register_buffer("cos_sin_cache", cos_sin);
+}
+
+/// \brief Rotates each pair of channels ``i`` and ``i + head_dim / 2`` of ``__x`` in place.
+/// \param __x The tensor of shape ``[num_tokens, num_heads, head_dim]``.
+/// \param __cos The cosines of shape ``[num_tokens, 1, head_dim / 2]``.
+/// \param __sin The sines of shape ``[num_tokens, 1, head_dim / 2]``.
+static inline void rotate_(const torch::Tensor &__x, const torch::Tensor &__cos, const torch::Tensor &__sin) {
+  auto half = __x.size(-1) / 2;
+  auto x1   = __x.narrow(-1, 0, half);
+  auto x2   = __x.narrow(-1, half, half);
+  // Only the products with the sines need the other half before it is overwritten, so the temporaries take up half
+  // of the channels, and nothing is concatenated.
+  auto x1_sin = x1.mul(__sin);
+  auto x2_sin = x2.mul(__sin);
+  x1.mul_(__cos).sub_(x2_sin);
+  x2.mul_(__cos).add_(x1_sin);
+}
+
+void mako::nn::rotary_embedding_impl::forward(
+  const torch::Tensor &positions,
+  const torch::Tensor &query,
+  const torch::Tensor &key) {
+  auto half    = cos_sin_cache_.size(-1) / 2;
+  auto cos_sin = cos_sin_cache_.index_select(0, positions).to(query.scalar_type()).unsqueeze(1);
+  auto cos     = cos_sin.narrow(-1, 0, half);
+  auto sin     = cos_sin.narrow(-1, half, half);
+  rotate_(query, cos, sin);
+  rotate_(key, cos, sin);
+}
@@ -0,0 +1,90 @@
+// Adapted from https://github.com/vllm-project/vllm/blob/v0.2.7/vllm/model_executor/layers/rotary_embedding.py
+// Copyright 2024 The Mako Authors
+// Copyright 2023 The vLLM team
+// Copyright 2022 EleutherAI and the HuggingFace Inc. team. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <torch/torch.h>
+
+#include "mako/utils/export.h"
+
+namespace mako {
+namespace nn {
+/// \brief Scaling of rotary position embedding to contexts longer than the model was trained on, with the same fields
+/// as ``rope_scaling`` of ``config.json``.
+struct MAKO_API rope_scaling_config {
+  /// \brief ``linear`` for position interpolation, ``dynamic`` for NTK-aware scaling, ``yarn`` for YaRN, or empty
+  /// for no scaling.
+  std::string type;
+
+  /// \brief The ratio of the extended context length to the original one.
+  double factor = 1.0;
+
+  /// \brief The context length the model was trained on, or ``0`` for ``max_position_embeddings``.
+  int64_t original_max_position_embeddings = 0;
+
+  /// \brief How much of the original frequencies YaRN keeps for the high-frequency channels.
+  double extrapolation_factor = 1.0;
+
+  /// \brief The factor YaRN scales the attention by, on top of its own temperature.
+  double attn_factor = 1.0;
+
+  /// \brief The number of rotations over the original context above which YaRN keeps a channel as is.
+  double beta_fast = 32.0;
+
+  /// \brief The number of rotations over the original context below which YaRN interpolates a channel.
+  double beta_slow = 1.0;
+};
+
+/// \brief Rotary position embedding in the style of GPT-NeoX, which rotates each pair of channels ``i`` and
+/// ``i + head_dim / 2``.
+///
+/// The cosines and sines of all positions are computed once at construction into a single cache, which the layers of
+/// a model share instead of each recomputing them from its inverse frequencies at every step.
+class MAKO_API rotary_embedding_impl : public torch::nn::Module {
+ public:
+  /// \param head_dim The number of channels per head, all of which are rotated.
+  /// \param max_position_embeddings The maximum number of positions, before scaling.
+  /// \param base The base of the frequencies, i.e., ``rope_theta``.
+  /// \param scaling The scaling, which extends the number of positions by its factor.
+  /// \throw std::invalid_argument If the type of scaling is unknown.
+  rotary_embedding_impl(
+    int64_t head_dim,
+    int64_t max_position_embeddings,
+    double base,
+    const rope_scaling_config &scaling = {});
+
+  /// \brief Rotates queries and keys by their positions, in place.
+  /// \param positions The positions of the tokens, of shape ``[num_tokens]``.
+  /// \param query The queries of shape ``[num_tokens, num_heads, head_dim]``, possibly a view of a larger tensor.
+  /// \param key The keys of shape ``[num_tokens, num_kv_heads, head_dim]``, possibly a view of a larger tensor.
+  void forward(const torch::Tensor &positions, const torch::Tensor &query, const torch::Tensor &key);
+
+  /// \brief The cosines and the sines of all positions, of shape ``[max_position, head_dim]``, with the cosines in
+  /// the first half of the channels and the sines in the other half.
+  const torch::Tensor &cos_sin_cache() const {
+    return cos_sin_cache_;
+  }
+
+ private:
+  torch::Tensor cos_sin_cache_;
+};
+TORCH_MODULE_IMPL(rotary_embedding, rotary_embedding_impl);
+} // namespace nn
+} // namespace mako
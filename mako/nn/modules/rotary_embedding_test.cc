@@ -0,0 +1,90 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/nn/modules/rotary_embedding.h"
+
+#include <cmath>
+
+#include <gtest/gtest.h>
+
+/// \brief Rotates queries as in Hugging Face Transformers, by concatenating the rotated halves.
+/// \param __query The queries of shape ``[num_tokens, num_heads, head_dim]``.
+/// \param __positions The positions of the tokens.
+/// \param __base The base of the frequencies.
+/// \return The rotated queries.
+static inline torch::Tensor reference(const torch::Tensor &__query, const torch::Tensor &__positions, double __base) {
+  auto head_dim = __query.size(-1);
+  auto half     = head_dim / 2;
+  auto inv_freq = torch::pow(__base, torch::arange(0, head_dim, 2, torch::kFloat32).div(head_dim)).reciprocal();
+  auto freqs    = __positions.to(torch::kFloat32).unsqueeze(-1).mul(inv_freq);
+  auto emb      = torch::cat({freqs, freqs}, -1).unsqueeze(1);
+  auto rotated  = torch::cat({__query.narrow(-1, half, half).neg(), __query.narrow(-1, 0, half)}, -1);
+  return __query.mul(emb.cos()).add(rotated.mul(emb.sin()));
+}
+
+TEST(RotaryEmbeddingTest, Forward) {
+  mako::nn::rotary_embedding rotary_emb(8, 64, 10000.0);
+  EXPECT_EQ(rotary_emb->cos_sin_cache().sizes(), torch::IntArrayRef({64, 8}));
+
+  // The queries and keys are views into one fused tensor, as they are in attention.
+  auto positions = torch::tensor({0, 5, 63}, torch::kInt64);
+  auto qkv       = torch::randn({3, 24});
+  auto expected  = reference(qkv.narrow(-1, 0, 16).view({3, 2, 8}), positions, 10000.0);
+  auto original  = qkv.narrow(-1, 16, 8).clone();
+  auto query     = qkv.narrow(-1, 0, 16).view({3, 2, 8});
+  auto key       = qkv.narrow(-1, 16, 8).view({3, 1, 8});
+  rotary_emb(positions, query, key);
+  EXPECT_TRUE(torch::allclose(qkv.narrow(-1, 0, 16).view({3, 2, 8}), expected, 1e-5, 1e-5));
+  EXPECT_TRUE(torch::allclose(key, reference(original.view({3, 1, 8}), positions, 10000.0), 1e-5, 1e-5));
+}
+
+TEST(RotaryEmbeddingTest, Scaling) {
+  mako::nn::rope_scaling_config linear;
+  linear.type   = "linear";
+  linear.factor = 2.0;
+  mako::nn::rotary_embedding unscaled(8, 64, 10000.0);
+  mako::nn::rotary_embedding interpolated(8, 64, 10000.0, linear);
+
+  // Position interpolation doubles the positions, each of which rotates as far as half of it did before.
+  auto cache = interpolated->cos_sin_cache();
+  EXPECT_EQ(cache.size(0), 128);
+  EXPECT_TRUE(torch::allclose(cache.slice(0, 0, 128, 2), unscaled->cos_sin_cache(), 1e-5, 1e-5));
+
+  mako::nn::rope_scaling_config dynamic;
+  dynamic.type   = "dynamic";
+  dynamic.factor = 4.0;
+  cache          = mako::nn::rotary_embedding(8, 64, 10000.0, dynamic)->cos_sin_cache();
+  EXPECT_EQ(cache.size(0), 256);
+  EXPECT_TRUE(torch::allclose(cache[0], unscaled->cos_sin_cache()[0]));
+
+  // YaRN extends the original context rather than the given one, and scales the cosines and sines by its temperature.
+  mako::nn::rope_scaling_config yarn;
+  yarn.type                             = "yarn";
+  yarn.factor                           = 4.0;
+  yarn.original_max_position_embeddings = 32;
+  cache                                 = mako::nn::rotary_embedding(8, 64, 10000.0, yarn)->cos_sin_cache();
+  EXPECT_EQ(cache.size(0), 128);
+  auto mscale = 0.1 * std::log(4.0) + 1.0;
+  auto norms  = cache.narrow(-1, 0, 4).pow(2).add(cache.narrow(-1, 4, 4).pow(2));
+  EXPECT_TRUE(torch::allclose(norms, torch::full_like(norms, mscale * mscale), 1e-5, 1e-5));
+
+  mako::nn::rope_scaling_config unknown;
+  unknown.type = "unknown";
+  EXPECT_THROW(mako::nn::rotary_embedding(8, 64, 10000.0, unknown), std::invalid_argument);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
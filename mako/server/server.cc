@@ -0,0 +1,738 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/server/server.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <absl/container/flat_hash_map.h>
+#include <absl/strings/str_cat.h>
+#include <absl/strings/str_format.h>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <nlohmann/json.hpp>
+
+#include "mako/utils/metrics.h"
+#include "mako/utils/mpsc_queue.h"
+
+namespace beast      = boost::beast;
+namespace beast_http = boost::beast::http;
+
+using tcp = boost::asio::ip::tcp;
+
+/// \brief A request from the I/O thread to the engine thread.
+struct command {
+  std::string request_id;
+
+  /// \brief Whether to abort the request rather than add it.
+  bool abort;
+
+  std::vector<int64_t> prompt_token_ids;
+  mako::engine::sampling_params params;
+};
+
+/// \brief Tokens from the engine thread to the I/O thread.
+struct event {
+  std::string request_id;
+  std::vector<int64_t> token_ids;
+  bool finished;
+
+  /// \brief Why the request was rejected, if it was.
+  std::string error;
+};
+
+/// \brief Reads an optional field of a request, where ``null`` stands for the default as well.
+/// \tparam T The type of the field.
+/// \param __body The request.
+/// \param __name The name of the field.
+/// \param __default The value if the field is not given.
+/// \return The value of the field.
+/// \throw nlohmann::json::type_error If the field is of another type.
+template <typename T>
+static inline T field(const nlohmann::json &__body, const char *__name, T __default) {
+  auto it = __body.find(__name);
+  if (it == __body.end() || it->is_null()) {
+    return __default;
+  }
+  return it->get<T>();
+}
+
+/// \brief Frames a piece of a response body in the chunked transfer coding.
+static inline std::string chunk(absl::string_view __data) {
+  return absl::StrFormat("%x\r\n%s\r\n", __data.size(), __data);
+}
+
+/// \brief Frames a message as a server-sent event, in the chunked transfer coding.
+static inline std::string server_sent_event(const nlohmann::json &__message) {
+  auto data = __message.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+  return chunk(absl::StrCat("data: ", data, "\n\n"));
+}
+
+class mako::server::api_server::impl {
+ public:
+  class session;
+
+  impl(engine::llm_engine &engine, const utils::tokenizer &tokenizer, server_config config)
+      : engine_(engine),
+        tokenizer_(tokenizer),
+        config_(std::move(config)),
+        acceptor_(context_, tcp::endpoint(boost::asio::ip::make_address(config_.host), config_.port)),
+        encoders_(std::max<size_t>(1, config_.num_encode_threads)) {}
+
+  void run();
+
+  void stop() {
+    context_.stop();
+  }
+
+  uint16_t port() const {
+    return acceptor_.local_endpoint().port();
+  }
+
+  /// \brief Hands a new request over to the engine thread, on the I/O thread.
+  void add(std::shared_ptr<session> session, command request);
+
+  /// \brief Aborts a request, on the I/O thread.
+  void abort(const std::string &request_id);
+
+  engine::llm_engine &engine_;
+  const utils::tokenizer &tokenizer_;
+  server_config config_;
+
+  /// \brief The number of requests so far, to name the next one after.
+  uint64_t num_requests_ = 0;
+
+ private:
+  /// \brief Accepts connections, each of which becomes a session.
+  void accept();
+
+  /// \brief Passes the events of the engine thread to their sessions, on the I/O thread.
+  void dispatch();
+
+  /// \brief Runs the engine, on the engine thread.
+  void serve();
+
+  /// \brief Wakes the engine thread up if it sleeps, after a command is pushed.
+  void wake();
+
+  /// \brief Wakes the engine thread up unconditionally.
+  void notify();
+
+  /// \brief The event loop, declared first to outlive the sockets and the pending handlers that refer to it.
+  boost::asio::io_context context_;
+  tcp::acceptor acceptor_;
+
+  /// \brief The threads encoding prompts, declared after the event loop so that they are joined before the handlers
+  /// they post to it are destroyed.
+  boost::asio::thread_pool encoders_;
+
+  /// \brief The sessions of the unfinished requests, which keep them alive while no I/O is pending on them.
+  absl::flat_hash_map<std::string, std::shared_ptr<session>> sessions_;
+
+  utils::mpsc_queue<command> commands_;
+  utils::mpsc_queue<event> events_;
+
+  /// \brief Whether ``dispatch`` has been posted to the event loop, not to post it again for each step.
+  std::atomic<bool> dispatching_{false};
+
+  std::atomic<bool> stopped_{false};
+
+  /// \brief Whether the engine thread is about to sleep or sleeps; only then do producers take ``mutex_``.
+  std::atomic<bool> idle_{false};
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+};
+
+/// \brief A connection, which serves one request at a time.
+class mako::server::api_server::impl::session : public std::enable_shared_from_this<session> {
+ public:
+  session(impl &server, tcp::socket socket) : server_(server), stream_(std::move(socket)) {}
+
+  void start() {
+    read();
+  }
+
+  /// \brief Writes the tokens of an event to the client.
+  void on_event(const event &e);
+
+ private:
+  void read();
+  void on_read(beast::error_code ec);
+
+  /// \brief Routes a request to its endpoint.
+  void handle(const beast_http::request<beast_http::string_body> &req);
+
+  /// \brief Starts serving a completion request, whose prompt is encoded on ``impl::encoders_`` if it is text.
+  void complete(const std::string &body);
+
+  /// \brief Hands a completion request with its encoded prompt over to the engine, on the I/O thread.
+  void start(command request);
+
+  /// \brief Writes a complete response with a JSON body.
+  void respond(beast_http::status status, const nlohmann::json &body);
+
+  /// \brief Writes a complete response with a body of the given type.
+  void respond(beast_http::status status, std::string body, absl::string_view content_type);
+
+  /// \brief Writes an error response in the format of OpenAI.
+  void respond_error(beast_http::status status, absl::string_view message);
+
+  /// \brief Queues bytes to write, starting the write unless one is in flight.
+  void write(std::string data);
+  void on_write(beast::error_code ec);
+
+  /// \brief Waits for the socket to become readable while a request is served, which it does once the client closes
+  /// the connection; no read is pending then, so the request would otherwise only be aborted by a failed write.
+  void watch();
+  void on_watch(beast::error_code ec);
+
+  /// \brief The choice of a completion, with ``text`` and ``finish_reason``.
+  nlohmann::json choice(std::string text, bool finished) const;
+
+  impl &server_;
+  beast::tcp_stream stream_;
+  beast::flat_buffer buffer_;
+  std::optional<beast_http::request_parser<beast_http::string_body>> parser_;
+
+  /// \brief The bytes to write, the first of which is being written.
+  std::deque<std::string> writes_;
+
+  bool keep_alive_ = false;
+
+  /// \brief Whether the response is complete once ``writes_`` is drained.
+  bool done_ = true;
+
+  /// \brief Whether ``watch`` is waiting on the socket.
+  bool watching_ = false;
+
+  // The completion being served.
+  std::string request_id_;
+  bool active_        = false;
+  bool streaming_     = false;
+  bool include_usage_ = false;
+  bool started_       = false;
+  int64_t created_    = 0;
+  std::vector<int64_t> stop_token_ids_;
+  size_t num_prompt_tokens_     = 0;
+  size_t num_completion_tokens_ = 0;
+  int64_t last_token_id_        = -1;
+  std::optional<mako::utils::incremental_detokenizer> detokenizer_;
+  std::string text_;
+};
+
+void mako::server::api_server::impl::session::read() {
+  parser_.emplace();
+  parser_->body_limit(server_.config_.max_body_size);
+  stream_.expires_after(std::chrono::seconds(server_.config_.timeout));
+  beast_http::async_read(
+    stream_,
+    buffer_,
+    *parser_,
+    [self = shared_from_this()](beast::error_code ec, size_t) { self->on_read(ec); });
+}
+
+void mako::server::api_server::impl::session::on_read(beast::error_code ec) {
+  if (ec == beast_http::error::body_limit) {
+    keep_alive_ = false;
+    respond_error(beast_http::status::payload_too_large, "The request body is too large");
+    return;
+  }
+  if (ec) {
+    // The client has closed the connection or timed out, which drops the session.
+    return;
+  }
+  auto req    = parser_->release();
+  keep_alive_ = req.keep_alive();
+  handle(req);
+}
+
+void mako::server::api_server::impl::session::handle(const beast_http::request<beast_http::string_body> &req) {
+  auto target = req.target();
+  target      = target.substr(0, target.find('?'));
+
+  if (target == "/health" && req.method() == beast_http::verb::get) {
+    respond(beast_http::status::ok, nlohmann::json::object());
+  } else if (target == "/v1/models" && req.method() == beast_http::verb::get) {
+    respond(
+      beast_http::status::ok,
+      {
+        {"object", "list"},
+        {"data",
+         nlohmann::json::array({
+           {{"id", server_.config_.served_model_name}, {"object", "model"}, {"owned_by", "mako"}},
+         })},
+    });
+  } else if (target == "/metrics" && req.method() == beast_http::verb::get) {
+    respond(
+      beast_http::status::ok,
+      mako::utils::metrics::registry::global().expose(),
+      "text/plain; version=0.0.4; charset=utf-8");
+  } else if (target == "/v1/completions" && req.method() == beast_http::verb::post) {
+    complete(req.body());
+  } else {
+    respond_error(
+      beast_http::status::not_found,
+      absl::StrFormat("No endpoint for %s %s", std::string(req.method_string()), std::string(target)));
+  }
+}
+
+void mako::server::api_server::impl::session::complete(const std::string &body) {
+  command request;
+  std::optional<std::string> text;
+  try {
+    auto json = nlohmann::json::parse(body);
+    if (!json.is_object()) {
+      throw std::invalid_argument("The request must be a JSON object");
+    }
+    if (field<int64_t>(json, "n", 1) != 1) {
+      throw std::invalid_argument("Only n = 1 is supported");
+    }
+
+    auto prompt = json.find("prompt");
+    if (prompt == json.end()) {
+      throw std::invalid_argument("The request has no prompt");
+    } else if (prompt->is_string()) {
+      text = prompt->get<std::string>();
+    } else if (prompt->is_array() && std::all_of(prompt->begin(), prompt->end(), [](const nlohmann::json &token) {
+                 return token.is_number_integer();
+               })) {
+      request.prompt_token_ids = prompt->get<std::vector<int64_t>>();
+    } else {
+      throw std::invalid_argument("The prompt must be a string or an array of token ids; batches are not supported");
+    }
+
+    auto &params              = request.params;
+    params.max_tokens         = field(json, "max_tokens", params.max_tokens);
+    params.temperature        = field(json, "temperature", params.temperature);
+    params.top_k              = field(json, "top_k", params.top_k);
+    params.top_p              = field(json, "top_p", params.top_p);
+    params.min_p              = field(json, "min_p", params.min_p);
+    params.repetition_penalty = field(json, "repetition_penalty", params.repetition_penalty);
+    params.frequency_penalty  = field(json, "frequency_penalty", params.frequency_penalty);
+    params.presence_penalty   = field(json, "presence_penalty", params.presence_penalty);
+    params.stop_token_ids     = field(json, "stop_token_ids", std::vector<int64_t>());
+    if (json.contains("seed") && !json.at("seed").is_null()) {
+      params.seed = json.at("seed").get<uint64_t>();
+    }
+    auto eos_token_id = server_.tokenizer_.eos_token_id();
+    if (eos_token_id.has_value() && !field(json, "ignore_eos", false)) {
+      params.stop_token_ids.push_back(*eos_token_id);
+    }
+
+    streaming_     = field(json, "stream", false);
+    include_usage_ = field(field(json, "stream_options", nlohmann::json::object()), "include_usage", false);
+  } catch (const nlohmann::json::exception &e) {
+    respond_error(beast_http::status::bad_request, e.what());
+    return;
+  } catch (const std::invalid_argument &e) {
+    respond_error(beast_http::status::bad_request, e.what());
+    return;
+  }
+
+  if (!text.has_value()) {
+    start(std::move(request));
+    return;
+  }
+  // A long prompt takes a while to encode, which would hold up every other connection on the I/O thread.
+  boost::asio::post(
+    server_.encoders_,
+    [self = shared_from_this(), text = std::move(*text), request = std::move(request)]() mutable {
+      std::string error;
+      try {
+        request.prompt_token_ids = self->server_.tokenizer_.encode(text);
+      } catch (const std::exception &e) {
+        error = e.what();
+      }
+      auto &context = self->server_.context_;
+      boost::asio::post(
+        context,
+        [self = std::move(self), request = std::move(request), error = std::move(error)]() mutable {
+          if (!error.empty()) {
+            self->respond_error(beast_http::status::bad_request, error);
+            return;
+          }
+          self->start(std::move(request));
+        });
+    });
+}
+
+void mako::server::api_server::impl::session::start(command request) {
+  request_id_            = absl::StrCat("cmpl-", server_.num_requests_++);
+  active_                = true;
+  started_               = false;
+  done_                  = false;
+  created_               = static_cast<int64_t>(std::time(nullptr));
+  stop_token_ids_        = request.params.stop_token_ids;
+  num_prompt_tokens_     = request.prompt_token_ids.size();
+  num_completion_tokens_ = 0;
+  last_token_id_         = -1;
+  text_.clear();
+  detokenizer_.emplace(server_.tokenizer_);
+
+  request.request_id = request_id_;
+  request.abort      = false;
+  server_.add(shared_from_this(), std::move(request));
+  watch();
+}
+
+nlohmann::json mako::server::api_server::impl::session::choice(std::string text, bool finished) const {
+  nlohmann::json finish_reason = nullptr;
+  if (finished) {
+    auto stopped  = std::find(stop_token_ids_.begin(), stop_token_ids_.end(), last_token_id_) != stop_token_ids_.end();
+    finish_reason = stopped ? "stop" : "length";
+  }
+  return {
+    {"index",         0                       },
+    {"text",          std::move(text)         },
+    {"logprobs",      nullptr                 },
+    {"finish_reason", std::move(finish_reason)},
+  };
+}
+
+void mako::server::api_server::impl::session::on_event(const event &e) {
+  if (!e.error.empty()) {
+    active_ = false;
+    respond_error(beast_http::status::bad_request, e.error);
+    return;
+  }
+
+  std::string delta;
+  for (auto token_id : e.token_ids) {
+    // Models may have more tokens than the tokenizer, e.g., to pad the vocabulary, which stand for no text.
+    if (token_id < server_.tokenizer_.vocab_size()) {
+      delta += detokenizer_->step(token_id);
+    }
+    last_token_id_ = token_id;
+  }
+  num_completion_tokens_ += e.token_ids.size();
+  if (e.finished) {
+    delta   += detokenizer_->flush();
+    active_  = false;
+  }
+
+  nlohmann::json completion = {
+    {"id",      request_id_                      },
+    {"object",  "text_completion"                },
+    {"created", created_                         },
+    {"model",   server_.config_.served_model_name},
+  };
+  nlohmann::json usage = {
+    {"prompt_tokens",     num_prompt_tokens_                         },
+    {"completion_tokens", num_completion_tokens_                     },
+    {"total_tokens",      num_prompt_tokens_ + num_completion_tokens_},
+  };
+
+  if (!streaming_) {
+    text_ += delta;
+    if (e.finished) {
+      completion["choices"] = nlohmann::json::array({choice(std::move(text_), true)});
+      completion["usage"]   = std::move(usage);
+      respond(beast_http::status::ok, completion);
+    }
+    return;
+  }
+
+  if (!started_) {
+    beast_http::response<beast_http::empty_body> res(beast_http::status::ok, 11);
+    res.set(beast_http::field::server, "mako");
+    res.set(beast_http::field::content_type, "text/event-stream");
+    res.set(beast_http::field::cache_control, "no-cache");
+    res.keep_alive(keep_alive_);
+    res.chunked(true);
+    std::ostringstream header;
+    header << res.base();
+    write(header.str());
+    started_ = true;
+  }
+  // The bytes of an incomplete character are held back, so a token may complete no text.
+  if (!delta.empty() || e.finished) {
+    completion["choices"] = nlohmann::json::array({choice(std::move(delta), e.finished)});
+    write(server_sent_event(completion));
+  }
+  if (e.finished) {
+    if (include_usage_) {
+      completion["choices"] = nlohmann::json::array();
+      completion["usage"]   = std::move(usage);
+      write(server_sent_event(completion));
+    }
+    write(chunk("data: [DONE]\n\n"));
+    done_ = true;
+    write(chunk(""));
+  }
+}
+
+void mako::server::api_server::impl::session::respond(beast_http::status status, const nlohmann::json &body) {
+  respond(status, body.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace), "application/json");
+}
+
+void mako::server::api_server::impl::session::respond(
+  beast_http::status status,
+  std::string body,
+  absl::string_view content_type) {
+  beast_http::response<beast_http::string_body> res(status, 11);
+  res.set(beast_http::field::server, "mako");
+  res.set(beast_http::field::content_type, beast::string_view(content_type.data(), content_type.size()));
+  res.keep_alive(keep_alive_);
+  res.body() = std::move(body);
+  res.prepare_payload();
+
+  std::ostringstream message;
+  message << res;
+  done_ = true;
+  write(message.str());
+}
+
+void mako::server::api_server::impl::session::respond_error(beast_http::status status, absl::string_view message) {
+  respond(
+    status,
+    {
+      {"error",
+       {
+         {"message", std::string(message)},
+         {"type", "invalid_request_error"},
+         {"code", static_cast<unsigned>(status)},
+       }},
+  });
+}
+
+void mako::server::api_server::impl::session::write(std::string data) {
+  writes_.push_back(std::move(data));
+  if (writes_.size() != 1) {
+    return;
+  }
+  stream_.expires_after(std::chrono::seconds(server_.config_.timeout));
+  boost::asio::async_write(
+    stream_,
+    boost::asio::buffer(writes_.front()),
+    [self = shared_from_this()](beast::error_code ec, size_t) { self->on_write(ec); });
+}
+
+void mako::server::api_server::impl::session::on_write(beast::error_code ec) {
+  writes_.pop_front();
+  if (ec) {
+    // The client has gone, so the request is of no use anymore.
+    if (active_) {
+      active_ = false;
+      server_.abort(request_id_);
+    }
+    return;
+  }
+
+  if (!writes_.empty()) {
+    stream_.expires_after(std::chrono::seconds(server_.config_.timeout));
+    boost::asio::async_write(
+      stream_,
+      boost::asio::buffer(writes_.front()),
+      [self = shared_from_this()](beast::error_code ec, size_t) { self->on_write(ec); });
+  } else if (done_) {
+    // The response is complete, so the wait is of no use anymore and must not keep the session alive.
+    if (watching_) {
+      stream_.socket().cancel(ec);
+    }
+    if (keep_alive_) {
+      read();
+    } else {
+      stream_.socket().shutdown(tcp::socket::shutdown_send, ec);
+    }
+  }
+}
+
+void mako::server::api_server::impl::session::watch() {
+  if (watching_) {
+    return;
+  }
+  watching_ = true;
+  stream_.socket().async_wait(tcp::socket::wait_read, [self = shared_from_this()](beast::error_code ec) {
+    self->on_watch(ec);
+  });
+}
+
+void mako::server::api_server::impl::session::on_watch(beast::error_code ec) {
+  watching_ = false;
+  if (ec == boost::asio::error::operation_aborted) {
+    // A wait cancelled after a response may have been overtaken by the next request on the connection.
+    if (active_) {
+      watch();
+    }
+    return;
+  }
+  if (!active_) {
+    return;
+  }
+
+  // The socket is readable if the client has closed it, or if it has sent its next request ahead, which is left in
+  // the socket for the next read; only the former ends the request.
+  if (!ec) {
+    char byte;
+    stream_.socket().non_blocking(true, ec);
+    if (!ec) {
+      stream_.socket().receive(boost::asio::buffer(&byte, 1), tcp::socket::message_peek, ec);
+    }
+    if (ec == boost::asio::error::would_block) {
+      watch();
+      return;
+    }
+  }
+  if (ec) {
+    active_ = false;
+    server_.abort(request_id_);
+  }
+}
+
+void mako::server::api_server::impl::add(std::shared_ptr<session> session, command request) {
+  sessions_.emplace(request.request_id, std::move(session));
+  commands_.push(std::move(request));
+  wake();
+}
+
+void mako::server::api_server::impl::abort(const std::string &request_id) {
+  sessions_.erase(request_id);
+  command request;
+  request.request_id = request_id;
+  request.abort      = true;
+  commands_.push(std::move(request));
+  wake();
+}
+
+void mako::server::api_server::impl::wake() {
+  // Either the push before the fence is seen by the engine thread before it sleeps, or the engine thread is seen to
+  // be idle here; the mutex then makes sure that the notification is not lost between its check and its wait.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (idle_.load(std::memory_order_relaxed)) {
+    notify();
+  }
+}
+
+void mako::server::api_server::impl::notify() {
+  { std::lock_guard<std::mutex> lock(mutex_); }
+  wakeup_.notify_one();
+}
+
+void mako::server::api_server::impl::accept() {
+  acceptor_.async_accept([this](beast::error_code ec, tcp::socket socket) {
+    if (!ec) {
+      socket.set_option(tcp::no_delay(true), ec);
+      std::make_shared<session>(*this, std::move(socket))->start();
+    }
+    accept();
+  });
+}
+
+void mako::server::api_server::impl::dispatch() {
+  // The flag is cleared before draining, so the events pushed from now on are dispatched by another post.
+  dispatching_.store(false, std::memory_order_seq_cst);
+  while (auto e = events_.pop()) {
+    auto it = sessions_.find(e->request_id);
+    if (it == sessions_.end()) {
+      // The request has been aborted.
+      continue;
+    }
+    auto session = it->second;
+    if (e->finished) {
+      sessions_.erase(it);
+    }
+    session->on_event(*e);
+  }
+}
+
+void mako::server::api_server::impl::serve() {
+  while (!stopped_.load(std::memory_order_acquire)) {
+    auto num_events = 0;
+    while (auto request = commands_.pop()) {
+      if (request->abort) {
+        engine_.abort_request(request->request_id);
+        continue;
+      }
+      try {
+        engine_.add_request(request->request_id, std::move(request->prompt_token_ids), std::move(request->params));
+      } catch (const std::invalid_argument &e) {
+        events_.push({request->request_id, {}, true, e.what()});
+        ++num_events;
+      }
+    }
+
+    if (engine_.has_unfinished_requests()) {
+      for (auto &output : engine_.step()) {
+        events_.push({std::move(output.request_id), std::move(output.token_ids), output.finished, ""});
+        ++num_events;
+      }
+    }
+    if (num_events != 0 && !dispatching_.exchange(true, std::memory_order_seq_cst)) {
+      boost::asio::post(context_, [this] { dispatch(); });
+    }
+
+    if (!engine_.has_unfinished_requests()) {
+      idle_.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      std::unique_lock<std::mutex> lock(mutex_);
+      wakeup_.wait(lock, [&] { return stopped_.load(std::memory_order_acquire) || !commands_.empty(); });
+      idle_.store(false, std::memory_order_relaxed);
+    }
+  }
+}
+
+void mako::server::api_server::impl::run() {
+  boost::asio::signal_set signals(context_, SIGINT, SIGTERM);
+  signals.async_wait([this](beast::error_code, int) { stop(); });
+
+  std::thread engine_thread([this] { serve(); });
+  accept();
+  context_.run();
+
+  stopped_.store(true, std::memory_order_release);
+  notify();
+  engine_thread.join();
+
+  // The sessions are closed while the event loop is still alive.
+  sessions_.clear();
+}
+
+mako::server::api_server::api_server(
+  engine::llm_engine &engine,
+  const utils::tokenizer &tokenizer,
+  server_config config)
+    : impl_(std::make_unique<impl>(engine, tokenizer, std::move(config))) {}
+
+mako::server::api_server::~api_server() = default;
+
+uint16_t mako::server::api_server::port() const {
+  return impl_->port();
+}
+
+void mako::server::api_server::run() {
+  impl_->run();
+}
+
+void mako::server::api_server::stop() {
+  impl_->stop();
+}
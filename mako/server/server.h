@@ -0,0 +1,99 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "mako/engine/engine.h"
+#include "mako/utils/export.h"
+#include "mako/utils/huggingface/tokenizers.h"
+
+namespace mako {
+namespace server {
+/// \brief Options to control the server.
+struct MAKO_API server_config {
+  /// \brief The address to listen on.
+  std::string host = "0.0.0.0";
+
+  /// \brief The port to listen on, or ``0`` for any free port.
+  uint16_t port = 8000;
+
+  /// \brief The name of the model in requests and responses.
+  std::string served_model_name = "mako";
+
+  /// \brief The maximum size of a request body in bytes.
+  size_t max_body_size = 1 << 20;
+
+  /// \brief The number of seconds to wait for a request on an idle connection, or for a write to a client.
+  int64_t timeout = 60;
+
+  /// \brief The number of threads encoding prompts.
+  size_t num_encode_threads = 2;
+};
+
+/// \brief HTTP server of the completions API of OpenAI, which streams tokens as server-sent events.
+///
+/// The server runs on two threads, besides those encoding prompts. The I/O thread runs an event loop of Boost.Asio,
+/// which is backed by ``epoll`` on Linux, so that any number of connections, streaming or idle, costs no thread of
+/// its own; it parses requests, and detokenizes and writes tokens, while the prompts are encoded on a pool of
+/// ``server_config::num_encode_threads`` threads, so that a long one does not hold up the other connections. The
+/// engine thread runs ``llm_engine::step`` in a loop and sleeps only while no request is unfinished. The threads hand
+/// requests and tokens over through lock-free queues, so the event loop never waits for the model and the model never
+/// waits for a client.
+///
+/// The endpoints are:
+///
+/// * ``POST /v1/completions``, which takes a single prompt, either as text or as token ids, along with the sampling
+///   parameters of ``engine::sampling_params``, ``ignore_eos``, and ``stop_token_ids``. With ``"stream": true``, the
+///   text is streamed as it is generated, ending with ``data: [DONE]``.
+/// * ``GET /v1/models``, which lists the served model.
+/// * ``GET /health``, which answers ``200`` while the server is up.
+/// * ``GET /metrics``, which exposes the metrics of the process, e.g., of the engine and the loader, in the text format
+///   of Prometheus.
+///
+/// A request whose client has gone is aborted as soon as the client closes the connection or a write to it fails, so
+/// that it stops taking up the cache.
+class MAKO_API api_server {
+ public:
+  /// \brief Binds the server to its address, without serving yet.
+  /// \param engine The engine, which only the engine thread touches once the server runs.
+  /// \param tokenizer The tokenizer of the model.
+  /// \param config Options to control the server.
+  /// \throw boost::system::system_error If the address cannot be bound.
+  api_server(engine::llm_engine &engine, const utils::tokenizer &tokenizer, server_config config);
+  api_server(const api_server &)            = delete;
+  api_server &operator=(const api_server &) = delete;
+  ~api_server();
+
+  /// \brief The port the server listens on, which is chosen by the system if ``server_config::port`` is ``0``.
+  uint16_t port() const;
+
+  /// \brief Serves on the calling thread as the I/O thread, until ``stop`` is called or the process is sent
+  /// ``SIGINT`` or ``SIGTERM``.
+  void run();
+
+  /// \brief Makes ``run`` return, which is safe to call from any thread.
+  void stop();
+
+ private:
+  class impl;
+
+  std::unique_ptr<impl> impl_;
+};
+} // namespace server
+} // namespace mako
@@ -0,0 +1,214 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/server/server.h"
+
+#include <chrono>
+#include <thread>
+
+#include <absl/strings/match.h>
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_format.h>
+#include <absl/strings/str_split.h>
+#include <absl/strings/strip.h>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <gtest/gtest.h>
+#include <nlohmann/json.hpp>
+
+#include "mako/utils/metrics.h"
+
+namespace beast_http = boost::beast::http;
+
+using tcp = boost::asio::ip::tcp;
+
+/// \brief Builds a tokenizer of byte tokens only, ``<0x00>`` to ``<0xFF>`` after ``<unk>``, ``<s>``, and ``</s>``.
+static inline mako::utils::tokenizer byte_tokenizer() {
+  nlohmann::json vocab = {
+    {"<unk>", 0},
+    {"<s>",   1},
+    {"</s>",  2},
+  };
+  for (auto byte = 0; byte < 256; ++byte) {
+    vocab[absl::StrFormat("<0x%02X>", byte)] = byte + 3;
+  }
+  nlohmann::json json = {
+    {"added_tokens",
+     {{{"id", 0}, {"content", "<unk>"}, {"special", true}},
+      {{"id", 1}, {"content", "<s>"}, {"special", true}},
+      {{"id", 2}, {"content", "</s>"}, {"special", true}}}},
+    {"normalizer", nullptr},
+    {"pre_tokenizer", nullptr},
+    {"decoder", {{"type", "ByteFallback"}}},
+    {"model", {{"type", "BPE"}, {"byte_fallback", true}, {"vocab", vocab}, {"merges", nlohmann::json::array()}}},
+  };
+  return mako::utils::tokenizer::from_json(json.dump());
+}
+
+/// \brief Sends a request to the server and reads the whole response.
+static inline beast_http::response<beast_http::string_body> request(
+  uint16_t __port,
+  beast_http::verb __method,
+  const std::string &__target,
+  const std::string &__body = "") {
+  boost::asio::io_context context;
+  tcp::resolver resolver(context);
+  tcp::socket socket(context);
+  boost::asio::connect(socket, resolver.resolve("127.0.0.1", std::to_string(__port)));
+
+  beast_http::request<beast_http::string_body> req(__method, __target, 11);
+  req.set(beast_http::field::host, "127.0.0.1");
+  req.set(beast_http::field::content_type, "application/json");
+  req.body() = __body;
+  req.prepare_payload();
+  beast_http::write(socket, req);
+
+  boost::beast::flat_buffer buffer;
+  beast_http::response<beast_http::string_body> res;
+  beast_http::read(socket, buffer, res);
+  return res;
+}
+
+/// \brief Reads a sample of the metrics of the process.
+/// \param __name The name of the sample, e.g., ``mako_generation_tokens_total``.
+/// \return The value of the sample, or ``0`` if it has not been registered.
+static inline double metric_value(absl::string_view __name) {
+  auto text = mako::utils::metrics::registry::global().expose();
+  for (absl::string_view line : absl::StrSplit(text, '\n')) {
+    if (absl::ConsumePrefix(&line, __name) && absl::ConsumePrefix(&line, " ")) {
+      double value;
+      return absl::SimpleAtod(line, &value) ? value : 0;
+    }
+  }
+  return 0;
+}
+
+TEST(APIServerTest, Completions) {
+  mako::nn::llama_config config;
+  config.vocab_size          = 259;
+  config.hidden_size         = 32;
+  config.intermediate_size   = 48;
+  config.num_hidden_layers   = 2;
+  config.num_attention_heads = 4;
+  config.num_key_value_heads = 2;
+  mako::nn::llama_for_causal_lm model(config);
+
+  mako::engine::engine_config engine_config;
+  engine_config.block_size = 4;
+  mako::engine::llm_engine engine(model, engine_config);
+  auto tokenizer = byte_tokenizer();
+
+  mako::server::server_config server_config;
+  server_config.host = "127.0.0.1";
+  server_config.port = 0;
+  mako::server::api_server server(engine, tokenizer, server_config);
+  std::thread thread([&] { server.run(); });
+
+  EXPECT_EQ(request(server.port(), beast_http::verb::get, "/health").result(), beast_http::status::ok);
+  auto models = nlohmann::json::parse(request(server.port(), beast_http::verb::get, "/v1/models").body());
+  EXPECT_EQ(models["data"][0]["id"], "mako");
+
+  auto res = request(
+    server.port(),
+    beast_http::verb::post,
+    "/v1/completions",
+    R"({"prompt": "hello", "max_tokens": 6, "temperature": 0, "ignore_eos": true})");
+  ASSERT_EQ(res.result(), beast_http::status::ok);
+  auto completion = nlohmann::json::parse(res.body());
+  EXPECT_EQ(completion["choices"][0]["finish_reason"], "length");
+  EXPECT_EQ(completion["usage"]["prompt_tokens"], 5);
+  EXPECT_EQ(completion["usage"]["completion_tokens"], 6);
+
+  // The streamed pieces of text add up to the same text, followed by the usage and the end of the stream.
+  res = request(
+    server.port(),
+    beast_http::verb::post,
+    "/v1/completions",
+    R"({"prompt": [1, 107, 104, 111], "max_tokens": 6, "temperature": 0, "ignore_eos": true, "stream": true,
+        "stream_options": {"include_usage": true}})");
+  ASSERT_EQ(res.result(), beast_http::status::ok);
+  EXPECT_EQ(res[beast_http::field::content_type], "text/event-stream");
+  std::vector<absl::string_view> events = absl::StrSplit(res.body(), "\n\n", absl::SkipEmpty());
+  ASSERT_LE(3, events.size());
+  EXPECT_EQ(events.back(), "data: [DONE]");
+  events.pop_back();
+
+  std::string text;
+  for (auto &event : events) {
+    ASSERT_TRUE(absl::ConsumePrefix(&event, "data: "));
+    auto chunk = nlohmann::json::parse(event);
+    if (chunk.contains("usage")) {
+      EXPECT_EQ(chunk["usage"]["completion_tokens"], 6);
+    } else {
+      text += chunk["choices"][0]["text"].get<std::string>();
+    }
+  }
+  res = request(
+    server.port(),
+    beast_http::verb::post,
+    "/v1/completions",
+    R"({"prompt": [1, 107, 104, 111], "max_tokens": 6, "temperature": 0, "ignore_eos": true})");
+  EXPECT_EQ(nlohmann::json::parse(res.body())["choices"][0]["text"], text);
+
+  // Malformed requests and requests the engine rejects are answered with errors.
+  EXPECT_EQ(
+    request(server.port(), beast_http::verb::post, "/v1/completions", "{").result(),
+    beast_http::status::bad_request);
+  EXPECT_EQ(
+    request(server.port(), beast_http::verb::post, "/v1/completions", R"({"prompt": "hi", "top_p": 2})").result(),
+    beast_http::status::bad_request);
+  EXPECT_EQ(request(server.port(), beast_http::verb::get, "/v1/chat").result(), beast_http::status::not_found);
+
+  // The metrics of the engine count the tokens generated above.
+  res = request(server.port(), beast_http::verb::get, "/metrics");
+  ASSERT_EQ(res.result(), beast_http::status::ok);
+  EXPECT_TRUE(absl::StrContains(res.body(), "# TYPE mako_generation_tokens_total counter\n"));
+  EXPECT_TRUE(absl::StrContains(res.body(), "mako_time_to_first_token_seconds_count "));
+
+  // A client which disconnects before its response is complete aborts the request, long before ``max_tokens``.
+  auto before = metric_value("mako_generation_tokens_total");
+  {
+    boost::asio::io_context context;
+    tcp::socket socket(context);
+    socket.connect({boost::asio::ip::make_address("127.0.0.1"), server.port()});
+    beast_http::request<beast_http::string_body> req(beast_http::verb::post, "/v1/completions", 11);
+    req.set(beast_http::field::host, "127.0.0.1");
+    req.set(beast_http::field::content_type, "application/json");
+    req.body() = R"({"prompt": "hello", "max_tokens": 2000, "temperature": 0, "ignore_eos": true})";
+    req.prepare_payload();
+    beast_http::write(socket, req);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  auto generated = metric_value("mako_generation_tokens_total");
+  for (;;) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    auto value = metric_value("mako_generation_tokens_total");
+    if (value == generated) {
+      break;
+    }
+    generated = value;
+  }
+  EXPECT_LT(generated - before, 2000);
+
+  server.stop();
+  thread.join();
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
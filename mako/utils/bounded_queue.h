@@ -0,0 +1,95 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+namespace mako {
+namespace utils {
+/// \brief Blocking multi-producer, multi-consumer FIFO queue bounded by the total cost of its elements.
+///
+/// Each element is pushed along with its cost (``1`` by default, so that the capacity is a number of elements),
+/// and producers block while the queue cannot afford the element. An element costing more than the whole capacity is
+/// still admitted once the queue is empty, so that a single huge element never deadlocks the producer.
+/// \tparam T The type of elements.
+template <typename T>
+class bounded_queue {
+ public:
+  /// \param capacity The maximum total cost of the elements in the queue.
+  explicit bounded_queue(size_t capacity) : capacity_(capacity), cost_(0), closed_(false) {}
+  bounded_queue(const bounded_queue &)            = delete;
+  bounded_queue &operator=(const bounded_queue &) = delete;
+
+  /// \brief Appends ``value`` to the queue, blocking while the queue is full.
+  /// \param value The element to push.
+  /// \param cost The cost of the element.
+  /// \return ``false`` if the queue has been closed, in which case ``value`` is discarded.
+  bool push(T value, size_t cost = 1) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [&] { return closed_ || queue_.empty() || cost_ + cost <= capacity_; });
+    if (closed_) {
+      return false;
+    }
+    queue_.emplace_back(std::move(value), cost);
+    cost_ += cost;
+    lock.unlock();
+    not_empty_.notify_one();
+    return true;
+  }
+
+  /// \brief Removes the first element of the queue, blocking while the queue is empty.
+  /// \return The first element, or ``std::nullopt`` if the queue has been closed and drained.
+  std::optional<T> pop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [&] { return closed_ || !queue_.empty(); });
+    if (queue_.empty()) {
+      return std::nullopt;
+    }
+    auto [value, cost] = std::move(queue_.front());
+    queue_.pop_front();
+    cost_ -= cost;
+    lock.unlock();
+    not_full_.notify_all();
+    return std::move(value);
+  }
+
+  /// \brief Closes the queue, waking up all blocked producers and consumers.
+  ///
+  /// Producers can no longer push once the queue is closed, while consumers can still pop the remaining elements.
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+    not_full_.notify_all();
+    not_empty_.notify_all();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+  std::deque<std::pair<T, size_t>> queue_;
+  size_t capacity_;
+  size_t cost_;
+  bool closed_;
+};
+} // namespace utils
+} // namespace mako
@@ -0,0 +1,119 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/utils/bounded_queue.h"
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+using namespace std::chrono_literals;
+
+TEST(BoundedQueueTest, BlockAtCapacity) {
+  mako::utils::bounded_queue<int> queue(4);
+  EXPECT_TRUE(queue.push(1, 3));
+  EXPECT_TRUE(queue.push(2));
+
+  // A producer blocks until the queue can afford its element.
+  std::atomic<bool> pushed{false};
+  std::thread producer([&] {
+    pushed = queue.push(3, 2);
+  });
+  std::this_thread::sleep_for(50ms);
+  EXPECT_FALSE(pushed);
+  EXPECT_EQ(queue.pop(), 1);
+  producer.join();
+  EXPECT_TRUE(pushed);
+  EXPECT_EQ(queue.pop(), 2);
+  EXPECT_EQ(queue.pop(), 3);
+
+  // A consumer blocks until an element is pushed.
+  std::atomic<int> popped{0};
+  std::thread consumer([&] {
+    popped = queue.pop().value_or(-1);
+  });
+  std::this_thread::sleep_for(50ms);
+  EXPECT_EQ(popped, 0);
+  // An element costing more than the whole capacity is admitted into the empty queue.
+  EXPECT_TRUE(queue.push(4, 8));
+  consumer.join();
+  EXPECT_EQ(popped, 4);
+}
+
+TEST(BoundedQueueTest, CloseWakesBlocked) {
+  mako::utils::bounded_queue<int> full(1);
+  mako::utils::bounded_queue<int> empty(1);
+  EXPECT_TRUE(full.push(1));
+
+  std::atomic<int> woken{0};
+  std::thread producer([&] {
+    EXPECT_FALSE(full.push(2));
+    ++woken;
+  });
+  std::thread consumer([&] {
+    EXPECT_EQ(empty.pop(), std::nullopt);
+    ++woken;
+  });
+  std::this_thread::sleep_for(50ms);
+  EXPECT_EQ(woken, 0);
+  full.close();
+  empty.close();
+  producer.join();
+  consumer.join();
+  EXPECT_EQ(woken, 2);
+
+  // The elements pushed before closing are still popped, while new ones are discarded.
+  EXPECT_FALSE(full.push(3));
+  EXPECT_EQ(full.pop(), 1);
+  EXPECT_EQ(full.pop(), std::nullopt);
+}
+
+TEST(BoundedQueueTest, ProducerException) {
+  // A failing producer closes the queue, and the consumer rethrows its exception once the elements are drained, as
+  // the pipeline stages and the loader do.
+  mako::utils::bounded_queue<int> queue(1);
+  std::exception_ptr error;
+  std::thread producer([&] {
+    try {
+      for (auto i = 0;; ++i) {
+        if (i == 3) {
+          throw std::runtime_error("producer failed");
+        }
+        queue.push(i);
+      }
+    } catch (...) {
+      error = std::current_exception();
+    }
+    queue.close();
+  });
+
+  auto next = 0;
+  while (auto value = queue.pop()) {
+    EXPECT_EQ(*value, next++);
+  }
+  producer.join();
+  EXPECT_EQ(next, 3);
+  ASSERT_TRUE(error);
+  EXPECT_THROW(std::rethrow_exception(error), std::runtime_error);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,46 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/utils/filelock.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <string>
+#include <system_error>
+
+#include <absl/strings/str_format.h>
+
+mako::utils::file_lock::file_lock(absl::string_view lock_file) {
+  fd_ = open(std::string(lock_file).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (fd_ < 0) {
+    throw std::system_error(errno, std::generic_category(), absl::StrFormat("Cannot open %s", lock_file));
+  }
+
+  // flock(2) may be interrupted by a signal while waiting for another process to release the lock.
+  while (flock(fd_, LOCK_EX) < 0) {
+    if (errno != EINTR) {
+      auto err = errno;
+      close(fd_);
+      throw std::system_error(err, std::generic_category(), absl::StrFormat("Cannot lock %s", lock_file));
+    }
+  }
+}
+
+mako::utils::file_lock::~file_lock() {
+  flock(fd_, LOCK_UN);
+  close(fd_);
+}
@@ -0,0 +1,42 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <absl/strings/string_view.h>
+
+#include "mako/utils/export.h"
+
+namespace mako {
+namespace utils {
+/// \brief Scoped cross-process lock on a file, equivalent to Python's ``filelock.FileLock`` used as a context manager.
+///
+/// The lock is an advisory ``flock(2)`` lock, so it is released by the kernel even if the holding process crashes,
+/// and the lock file is left in place to be reused by later processes.
+class MAKO_API file_lock {
+ public:
+  /// \brief Blocks until the lock on ``lock_file`` is acquired, creating the file if it does not exist.
+  /// \param lock_file Path to the lock file.
+  explicit file_lock(absl::string_view lock_file);
+  file_lock(const file_lock &)            = delete;
+  file_lock &operator=(const file_lock &) = delete;
+
+  /// \brief Releases the lock.
+  ~file_lock();
+
+ private:
+  int fd_;
+};
+} // namespace utils
+} // namespace mako
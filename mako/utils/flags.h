@@ -0,0 +1,98 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <absl/log/log.h>
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_split.h>
+#include <absl/strings/string_view.h>
+#include <absl/strings/strip.h>
+
+// Command-line flags of the form ``--flag=value``, shared by the executables. An invalid value is fatal, as flags are
+// read once at startup and there is nothing to recover from.
+
+namespace mako {
+namespace utils {
+/// \brief Parses ``--flag=value`` arguments, along with positional ones.
+/// \param argc The number of arguments.
+/// \param argv The arguments.
+/// \param positional The positional arguments, to which the arguments not starting with ``--`` are appended.
+/// \return The values of the flags by their names.
+inline std::map<std::string, std::string> parse_flags(int argc, char **argv, std::vector<std::string> &positional) {
+  std::map<std::string, std::string> flags;
+  for (auto i = 1; i < argc; ++i) {
+    absl::string_view arg = argv[i];
+    if (!absl::ConsumePrefix(&arg, "--")) {
+      positional.emplace_back(arg);
+      continue;
+    }
+    std::pair<std::string, std::string> flag = absl::StrSplit(arg, absl::MaxSplits('=', 1));
+    flags.insert(std::move(flag));
+  }
+  return flags;
+}
+
+/// \brief Reads a flag.
+/// \param flags The values of the flags by their names.
+/// \param name The name of the flag.
+/// \param default_value The value if the flag is not given.
+/// \return The value of the flag.
+inline std::string string_flag(
+  const std::map<std::string, std::string> &flags,
+  const std::string &name,
+  const std::string &default_value) {
+  auto it = flags.find(name);
+  return it == flags.end() ? default_value : it->second;
+}
+
+/// \brief Reads an integer flag, as ``string_flag`` does.
+inline int64_t int_flag(
+  const std::map<std::string, std::string> &flags,
+  const std::string &name,
+  int64_t default_value) {
+  auto it = flags.find(name);
+  if (it == flags.end()) {
+    return default_value;
+  }
+  int64_t value;
+  if (!absl::SimpleAtoi(it->second, &value)) {
+    LOG(FATAL) << "Invalid value for --" << name << ": " << it->second;
+  }
+  return value;
+}
+
+/// \brief Reads a floating-point flag, as ``string_flag`` does.
+inline double double_flag(
+  const std::map<std::string, std::string> &flags,
+  const std::string &name,
+  double default_value) {
+  auto it = flags.find(name);
+  if (it == flags.end()) {
+    return default_value;
+  }
+  double value;
+  if (!absl::SimpleAtod(it->second, &value)) {
+    LOG(FATAL) << "Invalid value for --" << name << ": " << it->second;
+  }
+  return value;
+}
+} // namespace utils
+} // namespace mako
@@ -0,0 +1,286 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/utils/http.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#include <absl/strings/ascii.h>
+#include <absl/strings/match.h>
+#include <absl/strings/str_cat.h>
+#include <absl/strings/str_format.h>
+#include <absl/strings/strip.h>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/ssl.hpp>
+#include <boost/version.hpp>
+#include <openssl/ssl.h>
+
+namespace beast      = boost::beast;
+namespace beast_http = boost::beast::http;
+namespace ssl        = boost::asio::ssl;
+
+using tcp = boost::asio::ip::tcp;
+
+static constexpr int max_redirects  = 10;
+static constexpr size_t buffer_size = 1 << 20;
+
+/// \brief Components of an ``http://`` or ``https://`` URL.
+struct url {
+  std::string scheme;
+  std::string host;
+  std::string port;
+  std::string target;
+};
+
+/// \brief Splits an absolute ``http://`` or ``https://`` URL into its components.
+/// \param __url The URL, e.g., ``http://localhost:8000/api/models``.
+/// \return The scheme, the host, the port, and the request target of the URL.
+static inline url parse_url(absl::string_view __url) {
+  url parsed;
+  auto rest = __url;
+  if (absl::ConsumePrefix(&rest, "http://")) {
+    parsed.scheme = "http";
+  } else if (absl::ConsumePrefix(&rest, "https://")) {
+    parsed.scheme = "https";
+  } else {
+    throw std::invalid_argument(
+      absl::StrFormat("Unsupported URL: %s; only http:// and https:// URLs are supported", __url));
+  }
+
+  auto slash     = rest.find('/');
+  auto authority = rest.substr(0, slash);
+  auto colon     = authority.rfind(':');
+
+  parsed.host = std::string(authority.substr(0, colon));
+  if (colon != absl::string_view::npos) {
+    parsed.port = std::string(authority.substr(colon + 1));
+  } else {
+    parsed.port = parsed.scheme == "https" ? "443" : "80";
+  }
+  parsed.target = slash == absl::string_view::npos ? "/" : std::string(rest.substr(slash));
+  if (parsed.host.empty()) {
+    throw std::invalid_argument(absl::StrFormat("Invalid URL: %s", __url));
+  }
+  return parsed;
+}
+
+/// \brief Runs an asynchronous operation to completion.
+///
+/// The expiry of a ``beast::tcp_stream`` only applies to its asynchronous operations, so every operation on a stream
+/// is started asynchronously and waited for, which lets a stalled server fail it with ``beast::error::timeout``.
+/// \param __context The context the stream runs on, which has no other work.
+/// \param __operation Callable to start the operation with the given completion handler.
+/// \return The error of the operation.
+template <typename Operation>
+static inline beast::error_code run(boost::asio::io_context &__context, Operation &&__operation) {
+  beast::error_code ec;
+  __operation([&ec](beast::error_code error, auto &&...) {
+    ec = error;
+  });
+  __context.restart();
+  __context.run();
+  return ec;
+}
+
+/// \brief Throws the error of an operation, if any.
+static inline void check(const beast::error_code &__ec) {
+  if (__ec) {
+    throw beast::system_error(__ec);
+  }
+}
+
+/// \brief Sends a request over a connected stream and reads the response.
+/// \param __context The context the stream runs on.
+/// \param __stream A plain TCP stream or a TLS stream over TCP, which has been connected to the host of ``__url``.
+/// \param __url The URL to request.
+/// \param __method The request method, e.g., ``"GET"``.
+/// \param __headers Additional header fields to send.
+/// \param __on_response Callback to inspect a response that is not a redirect before its body is read.
+/// \param __on_data Callback to receive the body of a successful response that is not a redirect.
+/// \param __timeout The time each operation on the stream may take.
+/// \return The response, whose body is collected only if it is not passed to ``__on_data``.
+template <typename Stream>
+static inline mako::utils::http::response send(
+  boost::asio::io_context &__context,
+  Stream &__stream,
+  const url &__url,
+  absl::string_view __method,
+  const std::vector<std::pair<std::string, std::string>> &__headers,
+  const std::function<void(const mako::utils::http::response &)> &__on_response,
+  const std::function<void(const char *, size_t)> &__on_data,
+  std::chrono::milliseconds __timeout) {
+  auto &lowest_layer = beast::get_lowest_layer(__stream);
+  auto default_port  = __url.scheme == "https" ? "443" : "80";
+
+  beast_http::request<beast_http::empty_body> req(beast_http::string_to_verb(std::string(__method)), __url.target, 11);
+  req.set(beast_http::field::host, __url.port == default_port ? __url.host : __url.host + ":" + __url.port);
+  req.set(beast_http::field::user_agent, "mako");
+  for (const auto &[name, value] : __headers) {
+    req.set(name, value);
+  }
+  lowest_layer.expires_after(__timeout);
+  check(run(__context, [&](auto handler) {
+    beast_http::async_write(__stream, req, std::move(handler));
+  }));
+
+  beast::flat_buffer buffer;
+  beast_http::response_parser<beast_http::buffer_body> parser;
+  // Some versions of Beast compare the body length against a disabled limit as if it were zero, so the limit is
+  // set to the maximum instead of ``boost::none``.
+  parser.body_limit(std::numeric_limits<std::uint64_t>::max());
+  // A response to HEAD carries the length of the body it would have, but not the body itself.
+  parser.skip(req.method() == beast_http::verb::head);
+  lowest_layer.expires_after(__timeout);
+  check(run(__context, [&](auto handler) {
+    beast_http::async_read_header(__stream, buffer, parser, std::move(handler));
+  }));
+
+  mako::utils::http::response res;
+  res.status = parser.get().result_int();
+  for (const auto &field : parser.get()) {
+    res.headers[absl::AsciiStrToLower(std::string(field.name_string()))] = std::string(field.value());
+  }
+  auto redirect    = 300 <= res.status && res.status < 400 && res.headers.count("location") != 0;
+  auto stream_body = __on_data && 200 <= res.status && res.status < 300;
+  if (!redirect && __on_response) {
+    __on_response(res);
+  }
+
+  // The body is read through a fixed-size buffer, so even a huge file never has to fit in memory.
+  std::string chunk(buffer_size, '\0');
+  while (!parser.is_done()) {
+    parser.get().body().data = chunk.data();
+    parser.get().body().size = chunk.size();
+    lowest_layer.expires_after(__timeout);
+
+    auto ec = run(__context, [&](auto handler) {
+      beast_http::async_read(__stream, buffer, parser, std::move(handler));
+    });
+    if (ec != beast_http::error::need_buffer) {
+      check(ec);
+    }
+
+    auto size = chunk.size() - parser.get().body().size;
+    if (redirect) {
+      continue;
+    } else if (stream_body) {
+      __on_data(chunk.data(), size);
+    } else {
+      res.body.append(chunk.data(), size);
+    }
+  }
+
+  // The connection is not reused, so it is closed without waiting for the TLS close_notify of the server.
+  beast::error_code ec;
+  lowest_layer.socket().shutdown(tcp::socket::shutdown_both, ec);
+  return res;
+}
+
+mako::utils::http::response mako::utils::http::request(
+  absl::string_view method,
+  absl::string_view url,
+  const std::vector<std::pair<std::string, std::string>> &headers,
+  const std::function<void(const char *, size_t)> &on_data,
+  const std::function<void(const response &)> &on_response,
+  std::chrono::milliseconds timeout) {
+  auto location  = std::string(url);
+  auto forwarded = headers;
+  for (auto redirects = 0;; ++redirects) {
+    auto target = parse_url(location);
+
+    boost::asio::io_context context;
+    tcp::resolver resolver(context);
+    auto endpoints = resolver.resolve(target.host, target.port);
+
+    response res;
+    if (target.scheme == "https") {
+      // The certificate of the server is verified against the system trust store, which ``SSL_CERT_FILE`` and
+      // ``SSL_CERT_DIR`` override.
+      ssl::context tls(ssl::context::tls_client);
+      tls.set_default_verify_paths();
+      tls.set_verify_mode(ssl::verify_peer);
+
+      beast::ssl_stream<beast::tcp_stream> stream(context, tls);
+#if BOOST_VERSION >= 107300
+      stream.set_verify_callback(ssl::host_name_verification(target.host));
+#else
+      stream.set_verify_callback(ssl::rfc2818_verification(target.host));
+#endif
+      // Servers hosting several domains, as CDNs do, pick the certificate by the server name indication.
+      if (!SSL_set_tlsext_host_name(stream.native_handle(), target.host.c_str())) {
+        throw beast::system_error(
+          beast::error_code(static_cast<int>(::ERR_get_error()), boost::asio::error::get_ssl_category()));
+      }
+      beast::get_lowest_layer(stream).expires_after(timeout);
+      check(run(context, [&](auto handler) {
+        beast::get_lowest_layer(stream).async_connect(endpoints, std::move(handler));
+      }));
+      beast::get_lowest_layer(stream).expires_after(timeout);
+      check(run(context, [&](auto handler) {
+        stream.async_handshake(ssl::stream_base::client, std::move(handler));
+      }));
+      res = send(context, stream, target, method, forwarded, on_response, on_data, timeout);
+    } else {
+      beast::tcp_stream stream(context);
+      stream.expires_after(timeout);
+      check(run(context, [&](auto handler) {
+        stream.async_connect(endpoints, std::move(handler));
+      }));
+      res = send(context, stream, target, method, forwarded, on_response, on_data, timeout);
+    }
+
+    auto redirect = 300 <= res.status && res.status < 400 && res.headers.count("location") != 0;
+    if (!redirect) {
+      return res;
+    }
+    if (max_redirects <= redirects) {
+      throw std::runtime_error(absl::StrFormat("Too many redirects from %s", url));
+    }
+
+    // A relative redirect keeps the scheme and the authority of the current URL.
+    const auto &next = res.headers.at("location");
+    if (absl::StartsWith(next, "/")) {
+      location = absl::StrCat(target.scheme, "://", target.host, ":", target.port, next);
+    } else {
+      location = next;
+    }
+
+    // The credentials are meant for the server they were given for, not for a third party, e.g., the CDN the files of
+    // Hugging Face Hub are redirected to, and are never sent in the clear.
+    auto redirected = parse_url(location);
+    if (target.scheme == "https" && redirected.scheme != "https") {
+      throw std::runtime_error(absl::StrFormat("Refusing to follow a redirect from %s to %s", url, location));
+    }
+    if (redirected.scheme != target.scheme || redirected.host != target.host || redirected.port != target.port) {
+      forwarded.erase(
+        std::remove_if(
+          forwarded.begin(),
+          forwarded.end(),
+          [](const std::pair<std::string, std::string> &header) {
+            return absl::EqualsIgnoreCase(header.first, "authorization");
+          }),
+        forwarded.end());
+    }
+  }
+}
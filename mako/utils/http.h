@@ -0,0 +1,70 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <absl/strings/string_view.h>
+
+#include "mako/utils/export.h"
+
+namespace mako {
+namespace utils {
+namespace http {
+/// \brief Response to an HTTP request.
+struct MAKO_API response {
+  /// \brief The status code, e.g., ``200``.
+  unsigned status;
+
+  /// \brief The header fields, whose names are in lowercase.
+  std::map<std::string, std::string> headers;
+
+  /// \brief The body, if it has not been passed to a callback.
+  std::string body;
+};
+
+/// \brief Sends an HTTP/1.1 request and waits for the response, following redirects.
+///
+/// An ``https://`` URL is requested over TLS, and the certificate of the server is verified against the system trust
+/// store, which ``SSL_CERT_FILE`` and ``SSL_CERT_DIR`` override. A redirect from ``https://`` to ``http://`` is
+/// refused, and the ``Authorization`` field is not sent on once a redirect leaves the scheme, the host, or the port it
+/// was given for.
+/// \param method The request method, e.g., ``"GET"``.
+/// \param url The absolute URL to request.
+/// \param headers Additional header fields to send.
+/// \param on_data Callback to receive the body chunk by chunk as it arrives. If not given, the body is collected into
+///  the response instead.
+/// \param on_response Callback to inspect the status and the header fields of the response before its body is read,
+///  which may throw to abort the request, e.g., if a server answers a range request with the whole body. It is not
+///  called for redirects.
+/// \param timeout The time connecting, each read, and each write may take before the request fails.
+/// \return The response of the last request in the chain of redirects.
+/// \throw boost::system::system_error If the request fails, e.g., times out.
+/// \throw std::runtime_error If the redirects are too many or downgrade to ``http://``.
+response MAKO_API request(
+  absl::string_view method,
+  absl::string_view url,
+  const std::vector<std::pair<std::string, std::string>> &headers = {},
+  const std::function<void(const char *, size_t)> &on_data        = nullptr,
+  const std::function<void(const response &)> &on_response        = nullptr,
+  std::chrono::milliseconds timeout                               = std::chrono::seconds(60));
+} // namespace http
+} // namespace utils
+} // namespace mako
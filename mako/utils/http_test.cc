@@ -0,0 +1,159 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/utils/http.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <absl/strings/str_cat.h>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/system/system_error.hpp>
+#include <gtest/gtest.h>
+
+namespace beast_http = boost::beast::http;
+
+using tcp = boost::asio::ip::tcp;
+
+/// \brief A local server answering one connection at a time, which records the requests it has read.
+class server {
+ public:
+  using handler = std::function<void(const beast_http::request<beast_http::empty_body> &, tcp::socket &)>;
+
+  explicit server(handler __handler)
+    : handler_(std::move(__handler)), acceptor_(context_, {boost::asio::ip::make_address("127.0.0.1"), 0}) {
+    thread_ = std::thread([this] {
+      for (;;) {
+        tcp::socket socket(context_);
+        acceptor_.accept(socket);
+        if (stopped_) {
+          break;
+        }
+        try {
+          boost::beast::flat_buffer buffer;
+          beast_http::request<beast_http::empty_body> req;
+          beast_http::read(socket, buffer, req);
+          {
+            std::lock_guard<std::mutex> lock(mutex_);
+            authorizations_[std::string(req.target())] = std::string(req[beast_http::field::authorization]);
+          }
+          handler_(req, socket);
+        } catch (const std::exception &) {
+        }
+      }
+    });
+  }
+
+  ~server() {
+    // Wake up the acceptor with a connection of its own.
+    stopped_ = true;
+    boost::asio::io_context context;
+    tcp::socket socket(context);
+    socket.connect(acceptor_.local_endpoint());
+    thread_.join();
+  }
+
+  unsigned short port() const {
+    return acceptor_.local_endpoint().port();
+  }
+
+  /// \return The ``Authorization`` fields by the targets requested so far, ``""`` for a request without one.
+  std::map<std::string, std::string> authorizations() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return authorizations_;
+  }
+
+ private:
+  handler handler_;
+  boost::asio::io_context context_;
+  tcp::acceptor acceptor_;
+  std::atomic<bool> stopped_{false};
+  std::thread thread_;
+
+  std::mutex mutex_;
+  std::map<std::string, std::string> authorizations_;
+};
+
+/// \brief Answers with ``__status``, redirecting to ``__location`` if it is not empty.
+static inline void respond(tcp::socket &__socket, beast_http::status __status, const std::string &__location = "") {
+  beast_http::response<beast_http::string_body> res(__status, 11);
+  res.keep_alive(false);
+  if (!__location.empty()) {
+    res.set(beast_http::field::location, __location);
+  }
+  res.body() = __status == beast_http::status::ok ? "ok" : "";
+  res.prepare_payload();
+  beast_http::write(__socket, res);
+}
+
+TEST(HttpTest, RedirectCredentials) {
+  // A relative redirect stays on the server the credentials were given for, while one to another host does not.
+  unsigned short port = 0;
+  server server([&](const beast_http::request<beast_http::empty_body> &req, tcp::socket &socket) {
+    if (req.target() == "/a") {
+      respond(socket, beast_http::status::found, "/b");
+    } else if (req.target() == "/b") {
+      respond(socket, beast_http::status::found, absl::StrCat("http://localhost:", port, "/c"));
+    } else {
+      respond(socket, beast_http::status::ok);
+    }
+  });
+  port = server.port();
+
+  auto res = mako::utils::http::request(
+    "GET",
+    absl::StrCat("http://127.0.0.1:", port, "/a"),
+    {{"Authorization", "Bearer secret"}});
+  EXPECT_EQ(res.status, 200);
+  EXPECT_EQ(res.body, "ok");
+  EXPECT_EQ(
+    server.authorizations(),
+    (std::map<std::string, std::string>{{"/a", "Bearer secret"}, {"/b", "Bearer secret"}, {"/c", ""}}));
+}
+
+TEST(HttpTest, Timeout) {
+  // A server which never answers fails the request once the timeout has passed, rather than hanging it.
+  std::atomic<bool> released{false};
+  server server([&](const beast_http::request<beast_http::empty_body> &, tcp::socket &) {
+    while (!released) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  });
+
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_THROW(
+    mako::utils::http::request(
+      "GET",
+      absl::StrCat("http://127.0.0.1:", server.port(), "/"),
+      {},
+      nullptr,
+      nullptr,
+      std::chrono::milliseconds(200)),
+    boost::system::system_error);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(10));
+  released = true;
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -21,10 +21,36 @@
 #include <unistd.h>
 #endif // _WIN32
 
+#include <fcntl.h>
+#include <fnmatch.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <exception>
 #include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#include <absl/strings/ascii.h>
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_cat.h>
+#include <absl/strings/str_format.h>
+#include <absl/strings/str_replace.h>
+#include <absl/strings/strip.h>
+#include <nlohmann/json.hpp>
+
+#include "mako/utils/http.h"
 
 namespace fs = std::filesystem;
 
+using nlohmann::json;
+
 /// \brief Utility to find the user's home directory, equivalent to Python's ``pathlib.Path.home``.
 /// \return The path to the the user's home directory.
 static inline std::string home() {
@@ -44,13 +70,376 @@ static inline std::string _getenv(absl::string_view __key, absl::string_view __d
   return value ? value : __default.data();
 }
 
-const auto _default_home                 = fs::path(home()) / fs::path(".cache");
-absl::string_view default_home           = _default_home.string();
-absl::string_view _xdg_cache_home        = _getenv("XDG_CACHE_HOME", default_home);
-const auto __hf_home                     = fs::path(_xdg_cache_home) / fs::path("huggingface");
-absl::string_view _hf_home               = _getenv("HF_HOME", __hf_home.string());
-const auto _default_cache_path           = fs::path(_hf_home) / fs::path("hub");
-absl::string_view default_cache_path     = _default_cache_path.string();
-absl::string_view _huggingface_hub_cache = _getenv("HUGGINGFACE_HUB_CACHE", default_cache_path);
-absl::string_view _hf_hub_cache          = _getenv("HF_HUB_CACHE", _huggingface_hub_cache);
+/// \brief Utility to parse a boolean environment variable, equivalent to ``huggingface_hub.constants._is_true``.
+/// \param __value Value of the environment variable.
+/// \return ``true`` if ``__value`` is one of ``"1"``, ``"ON"``, ``"YES"``, or ``"TRUE"`` in any case.
+static inline bool is_true(absl::string_view __value) {
+  auto upper = absl::AsciiStrToUpper(__value);
+  return upper == "1" || upper == "ON" || upper == "YES" || upper == "TRUE";
+}
+
+// Each string view refers to a string that lives as long as the program does; a view of the string returned by
+// ``_getenv`` or ``fs::path::string`` would dangle as soon as the temporary is destroyed.
+const auto default_home_value            = (fs::path(home()) / fs::path(".cache")).string();
+absl::string_view default_home           = default_home_value;
+const auto xdg_cache_home_value          = _getenv("XDG_CACHE_HOME", default_home);
+absl::string_view _xdg_cache_home        = xdg_cache_home_value;
+const auto hf_home_value                 = _getenv("HF_HOME", (fs::path(_xdg_cache_home) / fs::path("huggingface")).string());
+absl::string_view _hf_home               = hf_home_value;
+const auto default_cache_path_value      = (fs::path(_hf_home) / fs::path("hub")).string();
+absl::string_view default_cache_path     = default_cache_path_value;
+const auto huggingface_hub_cache_value   = _getenv("HUGGINGFACE_HUB_CACHE", default_cache_path);
+absl::string_view _huggingface_hub_cache = huggingface_hub_cache_value;
+const auto hf_hub_cache_value            = _getenv("HF_HUB_CACHE", _huggingface_hub_cache);
+absl::string_view _hf_hub_cache          = hf_hub_cache_value;
 absl::string_view _default_revision      = "main";
+const auto endpoint_value                = _getenv("HF_ENDPOINT", "https://huggingface.co");
+absl::string_view _endpoint              = endpoint_value;
+bool _hf_hub_offline                     = is_true(_getenv("HF_HUB_OFFLINE", ""));
+size_t _download_chunk_size              = size_t{64} << 20;
+
+/// \brief Checks if ``__revision`` is a full commit hash rather than a branch name or a tag.
+/// \param __revision A Git revision id.
+/// \return ``true`` if ``__revision`` consists of 40 lowercase hexadecimal digits.
+static inline bool is_commit_hash(absl::string_view __revision) {
+  return __revision.size() == 40 && std::all_of(__revision.begin(), __revision.end(), [](char c) {
+    return absl::ascii_isdigit(c) || ('a' <= c && c <= 'f');
+  });
+}
+
+std::string mako::utils::huggingface::repo_folder_name(absl::string_view repo_id, absl::string_view repo_type) {
+  // Converts "username/repo_name" into "models--username--repo_name".
+  return absl::StrCat(repo_type, "s--", absl::StrReplaceAll(repo_id, {{"/", "--"}}));
+}
+
+/// \brief Utility to find a snapshot in the local cache.
+/// \param __storage_folder The repository folder in the cache.
+/// \param __revision A Git revision id which can be a branch name, a tag, or a commit hash.
+/// \return The path to the snapshot folder.
+static inline std::string find_snapshot(const fs::path &__storage_folder, absl::string_view __revision) {
+  // A branch or a tag is resolved to the commit hash it pointed to when the snapshot was downloaded.
+  auto commit_hash = std::string(__revision);
+  if (!is_commit_hash(commit_hash)) {
+    auto ref_path = __storage_folder / fs::path("refs") / fs::path(commit_hash);
+    if (fs::is_regular_file(ref_path)) {
+      std::ifstream(ref_path) >> commit_hash;
+    }
+  }
+
+  auto snapshot_folder = __storage_folder / fs::path("snapshots") / fs::path(commit_hash);
+  if (!fs::is_directory(snapshot_folder)) {
+    throw std::runtime_error(absl::StrFormat(
+      "Cannot find the requested files in the local cache: %s does not exist",
+      snapshot_folder.string()));
+  }
+  return snapshot_folder.string();
+}
+
+/// \brief Percent-encodes ``__value`` for use in a URL path, equivalent to Python's ``urllib.parse.quote``.
+/// \param __value The string to encode.
+/// \param __safe Characters that should not be encoded besides the unreserved ones.
+/// \return The encoded string.
+static inline std::string quote(absl::string_view __value, absl::string_view __safe = "/") {
+  std::string quoted;
+  for (auto c : __value) {
+    if (absl::ascii_isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~' || __safe.find(c) != absl::string_view::npos) {
+      quoted.push_back(c);
+    } else {
+      absl::StrAppendFormat(&quoted, "%%%02X", static_cast<unsigned char>(c));
+    }
+  }
+  return quoted;
+}
+
+/// \return Header fields to authenticate requests with ``HF_TOKEN``, if any.
+static inline std::vector<std::pair<std::string, std::string>> build_hf_headers() {
+  std::vector<std::pair<std::string, std::string>> headers = {{"Accept-Encoding", "identity"}};
+  if (auto token = std::getenv("HF_TOKEN")) {
+    headers.emplace_back("Authorization", absl::StrCat("Bearer ", token));
+  }
+  return headers;
+}
+
+/// \brief Runs ``__fn(i)`` for each ``i`` in ``[0, __n)`` on up to ``__max_workers`` threads.
+///
+/// The first exception thrown by ``__fn`` is rethrown once all workers have stopped.
+static inline void parallel_for_each(size_t __n, size_t __max_workers, const std::function<void(size_t)> &__fn) {
+  std::atomic<size_t> next{0};
+  std::atomic<bool> failed{false};
+  std::exception_ptr error;
+  std::mutex mutex;
+
+  std::vector<std::thread> workers;
+  for (size_t worker = 0; worker < std::min(__n, std::max<size_t>(__max_workers, 1)); ++worker) {
+    workers.emplace_back([&] {
+      for (auto i = next++; i < __n && !failed; i = next++) {
+        try {
+          __fn(i);
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (!error) {
+            error = std::current_exception();
+          }
+          failed = true;
+        }
+      }
+    });
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+/// \brief A file to download into the blob storage of the cache.
+struct blob_download {
+  std::string url;
+  fs::path blob_path;
+  fs::path pointer_path;
+  size_t size;
+  size_t num_chunks;
+
+  // The chunks already written to the incomplete blob, persisted next to it so that an interrupted download resumes
+  // from where it stopped.
+  std::mutex mutex;
+  std::vector<bool> completed;
+
+  fs::path incomplete_path() const {
+    return fs::path(blob_path).concat(".incomplete");
+  }
+
+  fs::path progress_path() const {
+    return fs::path(blob_path).concat(".incomplete.json");
+  }
+};
+
+/// \brief Closes a file descriptor when it goes out of scope.
+struct file_descriptor {
+  int fd;
+
+  ~file_descriptor() {
+    if (0 <= fd) {
+      close(fd);
+    }
+  }
+};
+
+/// \brief Downloads a chunk of ``__download`` and writes it at its offset in the incomplete blob.
+/// \param __download The file to download.
+/// \param __chunk The index of the chunk, or ``0`` for the whole file if it is not split into chunks.
+static inline void download_chunk(blob_download &__download, size_t __chunk) {
+  auto headers = build_hf_headers();
+  auto ranged  = 1 < __download.num_chunks;
+  auto begin   = __chunk * DOWNLOAD_CHUNK_SIZE;
+  auto end     = ranged ? std::min(begin + DOWNLOAD_CHUNK_SIZE, __download.size) : __download.size;
+  if (ranged) {
+    headers.emplace_back("Range", absl::StrFormat("bytes=%d-%d", begin, end - 1));
+  }
+
+  file_descriptor file{open(__download.incomplete_path().c_str(), O_WRONLY | O_CLOEXEC)};
+  if (file.fd < 0) {
+    throw std::system_error(errno, std::generic_category(), __download.incomplete_path().string());
+  }
+
+  // A server may ignore the range and send the whole file, which must not be written over the other chunks, so the
+  // status is checked before any byte is written.
+  auto check_status = [&](const mako::utils::http::response &response) {
+    if (response.status != (ranged ? 206 : 200)) {
+      throw std::runtime_error(absl::StrFormat("Cannot download %s: HTTP %d", __download.url, response.status));
+    }
+  };
+
+  auto offset  = begin;
+  auto on_data = [&](const char *data, size_t size) {
+    if (end - offset < size) {
+      throw std::runtime_error(
+        absl::StrFormat("Cannot download %s: more than %d bytes received", __download.url, end - begin));
+    }
+    while (0 < size) {
+      auto written = pwrite(file.fd, data, size, static_cast<off_t>(offset));
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::system_error(errno, std::generic_category(), __download.incomplete_path().string());
+      }
+      data   += written;
+      size   -= written;
+      offset += written;
+    }
+  };
+  mako::utils::http::request("GET", __download.url, headers, on_data, check_status);
+
+  // The incomplete blob is already as large as the file, so a truncated body would otherwise go unnoticed.
+  if (offset != end) {
+    throw std::runtime_error(
+      absl::StrFormat("Cannot download %s: %d of %d bytes received", __download.url, offset - begin, end - begin));
+  }
+
+  if (ranged) {
+    std::lock_guard<std::mutex> lock(__download.mutex);
+    __download.completed[__chunk] = true;
+
+    std::vector<size_t> completed;
+    for (size_t chunk = 0; chunk < __download.num_chunks; ++chunk) {
+      if (__download.completed[chunk]) {
+        completed.push_back(chunk);
+      }
+    }
+    auto tmp_path = fs::path(__download.progress_path()).concat(".tmp");
+    std::ofstream(tmp_path) << json{
+      {"size", __download.size},
+      {"chunk_size", DOWNLOAD_CHUNK_SIZE},
+      {"completed", completed}};
+    fs::rename(tmp_path, __download.progress_path());
+  }
+}
+
+std::string mako::utils::huggingface::snapshot_download(
+  absl::string_view repo_id,
+  std::optional<absl::string_view> revision,
+  std::optional<absl::string_view> cache_dir,
+  const std::vector<std::string> &allow_patterns,
+  bool local_files_only,
+  size_t max_workers) {
+  auto storage_folder = fs::path(cache_dir.value_or(HF_HUB_CACHE)) / fs::path(repo_folder_name(repo_id));
+  auto rev            = revision.value_or(DEFAULT_REVISION);
+  if (local_files_only || HF_HUB_OFFLINE) {
+    return find_snapshot(storage_folder, rev);
+  }
+
+  // Resolve the revision into a commit hash and list the files of the repository.
+  json repo_info;
+  try {
+    auto url      = absl::StrCat(ENDPOINT, "/api/models/", repo_id, "/revision/", quote(rev, ""));
+    auto response = mako::utils::http::request("GET", url, build_hf_headers());
+    if (response.status != 200) {
+      throw std::runtime_error(absl::StrFormat("Cannot get %s: HTTP %d", url, response.status));
+    }
+    repo_info = json::parse(response.body);
+  } catch (const std::exception &e) {
+    // Like huggingface_hub, fall back to the local cache if the endpoint cannot be reached.
+    try {
+      return find_snapshot(storage_folder, rev);
+    } catch (const std::exception &) {
+      throw std::runtime_error(absl::StrFormat("Cannot download %s from %s: %s", repo_id, ENDPOINT, e.what()));
+    }
+  }
+
+  auto commit_hash     = repo_info.at("sha").get<std::string>();
+  auto snapshot_folder = storage_folder / fs::path("snapshots") / fs::path(commit_hash);
+  fs::create_directories(storage_folder / fs::path("blobs"));
+
+  std::vector<std::string> filenames;
+  for (const auto &sibling : repo_info.at("siblings")) {
+    auto filename = sibling.at("rfilename").get<std::string>();
+    auto allowed  = allow_patterns.empty() ||
+                    std::any_of(allow_patterns.begin(), allow_patterns.end(), [&](const auto &pattern) {
+                      return fnmatch(pattern.c_str(), filename.c_str(), 0) == 0;
+                    });
+    if (allowed && !fs::exists(snapshot_folder / fs::path(filename))) {
+      filenames.push_back(std::move(filename));
+    }
+  }
+
+  // Fetch the metadata of every missing file; the ETag identifies the blob, so a file shared by several revisions is
+  // stored only once.
+  std::vector<std::unique_ptr<blob_download>> downloads(filenames.size());
+  parallel_for_each(filenames.size(), max_workers, [&](size_t i) {
+    auto url      = absl::StrCat(ENDPOINT, "/", repo_id, "/resolve/", commit_hash, "/", quote(filenames[i]));
+    auto response = mako::utils::http::request("HEAD", url, build_hf_headers());
+    if (response.status != 200) {
+      throw std::runtime_error(absl::StrFormat("Cannot get %s: HTTP %d", url, response.status));
+    }
+
+    // Hugging Face Hub reports the metadata of LFS files in X-Linked-* fields, which take precedence.
+    const auto &headers = response.headers;
+    auto header         = [&](absl::string_view linked, absl::string_view name) -> std::string {
+      for (auto field : {linked, name}) {
+        auto it = headers.find(std::string(field));
+        if (it != headers.end()) {
+          return it->second;
+        }
+      }
+      return "";
+    };
+
+    auto etag = header("x-linked-etag", "etag");
+    etag      = std::string(absl::StripSuffix(absl::StripPrefix(absl::StripPrefix(etag, "W/"), "\""), "\""));
+    if (etag.empty()) {
+      etag = absl::StrCat(commit_hash, "-", absl::StrReplaceAll(filenames[i], {{"/", "--"}}));
+    }
+
+    size_t size = 0;
+    if (!absl::SimpleAtoi(header("x-linked-size", "content-length"), &size)) {
+      throw std::runtime_error(absl::StrFormat("Cannot get the size of %s", url));
+    }
+
+    downloads[i]               = std::make_unique<blob_download>();
+    downloads[i]->url          = url;
+    downloads[i]->blob_path    = storage_folder / fs::path("blobs") / fs::path(etag);
+    downloads[i]->pointer_path = snapshot_folder / fs::path(filenames[i]);
+    downloads[i]->size         = size;
+
+    // Split the file into ranges only if the server supports them, e.g., Python's http.server does not.
+    auto ranges = headers.count("accept-ranges") && headers.at("accept-ranges").compare("bytes") == 0;
+    downloads[i]->num_chunks = ranges ? std::max<size_t>((size + DOWNLOAD_CHUNK_SIZE - 1) / DOWNLOAD_CHUNK_SIZE, 1) : 1;
+    downloads[i]->completed.assign(downloads[i]->num_chunks, false);
+  });
+
+  // Prepare the incomplete blobs and restore the progress of interrupted downloads.
+  std::vector<std::pair<blob_download *, size_t>> chunks;
+  for (auto &download : downloads) {
+    if (fs::exists(download->blob_path)) {
+      continue;
+    }
+
+    if (fs::exists(download->incomplete_path()) && fs::exists(download->progress_path())) {
+      auto progress = json::parse(std::ifstream(download->progress_path()));
+      if (progress.at("size").get<size_t>() == download->size &&
+          progress.at("chunk_size").get<size_t>() == DOWNLOAD_CHUNK_SIZE) {
+        for (auto chunk : progress.at("completed").get<std::vector<size_t>>()) {
+          if (chunk < download->num_chunks) {
+            download->completed[chunk] = true;
+          }
+        }
+      }
+    } else {
+      fs::remove(download->progress_path());
+    }
+    std::ofstream(download->incomplete_path(), std::ios::binary | std::ios::app).close();
+    fs::resize_file(download->incomplete_path(), download->size);
+
+    for (size_t chunk = 0; chunk < download->num_chunks; ++chunk) {
+      if (!download->completed[chunk]) {
+        chunks.emplace_back(download.get(), chunk);
+      }
+    }
+  }
+
+  // Download the chunks of all files at once, so that both small files and a single huge file saturate the link.
+  parallel_for_each(chunks.size(), max_workers, [&](size_t i) {
+    download_chunk(*chunks[i].first, chunks[i].second);
+  });
+
+  // Every file has been downloaded, so the snapshot and the ref to it can be published.
+  for (auto &download : downloads) {
+    if (!fs::exists(download->blob_path)) {
+      fs::rename(download->incomplete_path(), download->blob_path);
+      fs::remove(download->progress_path());
+    }
+    fs::create_directories(download->pointer_path.parent_path());
+    fs::remove(download->pointer_path);
+    fs::create_symlink(fs::relative(download->blob_path, download->pointer_path.parent_path()), download->pointer_path);
+  }
+  fs::create_directories(snapshot_folder);
+  if (rev.compare(commit_hash) != 0) {
+    auto ref_path = storage_folder / fs::path("refs") / fs::path(rev);
+    fs::create_directories(ref_path.parent_path());
+    std::ofstream(ref_path) << commit_hash;
+  }
+
+  return snapshot_folder.string();
+}
@@ -14,8 +14,15 @@
 
 #pragma once
 
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <vector>
+
 #include <absl/strings/string_view.h>
 
+#include "mako/utils/export.h"
+
 // Definitions of constants and macros to interact with Hugging Face Hub.
 // Most of the below constants/macros are adapted from
 // https://github.com/huggingface/huggingface_hub/blob/v0.20.0/src/huggingface_hub/constants.py.
@@ -23,8 +30,58 @@ extern absl::string_view _hf_home;
 extern absl::string_view _huggingface_hub_cache;
 extern absl::string_view _hf_hub_cache;
 extern absl::string_view _default_revision;
+extern absl::string_view _endpoint;
+extern bool _hf_hub_offline;
+extern size_t _download_chunk_size;
 
 #define HF_HOME               _hf_home
 #define HUGGINGFACE_HUB_CACHE _huggingface_hub_cache
 #define HF_HUB_CACHE          _hf_hub_cache
 #define DEFAULT_REVISION      _default_revision
+#define ENDPOINT              _endpoint
+#define HF_HUB_OFFLINE        _hf_hub_offline
+#define DOWNLOAD_CHUNK_SIZE   _download_chunk_size
+
+namespace mako {
+namespace utils {
+inline namespace huggingface {
+/// \brief Utility to build the name of a repository folder in the cache, e.g., ``models--meta-llama--Llama-2-7b-hf``.
+/// \param repo_id A user or an organization name and a repo name separated by a ``/``.
+/// \param repo_type The type of the repository, e.g., ``"model"``.
+/// \return The name of the repository folder.
+std::string MAKO_API repo_folder_name(absl::string_view repo_id, absl::string_view repo_type = "model");
+
+/// \brief Utility to download a snapshot of a repository into the local cache, equivalent to
+/// ``huggingface_hub.snapshot_download``.
+///
+/// The cache layout is documented in https://huggingface.co/docs/huggingface_hub/guides/manage-cache; a branch or a
+/// tag is resolved to a commit hash through ``refs/<revision>``, the files are stored in ``blobs/<etag>``, and the
+/// snapshot in ``snapshots/<commit hash>`` consists of symbolic links to the blobs.
+///
+/// Files are downloaded from ``HF_ENDPOINT`` on up to ``max_workers`` threads. If the server accepts byte ranges,
+/// each file is further split into ranges of ``DOWNLOAD_CHUNK_SIZE`` bytes fetched concurrently, and the progress is
+/// saved next to the incomplete blob so that an interrupted download resumes rather than restarts. The ref and the
+/// snapshot are written only once every file has been downloaded, so a failed download never leaves a snapshot that
+/// is found offline.
+///
+/// ``HF_ENDPOINT`` may also point to a mirror of Hugging Face Hub. A static file server works as a mirror as long as
+/// it serves the repository info at ``api/models/<repo_id>/revision/<revision>`` and the files at
+/// ``<repo_id>/resolve/<commit hash>/<filename>``.
+/// \param repo_id A user or an organization name and a repo name separated by a ``/``.
+/// \param revision An optional Git revision id which can be a branch name, a tag, or a commit hash.
+/// \param cache_dir Path to the folder where cached files are stored, ``HF_HUB_CACHE`` if not given.
+/// \param allow_patterns If not empty, only files matching at least one of the glob patterns are downloaded.
+/// \param local_files_only If ``true``, never download files and only look for a snapshot in the local cache.
+///  Implied if ``HF_HUB_OFFLINE`` is set.
+/// \param max_workers The number of threads to download files concurrently.
+/// \return The path to the snapshot folder.
+std::string MAKO_API snapshot_download(
+  absl::string_view repo_id,
+  std::optional<absl::string_view> revision      = std::nullopt,
+  std::optional<absl::string_view> cache_dir     = std::nullopt,
+  const std::vector<std::string> &allow_patterns = {},
+  bool local_files_only                          = false,
+  size_t max_workers                             = 8);
+} // namespace huggingface
+} // namespace utils
+} // namespace mako
@@ -0,0 +1,333 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/utils/huggingface/hub.h"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_cat.h>
+#include <absl/strings/str_split.h>
+#include <absl/strings/strip.h>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <gtest/gtest.h>
+#include <nlohmann/json.hpp>
+
+namespace beast_http = boost::beast::http;
+namespace fs         = std::filesystem;
+
+using tcp = boost::asio::ip::tcp;
+
+static constexpr auto commit_hash = "0123456789abcdef0123456789abcdef01234567";
+
+/// \brief A local mirror of Hugging Face Hub serving the ``main`` revision of ``org/tiny``, which misbehaves as told.
+class mirror {
+ public:
+  /// \brief How the mirror answers a request for a file.
+  enum class mode {
+    // Byte ranges are accepted and honored.
+    ranges,
+    // Byte ranges are not accepted.
+    no_ranges,
+    // Byte ranges are accepted, but a range request is answered with the whole file.
+    ignore_ranges,
+    // Byte ranges are not accepted, and the body is cut short by closing the connection.
+    truncate,
+  };
+
+  mirror(std::map<std::string, std::string> __files, mode __mode)
+    : files_(std::move(__files)), mode_(__mode), acceptor_(context_, {boost::asio::ip::make_address("127.0.0.1"), 0}) {
+    thread_ = std::thread([this] {
+      for (;;) {
+        tcp::socket socket(context_);
+        acceptor_.accept(socket);
+        if (stopped_) {
+          break;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        sessions_.emplace_back([this, socket = std::move(socket)]() mutable {
+          // The client hangs up early on an unexpected response, which fails the write.
+          try {
+            serve(socket);
+          } catch (const std::exception &) {
+          }
+        });
+      }
+    });
+  }
+
+  ~mirror() {
+    // Wake up the acceptor with a connection of its own.
+    stopped_ = true;
+    boost::asio::io_context context;
+    tcp::socket socket(context);
+    socket.connect(acceptor_.local_endpoint());
+    thread_.join();
+    for (auto &session : sessions_) {
+      session.join();
+    }
+  }
+
+  std::string endpoint() const {
+    return absl::StrCat("http://127.0.0.1:", acceptor_.local_endpoint().port());
+  }
+
+  /// \brief Fails the next request for the range starting at ``begin`` with ``500``.
+  void fail_once(size_t begin) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    failures_.insert(begin);
+  }
+
+  /// \return The ``Range`` fields of the requests for files so far, or ``""`` for a request of the whole file.
+  std::vector<std::string> ranges() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ranges_;
+  }
+
+ private:
+  void serve(tcp::socket &socket) {
+    boost::beast::flat_buffer buffer;
+    beast_http::request<beast_http::empty_body> req;
+    beast_http::read(socket, buffer, req);
+
+    beast_http::response<beast_http::string_body> res(beast_http::status::ok, 11);
+    res.keep_alive(false);
+    auto target = absl::string_view(req.target().data(), req.target().size());
+    auto prefix = absl::StrCat("/org/tiny/resolve/", commit_hash, "/");
+    if (target == "/api/models/org/tiny/revision/main") {
+      auto siblings = nlohmann::json::array();
+      for (const auto &[filename, _] : files_) {
+        siblings.push_back({{"rfilename", filename}});
+      }
+      res.body() = nlohmann::json{{"sha", commit_hash}, {"siblings", siblings}}.dump();
+      res.prepare_payload();
+    } else if (absl::ConsumePrefix(&target, prefix) && files_.count(std::string(target))) {
+      const auto &file = files_.at(std::string(target));
+      res.set(beast_http::field::etag, absl::StrCat("\"", std::hash<std::string>()(file), "\""));
+      if (mode_ != mode::no_ranges && mode_ != mode::truncate) {
+        res.set(beast_http::field::accept_ranges, "bytes");
+      }
+
+      if (req.method() == beast_http::verb::head) {
+        res.content_length(file.size());
+        beast_http::serializer<false, beast_http::string_body> serializer(res);
+        beast_http::write_header(socket, serializer);
+        return;
+      }
+
+      auto range   = std::string(req[beast_http::field::range]);
+      size_t begin = 0, end = file.size();
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ranges_.push_back(range);
+        auto bytes = absl::string_view(range);
+        if (absl::ConsumePrefix(&bytes, "bytes=")) {
+          std::vector<absl::string_view> bounds = absl::StrSplit(bytes, '-');
+          EXPECT_TRUE(absl::SimpleAtoi(bounds[0], &begin) && absl::SimpleAtoi(bounds[1], &end));
+          ++end;
+          if (failures_.erase(begin)) {
+            res.result(beast_http::status::internal_server_error);
+            res.prepare_payload();
+            beast_http::write(socket, res);
+            return;
+          }
+        }
+      }
+
+      if (mode_ == mode::truncate) {
+        // Without a length, the body ends when the connection is closed.
+        res.body() = file.substr(0, file.size() / 2);
+      } else if (mode_ == mode::ranges && !range.empty()) {
+        res.result(beast_http::status::partial_content);
+        res.set(beast_http::field::content_range, absl::StrCat("bytes ", begin, "-", end - 1, "/", file.size()));
+        res.body() = file.substr(begin, end - begin);
+        res.prepare_payload();
+      } else {
+        res.body() = file;
+        res.prepare_payload();
+      }
+    } else {
+      res.result(beast_http::status::not_found);
+      res.prepare_payload();
+    }
+    beast_http::write(socket, res);
+  }
+
+  std::map<std::string, std::string> files_;
+  mode mode_;
+  boost::asio::io_context context_;
+  tcp::acceptor acceptor_;
+  std::atomic<bool> stopped_{false};
+  std::thread thread_;
+
+  std::mutex mutex_;
+  std::vector<std::thread> sessions_;
+  std::set<size_t> failures_;
+  std::vector<std::string> ranges_;
+};
+
+/// \brief Builds a file of ``__size`` bytes which differ from chunk to chunk.
+static inline std::string make_file(size_t __size) {
+  std::string file(__size, '\0');
+  for (size_t i = 0; i < __size; ++i) {
+    file[i] = static_cast<char>(i * 31 + i / 7);
+  }
+  return file;
+}
+
+/// \brief Reads a whole file.
+static inline std::string read_file(const fs::path &__path) {
+  std::ifstream stream(__path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+}
+
+/// \brief Points ``HF_ENDPOINT`` at a mirror and shrinks the chunks for the lifetime of a test.
+class SnapshotDownloadMirrorTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    cache_dir_          = fs::temp_directory_path() / fs::path("snapshot_download_mirror_test");
+    chunk_size_         = DOWNLOAD_CHUNK_SIZE;
+    endpoint_           = ENDPOINT;
+    DOWNLOAD_CHUNK_SIZE = 1000;
+    fs::remove_all(cache_dir_);
+  }
+
+  void TearDown() override {
+    DOWNLOAD_CHUNK_SIZE = chunk_size_;
+    ENDPOINT            = endpoint_;
+    fs::remove_all(cache_dir_);
+  }
+
+  std::string snapshot_download(const mirror &__mirror, bool __local_files_only = false) {
+    endpoint_value_ = __mirror.endpoint();
+    ENDPOINT        = endpoint_value_;
+    return mako::utils::snapshot_download("org/tiny", std::nullopt, cache_dir_.string(), {}, __local_files_only);
+  }
+
+  fs::path cache_dir_;
+
+ private:
+  size_t chunk_size_;
+  absl::string_view endpoint_;
+  std::string endpoint_value_;
+};
+
+TEST(SnapshotDownloadTest, LocalFilesOnly) {
+  auto cache_dir   = fs::temp_directory_path() / fs::path("snapshot_download_test");
+  auto commit_hash = std::string("01c7f73d771dfac7d292323805ebc428287df4f9");
+  auto repo_folder = cache_dir / fs::path("models--meta-llama--Llama-2-7b-hf");
+  fs::create_directories(repo_folder / fs::path("refs"));
+  fs::create_directories(repo_folder / fs::path("snapshots") / fs::path(commit_hash));
+  std::ofstream(repo_folder / fs::path("refs") / fs::path("main")) << commit_hash;
+
+  auto snapshot_folder = (repo_folder / fs::path("snapshots") / fs::path(commit_hash)).string();
+  EXPECT_EQ(mako::utils::repo_folder_name("meta-llama/Llama-2-7b-hf"), "models--meta-llama--Llama-2-7b-hf");
+
+  auto snapshot_download = [&](absl::string_view repo_id, std::optional<absl::string_view> revision) {
+    return mako::utils::snapshot_download(repo_id, revision, cache_dir.string(), {}, /*local_files_only=*/true);
+  };
+  EXPECT_EQ(snapshot_download("meta-llama/Llama-2-7b-hf", std::nullopt), snapshot_folder);
+  EXPECT_EQ(snapshot_download("meta-llama/Llama-2-7b-hf", commit_hash), snapshot_folder);
+  EXPECT_THROW(snapshot_download("meta-llama/Llama-2-7b-hf", "v1.0"), std::runtime_error);
+  EXPECT_THROW(snapshot_download("meta-llama/Llama-2-13b-hf", std::nullopt), std::runtime_error);
+  fs::remove_all(cache_dir);
+}
+
+TEST_F(SnapshotDownloadMirrorTest, Chunks) {
+  std::map<std::string, std::string> files = {{"model.bin", make_file(3500)}, {"config.json", "{}"}};
+  mirror mirror(files, mirror::mode::ranges);
+
+  auto snapshot_folder = snapshot_download(mirror);
+  EXPECT_EQ(read_file(fs::path(snapshot_folder) / fs::path("model.bin")), files.at("model.bin"));
+  EXPECT_EQ(read_file(fs::path(snapshot_folder) / fs::path("config.json")), files.at("config.json"));
+
+  // The large file is fetched in four ranges, the last one shorter, and the small one as a whole.
+  auto ranges = mirror.ranges();
+  std::sort(ranges.begin(), ranges.end());
+  EXPECT_EQ(
+    ranges,
+    (std::vector<std::string>{"", "bytes=0-999", "bytes=1000-1999", "bytes=2000-2999", "bytes=3000-3499"}));
+  EXPECT_EQ(snapshot_download(mirror, /*local_files_only=*/true), snapshot_folder);
+}
+
+TEST_F(SnapshotDownloadMirrorTest, Resume) {
+  std::map<std::string, std::string> files = {{"model.bin", make_file(3500)}};
+  mirror mirror(files, mirror::mode::ranges);
+  mirror.fail_once(2000);
+
+  // A failed download publishes neither the snapshot nor the ref, so it is not found offline.
+  EXPECT_THROW(snapshot_download(mirror), std::runtime_error);
+  EXPECT_THROW(snapshot_download(mirror, /*local_files_only=*/true), std::runtime_error);
+  EXPECT_FALSE(fs::exists(cache_dir_ / fs::path("models--org--tiny") / fs::path("refs")));
+  EXPECT_FALSE(fs::exists(cache_dir_ / fs::path("models--org--tiny") / fs::path("snapshots")));
+
+  // The second download fetches only the chunks which have not been written, so every chunk but the failed one is
+  // fetched once across both downloads; which chunks the first download skipped after the failure varies.
+  auto num_ranges      = mirror.ranges().size();
+  auto snapshot_folder = snapshot_download(mirror);
+  EXPECT_EQ(read_file(fs::path(snapshot_folder) / fs::path("model.bin")), files.at("model.bin"));
+
+  auto ranges = mirror.ranges();
+  EXPECT_NE(std::find(ranges.begin() + num_ranges, ranges.end(), "bytes=2000-2999"), ranges.end());
+  EXPECT_EQ(
+    std::multiset<std::string>(ranges.begin(), ranges.end()),
+    (std::multiset<std::string>{
+      "bytes=0-999",
+      "bytes=1000-1999",
+      "bytes=2000-2999",
+      "bytes=2000-2999",
+      "bytes=3000-3499"}));
+}
+
+TEST_F(SnapshotDownloadMirrorTest, NoRanges) {
+  std::map<std::string, std::string> files = {{"model.bin", make_file(3500)}};
+  mirror mirror(files, mirror::mode::no_ranges);
+
+  auto snapshot_folder = snapshot_download(mirror);
+  EXPECT_EQ(read_file(fs::path(snapshot_folder) / fs::path("model.bin")), files.at("model.bin"));
+  EXPECT_EQ(mirror.ranges(), (std::vector<std::string>{""}));
+}
+
+TEST_F(SnapshotDownloadMirrorTest, IgnoredRanges) {
+  // The whole file sent in reply to each range must not be committed as the blob.
+  mirror mirror({{"model.bin", make_file(3500)}}, mirror::mode::ignore_ranges);
+  EXPECT_THROW(snapshot_download(mirror), std::runtime_error);
+  EXPECT_THROW(snapshot_download(mirror, /*local_files_only=*/true), std::runtime_error);
+}
+
+TEST_F(SnapshotDownloadMirrorTest, Truncated) {
+  mirror mirror({{"model.bin", make_file(3500)}}, mirror::mode::truncate);
+  EXPECT_THROW(snapshot_download(mirror), std::runtime_error);
+  EXPECT_THROW(snapshot_download(mirror, /*local_files_only=*/true), std::runtime_error);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
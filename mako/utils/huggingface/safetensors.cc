@@ -0,0 +1,122 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/utils/huggingface/safetensors.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <numeric>
+
+#include <absl/strings/str_format.h>
+#include <nlohmann/json.hpp>
+
+using nlohmann::json;
+
+/// \brief Converts a safetensors dtype into the corresponding torch dtype.
+/// \param __dtype The dtype string in the header, e.g., ``"BF16"``.
+/// \return The corresponding torch dtype.
+static inline torch::Dtype to_dtype(absl::string_view __dtype) {
+  if (__dtype.compare("F64") == 0) {
+    return torch::kFloat64;
+  } else if (__dtype.compare("F32") == 0) {
+    return torch::kFloat32;
+  } else if (__dtype.compare("F16") == 0) {
+    return torch::kFloat16;
+  } else if (__dtype.compare("BF16") == 0) {
+    return torch::kBFloat16;
+  } else if (__dtype.compare("F8_E4M3") == 0) {
+    return torch::kFloat8_e4m3fn;
+  } else if (__dtype.compare("F8_E5M2") == 0) {
+    return torch::kFloat8_e5m2;
+  } else if (__dtype.compare("I64") == 0) {
+    return torch::kInt64;
+  } else if (__dtype.compare("I32") == 0) {
+    return torch::kInt32;
+  } else if (__dtype.compare("I16") == 0) {
+    return torch::kInt16;
+  } else if (__dtype.compare("I8") == 0) {
+    return torch::kInt8;
+  } else if (__dtype.compare("U8") == 0) {
+    return torch::kUInt8;
+  } else if (__dtype.compare("BOOL") == 0) {
+    return torch::kBool;
+  }
+  throw std::invalid_argument(absl::StrFormat("Unsupported safetensors dtype: %s", __dtype));
+}
+
+mako::utils::huggingface::safe_open::safe_open(absl::string_view filename)
+  : file_(std::make_shared<mapped_file>(filename)) {
+  // The file starts with an 8-byte little-endian unsigned integer denoting the size of the JSON header,
+  // followed by the header itself and the byte buffer.
+  uint64_t header_size = 0;
+  if (file_->size() < sizeof(header_size)) {
+    throw std::runtime_error(absl::StrFormat("%s is too small to be a safetensors file", filename));
+  }
+  std::memcpy(&header_size, file_->data(), sizeof(header_size));
+  if (file_->size() - sizeof(header_size) < header_size) {
+    throw std::runtime_error(absl::StrFormat("Invalid safetensors header size %d in %s", header_size, filename));
+  }
+  offset_ = sizeof(header_size) + header_size;
+
+  auto header = json::parse(file_->data() + sizeof(header_size), file_->data() + offset_);
+  for (const auto &[name, value] : header.items()) {
+    if (name.compare("__metadata__") == 0) {
+      metadata_ = value.get<std::map<std::string, std::string>>();
+      continue;
+    }
+
+    auto dtype        = to_dtype(value.at("dtype").get<std::string>());
+    auto shape        = value.at("shape").get<std::vector<int64_t>>();
+    auto data_offsets = value.at("data_offsets").get<std::vector<size_t>>();
+    if (data_offsets.size() != 2 || data_offsets[1] < data_offsets[0] || file_->size() - offset_ < data_offsets[1]) {
+      throw std::runtime_error(absl::StrFormat("Invalid data offsets of %s in %s", name, filename));
+    }
+
+    auto numel = std::accumulate(shape.begin(), shape.end(), int64_t{1}, std::multiplies<>());
+    if (static_cast<size_t>(numel) * torch::elementSize(dtype) != data_offsets[1] - data_offsets[0]) {
+      throw std::runtime_error(absl::StrFormat("Shape of %s does not match its data offsets in %s", name, filename));
+    }
+
+    tensors_.emplace(name, tensor_info{dtype, std::move(shape), data_offsets[0], data_offsets[1]});
+  }
+}
+
+std::vector<std::string> mako::utils::huggingface::safe_open::keys() const {
+  std::vector<std::string> keys;
+  keys.reserve(tensors_.size());
+  for (const auto &[name, _] : tensors_) {
+    keys.push_back(name);
+  }
+  std::sort(keys.begin(), keys.end(), [&](const auto &lhs, const auto &rhs) {
+    return tensors_.at(lhs).begin < tensors_.at(rhs).begin;
+  });
+  return keys;
+}
+
+torch::Tensor mako::utils::huggingface::safe_open::get_tensor(absl::string_view name) const {
+  auto it = tensors_.find(std::string(name));
+  if (it == tensors_.end()) {
+    throw std::out_of_range(absl::StrFormat("Cannot find tensor %s", name));
+  }
+  const auto &info = it->second;
+
+  // The deleter holds a reference to the mapping, so the mapping outlives every tensor that points into it,
+  // even after this ``safe_open`` has gone.
+  return torch::from_blob(
+    file_->data() + offset_ + info.begin,
+    info.shape,
+    [file = file_](void *) {},
+    torch::TensorOptions().dtype(info.dtype));
+}
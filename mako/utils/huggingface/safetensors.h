@@ -0,0 +1,70 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <absl/strings/string_view.h>
+#include <torch/torch.h>
+
+#include "mako/utils/export.h"
+#include "mako/utils/mapped_file.h"
+
+namespace mako {
+namespace utils {
+inline namespace huggingface {
+/// \brief Zero-copy reader of a safetensors file, equivalent to ``safetensors.safe_open`` with ``framework="pt"``.
+///
+/// The file is memory-mapped as a whole and every tensor returned by ``get_tensor`` points straight into the mapping,
+/// so no weight is ever copied onto the heap. The mapping is kept alive as long as any of the returned tensors is.
+///
+/// The file layout is documented in https://github.com/huggingface/safetensors#format.
+class MAKO_API safe_open {
+ public:
+  /// \param filename Path to the safetensors file.
+  explicit safe_open(absl::string_view filename);
+
+  /// \return The names of all tensors in the file, ordered by their offsets so that iterating over them reads the
+  ///  file sequentially.
+  std::vector<std::string> keys() const;
+
+  /// \param name The name of the tensor.
+  /// \return The tensor named ``name``, backed by the memory mapping.
+  torch::Tensor get_tensor(absl::string_view name) const;
+
+  /// \return The free-form string-to-string map stored under ``__metadata__``, if any.
+  inline const std::map<std::string, std::string> &metadata() const noexcept {
+    return metadata_;
+  }
+
+ private:
+  struct tensor_info {
+    torch::Dtype dtype;
+    std::vector<int64_t> shape;
+    size_t begin;
+    size_t end;
+  };
+
+  std::shared_ptr<mapped_file> file_;
+  size_t offset_;
+  std::map<std::string, tensor_info> tensors_;
+  std::map<std::string, std::string> metadata_;
+};
+} // namespace huggingface
+} // namespace utils
+} // namespace mako
@@ -0,0 +1,62 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/utils/huggingface/safetensors.h"
+
+#include <filesystem>
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+namespace fs = std::filesystem;
+
+TEST(SafeOpenTest, GetTensor) {
+  // A hand-crafted file holding a 2x3 float tensor followed by a 2-element int64 tensor,
+  // stored in reverse order of their names to check that keys follow the storage order.
+  std::string header = R"({"b":{"dtype":"F32","shape":[2,3],"data_offsets":[0,24]},)"
+                       R"("a":{"dtype":"I64","shape":[2],"data_offsets":[24,40]},)"
+                       R"("__metadata__":{"format":"pt"}})";
+  float b[]   = {0, 1, 2, 3, 4, 5};
+  int64_t a[] = {42, -1};
+
+  auto filename = fs::temp_directory_path() / fs::path("safe_open_test.safetensors");
+  {
+    auto header_size = static_cast<uint64_t>(header.size());
+    std::ofstream stream(filename, std::ios::binary);
+    stream.write(reinterpret_cast<const char *>(&header_size), sizeof(header_size));
+    stream.write(header.data(), header.size());
+    stream.write(reinterpret_cast<const char *>(b), sizeof(b));
+    stream.write(reinterpret_cast<const char *>(a), sizeof(a));
+  }
+
+  torch::Tensor tensor;
+  {
+    auto reader = mako::utils::safe_open(filename.string());
+    EXPECT_EQ(reader.keys(), std::vector<std::string>({"b", "a"}));
+    EXPECT_EQ(reader.metadata().at("format"), "pt");
+    EXPECT_TRUE(torch::equal(reader.get_tensor("a"), torch::tensor({42, -1}, torch::kInt64)));
+    EXPECT_THROW(reader.get_tensor("c"), std::out_of_range);
+    tensor = reader.get_tensor("b");
+  }
+
+  // The tensor must stay valid after the reader has gone.
+  EXPECT_EQ(tensor.sizes(), torch::IntArrayRef({2, 3}));
+  EXPECT_TRUE(torch::equal(tensor, torch::arange(6, torch::kFloat32).view({2, 3})));
+  fs::remove(filename);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
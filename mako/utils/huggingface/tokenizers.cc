@@ -0,0 +1,966 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/utils/huggingface/tokenizers.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <sstream>
+#include <stdexcept>
+
+#include <absl/strings/match.h>
+#include <absl/strings/str_format.h>
+#include <absl/strings/str_replace.h>
+#include <nlohmann/json.hpp>
+#include <torch/torch.h>
+
+namespace fs = std::filesystem;
+
+using nlohmann::json;
+
+/// \brief The piece SentencePiece replaces spaces with, i.e., ``U+2581``.
+static constexpr absl::string_view space_piece = "\xe2\x96\x81";
+
+/// \brief The encoding of ``U+FFFD``, which replaces invalid byte sequences.
+static constexpr absl::string_view replacement_character = "\xef\xbf\xbd";
+
+/// \brief Reads a whole file.
+/// \param __filename The file.
+/// \return The contents of the file.
+static inline std::string read_file(const fs::path &__filename) {
+  std::ifstream stream(__filename, std::ios::binary);
+  if (!stream) {
+    throw std::runtime_error(absl::StrFormat("Failed to open %s", __filename.string()));
+  }
+  std::ostringstream contents;
+  contents << stream.rdbuf();
+  return contents.str();
+}
+
+/// \brief Appends the UTF-8 encoding of a code point.
+/// \param __text The text to append to.
+/// \param __code_point The code point.
+static inline void append_utf8(std::string &__text, uint32_t __code_point) {
+  if (__code_point < 0x80) {
+    __text.push_back(static_cast<char>(__code_point));
+  } else if (__code_point < 0x800) {
+    __text.push_back(static_cast<char>(0xC0 | (__code_point >> 6)));
+    __text.push_back(static_cast<char>(0x80 | (__code_point & 0x3F)));
+  } else if (__code_point < 0x10000) {
+    __text.push_back(static_cast<char>(0xE0 | (__code_point >> 12)));
+    __text.push_back(static_cast<char>(0x80 | ((__code_point >> 6) & 0x3F)));
+    __text.push_back(static_cast<char>(0x80 | (__code_point & 0x3F)));
+  } else {
+    __text.push_back(static_cast<char>(0xF0 | (__code_point >> 18)));
+    __text.push_back(static_cast<char>(0x80 | ((__code_point >> 12) & 0x3F)));
+    __text.push_back(static_cast<char>(0x80 | ((__code_point >> 6) & 0x3F)));
+    __text.push_back(static_cast<char>(0x80 | (__code_point & 0x3F)));
+  }
+}
+
+/// \brief Decodes the UTF-8 character at a position.
+/// \param __text The text.
+/// \param __pos The position, which is advanced past the character, or past one byte if the bytes are invalid.
+/// \return The code point, or ``std::nullopt`` if the bytes are not a valid character.
+static inline std::optional<uint32_t> next_code_point(absl::string_view __text, size_t &__pos) {
+  auto lead = static_cast<unsigned char>(__text[__pos]);
+  if (lead < 0x80) {
+    ++__pos;
+    return lead;
+  }
+
+  // The ranges of the second byte rule out overlong encodings, surrogates, and code points beyond U+10FFFF.
+  size_t length;
+  uint32_t code_point;
+  unsigned char min = 0x80;
+  unsigned char max = 0xBF;
+  if (0xC2 <= lead && lead <= 0xDF) {
+    length     = 2;
+    code_point = lead & 0x1F;
+  } else if (0xE0 <= lead && lead <= 0xEF) {
+    length     = 3;
+    code_point = lead & 0x0F;
+    min        = lead == 0xE0 ? 0xA0 : 0x80;
+    max        = lead == 0xED ? 0x9F : 0xBF;
+  } else if (0xF0 <= lead && lead <= 0xF4) {
+    length     = 4;
+    code_point = lead & 0x07;
+    min        = lead == 0xF0 ? 0x90 : 0x80;
+    max        = lead == 0xF4 ? 0x8F : 0xBF;
+  } else {
+    ++__pos;
+    return std::nullopt;
+  }
+
+  for (size_t i = 1; i < length; ++i) {
+    if (__text.size() <= __pos + i) {
+      ++__pos;
+      return std::nullopt;
+    }
+    auto byte = static_cast<unsigned char>(__text[__pos + i]);
+    if (byte < (i == 1 ? min : 0x80) || (i == 1 ? max : 0xBF) < byte) {
+      ++__pos;
+      return std::nullopt;
+    }
+    code_point = (code_point << 6) | (byte & 0x3F);
+  }
+  __pos += length;
+  return code_point;
+}
+
+/// \brief Replaces the invalid byte sequences of a text by ``U+FFFD``.
+/// \param __text The text.
+/// \return The valid UTF-8 text.
+static inline std::string sanitize_utf8(absl::string_view __text) {
+  std::string sanitized;
+  sanitized.reserve(__text.size());
+  for (size_t pos = 0; pos < __text.size();) {
+    auto begin = pos;
+    if (next_code_point(__text, pos)) {
+      sanitized.append(__text.data() + begin, pos - begin);
+    } else {
+      sanitized.append(replacement_character.data(), replacement_character.size());
+    }
+  }
+  return sanitized;
+}
+
+/// \brief Finds where an incomplete character at the end of a text begins.
+/// \param __text The text.
+/// \return The length of the text without the incomplete character, if any.
+static inline size_t complete_length(absl::string_view __text) {
+  // A character is at most 4 bytes long, so only the last 3 bytes may begin an incomplete one.
+  for (size_t i = 1; i <= std::min<size_t>(3, __text.size()); ++i) {
+    auto byte = static_cast<unsigned char>(__text[__text.size() - i]);
+    if ((byte & 0xC0) == 0x80) {
+      continue;
+    }
+    size_t length = byte < 0xC0 ? 1 : byte < 0xE0 ? 2 : byte < 0xF0 ? 3 : 4;
+    return i < length ? __text.size() - i : __text.size();
+  }
+  return __text.size();
+}
+
+/// \brief The mapping of bytes to printable characters in byte-level BPE, as in ``bytes_to_unicode`` of GPT-2.
+///
+/// Printable bytes map to themselves, and the others to the code points from ``U+0100`` on, in order.
+/// \return The code point of each byte.
+static inline const std::array<uint32_t, 256> &byte_to_code_point() {
+  static const auto table = [] {
+    std::array<uint32_t, 256> table;
+    uint32_t n = 0;
+    for (uint32_t byte = 0; byte < 256; ++byte) {
+      auto printable = ('!' <= byte && byte <= '~') || (0xA1 <= byte && byte <= 0xAC) || (0xAE <= byte && byte <= 0xFF);
+      table[byte]    = printable ? byte : 256 + n++;
+    }
+    return table;
+  }();
+  return table;
+}
+
+/// \brief The inverse of ``byte_to_code_point``, indexed by code point.
+/// \return The byte of each code point below ``U+0144``, or ``-1`` for none.
+static inline const std::array<int16_t, 0x144> &code_point_to_byte() {
+  static const auto table = [] {
+    std::array<int16_t, 0x144> table;
+    table.fill(-1);
+    for (int16_t byte = 0; byte < 256; ++byte) {
+      table[byte_to_code_point()[byte]] = byte;
+    }
+    return table;
+  }();
+  return table;
+}
+
+/// \brief Classes of characters in the patterns of byte-level BPE.
+enum class char_class { letter, number, whitespace, other };
+
+/// \brief Classifies a code point as ``\p{L}``, ``\p{N}``, ``\s``, or none of them.
+///
+/// Non-ASCII code points are approximated by their blocks: the blocks of punctuation and symbols, e.g., General
+/// Punctuation and emoji, are neither letters nor numbers, and everything else outside the known digits and spaces is
+/// a letter, which holds for the scripts of natural languages.
+/// \param __code_point The code point.
+/// \return The class of the code point.
+static inline char_class classify(uint32_t __code_point) {
+  auto c = __code_point;
+  if (c < 0x80) {
+    if (('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z')) {
+      return char_class::letter;
+    } else if ('0' <= c && c <= '9') {
+      return char_class::number;
+    } else if (c == ' ' || ('\t' <= c && c <= '\r')) {
+      return char_class::whitespace;
+    }
+    return char_class::other;
+  }
+
+  if (c == 0x85 || c == 0xA0 || c == 0x1680 || (0x2000 <= c && c <= 0x200A) || c == 0x2028 || c == 0x2029 ||
+      c == 0x202F || c == 0x205F || c == 0x3000) {
+    return char_class::whitespace;
+  }
+  if (c == 0xB2 || c == 0xB3 || c == 0xB9 || (0xBC <= c && c <= 0xBE) || (0x660 <= c && c <= 0x669) ||
+      (0x6F0 <= c && c <= 0x6F9) || (0x966 <= c && c <= 0x96F) || (0x2070 <= c && c <= 0x2089) ||
+      (0x2150 <= c && c <= 0x218B) || (0x2460 <= c && c <= 0x249B) || (0xFF10 <= c && c <= 0xFF19)) {
+    return char_class::number;
+  }
+  if (c == 0xAA || c == 0xB5 || c == 0xBA) {
+    return char_class::letter;
+  }
+  if (c < 0xC0 || c == 0xD7 || c == 0xF7 || (0x300 <= c && c <= 0x36F) || (0x2000 <= c && c <= 0x2BFF) ||
+      (0x2E00 <= c && c <= 0x2E7F) || (0x3000 <= c && c <= 0x303F) || (0xE000 <= c && c <= 0xF8FF) ||
+      (0xFE30 <= c && c <= 0xFE4F) || (0xFF00 <= c && c <= 0xFF0F) || (0xFF1A <= c && c <= 0xFF20) ||
+      (0xFF3B <= c && c <= 0xFF40) || (0xFF5B <= c && c <= 0xFF65) || (0x1F000 <= c && c <= 0x1FAFF)) {
+    return char_class::other;
+  }
+  return char_class::letter;
+}
+
+/// \brief Splits a text into words by the pattern of byte-level BPE.
+///
+/// The pattern of Llama 3 is
+///
+/// (?i:'s|'t|'re|'ve|'m|'ll|'d)|[^\r\n\p{L}\p{N}]?\p{L}+|\p{N}{1,3}| ?[^\s\p{L}\p{N}]+[\r\n]*|\s*[\r\n]+|\s+(?!\S)|\s+
+///
+/// and the one of GPT-2 is ``'s|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+``, which are
+/// matched by hand rather than by a regular expression engine, as ``std::regex`` knows no Unicode categories.
+/// \param __text The text.
+/// \param __llama3 Whether to follow the pattern of Llama 3 rather than GPT-2.
+/// \return The words, which are views of the text.
+static inline std::vector<absl::string_view> split_words(absl::string_view __text, bool __llama3) {
+  // Each character is decoded once, along with its class and its offset in the text.
+  std::vector<uint32_t> chars;
+  std::vector<char_class> classes;
+  std::vector<size_t> offsets;
+  for (size_t pos = 0; pos < __text.size();) {
+    offsets.push_back(pos);
+    auto code_point = next_code_point(__text, pos).value_or(0xFFFD);
+    chars.push_back(code_point);
+    classes.push_back(classify(code_point));
+  }
+  offsets.push_back(__text.size());
+
+  auto n       = chars.size();
+  auto is      = [&](size_t i, char_class c) { return i < n && classes[i] == c; };
+  auto newline = [&](size_t i) { return i < n && (chars[i] == '\r' || chars[i] == '\n'); };
+  auto run     = [&](size_t i, char_class c) {
+    while (is(i, c)) {
+      ++i;
+    }
+    return i;
+  };
+  // Contractions are case-insensitive in the pattern of Llama 3 only.
+  auto lower = [&](size_t i) -> uint32_t {
+    if (n <= i || 0x80 <= chars[i]) {
+      return 0;
+    }
+    return __llama3 ? static_cast<uint32_t>(std::tolower(static_cast<int>(chars[i]))) : chars[i];
+  };
+  auto contract = [&](size_t i) -> size_t {
+    if (i >= n || chars[i] != '\'') {
+      return 0;
+    }
+    auto a = lower(i + 1);
+    auto b = lower(i + 2);
+    if ((a == 'r' && b == 'e') || (a == 'v' && b == 'e') || (a == 'l' && b == 'l')) {
+      return 3;
+    }
+    return a == 's' || a == 't' || a == 'm' || a == 'd' ? 2 : 0;
+  };
+
+  std::vector<absl::string_view> words;
+  for (size_t i = 0; i < n;) {
+    size_t end = i;
+    if (auto length = contract(i)) {
+      end = i + length;
+    } else if (is(i, char_class::letter)) {
+      end = run(i, char_class::letter);
+    } else if (
+      is(i + 1, char_class::letter) &&
+      (__llama3 ? !newline(i) && !is(i, char_class::number) : chars[i] == ' ')) {
+      end = run(i + 1, char_class::letter);
+    } else if (is(i, char_class::number) || (!__llama3 && chars[i] == ' ' && is(i + 1, char_class::number))) {
+      auto begin = is(i, char_class::number) ? i : i + 1;
+      end        = __llama3 ? std::min(run(begin, char_class::number), begin + 3) : run(begin, char_class::number);
+    } else if (is(i, char_class::other) || (chars[i] == ' ' && is(i + 1, char_class::other))) {
+      end = run(is(i, char_class::other) ? i : i + 1, char_class::other);
+      while (__llama3 && newline(end)) {
+        ++end;
+      }
+    } else {
+      // The remaining character is whitespace; a run of it ending in newlines stops at the last newline, and
+      // otherwise leaves its last space to the word that follows.
+      auto space_end = run(i, char_class::whitespace);
+      auto last      = space_end;
+      while (__llama3 && i < last && !newline(last - 1)) {
+        --last;
+      }
+      if (__llama3 && i < last) {
+        end = last;
+      } else if (space_end < n && i + 1 < space_end) {
+        end = space_end - 1;
+      } else {
+        end = space_end;
+      }
+    }
+    words.push_back(__text.substr(offsets[i], offsets[end] - offsets[i]));
+    i = end;
+  }
+  return words;
+}
+
+/// \brief Reader of the protobuf wire format, just enough to read SentencePiece models.
+class proto_reader {
+ public:
+  explicit proto_reader(absl::string_view data) : data_(data), pos_(0) {}
+
+  bool done() const {
+    return data_.size() <= pos_;
+  }
+
+  /// \brief Reads the tag of the next field.
+  /// \return The field number and the wire type.
+  std::pair<uint64_t, uint64_t> tag() {
+    auto key = varint();
+    return {key >> 3, key & 7};
+  }
+
+  uint64_t varint() {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      auto byte = static_cast<unsigned char>(read(1).front());
+      value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+      if ((byte & 0x80) == 0) {
+        return value;
+      }
+    }
+    throw std::invalid_argument("Malformed varint in the SentencePiece model");
+  }
+
+  absl::string_view bytes() {
+    return read(varint());
+  }
+
+  float fixed32() {
+    float value;
+    std::memcpy(&value, read(4).data(), 4);
+    return value;
+  }
+
+  /// \brief Skips a field of the wire type.
+  void skip(uint64_t wire_type) {
+    switch (wire_type) {
+      case 0:
+        varint();
+        break;
+      case 1:
+        read(8);
+        break;
+      case 2:
+        bytes();
+        break;
+      case 5:
+        read(4);
+        break;
+      default:
+        throw std::invalid_argument(absl::StrFormat("Unsupported wire type %d in the SentencePiece model", wire_type));
+    }
+  }
+
+ private:
+  absl::string_view read(size_t size) {
+    if (data_.size() - pos_ < size) {
+      throw std::invalid_argument("Truncated SentencePiece model");
+    }
+    auto value = data_.substr(pos_, size);
+    pos_ += size;
+    return value;
+  }
+
+  absl::string_view data_;
+  size_t pos_;
+};
+
+/// \brief Visits a component of ``tokenizer.json`` and the components of a ``Sequence`` of it, recursively.
+/// \param __component The component, e.g., the normalizer, which may be ``null``.
+/// \param __key The key of the components of a ``Sequence``, e.g., ``"normalizers"``.
+/// \param __visit The function to call on each component.
+static inline void visit(const json &__component, const char *__key, const std::function<void(const json &)> &__visit) {
+  if (!__component.is_object()) {
+    return;
+  }
+  if (__component.value("type", "") == "Sequence" && __component.contains(__key)) {
+    for (const auto &component : __component.at(__key)) {
+      visit(component, __key, __visit);
+    }
+    return;
+  }
+  __visit(__component);
+}
+
+/// \brief Reads the name of a special token in ``tokenizer_config.json``, given either as is or as an added token.
+static inline std::optional<std::string> token_name(const json &__config, const char *__key) {
+  auto it = __config.find(__key);
+  if (it == __config.end()) {
+    return std::nullopt;
+  } else if (it->is_string()) {
+    return it->get<std::string>();
+  } else if (it->is_object() && it->contains("content")) {
+    return it->at("content").get<std::string>();
+  }
+  return std::nullopt;
+}
+
+void mako::utils::tokenizer::add_piece(std::string piece, int64_t id) {
+  if (id < 0) {
+    throw std::invalid_argument(absl::StrFormat("Invalid token id %d for %s", id, piece));
+  }
+  if (static_cast<int64_t>(pieces_.size()) <= id) {
+    pieces_.resize(id + 1);
+    special_.resize(id + 1);
+    added_.resize(id + 1);
+  }
+  piece_to_id_[piece] = static_cast<int32_t>(id);
+  pieces_[id]         = std::move(piece);
+}
+
+/// \brief Packs a pair of tokens into the key of the merge table.
+static inline uint64_t pair_key(int32_t __left, int32_t __right) {
+  return (static_cast<uint64_t>(static_cast<uint32_t>(__left)) << 32) | static_cast<uint32_t>(__right);
+}
+
+void mako::utils::tokenizer::add_merge(absl::string_view left, absl::string_view right, int32_t rank) {
+  auto l      = piece_to_id_.find(left);
+  auto r      = piece_to_id_.find(right);
+  auto merged = piece_to_id_.find(absl::StrCat(left, right));
+  if (l == piece_to_id_.end() || r == piece_to_id_.end() || merged == piece_to_id_.end()) {
+    return;
+  }
+  // The first merge of a pair has the highest priority.
+  merges_.try_emplace(pair_key(l->second, r->second), merge{rank, merged->second});
+}
+
+mako::utils::tokenizer mako::utils::tokenizer::from_json(absl::string_view contents) {
+  auto config       = json::parse(contents.begin(), contents.end());
+  const auto &model = config.at("model");
+  if (model.value("type", "BPE") != "BPE") {
+    throw std::invalid_argument(
+      absl::StrFormat("Unsupported tokenizer model: %s; only BPE is supported", model.value("type", "")));
+  }
+
+  tokenizer t;
+  t.byte_ids_.fill(-1);
+  for (const auto &[piece, id] : model.at("vocab").items()) {
+    t.add_piece(piece, id.get<int64_t>());
+  }
+  for (const auto &token : config.value("added_tokens", json::array())) {
+    auto id      = token.at("id").get<int64_t>();
+    auto content = token.at("content").get<std::string>();
+    t.add_piece(content, id);
+    t.special_[id] = token.value("special", false);
+    t.added_[id]   = true;
+    t.added_tokens_.emplace_back(content, static_cast<int32_t>(id));
+  }
+
+  // Merges are either strings of two pieces separated by a space, or pairs of pieces in newer versions.
+  int32_t rank = 0;
+  for (const auto &merge : model.value("merges", json::array())) {
+    if (merge.is_string()) {
+      auto pair  = merge.get<std::string>();
+      auto space = pair.find(' ', 1);
+      if (space != std::string::npos) {
+        t.add_merge(absl::string_view(pair).substr(0, space), absl::string_view(pair).substr(space + 1), rank);
+      }
+    } else {
+      t.add_merge(merge.at(0).get<std::string>(), merge.at(1).get<std::string>(), rank);
+    }
+    ++rank;
+  }
+  t.ignore_merges_ = model.value("ignore_merges", false);
+  if (model.contains("unk_token") && model.at("unk_token").is_string()) {
+    if (auto id = t.token_to_id(model.at("unk_token").get<std::string>())) {
+      t.unk_token_id_ = static_cast<int32_t>(*id);
+    }
+  }
+
+  visit(config.value("pre_tokenizer", json()), "pretokenizers", [&](const json &pre_tokenizer) {
+    auto type = pre_tokenizer.value("type", "");
+    if (type == "ByteLevel") {
+      t.byte_level_ = true;
+    } else if (type == "Split") {
+      auto pattern      = pre_tokenizer.value("pattern", json::object()).value("Regex", "");
+      t.llama3_pattern_ = absl::StrContains(pattern, "\\p{N}{1,3}");
+    } else if (type == "Metaspace") {
+      auto scheme             = pre_tokenizer.value("prepend_scheme", "always");
+      t.add_prefix_space_     = pre_tokenizer.value("add_prefix_space", true) && scheme != "never";
+      t.prefix_every_segment_ = scheme == "always";
+    }
+  });
+  visit(config.value("normalizer", json()), "normalizers", [&](const json &normalizer) {
+    if (normalizer.value("type", "") == "Prepend" && normalizer.value("prepend", "") == space_piece) {
+      t.add_prefix_space_     = true;
+      t.prefix_every_segment_ = true;
+    }
+  });
+  visit(config.value("decoder", json()), "decoders", [&](const json &decoder) {
+    auto type = decoder.value("type", "");
+    if (type == "Strip" && 0 < decoder.value("start", 0)) {
+      t.strip_leading_space_ = true;
+    } else if (type == "Metaspace") {
+      t.strip_leading_space_ = t.add_prefix_space_;
+    }
+  });
+
+  // The template for a single sequence, e.g., ``<s> $A``, gives the special tokens around a text.
+  visit(config.value("post_processor", json()), "processors", [&](const json &processor) {
+    if (processor.value("type", "") != "TemplateProcessing") {
+      return;
+    }
+    auto *tokens = &t.prefix_tokens_;
+    for (const auto &item : processor.at("single")) {
+      if (item.contains("Sequence")) {
+        tokens = &t.suffix_tokens_;
+      } else if (item.contains("SpecialToken")) {
+        auto name = item.at("SpecialToken").at("id").get<std::string>();
+        for (const auto &id : processor.at("special_tokens").at(name).at("ids")) {
+          tokens->push_back(id.get<int64_t>());
+        }
+      }
+    }
+  });
+
+  if (t.byte_level_) {
+    for (int byte = 0; byte < 256; ++byte) {
+      std::string piece;
+      append_utf8(piece, byte_to_code_point()[byte]);
+      auto it           = t.piece_to_id_.find(piece);
+      t.byte_ids_[byte] = it == t.piece_to_id_.end() ? -1 : it->second;
+    }
+  } else if (model.value("byte_fallback", false)) {
+    for (int byte = 0; byte < 256; ++byte) {
+      auto it           = t.piece_to_id_.find(absl::StrFormat("<0x%02X>", byte));
+      t.byte_ids_[byte] = it == t.piece_to_id_.end() ? -1 : it->second;
+    }
+  }
+
+  if (!t.prefix_tokens_.empty()) {
+    t.bos_token_id_ = t.prefix_tokens_.front();
+  }
+  for (auto name : {"</s>", "<|end_of_text|>", "<|endoftext|>"}) {
+    if (auto id = t.token_to_id(name)) {
+      t.eos_token_id_ = *id;
+      break;
+    }
+  }
+  std::sort(t.added_tokens_.begin(), t.added_tokens_.end(), [](const auto &a, const auto &b) {
+    return a.first.size() > b.first.size();
+  });
+  for (const auto &[content, id] : t.added_tokens_) {
+    if (!content.empty()) {
+      t.added_first_bytes_[static_cast<unsigned char>(content.front())] = true;
+    }
+  }
+  return t;
+}
+
+mako::utils::tokenizer mako::utils::tokenizer::from_sentencepiece(absl::string_view contents) {
+  // The fields of ModelProto, SentencePiece, TrainerSpec, and NormalizerSpec in sentencepiece_model.proto.
+  enum piece_type { normal = 1, unknown = 2, control = 3, user_defined = 4, unused = 5, byte = 6 };
+  struct piece {
+    std::string text;
+    float score;
+    uint64_t type;
+  };
+  std::vector<piece> pieces;
+  uint64_t model_type   = 1;
+  auto add_dummy_prefix = true;
+
+  proto_reader model(contents);
+  while (!model.done()) {
+    auto [field, wire_type] = model.tag();
+    if (field == 1 && wire_type == 2) {
+      proto_reader reader(model.bytes());
+      piece p{"", 0, normal};
+      while (!reader.done()) {
+        auto [piece_field, piece_wire_type] = reader.tag();
+        if (piece_field == 1 && piece_wire_type == 2) {
+          p.text = std::string(reader.bytes());
+        } else if (piece_field == 2 && piece_wire_type == 5) {
+          p.score = reader.fixed32();
+        } else if (piece_field == 3 && piece_wire_type == 0) {
+          p.type = reader.varint();
+        } else {
+          reader.skip(piece_wire_type);
+        }
+      }
+      pieces.push_back(std::move(p));
+    } else if (field == 2 && wire_type == 2) {
+      proto_reader reader(model.bytes());
+      while (!reader.done()) {
+        auto [spec_field, spec_wire_type] = reader.tag();
+        if (spec_field == 3 && spec_wire_type == 0) {
+          model_type = reader.varint();
+        } else {
+          reader.skip(spec_wire_type);
+        }
+      }
+    } else if (field == 3 && wire_type == 2) {
+      proto_reader reader(model.bytes());
+      while (!reader.done()) {
+        auto [spec_field, spec_wire_type] = reader.tag();
+        if (spec_field == 3 && spec_wire_type == 0) {
+          add_dummy_prefix = reader.varint() != 0;
+        } else {
+          reader.skip(spec_wire_type);
+        }
+      }
+    } else {
+      model.skip(wire_type);
+    }
+  }
+  if (model_type != 2) {
+    throw std::invalid_argument(
+      absl::StrFormat("Unsupported SentencePiece model type %d; only BPE is supported", model_type));
+  }
+
+  tokenizer t;
+  t.byte_ids_.fill(-1);
+  for (size_t id = 0; id < pieces.size(); ++id) {
+    const auto &p = pieces[id];
+    t.add_piece(p.text, static_cast<int64_t>(id));
+    if (p.type == control) {
+      t.special_[id] = true;
+      if (p.text == "<s>") {
+        t.bos_token_id_ = static_cast<int64_t>(id);
+      } else if (p.text == "</s>") {
+        t.eos_token_id_ = static_cast<int64_t>(id);
+      }
+    } else if (p.type == user_defined) {
+      t.added_[id] = true;
+      t.added_tokens_.emplace_back(p.text, static_cast<int32_t>(id));
+    } else if (p.type == unknown) {
+      t.unk_token_id_ = static_cast<int32_t>(id);
+    } else if (p.type == byte && p.text.size() == 6) {
+      t.byte_ids_[std::stoi(p.text.substr(3, 2), nullptr, 16)] = static_cast<int32_t>(id);
+    }
+  }
+
+  // SentencePiece merges the pair whose merged piece has the highest score, so the merges are ranked by score, and
+  // every split of a piece into two pieces is a merge into it.
+  std::vector<size_t> order;
+  for (size_t id = 0; id < pieces.size(); ++id) {
+    if (pieces[id].type == normal || pieces[id].type == user_defined) {
+      order.push_back(id);
+    }
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return pieces[a].score > pieces[b].score; });
+  for (size_t rank = 0; rank < order.size(); ++rank) {
+    absl::string_view text = pieces[order[rank]].text;
+    for (size_t pos = 0; pos < text.size();) {
+      next_code_point(text, pos);
+      if (pos < text.size()) {
+        t.add_merge(text.substr(0, pos), text.substr(pos), static_cast<int32_t>(rank));
+      }
+    }
+  }
+
+  t.add_prefix_space_    = add_dummy_prefix;
+  t.strip_leading_space_ = add_dummy_prefix;
+  if (t.bos_token_id_) {
+    t.prefix_tokens_.push_back(*t.bos_token_id_);
+  }
+  std::sort(t.added_tokens_.begin(), t.added_tokens_.end(), [](const auto &a, const auto &b) {
+    return a.first.size() > b.first.size();
+  });
+  for (const auto &[content, id] : t.added_tokens_) {
+    if (!content.empty()) {
+      t.added_first_bytes_[static_cast<unsigned char>(content.front())] = true;
+    }
+  }
+  return t;
+}
+
+mako::utils::tokenizer mako::utils::tokenizer::from_pretrained(absl::string_view path) {
+  auto folder = fs::path(std::string(path));
+  tokenizer t;
+  if (fs::is_directory(folder)) {
+    if (fs::exists(folder / fs::path("tokenizer.json"))) {
+      t = from_json(read_file(folder / fs::path("tokenizer.json")));
+    } else if (fs::exists(folder / fs::path("tokenizer.model"))) {
+      t = from_sentencepiece(read_file(folder / fs::path("tokenizer.model")));
+    } else {
+      throw std::runtime_error(absl::StrFormat("Found neither tokenizer.json nor tokenizer.model in %s", path));
+    }
+  } else {
+    t      = folder.extension() == ".json" ? from_json(read_file(folder)) : from_sentencepiece(read_file(folder));
+    folder = folder.parent_path();
+  }
+
+  // The special tokens in tokenizer_config.json take precedence, as they are what Transformers uses.
+  auto config_file = folder / fs::path("tokenizer_config.json");
+  if (fs::exists(config_file)) {
+    auto config = json::parse(read_file(config_file));
+    if (auto name = token_name(config, "bos_token")) {
+      if (auto id = t.token_to_id(*name)) {
+        t.bos_token_id_ = *id;
+      }
+    }
+    if (auto name = token_name(config, "eos_token")) {
+      if (auto id = t.token_to_id(*name)) {
+        t.eos_token_id_ = *id;
+      }
+    }
+  }
+  return t;
+}
+
+std::optional<int64_t> mako::utils::tokenizer::token_to_id(absl::string_view token) const {
+  auto it = piece_to_id_.find(token);
+  if (it == piece_to_id_.end()) {
+    return std::nullopt;
+  }
+  return it->second;
+}
+
+void mako::utils::tokenizer::encode_word(absl::string_view word, std::vector<int64_t> &token_ids) const {
+  /// \brief A token of the word, linked to its neighbors that have not been merged away.
+  struct symbol {
+    int32_t id;
+    int32_t prev;
+    int32_t next;
+  };
+  std::vector<symbol> symbols;
+  auto push_symbol = [&](int32_t id) {
+    auto index = static_cast<int32_t>(symbols.size());
+    symbols.push_back({id, index - 1, -1});
+    if (0 < index) {
+      symbols[index - 1].next = index;
+    }
+  };
+
+  if (byte_level_) {
+    if (ignore_merges_) {
+      std::string piece;
+      for (auto c : word) {
+        append_utf8(piece, byte_to_code_point()[static_cast<unsigned char>(c)]);
+      }
+      if (auto it = piece_to_id_.find(piece); it != piece_to_id_.end()) {
+        token_ids.push_back(it->second);
+        return;
+      }
+    }
+    for (auto c : word) {
+      push_symbol(byte_ids_[static_cast<unsigned char>(c)]);
+    }
+  } else {
+    // Each character is a token to begin with, or falls back to its bytes if it is not in the vocabulary.
+    for (size_t pos = 0; pos < word.size();) {
+      auto begin = pos;
+      next_code_point(word, pos);
+      auto it = piece_to_id_.find(word.substr(begin, pos - begin));
+      if (it != piece_to_id_.end()) {
+        push_symbol(it->second);
+        continue;
+      }
+      for (auto i = begin; i < pos; ++i) {
+        auto id = byte_ids_[static_cast<unsigned char>(word[i])];
+        push_symbol(0 <= id ? id : unk_token_id_.value_or(0));
+      }
+    }
+  }
+
+  /// \brief A pair of adjacent symbols to merge, ordered by the rank of the merge and then by position.
+  struct candidate {
+    int32_t rank;
+    int32_t left;
+    int32_t left_id;
+    int32_t right_id;
+    int32_t merged_id;
+
+    bool operator>(const candidate &other) const {
+      return rank != other.rank ? rank > other.rank : left > other.left;
+    }
+  };
+  std::priority_queue<candidate, std::vector<candidate>, std::greater<candidate>> queue;
+  auto push_pair = [&](int32_t left) {
+    auto right = symbols[left].next;
+    if (right < 0) {
+      return;
+    }
+    auto it = merges_.find(pair_key(symbols[left].id, symbols[right].id));
+    if (it != merges_.end()) {
+      queue.push({it->second.rank, left, symbols[left].id, symbols[right].id, it->second.id});
+    }
+  };
+  for (int32_t i = 0; i + 1 < static_cast<int32_t>(symbols.size()); ++i) {
+    push_pair(i);
+  }
+
+  // A candidate is stale if either of its symbols has been merged since it was pushed.
+  while (!queue.empty()) {
+    auto top = queue.top();
+    queue.pop();
+    auto &left = symbols[top.left];
+    if (left.id != top.left_id || left.next < 0 || symbols[left.next].id != top.right_id) {
+      continue;
+    }
+    auto &right = symbols[left.next];
+    left.id     = top.merged_id;
+    left.next   = right.next;
+    if (0 <= right.next) {
+      symbols[right.next].prev = top.left;
+    }
+    right.id = -1;
+    if (0 <= left.prev) {
+      push_pair(left.prev);
+    }
+    push_pair(top.left);
+  }
+
+  for (int32_t i = symbols.empty() ? -1 : 0; 0 <= i; i = symbols[i].next) {
+    token_ids.push_back(symbols[i].id);
+  }
+}
+
+void mako::utils::tokenizer::encode_segment(absl::string_view text, bool first, std::vector<int64_t> &token_ids) const {
+  if (byte_level_) {
+    for (auto word : split_words(text, llama3_pattern_)) {
+      encode_word(word, token_ids);
+    }
+    return;
+  }
+
+  // SentencePiece BPE runs over the whole segment, with spaces replaced by ``▁``.
+  std::string normalized;
+  if (add_prefix_space_ && (first || prefix_every_segment_)) {
+    normalized.append(space_piece.data(), space_piece.size());
+  }
+  normalized += absl::StrReplaceAll(text, {{" ", space_piece}});
+  encode_word(normalized, token_ids);
+}
+
+std::vector<int64_t> mako::utils::tokenizer::encode(absl::string_view text, bool add_special_tokens) const {
+  std::vector<int64_t> token_ids;
+  if (add_special_tokens) {
+    token_ids = prefix_tokens_;
+  }
+
+  // The text is split at the added tokens, taking the longest one at the earliest position.
+  size_t begin = 0;
+  for (size_t pos = 0; pos < text.size(); ++pos) {
+    if (!added_first_bytes_[static_cast<unsigned char>(text[pos])]) {
+      continue;
+    }
+    auto rest = text.substr(pos);
+    auto it   = std::find_if(added_tokens_.begin(), added_tokens_.end(), [&](const auto &token) {
+      return !token.first.empty() && absl::StartsWith(rest, token.first);
+    });
+    if (it == added_tokens_.end()) {
+      continue;
+    }
+    if (begin < pos) {
+      encode_segment(text.substr(begin, pos - begin), begin == 0, token_ids);
+    }
+    token_ids.push_back(it->second);
+    begin = pos + it->first.size();
+    pos   = begin - 1;
+  }
+  if (begin < text.size()) {
+    encode_segment(text.substr(begin), begin == 0, token_ids);
+  }
+
+  if (add_special_tokens) {
+    token_ids.insert(token_ids.end(), suffix_tokens_.begin(), suffix_tokens_.end());
+  }
+  return token_ids;
+}
+
+std::vector<std::vector<int64_t>> mako::utils::tokenizer::encode_batch(
+  const std::vector<std::string> &texts,
+  bool add_special_tokens) const {
+  std::vector<std::vector<int64_t>> token_ids(texts.size());
+  at::parallel_for(0, static_cast<int64_t>(texts.size()), 1, [&](int64_t begin, int64_t end) {
+    for (auto i = begin; i < end; ++i) {
+      token_ids[i] = encode(texts[i], add_special_tokens);
+    }
+  });
+  return token_ids;
+}
+
+std::string mako::utils::tokenizer::token_bytes(int64_t token_id, bool skip_special_tokens) const {
+  if (token_id < 0 || vocab_size() <= token_id) {
+    throw std::out_of_range(absl::StrFormat("Token %d is out of the vocabulary of %d tokens", token_id, vocab_size()));
+  }
+  if (special_[token_id] && skip_special_tokens) {
+    return "";
+  }
+  const auto &piece = pieces_[token_id];
+  if (added_[token_id] || special_[token_id]) {
+    return piece;
+  }
+
+  if (byte_level_) {
+    std::string bytes;
+    for (size_t pos = 0; pos < piece.size();) {
+      auto begin      = pos;
+      auto code_point = next_code_point(piece, pos);
+      if (code_point && *code_point < code_point_to_byte().size() && 0 <= code_point_to_byte()[*code_point]) {
+        bytes.push_back(static_cast<char>(code_point_to_byte()[*code_point]));
+      } else {
+        bytes.append(piece, begin, pos - begin);
+      }
+    }
+    return bytes;
+  }
+
+  // A byte token such as ``<0x0A>`` stands for its byte.
+  if (piece.size() == 6 && absl::StartsWith(piece, "<0x") && piece.back() == '>') {
+    auto byte = std::stoi(piece.substr(3, 2), nullptr, 16);
+    if (byte_ids_[byte] == token_id) {
+      return std::string(1, static_cast<char>(byte));
+    }
+  }
+  return absl::StrReplaceAll(piece, {{space_piece, " "}});
+}
+
+std::string mako::utils::tokenizer::decode(const std::vector<int64_t> &token_ids, bool skip_special_tokens) const {
+  std::string text;
+  for (auto token_id : token_ids) {
+    auto bytes = token_bytes(token_id, skip_special_tokens);
+    // Only the space prepended to the text is stripped, i.e., the one of the first token.
+    if (strip_leading_space_ && text.empty() && absl::StartsWith(bytes, " ")) {
+      bytes.erase(0, 1);
+    }
+    text += bytes;
+  }
+  return sanitize_utf8(text);
+}
+
+std::string mako::utils::incremental_detokenizer::step(int64_t token_id) {
+  pending_ += tokenizer_.token_bytes(token_id, skip_special_tokens_);
+  auto length = complete_length(pending_);
+  auto text   = sanitize_utf8(absl::string_view(pending_).substr(0, length));
+  pending_.erase(0, length);
+  return text;
+}
+
+std::string mako::utils::incremental_detokenizer::flush() {
+  auto text = sanitize_utf8(pending_);
+  pending_.clear();
+  return text;
+}
@@ -0,0 +1,209 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <absl/container/flat_hash_map.h>
+#include <absl/strings/string_view.h>
+
+#include "mako/utils/export.h"
+
+namespace mako {
+namespace utils {
+inline namespace huggingface {
+/// \brief Byte-pair encoding tokenizer, equivalent to the fast tokenizers of Hugging Face Transformers for Llama
+/// models.
+///
+/// Two flavors of BPE are supported:
+///
+/// * SentencePiece BPE, as in Llama 2 and Mistral, where spaces are replaced by ``▁`` and characters missing from the
+///   vocabulary fall back to byte tokens such as ``<0x0A>``.
+/// * Byte-level BPE, as in Llama 3 and GPT-2, where the text is split into words by the pattern of the model, and
+///   each byte of a word is a token to begin with.
+///
+/// Merges are looked up in a flat hash table keyed by the pair of token ids, and applied in order of rank with a
+/// heap, so that encoding a word of ``n`` tokens takes ``O(n log n)`` rather than a scan of all pairs per merge.
+///
+/// NOTE:
+///
+/// Unicode categories in the pattern of byte-level BPE are approximated: ASCII is classified exactly, while other
+/// code points are letters unless they are in a block of whitespace, digits, punctuation, or symbols.
+class MAKO_API tokenizer {
+ public:
+  /// \brief Loads the tokenizer of a model, from ``tokenizer.json`` or, if not found, ``tokenizer.model``.
+  /// \param path The directory of the model, e.g., as resolved by ``snapshot_download``, or the file itself.
+  /// \throw std::runtime_error If no tokenizer is found.
+  /// \throw std::invalid_argument If the tokenizer is not a BPE tokenizer.
+  static tokenizer from_pretrained(absl::string_view path);
+
+  /// \brief Loads a tokenizer of Hugging Face Tokenizers.
+  /// \param contents The contents of ``tokenizer.json``.
+  /// \throw std::invalid_argument If the tokenizer is not a BPE tokenizer.
+  static tokenizer from_json(absl::string_view contents);
+
+  /// \brief Loads a SentencePiece model.
+  /// \param contents The serialized ``ModelProto``, i.e., the contents of ``tokenizer.model``.
+  /// \throw std::invalid_argument If the model is malformed or not a BPE model.
+  static tokenizer from_sentencepiece(absl::string_view contents);
+
+  /// \brief Encodes a text into tokens.
+  ///
+  /// Added tokens such as ``<s>`` in the text are encoded as such, and the rest is normalized, split into words, and
+  /// encoded by BPE.
+  /// \param text The text in UTF-8.
+  /// \param add_special_tokens Whether to add special tokens such as ``<s>`` around the text, as the model expects.
+  /// \return The tokens.
+  std::vector<int64_t> encode(absl::string_view text, bool add_special_tokens = true) const;
+
+  /// \brief Encodes texts into tokens in parallel, one text per task on the intra-op thread pool of LibTorch.
+  /// \param texts The texts in UTF-8.
+  /// \param add_special_tokens Whether to add special tokens such as ``<s>`` around each text.
+  /// \return The tokens of each text.
+  std::vector<std::vector<int64_t>> encode_batch(
+    const std::vector<std::string> &texts,
+    bool add_special_tokens = true) const;
+
+  /// \brief Decodes tokens into a text.
+  /// \param token_ids The tokens.
+  /// \param skip_special_tokens Whether to leave out special tokens such as ``</s>``.
+  /// \return The text in UTF-8, where invalid byte sequences are replaced by ``U+FFFD``.
+  std::string decode(const std::vector<int64_t> &token_ids, bool skip_special_tokens = true) const;
+
+  /// \brief The bytes a token stands for in the middle of a text, which may be part of a multibyte character.
+  /// \param token_id The token.
+  /// \param skip_special_tokens Whether a special token stands for no bytes.
+  std::string token_bytes(int64_t token_id, bool skip_special_tokens = true) const;
+
+  /// \brief The token of a piece of the vocabulary or an added token, e.g., ``"</s>"``.
+  std::optional<int64_t> token_to_id(absl::string_view token) const;
+
+  /// \brief The number of tokens, including added tokens.
+  int64_t vocab_size() const {
+    return static_cast<int64_t>(pieces_.size());
+  }
+
+  /// \brief The token to begin a sequence with, if any.
+  std::optional<int64_t> bos_token_id() const {
+    return bos_token_id_;
+  }
+
+  /// \brief The token to end a sequence with, if any.
+  std::optional<int64_t> eos_token_id() const {
+    return eos_token_id_;
+  }
+
+  bool is_special(int64_t token_id) const {
+    return 0 <= token_id && token_id < vocab_size() && special_[token_id];
+  }
+
+ private:
+  /// \brief A merge of a pair of tokens.
+  struct merge {
+    /// \brief The priority of the merge, which is lower for earlier merges.
+    int32_t rank;
+
+    /// \brief The token the pair is merged into.
+    int32_t id;
+  };
+
+  tokenizer() = default;
+
+  /// \brief Adds a token to the vocabulary, growing it as needed.
+  void add_piece(std::string piece, int64_t id);
+
+  /// \brief Adds a merge of the pair of pieces, if all three are in the vocabulary.
+  void add_merge(absl::string_view left, absl::string_view right, int32_t rank);
+
+  /// \brief Encodes a text without added tokens, appending the tokens to ``token_ids``.
+  void encode_segment(absl::string_view text, bool first, std::vector<int64_t> &token_ids) const;
+
+  /// \brief Encodes a word by BPE, appending the tokens to ``token_ids``.
+  void encode_word(absl::string_view word, std::vector<int64_t> &token_ids) const;
+
+  /// \brief Whether the tokenizer is byte-level rather than SentencePiece.
+  bool byte_level_ = false;
+
+  /// \brief Whether the pre-tokenizer of byte-level BPE follows Llama 3 rather than GPT-2.
+  bool llama3_pattern_ = false;
+
+  /// \brief Whether a word found whole in the vocabulary skips the merges.
+  bool ignore_merges_ = false;
+
+  /// \brief Whether ``▁`` is prepended to a text in SentencePiece BPE.
+  bool add_prefix_space_ = false;
+
+  /// \brief Whether ``▁`` is prepended to every segment between added tokens, rather than only at the start.
+  bool prefix_every_segment_ = false;
+
+  /// \brief Whether the space of the prepended ``▁`` is stripped from a decoded text.
+  bool strip_leading_space_ = false;
+
+  std::vector<std::string> pieces_;
+  std::vector<bool> special_;
+  std::vector<bool> added_;
+  absl::flat_hash_map<std::string, int32_t> piece_to_id_;
+  absl::flat_hash_map<uint64_t, merge> merges_;
+
+  /// \brief The tokens matched in the text before BPE, longest first.
+  std::vector<std::pair<std::string, int32_t>> added_tokens_;
+
+  /// \brief Whether any added token begins with each byte, to skip the positions where none can match.
+  std::array<bool, 256> added_first_bytes_ = {};
+
+  /// \brief The token of each byte, in byte-level BPE or for byte fallback, or ``-1`` if none.
+  std::array<int32_t, 256> byte_ids_ = {};
+
+  std::optional<int32_t> unk_token_id_;
+  std::optional<int64_t> bos_token_id_;
+  std::optional<int64_t> eos_token_id_;
+
+  /// \brief The special tokens to add before and after a text.
+  std::vector<int64_t> prefix_tokens_;
+  std::vector<int64_t> suffix_tokens_;
+};
+
+/// \brief Detokenizer for streaming, which turns the tokens generated for a sequence into text one token at a time.
+///
+/// Each token costs only the decoding of its own bytes; the bytes of an incomplete multibyte character are held back
+/// until the character is complete, so the pieces of text are always valid UTF-8.
+class MAKO_API incremental_detokenizer {
+ public:
+  /// \param tokenizer The tokenizer, which must outlive the detokenizer.
+  /// \param skip_special_tokens Whether to leave out special tokens such as ``</s>``.
+  explicit incremental_detokenizer(const tokenizer &tokenizer, bool skip_special_tokens = true)
+      : tokenizer_(tokenizer), skip_special_tokens_(skip_special_tokens) {}
+
+  /// \brief Appends a token.
+  /// \return The text completed by the token, which is empty while a multibyte character is incomplete.
+  std::string step(int64_t token_id);
+
+  /// \brief Ends the sequence.
+  /// \return The bytes held back, where an incomplete character is replaced by ``U+FFFD``.
+  std::string flush();
+
+ private:
+  const tokenizer &tokenizer_;
+  bool skip_special_tokens_;
+  std::string pending_;
+};
+} // namespace huggingface
+} // namespace utils
+} // namespace mako
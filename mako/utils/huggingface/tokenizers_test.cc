@@ -0,0 +1,180 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/utils/huggingface/tokenizers.h"
+
+#include <filesystem>
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+namespace fs = std::filesystem;
+
+/// \brief A tokenizer.json in the style of Llama 2, with byte fallback.
+static constexpr char sentencepiece_json[] = R"({
+  "added_tokens": [
+    {"id": 0, "content": "<unk>", "special": true},
+    {"id": 1, "content": "<s>", "special": true},
+    {"id": 2, "content": "</s>", "special": true}
+  ],
+  "normalizer": {"type": "Sequence", "normalizers": [
+    {"type": "Prepend", "prepend": "▁"},
+    {"type": "Replace", "pattern": {"String": " "}, "content": "▁"}
+  ]},
+  "pre_tokenizer": null,
+  "post_processor": {
+    "type": "TemplateProcessing",
+    "single": [{"SpecialToken": {"id": "<s>", "type_id": 0}}, {"Sequence": {"id": "A", "type_id": 0}}],
+    "special_tokens": {"<s>": {"id": "<s>", "ids": [1], "tokens": ["<s>"]}}
+  },
+  "decoder": {"type": "Sequence", "decoders": [
+    {"type": "Replace", "pattern": {"String": "▁"}, "content": " "},
+    {"type": "ByteFallback"},
+    {"type": "Fuse"},
+    {"type": "Strip", "content": " ", "start": 1, "stop": 0}
+  ]},
+  "model": {
+    "type": "BPE",
+    "unk_token": "<unk>",
+    "byte_fallback": true,
+    "vocab": {
+      "<unk>": 0, "<s>": 1, "</s>": 2, "<0x0A>": 3, "<0xC3>": 4, "<0xA9>": 5, "▁": 6, "h": 7, "e": 8, "l": 9,
+      "o": 10, "▁h": 11, "ll": 12, "▁he": 13, "llo": 14, "▁hello": 15, "w": 16, "▁w": 17
+    },
+    "merges": ["▁ h", "l l", "▁h e", "ll o", "▁he llo", "▁ w"]
+  }
+})";
+
+/// \brief A tokenizer.json in the style of Llama 3, with byte-level BPE.
+static constexpr char byte_level_json[] = R"({
+  "added_tokens": [{"id": 20, "content": "<|begin_of_text|>", "special": true}],
+  "normalizer": null,
+  "pre_tokenizer": {"type": "Sequence", "pretokenizers": [
+    {"type": "Split", "pattern": {"Regex": "(?i:'s|'t|'re|'ve|'m|'ll|'d)|[^\\r\\n\\p{L}\\p{N}]?\\p{L}+|\\p{N}{1,3}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n]*|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+"}, "behavior": "Isolated"},
+    {"type": "ByteLevel", "add_prefix_space": false, "use_regex": false}
+  ]},
+  "post_processor": {"type": "Sequence", "processors": [
+    {"type": "ByteLevel"},
+    {
+      "type": "TemplateProcessing",
+      "single": [{"SpecialToken": {"id": "<|begin_of_text|>", "type_id": 0}}, {"Sequence": {"id": "A", "type_id": 0}}],
+      "special_tokens": {"<|begin_of_text|>": {"id": "<|begin_of_text|>", "ids": [20]}}
+    }
+  ]},
+  "decoder": {"type": "ByteLevel"},
+  "model": {
+    "type": "BPE",
+    "ignore_merges": true,
+    "vocab": {
+      "h": 0, "e": 1, "l": 2, "o": 3, "Ġ": 4, "1": 5, "2": 6, "3": 7, "4": 8, "!": 9, "Ċ": 10, "he": 11,
+      "ll": 12, "llo": 13, "hello": 14, "Ġhello": 15, "Ġh": 16, "Ġhe": 17, "12": 18, "123": 19
+    },
+    "merges": [["h", "e"], ["l", "l"], ["ll", "o"], ["he", "llo"], ["Ġ", "h"], ["Ġh", "e"], ["1", "2"]]
+  }
+})";
+
+TEST(TokenizerTest, SentencePiece) {
+  auto tokenizer = mako::utils::tokenizer::from_json(sentencepiece_json);
+  EXPECT_EQ(tokenizer.vocab_size(), 18);
+  EXPECT_EQ(tokenizer.bos_token_id(), 1);
+  EXPECT_EQ(tokenizer.eos_token_id(), 2);
+
+  EXPECT_EQ(tokenizer.encode("hello w"), std::vector<int64_t>({1, 15, 17}));
+  // Characters missing from the vocabulary fall back to their bytes.
+  EXPECT_EQ(tokenizer.encode("hello\n\xc3\xa9", false), std::vector<int64_t>({15, 3, 4, 5}));
+  // Added tokens are matched in the text, and each segment after them is prefixed with a space.
+  EXPECT_EQ(tokenizer.encode("</s>hello", false), std::vector<int64_t>({2, 15}));
+
+  EXPECT_EQ(tokenizer.decode({1, 15, 17}), "hello w");
+  EXPECT_EQ(tokenizer.decode({1, 15, 17}, false), "<s> hello w");
+  EXPECT_EQ(tokenizer.decode({15, 3, 4, 5}), "hello\n\xc3\xa9");
+  EXPECT_EQ(tokenizer.decode({15, 4}), "hello\xef\xbf\xbd");
+
+  auto texts = std::vector<std::string>({"hello w", "w", "", "hello hello"});
+  auto batch = tokenizer.encode_batch(texts);
+  ASSERT_EQ(batch.size(), texts.size());
+  for (size_t i = 0; i < texts.size(); ++i) {
+    EXPECT_EQ(batch[i], tokenizer.encode(texts[i]));
+  }
+}
+
+TEST(TokenizerTest, ByteLevel) {
+  auto tokenizer = mako::utils::tokenizer::from_json(byte_level_json);
+  EXPECT_EQ(tokenizer.bos_token_id(), 20);
+
+  // The words are "hello", " hello", "!", "123", and "4", and "hello" is in the vocabulary as a whole.
+  EXPECT_EQ(tokenizer.encode("hello hello!1234"), std::vector<int64_t>({20, 14, 15, 9, 19, 8}));
+  EXPECT_EQ(tokenizer.encode("hello\n\nhello", false), std::vector<int64_t>({14, 10, 10, 14}));
+  EXPECT_EQ(tokenizer.encode("<|begin_of_text|>he", false), std::vector<int64_t>({20, 11}));
+
+  EXPECT_EQ(tokenizer.decode({20, 14, 15, 9, 19, 8}), "hello hello!1234");
+  EXPECT_EQ(tokenizer.decode({20, 11}, false), "<|begin_of_text|>he");
+}
+
+TEST(TokenizerTest, FromSentencePiece) {
+  // A ModelProto of a BPE model with the pieces <unk>, <s>, </s>, ▁, h, e, ▁h, he, and ▁he.
+  auto varint = [](uint64_t value) {
+    std::string bytes;
+    for (; 0x80 <= value; value >>= 7) {
+      bytes.push_back(static_cast<char>(value | 0x80));
+    }
+    bytes.push_back(static_cast<char>(value));
+    return bytes;
+  };
+  auto message = [&](uint64_t field, const std::string &bytes) {
+    return varint(field << 3 | 2) + varint(bytes.size()) + bytes;
+  };
+  auto piece = [&](const std::string &text, float score, uint64_t type) {
+    std::string score_bytes(reinterpret_cast<const char *>(&score), 4);
+    return message(1, message(1, text) + varint(2 << 3 | 5) + score_bytes + varint(3 << 3) + varint(type));
+  };
+  auto model = piece("<unk>", 0, 2) + piece("<s>", 0, 3) + piece("</s>", 0, 3) + piece("▁", -10, 1) +
+               piece("h", -11, 1) + piece("e", -12, 1) + piece("▁h", -1, 1) + piece("he", -3, 1) +
+               piece("▁he", -2, 1);
+
+  // The pieces with higher scores are merged first, so ▁ and h are merged before h and e.
+  auto tokenizer = mako::utils::tokenizer::from_sentencepiece(model + message(2, varint(3 << 3) + varint(2)));
+  EXPECT_EQ(tokenizer.encode("he"), std::vector<int64_t>({1, 8}));
+  EXPECT_EQ(tokenizer.decode({1, 8, 2}), "he");
+  EXPECT_EQ(tokenizer.eos_token_id(), 2);
+
+  // Unigram models, the default type, are not supported.
+  EXPECT_THROW(mako::utils::tokenizer::from_sentencepiece(model), std::invalid_argument);
+
+  auto folder = fs::temp_directory_path() / fs::path("tokenizer_test");
+  fs::create_directories(folder);
+  std::ofstream(folder / fs::path("tokenizer.model"), std::ios::binary) << model + message(2, varint(3 << 3) + varint(2));
+  std::ofstream(folder / fs::path("tokenizer_config.json")) << R"({"eos_token": {"content": "<s>"}})";
+  EXPECT_EQ(mako::utils::tokenizer::from_pretrained(folder.string()).eos_token_id(), 1);
+  fs::remove_all(folder);
+  EXPECT_THROW(mako::utils::tokenizer::from_pretrained(folder.string()), std::runtime_error);
+}
+
+TEST(IncrementalDetokenizerTest, Step) {
+  auto tokenizer = mako::utils::tokenizer::from_json(sentencepiece_json);
+  mako::utils::incremental_detokenizer detokenizer(tokenizer);
+
+  // The bytes of a multibyte character are held back until the character is complete.
+  EXPECT_EQ(detokenizer.step(15), " hello");
+  EXPECT_EQ(detokenizer.step(4), "");
+  EXPECT_EQ(detokenizer.step(5), "\xc3\xa9");
+  EXPECT_EQ(detokenizer.step(2), "");
+  EXPECT_EQ(detokenizer.step(4), "");
+  EXPECT_EQ(detokenizer.flush(), "\xef\xbf\xbd");
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -16,19 +16,56 @@
 
 #include "mako/utils/huggingface/transformers.h"
 
+#include <unistd.h>
+
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <exception>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
 
+#include <absl/strings/match.h>
+#include <absl/strings/str_cat.h>
 #include <absl/strings/str_format.h>
+#include <absl/strings/str_replace.h>
+#include <absl/strings/str_split.h>
 #include <boost/bind/bind.hpp>
 #include <nlohmann/json.hpp>
 
+#include "mako/utils/bounded_queue.h"
+#include "mako/utils/filelock.h"
+#include "mako/utils/huggingface/hub.h"
+#include "mako/utils/huggingface/safetensors.h"
+#include "mako/utils/metrics.h"
+#include "mako/utils/numpy.h"
+#include "mako/utils/pickle.h"
+#include "mako/utils/pipeline.h"
+#include "mako/utils/quantization.h"
+
 namespace fs = std::filesystem;
 
 using nlohmann::json;
 
+/// \brief Creates a lock on the model so that only one process converts or downloads it at a time.
+/// \param __model_name_or_path The name or path of the model.
+/// \param __cache_dir The directory to place the lock file in, or the temporary directory if not given.
+/// \return The lock, which is held until it goes out of scope.
+static inline std::unique_ptr<mako::utils::file_lock> get_lock(
+  absl::string_view __model_name_or_path,
+  std::optional<absl::string_view> __cache_dir) {
+  auto lock_dir = __cache_dir ? fs::path(*__cache_dir) : fs::temp_directory_path();
+  fs::create_directories(lock_dir);
+  auto lock_file_name = absl::StrReplaceAll(__model_name_or_path, {{"/", "-"}}) + ".lock";
+  return std::make_unique<mako::utils::file_lock>((lock_dir / fs::path(lock_file_name)).string());
+}
+
 static inline std::tuple<std::string, std::vector<std::string>, bool> prepare_load(
   absl::string_view model_name_or_path,
   std::optional<absl::string_view> cache_dir,
@@ -59,9 +96,15 @@ static inline std::tuple<std::string, std::vector<std::string>, bool> prepare_lo
 
   std::string hf_folder;
   if (!is_local) {
+    // Use file lock to prevent multiple processes from downloading the same model weights at the same time.
+    auto lock = get_lock(model_name_or_path, cache_dir);
+
     // Download model weights from Hugging Face Hub.
-    // TODO: implement ``snapshot_download``
-    throw std::logic_error("snapshot download is currently not supported");
+    std::vector<std::string> patterns;
+    for (auto pattern : allow_patterns) {
+      patterns.push_back(absl::StrCat("*", pattern));
+    }
+    hf_folder = mako::utils::snapshot_download(model_name_or_path, revision, cache_dir, patterns);
   } else {
     hf_folder = model_name_or_path;
   }
@@ -119,13 +162,304 @@ static inline std::tuple<std::string, std::vector<std::string>, bool> prepare_lo
   return std::make_tuple(hf_folder, hf_weight_files, use_safetensors);
 }
 
+using weight_fn = std::function<void(std::string, torch::Tensor)>;
+
+/// \brief Decodes a shard and passes each of its weights to ``__fn``.
+/// \param __file Path to the shard.
+/// \param __use_safetensors If ``true``, the shard is in safetensors format, otherwise it is a ``torch.save`` archive.
+/// \param __fn Callback to receive the name and tensor of each weight.
+static inline void load_shard(const std::string &__file, bool __use_safetensors, const weight_fn &__fn) {
+  if (__use_safetensors) {
+    // Tensors from ``safe_open`` point straight into the memory mapping of the file,
+    // so pages are read on demand instead of buffering the whole file on the heap.
+    auto reader = mako::utils::safe_open(__file);
+    for (const auto &name : reader.keys()) {
+      __fn(name, reader.get_tensor(name));
+    }
+  } else {
+    // CAUTION:
+    //
+    // Several previous versions of LibTorch including v2.1.2 may result in deserialization failure upon
+    // ``torch::pickle_load`` (and thus ``mako::utils::pickle_load``, which shares the same unpickler) due to the
+    // lacked support for pickling protocol.
+    //
+    // To avoid such pickling issues, we recommend using LibTorch v2.2.0 but if you have to use other versions
+    // including v2.1.2, make sure the pickle header ends with 80 02 7d 71 00 28 58 19 00 00 00 by converting it into
+    // hexadecimal form; e.g., the below left header is deserializable in LibTorch v2.1.2, but the right one fails to
+    // be deserialized:
+    //
+    // 000000: 50 4b 03 04 00 00 08 08 00 00 00 00 00 00 00 00  PK..............  000000: 50 4b 03 04 00 00 08 08 00 00 00 00 00 00 00 00  PK..............
+    // 000010: 00 00 00 00 00 00 00 00 00 00 25 00 3d 00 70 79  ..........%.=.py  000010: 00 00 00 00 00 00 00 00 00 00 25 00 3d 00 70 79  ..........%.=.py
+    // 000020: 74 6f 72 63 68 5f 6d 6f 64 65 6c 2d 30 30 30 30  torch_model-0000  000020: 74 6f 72 63 68 5f 6d 6f 64 65 6c 2d 30 30 30 30  torch_model-0000
+    // 000030: 31 2d 6f 66 2d 30 30 30 30 33 2f 64 61 74 61 2e  1-of-00003/data.  000030: 32 2d 6f 66 2d 30 30 30 30 33 2f 64 61 74 61 2e  2-of-00003/data.
+    // 000040: 70 6b 6c 46 42 39 00 5a 5a 5a 5a 5a 5a 5a 5a 5a  pklFB9.ZZZZZZZZZ  000040: 70 6b 6c 46 42 39 00 5a 5a 5a 5a 5a 5a 5a 5a 5a  pklFB9.ZZZZZZZZZ
+    // 000050: 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a  ZZZZZZZZZZZZZZZZ  000050: 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a  ZZZZZZZZZZZZZZZZ
+    // 000060: 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a  ZZZZZZZZZZZZZZZZ  000060: 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a  ZZZZZZZZZZZZZZZZ
+    // 000070: 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a  ZZZZZZZZZZZZZZZZ  000070: 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a  ZZZZZZZZZZZZZZZZ
+    // 000080: 80 02 7d 71 00 28 58 19 00 00 00                 ..}q.(X....       000080: 80 02 7d 71 00 28 58 22 00 00 00                 ..}q.(X"...
+    //
+    // Each tensor points into the memory mapping of the file rather than a copy of the whole file, so peak memory
+    // stays around the size of the tensors in use instead of the size of the shard.
+    auto weights = mako::utils::pickle_load(__file).toGenericDict();
+    for (const auto &weight : weights) {
+      __fn(weight.key().toStringRef(), weight.value().toTensor());
+    }
+  }
+}
+
+/// \brief Touches every page backing ``__tensor`` so that it is read from disk before being handed to the consumer.
+/// \param __tensor A tensor, usually backed by a memory mapping.
+static inline void prefault(const torch::Tensor &__tensor) {
+  // The bytes of a non-contiguous tensor do not necessarily span ``nbytes`` from its data pointer, and the bytes of a
+  // tensor on a GPU are not accessible from the host at all.
+  if (!__tensor.is_contiguous() || !__tensor.device().is_cpu()) {
+    return;
+  }
+
+  static const auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  auto data                   = static_cast<const volatile char *>(__tensor.data_ptr());
+  auto nbytes                 = __tensor.nbytes();
+  for (size_t offset = 0; offset < nbytes; offset += page_size) {
+    data[offset];
+  }
+}
+
+/// \brief The number of bytes to convert at a time, small enough to stay in cache and to bound staging memory.
+static constexpr size_t convert_chunk_size = size_t{16} << 20;
+
+/// \brief Converts ``__tensor`` into the dtype and onto the device requested in ``__options``.
+///
+/// The conversion is fused into the read path: the source is read, cast and copied chunk by chunk straight into
+/// the destination, so a weight is never fully materialized in its source precision. As the source is usually backed
+/// by a memory mapping, only the destination takes up memory.
+/// \param __tensor The tensor as decoded from the checkpoint.
+/// \param __options Options with the target dtype, device, and whether to pin memory.
+/// \return ``__tensor`` itself if no conversion is requested, otherwise the converted tensor.
+static inline torch::Tensor convert(const torch::Tensor &__tensor, const mako::utils::load_options &__options) {
+  // Integral weights, e.g., indices or quantized weights, keep their dtype.
+  auto dtype  = __tensor.scalar_type();
+  auto device = __options.device.value_or(torch::Device(torch::kCPU));
+  if (__tensor.is_floating_point()) {
+    dtype = __options.dtype.value_or(dtype);
+  }
+  if (dtype == __tensor.scalar_type() && device == __tensor.device() && !__options.pin_memory) {
+    return __tensor;
+  }
+
+  auto source = __tensor.contiguous().view(-1);
+  auto target = torch::empty(
+    __tensor.sizes(),
+    torch::TensorOptions().dtype(dtype).device(device).pinned_memory(__options.pin_memory && device.is_cpu()));
+  auto flat   = target.view(-1);
+  auto step   = std::max<int64_t>(convert_chunk_size / std::max(source.element_size(), flat.element_size()), 1);
+
+  if (device.is_cpu()) {
+    for (int64_t begin = 0; begin < source.numel(); begin += step) {
+      auto end = std::min(begin + step, source.numel());
+      flat.slice(0, begin, end).copy_(source.slice(0, begin, end));
+    }
+  } else {
+    // Cast on the host into a staging buffer first, so that only the target precision crosses the bus.
+    auto staging = torch::empty(
+      {std::min(step, source.numel())},
+      torch::TensorOptions().dtype(dtype).pinned_memory(__options.pin_memory));
+    for (int64_t begin = 0; begin < source.numel(); begin += step) {
+      auto end   = std::min(begin + step, source.numel());
+      auto chunk = staging.slice(0, 0, end - begin);
+      chunk.copy_(source.slice(0, begin, end));
+      flat.slice(0, begin, end).copy_(chunk);
+    }
+  }
+  return target;
+}
+
+/// \brief Slices the part of a weight owned by this rank under tensor parallelism.
+/// \param __name The name of the weight, e.g., ``model.layers.0.self_attn.q_proj.weight``.
+/// \param __tensor The whole weight.
+/// \param __options Options with the rank, the world size, and the dimension to split each layer along.
+/// \return The slice of ``__tensor``, or ``__tensor`` itself if it is not split.
+static inline torch::Tensor shard(
+  absl::string_view __name,
+  const torch::Tensor &__tensor,
+  const mako::utils::load_options &__options) {
+  if (__options.world_size <= 1) {
+    return __tensor;
+  }
+
+  // The module name is the second last component of the parameter name.
+  std::vector<absl::string_view> components = absl::StrSplit(__name, '.');
+  if (components.size() < 2) {
+    return __tensor;
+  }
+  auto it = __options.tensor_parallel_dims.find(std::string(components[components.size() - 2]));
+  if (it == __options.tensor_parallel_dims.end() || __tensor.dim() <= it->second) {
+    return __tensor;
+  }
+
+  auto dim  = it->second;
+  auto size = __tensor.size(dim);
+  if (size % static_cast<int64_t>(__options.world_size) != 0) {
+    throw std::invalid_argument(absl::StrFormat(
+      "Cannot split %s of size %d along dimension %d evenly into %d parts",
+      __name,
+      size,
+      dim,
+      __options.world_size));
+  }
+  auto part = size / static_cast<int64_t>(__options.world_size);
+  // A slice along the first dimension is a contiguous range of the file, while any other slice is strided and thus
+  // gathered into a tensor of its own.
+  return __tensor.narrow(dim, static_cast<int64_t>(__options.rank) * part, part).contiguous();
+}
+
+/// \brief Converts a weight as decoded from the checkpoint into the weights to yield, slicing and quantizing it if
+/// requested.
+/// \param __name The name of the weight.
+/// \param __tensor The weight.
+/// \param __options Options with the tensor parallelism, the quantization scheme, and the target dtype and device.
+/// \return The pairs of name and weight, which are ``<module>.qweight`` and ``<module>.scales`` for a quantized
+///  layer and the weight itself otherwise.
+static inline std::vector<std::pair<std::string, torch::Tensor>> transform(
+  std::string __name,
+  const torch::Tensor &__tensor,
+  const mako::utils::load_options &__options) {
+  auto tensor = shard(__name, __tensor, __options);
+  // The scales stay in float32 whatever the dtype of the model, as a scale rounded to half precision would skew every
+  // weight sharing it; this holds for the scales cached by npcache as well.
+  auto scale_options  = __options;
+  scale_options.dtype = std::nullopt;
+
+  std::vector<std::pair<std::string, torch::Tensor>> weights;
+  if (__options.quantize != mako::utils::quantization::scheme::none && tensor.dim() == 2) {
+    for (const auto &module : __options.quantized_modules) {
+      auto suffix = absl::StrCat(".", module, ".weight");
+      if (absl::EndsWith(__name, suffix) || __name.compare(module + ".weight") == 0) {
+        auto [qweight, scales] = mako::utils::quantization::quantize(tensor, __options.quantize, __options.group_size);
+        auto prefix            = __name.substr(0, __name.size() - std::string("weight").size());
+        weights.emplace_back(prefix + "qweight", convert(qweight, __options));
+        weights.emplace_back(prefix + "scales", convert(scales, scale_options));
+        return weights;
+      }
+    }
+  }
+  auto is_scales = absl::EndsWith(__name, ".scales");
+  weights.emplace_back(std::move(__name), convert(tensor, is_scales ? scale_options : __options));
+  return weights;
+}
+
+/// \brief Measures the time to load a shard, or a cached weight with npcache, into ``mako_weight_load_shard_seconds``.
+///
+/// The time the loader waits for the consumer, e.g., on a full queue, is not counted, so that the histogram tells how
+/// fast the shards are read and decoded rather than how fast the model takes the weights.
+class shard_timer {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  /// \brief Runs ``__fn``, which hands weights over to the consumer, without counting its time.
+  template <typename F>
+  void wait(F &&__fn) {
+    auto begin = clock::now();
+    __fn();
+    waited_ += clock::now() - begin;
+  }
+
+  /// \brief Records the time since the timer was created, once the shard has been loaded.
+  void record() const {
+    static auto &shard_seconds = mako::utils::metrics::registry::global().add_histogram(
+      "mako_weight_load_shard_seconds",
+      "Time to read, decode, and convert a shard of the weights, not counting the time its consumer holds it up.",
+      mako::utils::metrics::histogram::exponential_buckets(0.01, 2, 14));
+    shard_seconds.observe(std::chrono::duration<double>(clock::now() - start_ - waited_).count());
+  }
+
+ private:
+  clock::time_point start_ = clock::now();
+  clock::duration waited_  = clock::duration::zero();
+};
+
+/// \brief Signals a worker that the consumer has gone and no more weights are needed.
+struct cancelled {};
+
+/// \brief Runs each of ``__tasks`` on a pool of worker threads and yields the weights they produce.
+///
+/// Workers pass the weights to the coroutine through a queue bounded by ``max_prefetch_bytes``, so reading and
+/// deserializing several shards at once overlaps with the consumer while capping how much memory is in flight.
+/// The weights are yielded in the order they are decoded, which is not deterministic across shards.
+/// \param yield The coroutine to yield the weights.
+/// \param __tasks Callables to produce weights, e.g., one per shard.
+/// \param __options Options to control the number of workers, the byte budget, and the conversion of weights.
+static inline void load_concurrently(
+  boost::coroutines2::coroutine<std::pair<std::string, torch::Tensor>>::push_type &yield,
+  const std::vector<std::function<void(const weight_fn &)>> &__tasks,
+  const mako::utils::load_options &__options) {
+  mako::utils::bounded_queue<std::pair<std::string, torch::Tensor>> queue(__options.max_prefetch_bytes);
+  std::atomic<size_t> next_task{0};
+  std::atomic<size_t> running_workers{__options.num_workers};
+  std::mutex mutex;
+  std::exception_ptr error;
+
+  // If the iterator is destroyed halfway, the coroutine is unwound from ``yield``. Closing the queue before joining
+  // releases the workers blocked on a full queue, so abandoning the iterator never hangs.
+  mako::utils::pipeline::worker_pool<std::pair<std::string, torch::Tensor>> pool{queue};
+
+  for (size_t i = 0; i < __options.num_workers; ++i) {
+    pool.threads.emplace_back([&] {
+      try {
+        for (auto task = next_task++; task < __tasks.size(); task = next_task++) {
+          shard_timer timer;
+          __tasks[task]([&](std::string name, torch::Tensor tensor) {
+            for (auto &weight : transform(std::move(name), tensor, __options)) {
+              // Faulting in a tensor that has already been read, e.g., by a conversion, costs a mere page walk.
+              prefault(weight.second);
+              auto nbytes = weight.second.nbytes();
+              auto pushed = false;
+              timer.wait([&] { pushed = queue.push(std::move(weight), nbytes); });
+              if (!pushed) {
+                throw cancelled{};
+              }
+            }
+          });
+          timer.record();
+        }
+      } catch (const cancelled &) {
+        // The queue has already been closed by the consumer.
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+        queue.close();
+      }
+
+      if (--running_workers == 0) {
+        queue.close();
+      }
+    });
+  }
+
+  while (auto weight = queue.pop()) {
+    yield(std::move(*weight));
+  }
+
+  pool.join();
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
 static inline void load(
   boost::coroutines2::coroutine<std::pair<std::string, torch::Tensor>>::push_type &yield,
   absl::string_view model_name_or_path,
   std::optional<absl::string_view> cache_dir,
   absl::string_view load_format,
   bool fall_back_to_pt,
-  std::optional<absl::string_view> revision) {
+  std::optional<absl::string_view> revision,
+  const mako::utils::load_options &options) {
+  if (options.world_size == 0 || options.world_size <= options.rank) {
+    throw std::invalid_argument(
+      absl::StrFormat("Invalid rank %d for tensor parallelism of size %d", options.rank, options.world_size));
+  }
+
   auto [hf_folder, hf_weight_files, use_safetensors] = prepare_load(
     model_name_or_path,
     cache_dir,
@@ -133,72 +467,94 @@ static inline void load(
     fall_back_to_pt,
     revision);
 
+  std::vector<std::function<void(const weight_fn &)>> tasks;
+  auto effective_options = options;
   if (load_format.compare("npcache") == 0) {
     // Currently npcache only supports .bin checkpoints.
     assert(!use_safetensors);
 
     // Convert the model weights from torch tensors to numpy arrays for faster loading.
-    auto np_folder = fs::path(hf_folder) / fs::path("np");
+    // Quantized weights are cached in a folder of their own, e.g., np-int4-g128, as they differ in names and shapes.
+    std::string np_folder_name = "np";
+    if (options.quantize == mako::utils::quantization::scheme::int8) {
+      np_folder_name = "np-int8";
+    } else if (options.quantize == mako::utils::quantization::scheme::int4) {
+      np_folder_name = absl::StrFormat("np-int4-g%d", options.group_size);
+    }
+    auto np_folder = fs::path(hf_folder) / fs::path(np_folder_name);
     fs::create_directories(np_folder);
 
     auto weight_names_file = np_folder / fs::path("weight_names.json");
     // Use file lock to prevent multiple processes from dumping the same model weights to numpy at the same time.
-    // TODO: use file lock
+    // The existence of weight_names.json marks a complete conversion, so it is checked again once the lock is held
+    // and processes that waited for the lock reuse the result instead of converting the weights again.
     if (!fs::exists(weight_names_file)) {
-      std::vector<std::string> weight_names;
-      for (const auto &file : hf_weight_files) {
-        auto stream = std::ifstream(file, std::ios::binary);
-        auto buf    = std::vector<char>(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
-        stream.close();
-        auto weights = torch::pickle_load(buf).toGenericDict();
-        for (const auto &weight : weights) {
-          auto name       = weight.key().toStringRef();
-          auto param_path = np_folder / fs::path(name);
-          // TODO: np.save(param_path, param.cpu().detach().numpy())
-          weight_names.push_back(name);
+      auto lock = get_lock(model_name_or_path, cache_dir);
+      if (!fs::exists(weight_names_file)) {
+        mako::utils::load_options cache_options;
+        cache_options.quantize          = options.quantize;
+        cache_options.group_size        = options.group_size;
+        cache_options.quantized_modules = options.quantized_modules;
+
+        std::vector<std::string> weight_names;
+        for (const auto &file : hf_weight_files) {
+          auto weights = mako::utils::pickle_load(file).toGenericDict();
+          for (const auto &weight : weights) {
+            // Only quantization is applied to the cache, which is shared by every dtype and device.
+            auto transformed = transform(weight.key().toStringRef(), weight.value().toTensor(), cache_options);
+            for (const auto &[name, tensor] : transformed) {
+              auto param_path = np_folder / fs::path(name);
+              mako::utils::numpy::save(param_path.string(), tensor);
+              weight_names.push_back(name);
+            }
+          }
         }
+
+        // Publish the conversion by an atomic rename, so that weight_names.json is never observed half-written
+        // even if this process is killed. A failed write, e.g., on a full disk, must not be published either.
+        auto tmp_file = fs::path(weight_names_file).concat(absl::StrFormat(".%d.tmp", getpid()));
+        {
+          std::ofstream stream(tmp_file);
+          stream << json(weight_names);
+          stream.flush();
+          if (!stream.good()) {
+            throw std::runtime_error(absl::StrFormat("Cannot write %s", tmp_file.string()));
+          }
+        }
+        fs::rename(tmp_file, weight_names_file);
       }
-      std::ofstream(weight_names_file) << json(weight_names);
     }
 
+    // Each weight is a raw array behind a small header, so loading it is no more than mapping the file.
+    // The cached weights have already been quantized, so they are only converted.
+    effective_options.quantize = mako::utils::quantization::scheme::none;
     auto weight_names = json::parse(std::ifstream(weight_names_file)).get<std::vector<std::string>>();
     for (const auto &name : weight_names) {
       auto param_path = np_folder / fs::path(name);
-      // TODO: yield torch.from_numpy(np.load(param_path))
+      tasks.emplace_back([name, param_path](const weight_fn &fn) {
+        fn(name, mako::utils::numpy::load(param_path.string()));
+      });
     }
-  } else if (use_safetensors) {
-    // TODO: implement ``safe_open``
-    throw std::logic_error("safetensors is currently not supported");
   } else {
     for (const auto &file : hf_weight_files) {
-      auto stream = std::ifstream(file, std::ios::binary);
-      auto buf    = std::vector<char>(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
-      stream.close();
-
-      // CAUTION:
-      //
-      // Several previous versions of LibTorch including v2.1.2 may result in deserialization failure upon
-      // ``torch::pickle_load`` due to the lacked support for pickling protocol.
-      //
-      // To avoid such pickling issues, we recommend using LibTorch v2.2.0 but if you have to use other versions
-      // including v2.1.2, make sure the pickle header ends with 80 02 7d 71 00 28 58 19 00 00 00 by converting it into
-      // hexadecimal form; e.g., the below left header is deserializable in LibTorch v2.1.2, but the right one fails to
-      // be deserialized:
-      //
-      // 000000: 50 4b 03 04 00 00 08 08 00 00 00 00 00 00 00 00  PK..............  000000: 50 4b 03 04 00 00 08 08 00 00 00 00 00 00 00 00  PK..............
-      // 000010: 00 00 00 00 00 00 00 00 00 00 25 00 3d 00 70 79  ..........%.=.py  000010: 00 00 00 00 00 00 00 00 00 00 25 00 3d 00 70 79  ..........%.=.py
-      // 000020: 74 6f 72 63 68 5f 6d 6f 64 65 6c 2d 30 30 30 30  torch_model-0000  000020: 74 6f 72 63 68 5f 6d 6f 64 65 6c 2d 30 30 30 30  torch_model-0000
-      // 000030: 31 2d 6f 66 2d 30 30 30 30 33 2f 64 61 74 61 2e  1-of-00003/data.  000030: 32 2d 6f 66 2d 30 30 30 30 33 2f 64 61 74 61 2e  2-of-00003/data.
-      // 000040: 70 6b 6c 46 42 39 00 5a 5a 5a 5a 5a 5a 5a 5a 5a  pklFB9.ZZZZZZZZZ  000040: 70 6b 6c 46 42 39 00 5a 5a 5a 5a 5a 5a 5a 5a 5a  pklFB9.ZZZZZZZZZ
-      // 000050: 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a  ZZZZZZZZZZZZZZZZ  000050: 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a  ZZZZZZZZZZZZZZZZ
-      // 000060: 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a  ZZZZZZZZZZZZZZZZ  000060: 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a  ZZZZZZZZZZZZZZZZ
-      // 000070: 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a  ZZZZZZZZZZZZZZZZ  000070: 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a 5a  ZZZZZZZZZZZZZZZZ
-      // 000080: 80 02 7d 71 00 28 58 19 00 00 00                 ..}q.(X....       000080: 80 02 7d 71 00 28 58 22 00 00 00                 ..}q.(X"...
-      auto weights = torch::pickle_load(buf).toGenericDict();
-      for (const auto &weight : weights) {
-        yield(std::make_pair(weight.key().toStringRef(), weight.value().toTensor()));
-      }
+      tasks.emplace_back([&, use_safetensors = use_safetensors](const weight_fn &fn) {
+        load_shard(file, use_safetensors, fn);
+      });
+    }
+  }
+
+  if (options.num_workers <= 1) {
+    for (const auto &task : tasks) {
+      shard_timer timer;
+      task([&](std::string name, torch::Tensor tensor) {
+        for (auto &weight : transform(std::move(name), tensor, effective_options)) {
+          timer.wait([&] { yield(std::move(weight)); });
+        }
+      });
+      timer.record();
     }
+  } else {
+    load_concurrently(yield, tasks, effective_options);
   }
 }
 
@@ -207,7 +563,8 @@ boost::coroutines2::coroutine<std::pair<std::string, torch::Tensor>>::pull_type
   std::optional<absl::string_view> cache_dir,
   absl::string_view load_format,
   bool fall_back_to_pt,
-  std::optional<absl::string_view> revision) {
+  std::optional<absl::string_view> revision,
+  const load_options &options) {
   boost::coroutines2::coroutine<std::pair<std::string, torch::Tensor>>::pull_type iterator{
     boost::bind(
       load,
@@ -216,6 +573,7 @@ boost::coroutines2::coroutine<std::pair<std::string, torch::Tensor>>::pull_type
       cache_dir,
       load_format,
       fall_back_to_pt,
-      revision)};
+      revision,
+      options)};
     return iterator;
 }
@@ -14,18 +14,97 @@
 
 #pragma once
 
+#include <cstddef>
+#include <map>
 #include <optional>
+#include <string>
 #include <utility>
+#include <vector>
 
 #include <absl/strings/string_view.h>
 #include <boost/coroutine2/all.hpp>
 #include <torch/torch.h>
 
 #include "mako/utils/export.h"
+#include "mako/utils/quantization.h"
 
 namespace mako {
 namespace utils {
 inline namespace huggingface {
+/// \brief Options to control how the weights of a model are loaded.
+struct MAKO_API load_options {
+  /// \brief The number of worker threads to decode shards concurrently.
+  ///
+  /// If ``1``, shards are decoded one at a time on the thread iterating the weights.
+  size_t num_workers = 1;
+
+  /// \brief The maximum number of bytes of tensors that have been decoded by the workers but not yet consumed.
+  ///
+  /// Ignored if ``num_workers`` is ``1``.
+  size_t max_prefetch_bytes = size_t{1} << 32;
+
+  /// \brief The dtype to convert floating-point weights to, or their original dtype if not given.
+  std::optional<torch::Dtype> dtype = std::nullopt;
+
+  /// \brief The device to place the weights on, or the CPU if not given.
+  std::optional<torch::Device> device = std::nullopt;
+
+  /// \brief If ``true``, host memory involved in loading is pinned; i.e., weights placed on the CPU are allocated
+  /// in pinned memory, and weights placed on a GPU are staged through a pinned buffer.
+  ///
+  /// Requires LibTorch built with CUDA.
+  bool pin_memory = false;
+
+  /// \brief The scheme to quantize the weights of linear layers with as they are loaded.
+  ///
+  /// The weight ``<module>.weight`` of a quantized layer is replaced by the packed integers ``<module>.qweight`` and
+  /// the scales ``<module>.scales``; see ``quantization::quantize`` for their layout. The scales are kept in float32
+  /// regardless of ``dtype``. With ``"npcache"``, the quantized weights are cached next to the converted ones, so that
+  /// they are quantized only once. ``mako::nn::llama_for_causal_lm`` takes them if its ``quantize`` is the same.
+  quantization::scheme quantize = quantization::scheme::none;
+
+  /// \brief The number of input channels sharing a scale, used only for ``quantization::scheme::int4``.
+  int64_t group_size = 128;
+
+  /// \brief The names of the linear layers to quantize, matched against the last component of a module name.
+  std::vector<std::string> quantized_modules = {
+    "q_proj",
+    "k_proj",
+    "v_proj",
+    "o_proj",
+    "gate_proj",
+    "up_proj",
+    "down_proj",
+  };
+
+  /// \brief The rank of this process among the processes the model is partitioned across by tensor parallelism.
+  size_t rank = 0;
+
+  /// \brief The number of processes the model is partitioned across by tensor parallelism.
+  ///
+  /// If greater than ``1``, each weight of the layers in ``tensor_parallel_dims`` is split evenly along the mapped
+  /// dimension and only the ``rank``-th slice is yielded. As the slice is a view of the memory-mapped checkpoint, only
+  /// the bytes of the slice are ever read.
+  size_t world_size = 1;
+
+  /// \brief The dimension to split the weights of each layer along, keyed by the last component of the module name.
+  ///
+  /// The defaults follow Megatron-LM: column-parallel layers are split along the output features and row-parallel
+  /// layers along the input features. Parameters with no such dimension, e.g., the bias of a row-parallel layer, are
+  /// yielded as is.
+  std::map<std::string, int64_t> tensor_parallel_dims = {
+    {"embed_tokens", 0},
+    {"q_proj",       0},
+    {"k_proj",       0},
+    {"v_proj",       0},
+    {"o_proj",       1},
+    {"gate_proj",    0},
+    {"up_proj",      0},
+    {"down_proj",    1},
+    {"lm_head",      0},
+  };
+};
+
 /// \brief Utility to download and initialize Hugging Face Transformers model.
 /// \param model_name_or_path A path to a directory containing model weights saved using ``save_pretrained``.
 /// \param cache_dir Path to the folder where cached files are stored.
@@ -33,13 +112,15 @@ inline namespace huggingface {
 ///  Must be one of ``"auto"``, ``"safetensors"``, ``"pt"``, or ``"npcache"``.
 /// \param fall_back_to_pt If ``true``, will always allow pt format.
 /// \param revision An optional Git revision id which can be a branch name, a tag, or a commit hash.
+/// \param options Options to control how the weights are loaded.
 /// \return An iterator generating the pairs of name and weight of the loaded model.
 boost::coroutines2::coroutine<std::pair<std::string, torch::Tensor>>::pull_type MAKO_API weight_iterator(
   absl::string_view model_name_or_path,
   std::optional<absl::string_view> cache_dir = std::nullopt,
   absl::string_view load_format              = "auto",
   bool fall_back_to_pt                       = true,
-  std::optional<absl::string_view> revision  = std::nullopt);
+  std::optional<absl::string_view> revision  = std::nullopt,
+  const load_options &options                = load_options());
 } // namespace huggingface
 } // namespace utils
 } // namespace mako
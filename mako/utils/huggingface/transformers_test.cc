@@ -12,10 +12,66 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include "mako/utils/huggingface/transformers.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
 #include <map>
+#include <string>
 #include <vector>
 
+#include <absl/strings/str_format.h>
 #include <gtest/gtest.h>
+#include <nlohmann/json.hpp>
+
+namespace fs = std::filesystem;
+
+/// \brief Saves float32 tensors into ``model.safetensors`` of a fresh folder, as a local checkpoint.
+static inline fs::path save_checkpoint(
+  const std::string &__name,
+  const std::map<std::string, torch::Tensor> &__tensors) {
+  auto folder = fs::temp_directory_path() / fs::path(__name);
+  fs::remove_all(folder);
+  fs::create_directories(folder);
+
+  nlohmann::json header;
+  std::string data;
+  for (const auto &[name, tensor] : __tensors) {
+    auto contiguous = tensor.to(torch::kFloat32).contiguous();
+    auto begin      = data.size();
+    data.append(static_cast<const char *>(contiguous.data_ptr()), contiguous.nbytes());
+    header[name]["dtype"]        = "F32";
+    header[name]["shape"]        = contiguous.sizes().vec();
+    header[name]["data_offsets"] = {begin, data.size()};
+  }
+  // The header is padded with spaces to align the data, as safetensors does.
+  auto text = header.dump();
+  text.resize((text.size() + 7) / 8 * 8, ' ');
+  auto header_size = static_cast<uint64_t>(text.size());
+  std::ofstream stream(folder / fs::path("model.safetensors"), std::ios::binary);
+  stream.write(reinterpret_cast<const char *>(&header_size), sizeof(header_size));
+  stream.write(text.data(), text.size());
+  stream.write(data.data(), data.size());
+  return folder;
+}
+
+/// \brief Loads all weights of a local checkpoint.
+static inline std::map<std::string, torch::Tensor> load_checkpoint(
+  const fs::path &__folder,
+  absl::string_view __load_format,
+  const mako::utils::load_options &__options) {
+  std::map<std::string, torch::Tensor> weights;
+  auto iterator =
+    mako::utils::weight_iterator(__folder.string(), std::nullopt, __load_format, true, std::nullopt, __options);
+  for (auto [name, tensor] : iterator) {
+    weights.emplace(std::move(name), std::move(tensor));
+  }
+  return weights;
+}
 
 TEST(WeightIteratorTest, Llama2) {
   // Test case for Llama 2 7B
@@ -694,6 +750,144 @@ TEST(WeightIteratorTest, Llama2) {
   EXPECT_TRUE(shapes.empty());
 }
 
+TEST(WeightIteratorTest, TensorParallel) {
+  auto q      = torch::arange(48, torch::kFloat32).view({6, 8});
+  auto o      = torch::arange(48, torch::kFloat32).view({8, 6});
+  auto norm   = torch::arange(8, torch::kFloat32);
+  auto folder = save_checkpoint(
+    "weight_iterator_tensor_parallel_test",
+    {
+      {"model.layers.0.self_attn.q_proj.weight", q   },
+      {"model.layers.0.self_attn.o_proj.weight", o   },
+      {"model.norm.weight",                      norm},
+  });
+
+  // Every rank takes its own slice of the column-parallel layer along dim 0 and of the row-parallel layer along dim 1,
+  // and the slices of all ranks make up the whole weights.
+  for (size_t world_size : {1, 2, 3, 6}) {
+    for (size_t rank = 0; rank < world_size; ++rank) {
+      mako::utils::load_options options;
+      options.rank       = rank;
+      options.world_size = world_size;
+      auto weights       = load_checkpoint(folder, "safetensors", options);
+      ASSERT_EQ(weights.size(), 3);
+      auto i = static_cast<int64_t>(rank);
+      EXPECT_TRUE(torch::equal(weights["model.layers.0.self_attn.q_proj.weight"], q.chunk(world_size, 0)[i]));
+      EXPECT_TRUE(torch::equal(weights["model.layers.0.self_attn.o_proj.weight"], o.chunk(world_size, 1)[i]));
+      EXPECT_TRUE(weights["model.layers.0.self_attn.o_proj.weight"].is_contiguous());
+      EXPECT_TRUE(torch::equal(weights["model.norm.weight"], norm));
+    }
+  }
+
+  // Neither 6 rows nor 6 columns are split evenly into 4 parts, and a rank must be less than the world size.
+  for (auto [rank, world_size] : std::vector<std::pair<size_t, size_t>>{{0, 4}, {3, 4}, {2, 2}, {0, 0}}) {
+    mako::utils::load_options options;
+    options.rank       = rank;
+    options.world_size = world_size;
+    EXPECT_THROW(load_checkpoint(folder, "safetensors", options), std::invalid_argument);
+  }
+  fs::remove_all(folder);
+}
+
+TEST(WeightIteratorTest, ConcurrentNpcache) {
+  auto folder = fs::temp_directory_path() / fs::path("weight_iterator_concurrent_npcache_test");
+  fs::remove_all(folder);
+  fs::create_directories(folder);
+  c10::Dict<std::string, torch::Tensor> state_dict;
+  for (auto i = 0; i < 64; ++i) {
+    state_dict.insert(absl::StrFormat("model.layers.%d.mlp.up_proj.weight", i), torch::full({16, 8}, static_cast<float>(i)));
+  }
+  auto buf = torch::pickle_save(state_dict);
+  std::ofstream(folder / fs::path("pytorch_model.bin"), std::ios::binary).write(buf.data(), buf.size());
+
+  // Two processes convert the same checkpoint at once, and the one that waits for the lock reuses the conversion.
+  std::vector<pid_t> pids;
+  for (auto i = 0; i < 2; ++i) {
+    auto pid = fork();
+    ASSERT_NE(pid, -1);
+    if (pid == 0) {
+      auto status = 0;
+      try {
+        auto weights = load_checkpoint(folder, "npcache", mako::utils::load_options());
+        status       = weights.size() == state_dict.size() ? 0 : 1;
+      } catch (...) {
+        status = 2;
+      }
+      _exit(status);
+    }
+    pids.push_back(pid);
+  }
+  for (auto pid : pids) {
+    auto status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    EXPECT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 0);
+  }
+
+  // No temporary file is left behind, and the published conversion holds every weight.
+  for (const auto &entry : fs::directory_iterator(folder / fs::path("np"))) {
+    EXPECT_NE(entry.path().extension(), ".tmp");
+  }
+  auto weights = load_checkpoint(folder, "npcache", mako::utils::load_options());
+  ASSERT_EQ(weights.size(), state_dict.size());
+  for (const auto &weight : state_dict) {
+    EXPECT_TRUE(torch::equal(weights.at(weight.key()), weight.value()));
+  }
+  fs::remove_all(folder);
+}
+
+TEST(WeightIteratorTest, Convert) {
+  // The transposed weight is saved with its strides, so it is decoded as a non-contiguous view of the file, and the
+  // large one takes more than one chunk to convert.
+  c10::Dict<std::string, torch::Tensor> state_dict;
+  state_dict.insert("large", torch::randn({2049, 2051}));
+  state_dict.insert("transposed", torch::randn({67, 129}, torch::kBFloat16).t());
+  state_dict.insert("indices", torch::arange(16));
+  ASSERT_FALSE(state_dict.at("transposed").is_contiguous());
+  auto folder = fs::temp_directory_path() / fs::path("weight_iterator_convert_test");
+  fs::remove_all(folder);
+  fs::create_directories(folder);
+  auto buf = torch::pickle_save(state_dict);
+  std::ofstream(folder / fs::path("pytorch_model.bin"), std::ios::binary).write(buf.data(), buf.size());
+
+  // Pinning memory requires CUDA.
+  std::vector<torch::Device> devices = {torch::kCPU};
+  std::vector<bool> pin_memories     = {false};
+  if (torch::cuda::is_available()) {
+    devices.emplace_back(torch::kCUDA);
+    pin_memories.push_back(true);
+  }
+  for (auto device : devices) {
+    for (auto dtype : {torch::kFloat32, torch::kBFloat16, torch::kFloat16}) {
+      for (bool pin_memory : pin_memories) {
+        for (size_t num_workers : {1, 2}) {
+          mako::utils::load_options options;
+          options.num_workers = num_workers;
+          options.dtype       = dtype;
+          options.device      = device;
+          options.pin_memory  = pin_memory;
+          auto weights        = load_checkpoint(folder, "auto", options);
+          ASSERT_EQ(weights.size(), state_dict.size());
+          for (const auto &weight : state_dict) {
+            // Integral weights keep their dtype.
+            auto expected = weight.value().is_floating_point() ? weight.value().to(device, dtype)
+                                                               : weight.value().to(device);
+            auto &actual  = weights.at(weight.key());
+            EXPECT_EQ(actual.scalar_type(), expected.scalar_type());
+            EXPECT_EQ(actual.device(), expected.device());
+            EXPECT_EQ(actual.sizes(), expected.sizes());
+            EXPECT_TRUE(torch::equal(actual, expected));
+            if (pin_memory && device.is_cpu()) {
+              EXPECT_TRUE(actual.is_pinned());
+            }
+          }
+        }
+      }
+    }
+  }
+  fs::remove_all(folder);
+}
+
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -0,0 +1,61 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/utils/mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <string>
+#include <system_error>
+
+#include <absl/strings/str_format.h>
+
+mako::utils::mapped_file::mapped_file(absl::string_view path) : data_(nullptr), size_(0) {
+  auto fd = open(std::string(path).c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::system_error(errno, std::generic_category(), absl::StrFormat("Cannot open %s", path));
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    auto err = errno;
+    close(fd);
+    throw std::system_error(err, std::generic_category(), absl::StrFormat("Cannot stat %s", path));
+  }
+  size_ = static_cast<size_t>(st.st_size);
+
+  // mmap(2) fails with EINVAL on zero length, so an empty file is represented by a null mapping.
+  if (0 < size_) {
+    auto addr = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      auto err = errno;
+      close(fd);
+      throw std::system_error(err, std::generic_category(), absl::StrFormat("Cannot map %s", path));
+    }
+    data_ = static_cast<char *>(addr);
+  }
+
+  // The mapping holds its own reference to the file, so the descriptor is no longer needed.
+  close(fd);
+}
+
+mako::utils::mapped_file::~mapped_file() {
+  if (data_ != nullptr) {
+    munmap(data_, size_);
+  }
+}
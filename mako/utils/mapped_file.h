@@ -0,0 +1,55 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+
+#include <absl/strings/string_view.h>
+
+#include "mako/utils/export.h"
+
+namespace mako {
+namespace utils {
+/// \brief Memory mapping of a whole file, equivalent to Python's ``mmap.mmap`` with ``access=ACCESS_COPY``.
+///
+/// NOTE:
+///
+/// The mapping is private and copy-on-write, so tensors created on top of it can be modified in place without
+/// writing back to the file, while untouched pages stay shared with the page cache.
+class MAKO_API mapped_file {
+ public:
+  /// \brief Maps the file at ``path`` into memory.
+  /// \param path Path to the file to map.
+  explicit mapped_file(absl::string_view path);
+  mapped_file(const mapped_file &)            = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+  ~mapped_file();
+
+  /// \return The beginning of the mapping, or ``nullptr`` if the file is empty.
+  inline char *data() const noexcept {
+    return data_;
+  }
+
+  /// \return The size of the mapping in bytes.
+  inline size_t size() const noexcept {
+    return size_;
+  }
+
+ private:
+  char *data_;
+  size_t size_;
+};
+} // namespace utils
+} // namespace mako
@@ -0,0 +1,162 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/utils/metrics.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+#include <utility>
+
+#include <absl/strings/str_cat.h>
+#include <absl/strings/str_format.h>
+
+/// \brief Formats a value as Prometheus parses it, in as few digits as read back the same value.
+static inline std::string format_value(double __value) {
+  if (std::isinf(__value)) {
+    return __value < 0 ? "-Inf" : "+Inf";
+  }
+  if (std::isnan(__value)) {
+    return "NaN";
+  }
+  auto text = absl::StrFormat("%.15g", __value);
+  if (std::strtod(text.c_str(), nullptr) != __value) {
+    text = absl::StrFormat("%.17g", __value);
+  }
+  return text;
+}
+
+double mako::utils::metrics::counter::value() const noexcept {
+  double value = 0;
+  for (const auto &shard : shards_) {
+    value += shard.value.load(std::memory_order_relaxed);
+  }
+  return value;
+}
+
+mako::utils::metrics::histogram::histogram(std::vector<double> bounds) : bounds_(std::move(bounds)) {
+  for (size_t i = 1; i < bounds_.size(); ++i) {
+    if (!(bounds_[i - 1] < bounds_[i])) {
+      throw std::invalid_argument(absl::StrFormat(
+        "The bounds of a histogram must be increasing, but got %s after %s",
+        format_value(bounds_[i]),
+        format_value(bounds_[i - 1])));
+    }
+  }
+  for (auto &shard : shards_) {
+    shard.counts = std::make_unique<std::atomic<uint64_t>[]>(bounds_.size() + 1);
+  }
+}
+
+std::vector<double> mako::utils::metrics::histogram::exponential_buckets(double start, double factor, size_t count) {
+  std::vector<double> bounds;
+  for (size_t i = 0; i < count; ++i) {
+    bounds.push_back(start);
+    start *= factor;
+  }
+  return bounds;
+}
+
+std::vector<uint64_t> mako::utils::metrics::histogram::counts() const noexcept {
+  std::vector<uint64_t> counts(bounds_.size() + 1);
+  for (const auto &shard : shards_) {
+    for (size_t i = 0; i < counts.size(); ++i) {
+      counts[i] += shard.counts[i].load(std::memory_order_relaxed);
+    }
+  }
+  return counts;
+}
+
+double mako::utils::metrics::histogram::sum() const noexcept {
+  double sum = 0;
+  for (const auto &shard : shards_) {
+    sum += shard.sum.load(std::memory_order_relaxed);
+  }
+  return sum;
+}
+
+mako::utils::metrics::registry &mako::utils::metrics::registry::global() {
+  // The registry is never destroyed, so metrics may be recorded by threads that outlive ``main``.
+  static auto *registry = new mako::utils::metrics::registry();
+  return *registry;
+}
+
+mako::utils::metrics::registry::metric &mako::utils::metrics::registry::add(std::string name, std::string help) {
+  for (const auto &metric : metrics_) {
+    if (metric->name == name) {
+      throw std::invalid_argument(absl::StrFormat("The metric %s has already been registered", name));
+    }
+  }
+  metrics_.push_back(std::make_unique<metric>());
+  metrics_.back()->name = std::move(name);
+  metrics_.back()->help = std::move(help);
+  return *metrics_.back();
+}
+
+mako::utils::metrics::counter &mako::utils::metrics::registry::add_counter(std::string name, std::string help) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto &metric          = add(std::move(name), std::move(help));
+  metric.counter_metric = std::make_unique<counter>();
+  return *metric.counter_metric;
+}
+
+mako::utils::metrics::gauge &mako::utils::metrics::registry::add_gauge(std::string name, std::string help) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto &metric        = add(std::move(name), std::move(help));
+  metric.gauge_metric = std::make_unique<gauge>();
+  return *metric.gauge_metric;
+}
+
+mako::utils::metrics::histogram &mako::utils::metrics::registry::add_histogram(
+  std::string name,
+  std::string help,
+  std::vector<double> bounds) {
+  auto histogram = std::make_unique<mako::utils::metrics::histogram>(std::move(bounds));
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto &metric            = add(std::move(name), std::move(help));
+  metric.histogram_metric = std::move(histogram);
+  return *metric.histogram_metric;
+}
+
+std::string mako::utils::metrics::registry::expose() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::string text;
+  for (const auto &metric : metrics_) {
+    if (metric->counter_metric) {
+      absl::StrAppend(&text, "# HELP ", metric->name, " ", metric->help, "\n");
+      absl::StrAppend(&text, "# TYPE ", metric->name, " counter\n");
+      absl::StrAppend(&text, metric->name, " ", format_value(metric->counter_metric->value()), "\n");
+    } else if (metric->gauge_metric) {
+      absl::StrAppend(&text, "# HELP ", metric->name, " ", metric->help, "\n");
+      absl::StrAppend(&text, "# TYPE ", metric->name, " gauge\n");
+      absl::StrAppend(&text, metric->name, " ", format_value(metric->gauge_metric->value()), "\n");
+    } else {
+      // The buckets of Prometheus are cumulative, each counting the values up to its bound.
+      const auto &histogram = *metric->histogram_metric;
+      const auto &bounds    = histogram.bounds();
+      auto counts           = histogram.counts();
+      absl::StrAppend(&text, "# HELP ", metric->name, " ", metric->help, "\n");
+      absl::StrAppend(&text, "# TYPE ", metric->name, " histogram\n");
+      uint64_t count = 0;
+      for (size_t i = 0; i < counts.size(); ++i) {
+        count     += counts[i];
+        auto bound = i < bounds.size() ? format_value(bounds[i]) : "+Inf";
+        absl::StrAppend(&text, metric->name, "_bucket{le=\"", bound, "\"} ", count, "\n");
+      }
+      absl::StrAppend(&text, metric->name, "_sum ", format_value(histogram.sum()), "\n");
+      absl::StrAppend(&text, metric->name, "_count ", count, "\n");
+    }
+  }
+  return text;
+}
@@ -0,0 +1,179 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "mako/utils/export.h"
+
+namespace mako {
+namespace utils {
+/// \brief Counters, gauges, and histograms, exposed in the text format of Prometheus.
+///
+/// Recording a value is a relaxed atomic add to the shard of the calling thread, so threads recording the same metric
+/// do not contend for a cache line, and recording never takes a lock. The shards are summed only when the metrics are
+/// exposed, which is rare next to recording.
+namespace metrics {
+/// \brief The number of shards of a metric, which threads take in turn.
+static constexpr size_t num_shards = 16;
+
+namespace detail {
+/// \brief The shard of the calling thread.
+inline size_t shard_index() noexcept {
+  static std::atomic<size_t> next_index{0};
+  thread_local size_t index = next_index.fetch_add(1, std::memory_order_relaxed) % num_shards;
+  return index;
+}
+
+/// \brief Adds ``value`` to ``target``, which a single thread usually owns, so the exchange rarely fails.
+inline void add(std::atomic<double> &target, double value) noexcept {
+  auto expected = target.load(std::memory_order_relaxed);
+  while (!target.compare_exchange_weak(expected, expected + value, std::memory_order_relaxed)) {
+  }
+}
+} // namespace detail
+
+/// \brief A value that only goes up, e.g., the number of tokens generated.
+class MAKO_API counter {
+ public:
+  counter() = default;
+  counter(const counter &)            = delete;
+  counter &operator=(const counter &) = delete;
+
+  /// \brief Adds ``value``, which must not be negative.
+  inline void inc(double value = 1) noexcept {
+    detail::add(shards_[detail::shard_index()].value, value);
+  }
+
+  /// \return The sum of the values added so far.
+  double value() const noexcept;
+
+ private:
+  struct alignas(64) shard {
+    std::atomic<double> value{0};
+  };
+
+  std::array<shard, num_shards> shards_;
+};
+
+/// \brief A value that goes up and down, e.g., the number of requests waiting.
+class MAKO_API gauge {
+ public:
+  gauge() = default;
+  gauge(const gauge &)            = delete;
+  gauge &operator=(const gauge &) = delete;
+
+  inline void set(double value) noexcept {
+    value_.store(value, std::memory_order_relaxed);
+  }
+
+  inline double value() const noexcept {
+    return value_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::atomic<double> value_{0};
+};
+
+/// \brief The distribution of observed values, counted in buckets, e.g., the latencies of steps.
+class MAKO_API histogram {
+ public:
+  /// \param bounds The inclusive upper bounds of the buckets in increasing order, besides the last bucket, which is
+  ///  unbounded.
+  /// \throw std::invalid_argument If the bounds are not increasing.
+  explicit histogram(std::vector<double> bounds);
+  histogram(const histogram &)            = delete;
+  histogram &operator=(const histogram &) = delete;
+
+  /// \brief The bounds ``start``, ``start * factor``, ... of ``count`` buckets.
+  static std::vector<double> exponential_buckets(double start, double factor, size_t count);
+
+  inline void observe(double value) noexcept {
+    size_t bucket = 0;
+    while (bucket < bounds_.size() && bounds_[bucket] < value) {
+      ++bucket;
+    }
+    auto &shard = shards_[detail::shard_index()];
+    shard.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+    detail::add(shard.sum, value);
+  }
+
+  const std::vector<double> &bounds() const noexcept {
+    return bounds_;
+  }
+
+  /// \return The number of values observed in each bucket, not cumulative, with the unbounded bucket last.
+  std::vector<uint64_t> counts() const noexcept;
+
+  /// \return The sum of the values observed.
+  double sum() const noexcept;
+
+ private:
+  struct alignas(64) shard {
+    std::unique_ptr<std::atomic<uint64_t>[]> counts;
+    std::atomic<double> sum{0};
+  };
+
+  std::vector<double> bounds_;
+  std::array<shard, num_shards> shards_;
+};
+
+/// \brief Metrics by their names, which are exposed together.
+class MAKO_API registry {
+ public:
+  registry() = default;
+  registry(const registry &)            = delete;
+  registry &operator=(const registry &) = delete;
+
+  /// \brief The registry of the process, which the metrics of the engine and the loader are registered to.
+  static registry &global();
+
+  /// \brief Registers a metric, which lives as long as the registry.
+  /// \param name The name of the metric, e.g., ``mako_generation_tokens_total``.
+  /// \param help The description of the metric.
+  /// \return The metric.
+  /// \throw std::invalid_argument If a metric of the name has been registered.
+  counter &add_counter(std::string name, std::string help);
+  gauge &add_gauge(std::string name, std::string help);
+  histogram &add_histogram(std::string name, std::string help, std::vector<double> bounds);
+
+  /// \return The metrics in the text format of Prometheus, in the order they were registered.
+  std::string expose() const;
+
+ private:
+  struct metric {
+    std::string name;
+    std::string help;
+    std::unique_ptr<counter> counter_metric;
+    std::unique_ptr<gauge> gauge_metric;
+    std::unique_ptr<histogram> histogram_metric;
+  };
+
+  /// \brief Registers a metric, checking that its name is unique.
+  metric &add(std::string name, std::string help);
+
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<metric>> metrics_;
+};
+} // namespace metrics
+} // namespace utils
+} // namespace mako
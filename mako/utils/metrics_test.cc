@@ -0,0 +1,80 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/utils/metrics.h"
+
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace metrics = mako::utils::metrics;
+
+TEST(MetricsTest, ConcurrentRecording) {
+  // More threads than shards record at once, and no value is lost.
+  metrics::counter counter;
+  metrics::histogram histogram({1, 2, 4});
+  std::vector<std::thread> threads;
+  for (auto i = 0; i < 32; ++i) {
+    threads.emplace_back([&] {
+      for (auto j = 0; j < 10000; ++j) {
+        counter.inc();
+        histogram.observe(j % 5);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(counter.value(), 320000);
+  EXPECT_EQ(histogram.counts(), (std::vector<uint64_t>{128000, 64000, 128000, 0}));
+  EXPECT_EQ(histogram.sum(), 640000);
+}
+
+TEST(MetricsTest, Expose) {
+  metrics::registry registry;
+  registry.add_counter("tokens_total", "Tokens.").inc(3);
+  registry.add_gauge("usage_ratio", "Usage.").set(0.25);
+  auto &latency = registry.add_histogram("latency_seconds", "Latency.", {0.1, 1});
+  latency.observe(0.05);
+  latency.observe(0.5);
+  latency.observe(5);
+
+  EXPECT_EQ(
+    registry.expose(),
+    "# HELP tokens_total Tokens.\n"
+    "# TYPE tokens_total counter\n"
+    "tokens_total 3\n"
+    "# HELP usage_ratio Usage.\n"
+    "# TYPE usage_ratio gauge\n"
+    "usage_ratio 0.25\n"
+    "# HELP latency_seconds Latency.\n"
+    "# TYPE latency_seconds histogram\n"
+    "latency_seconds_bucket{le=\"0.1\"} 1\n"
+    "latency_seconds_bucket{le=\"1\"} 2\n"
+    "latency_seconds_bucket{le=\"+Inf\"} 3\n"
+    "latency_seconds_sum 5.55\n"
+    "latency_seconds_count 3\n");
+
+  EXPECT_THROW(registry.add_gauge("tokens_total", "Tokens."), std::invalid_argument);
+  EXPECT_THROW(registry.add_histogram("sizes", "Sizes.", {2, 1}), std::invalid_argument);
+  EXPECT_EQ(metrics::histogram::exponential_buckets(1, 2, 4), (std::vector<double>{1, 2, 4, 8}));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
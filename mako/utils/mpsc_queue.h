@@ -0,0 +1,93 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <optional>
+#include <utility>
+
+namespace mako {
+namespace utils {
+/// \brief Lock-free, unbounded multi-producer, single-consumer FIFO queue.
+///
+/// The queue is a singly linked list whose producers swap themselves in at the head with a single atomic exchange,
+/// so a push never waits for other threads, and whose only consumer unlinks nodes at the tail without any atomic
+/// read-modify-write. Neither side ever blocks; a consumer that must sleep while the queue is empty needs its own way
+/// to be woken up.
+///
+/// NOTE:
+///
+/// A push that has swapped the head but not yet linked its node is not visible to ``pop``, which then returns
+/// ``std::nullopt`` even though the queue is not empty; the element is popped once its push returns.
+/// \tparam T The type of elements.
+template <typename T>
+class mpsc_queue {
+ public:
+  mpsc_queue() : head_(new node), tail_(head_.load(std::memory_order_relaxed)) {}
+  mpsc_queue(const mpsc_queue &)            = delete;
+  mpsc_queue &operator=(const mpsc_queue &) = delete;
+
+  ~mpsc_queue() {
+    while (tail_ != nullptr) {
+      auto next = tail_->next.load(std::memory_order_relaxed);
+      delete tail_;
+      tail_ = next;
+    }
+  }
+
+  /// \brief Appends ``value`` to the queue, which is safe to call from any thread.
+  void push(T value) {
+    auto n    = new node(std::move(value));
+    auto prev = head_.exchange(n, std::memory_order_acq_rel);
+    prev->next.store(n, std::memory_order_release);
+  }
+
+  /// \brief Removes the first element of the queue, which only the consumer thread may call.
+  /// \return The first element, or ``std::nullopt`` if the queue is empty.
+  std::optional<T> pop() {
+    auto next = tail_->next.load(std::memory_order_acquire);
+    if (next == nullptr) {
+      return std::nullopt;
+    }
+    // The node of the popped element stays as the new sentinel, which holds no element.
+    auto value = std::move(next->value);
+    next->value.reset();
+    delete tail_;
+    tail_ = next;
+    return value;
+  }
+
+  /// \brief Whether the queue is empty, which only the consumer thread may call.
+  bool empty() const {
+    return tail_->next.load(std::memory_order_acquire) == nullptr;
+  }
+
+ private:
+  struct node {
+    node() = default;
+    explicit node(T value) : value(std::move(value)) {}
+
+    std::atomic<node *> next{nullptr};
+    std::optional<T> value;
+  };
+
+  /// \brief The last node, which producers contend on; kept apart from the tail not to share a cache line with it.
+  alignas(64) std::atomic<node *> head_;
+
+  /// \brief The sentinel before the first element, touched only by the consumer.
+  alignas(64) node *tail_;
+};
+} // namespace utils
+} // namespace mako
@@ -0,0 +1,75 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/utils/mpsc_queue.h"
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+TEST(MPSCQueueTest, PushPop) {
+  mako::utils::mpsc_queue<std::unique_ptr<int>> queue;
+  EXPECT_TRUE(queue.empty());
+  EXPECT_FALSE(queue.pop().has_value());
+
+  queue.push(std::make_unique<int>(1));
+  queue.push(std::make_unique<int>(2));
+  EXPECT_FALSE(queue.empty());
+  EXPECT_EQ(**queue.pop(), 1);
+  EXPECT_EQ(**queue.pop(), 2);
+  EXPECT_FALSE(queue.pop().has_value());
+
+  // The elements left in the queue are destroyed along with it.
+  queue.push(std::make_unique<int>(3));
+}
+
+TEST(MPSCQueueTest, ConcurrentProducers) {
+  // The elements of each producer are popped in the order it pushed them, and none is lost.
+  constexpr int num_producers = 4;
+  constexpr int num_elements  = 100000;
+  mako::utils::mpsc_queue<std::pair<int, int>> queue;
+
+  std::vector<std::thread> producers;
+  for (auto producer = 0; producer < num_producers; ++producer) {
+    producers.emplace_back([&, producer] {
+      for (auto i = 0; i < num_elements; ++i) {
+        queue.push({producer, i});
+      }
+    });
+  }
+
+  std::vector<int> next(num_producers, 0);
+  for (auto popped = 0; popped < num_producers * num_elements;) {
+    auto element = queue.pop();
+    if (!element.has_value()) {
+      std::this_thread::yield();
+      continue;
+    }
+    auto [producer, i] = *element;
+    EXPECT_EQ(i, next[producer]);
+    next[producer] = i + 1;
+    ++popped;
+  }
+  for (auto &producer : producers) {
+    producer.join();
+  }
+  EXPECT_TRUE(queue.empty());
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,219 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/utils/numpy.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_format.h>
+#include <absl/strings/str_join.h>
+#include <absl/strings/str_split.h>
+#include <absl/strings/strip.h>
+
+#include "mako/utils/mapped_file.h"
+
+// The format is documented in https://numpy.org/doc/stable/reference/generated/numpy.lib.format.html.
+static constexpr char magic[]           = "\x93NUMPY";
+static constexpr size_t magic_size      = sizeof(magic) - 1;
+static constexpr size_t alignment       = 64;
+static constexpr size_t max_header_size = 65535;
+
+/// \brief Converts a torch dtype into the corresponding NumPy array-protocol type string.
+/// \param __dtype The torch dtype.
+/// \return The type string, e.g., ``"<f4"``.
+static inline std::string to_descr(torch::Dtype __dtype) {
+  switch (__dtype) {
+  case torch::kFloat64:
+    return "<f8";
+  case torch::kFloat32:
+    return "<f4";
+  case torch::kFloat16:
+    return "<f2";
+  case torch::kBFloat16:
+    return "bfloat16";
+  case torch::kInt64:
+    return "<i8";
+  case torch::kInt32:
+    return "<i4";
+  case torch::kInt16:
+    return "<i2";
+  case torch::kInt8:
+    return "|i1";
+  case torch::kUInt8:
+    return "|u1";
+  case torch::kBool:
+    return "|b1";
+  default:
+    throw std::invalid_argument(absl::StrFormat("Unsupported dtype for npy: %s", c10::toString(__dtype)));
+  }
+}
+
+/// \brief Converts a NumPy array-protocol type string into the corresponding torch dtype.
+/// \param __descr The type string, e.g., ``"<f4"``.
+/// \return The torch dtype.
+static inline torch::Dtype to_dtype(absl::string_view __descr) {
+  // Single-byte types may be written with any byte order character.
+  if (__descr.size() == 3 && __descr[2] == '1' && (__descr[0] == '<' || __descr[0] == '>' || __descr[0] == '=')) {
+    __descr.remove_prefix(1);
+  } else {
+    __descr = absl::StripPrefix(__descr, "<");
+  }
+
+  if (__descr.compare("f8") == 0) {
+    return torch::kFloat64;
+  } else if (__descr.compare("f4") == 0) {
+    return torch::kFloat32;
+  } else if (__descr.compare("f2") == 0) {
+    return torch::kFloat16;
+  } else if (__descr.compare("bfloat16") == 0) {
+    return torch::kBFloat16;
+  } else if (__descr.compare("i8") == 0) {
+    return torch::kInt64;
+  } else if (__descr.compare("i4") == 0) {
+    return torch::kInt32;
+  } else if (__descr.compare("i2") == 0) {
+    return torch::kInt16;
+  } else if (__descr.compare("|i1") == 0 || __descr.compare("i1") == 0) {
+    return torch::kInt8;
+  } else if (__descr.compare("|u1") == 0 || __descr.compare("u1") == 0) {
+    return torch::kUInt8;
+  } else if (__descr.compare("|b1") == 0 || __descr.compare("b1") == 0) {
+    return torch::kBool;
+  }
+  throw std::invalid_argument(absl::StrFormat("Unsupported npy dtype: %s", __descr));
+}
+
+/// \brief Finds the value of ``__key`` in the Python literal dictionary of an npy header.
+/// \param __header The header, e.g., ``{'descr': '<f4', 'fortran_order': False, 'shape': (3, 4), }``.
+/// \param __key The key to find.
+/// \return The literal value of the key, e.g., ``(3, 4)``.
+static inline absl::string_view find_value(absl::string_view __header, absl::string_view __key) {
+  auto quoted = absl::StrFormat("'%s':", __key);
+  auto pos    = __header.find(quoted);
+  if (pos == absl::string_view::npos) {
+    throw std::runtime_error(absl::StrFormat("Cannot find %s in npy header", __key));
+  }
+  auto value = absl::StripLeadingAsciiWhitespace(__header.substr(pos + quoted.size()));
+
+  // The shape is the only value that may contain a comma.
+  auto end = value.front() == '(' ? value.find(')') + 1 : value.find_first_of(",}");
+  return absl::StripTrailingAsciiWhitespace(value.substr(0, end));
+}
+
+void mako::utils::numpy::save(absl::string_view filename, const torch::Tensor &tensor) {
+  auto contiguous = tensor.cpu().contiguous();
+
+  std::vector<std::string> dims;
+  for (auto dim : contiguous.sizes()) {
+    dims.push_back(std::to_string(dim));
+  }
+  // A tuple of a single element requires a trailing comma in Python.
+  auto shape = dims.size() == 1 ? dims.front() + "," : absl::StrJoin(dims, ", ");
+
+  auto header = absl::StrFormat(
+    "{'descr': '%s', 'fortran_order': False, 'shape': (%s), }",
+    to_descr(contiguous.scalar_type()),
+    shape);
+
+  // Pad the header with spaces and a trailing newline so that the data is aligned, then fall back to version 2.0
+  // whose header length field is 4 bytes wide only if the header does not fit in version 1.0.
+  auto version    = static_cast<uint8_t>(1);
+  auto field_size = sizeof(uint16_t);
+  auto preamble   = magic_size + 2 + field_size;
+  auto padding    = alignment - (preamble + header.size() + 1) % alignment;
+  if (max_header_size < header.size() + padding % alignment + 1) {
+    version    = 2;
+    field_size = sizeof(uint32_t);
+    preamble   = magic_size + 2 + field_size;
+    padding    = alignment - (preamble + header.size() + 1) % alignment;
+  }
+  header.append(padding % alignment, ' ');
+  header.push_back('\n');
+
+  std::ofstream stream(std::string(filename), std::ios::binary);
+  stream.write(magic, magic_size);
+  stream.put(static_cast<char>(version));
+  stream.put(0);
+  auto header_size = static_cast<uint32_t>(header.size());
+  stream.write(reinterpret_cast<const char *>(&header_size), field_size);
+  stream.write(header.data(), header.size());
+  stream.write(static_cast<const char *>(contiguous.data_ptr()), contiguous.nbytes());
+  if (!stream) {
+    throw std::runtime_error(absl::StrFormat("Cannot write %s", filename));
+  }
+}
+
+torch::Tensor mako::utils::numpy::load(absl::string_view filename) {
+  auto file = std::make_shared<mapped_file>(filename);
+  if (file->size() < magic_size + 2 || std::memcmp(file->data(), magic, magic_size) != 0) {
+    throw std::runtime_error(absl::StrFormat("%s is not an npy file", filename));
+  }
+
+  auto version    = static_cast<uint8_t>(file->data()[magic_size]);
+  auto field_size = version == 1 ? sizeof(uint16_t) : sizeof(uint32_t);
+  auto preamble   = magic_size + 2 + field_size;
+  if (file->size() < preamble) {
+    throw std::runtime_error(absl::StrFormat("%s is truncated", filename));
+  }
+  uint32_t header_size = 0;
+  std::memcpy(&header_size, file->data() + magic_size + 2, field_size);
+  auto offset = preamble + header_size;
+  if (file->size() < offset) {
+    throw std::runtime_error(absl::StrFormat("%s is truncated", filename));
+  }
+
+  auto header = absl::string_view(file->data() + preamble, header_size);
+  auto descr  = find_value(header, "descr");
+  auto dtype  = to_dtype(absl::StripSuffix(absl::StripPrefix(descr, "'"), "'"));
+
+  std::vector<int64_t> shape;
+  auto dims = absl::StripSuffix(absl::StripPrefix(find_value(header, "shape"), "("), ")");
+  for (auto dim : absl::StrSplit(dims, ',', absl::SkipWhitespace())) {
+    int64_t size = 0;
+    if (!absl::SimpleAtoi(dim, &size)) {
+      throw std::runtime_error(absl::StrFormat("Invalid shape in %s", filename));
+    }
+    shape.push_back(size);
+  }
+
+  auto numel = std::accumulate(shape.begin(), shape.end(), int64_t{1}, std::multiplies<>());
+  if (file->size() - offset < static_cast<size_t>(numel) * torch::elementSize(dtype)) {
+    throw std::runtime_error(absl::StrFormat("%s is truncated", filename));
+  }
+
+  // A Fortran-ordered array is the transpose of a C-ordered array of the reversed shape.
+  auto fortran_order = find_value(header, "fortran_order").compare("True") == 0;
+  if (fortran_order) {
+    std::reverse(shape.begin(), shape.end());
+  }
+
+  auto tensor = torch::from_blob(
+    file->data() + offset,
+    shape,
+    [file](void *) {},
+    torch::TensorOptions().dtype(dtype));
+  if (fortran_order) {
+    std::vector<int64_t> order(shape.size());
+    std::iota(order.rbegin(), order.rend(), 0);
+    tensor = tensor.permute(order);
+  }
+  return tensor;
+}
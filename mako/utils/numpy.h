@@ -0,0 +1,44 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <absl/strings/string_view.h>
+#include <torch/torch.h>
+
+#include "mako/utils/export.h"
+
+namespace mako {
+namespace utils {
+namespace numpy {
+/// \brief Saves a tensor to a file in NumPy ``.npy`` format, equivalent to ``np.save``.
+///
+/// The header records the dtype and shape of the tensor and is padded so that the raw data starts at a 64-byte
+/// boundary, which makes the file loadable through a memory mapping with no deserialization.
+///
+/// NOTE:
+///
+/// NumPy has no native bfloat16, so bfloat16 tensors are described as ``bfloat16``, the name ``ml_dtypes``
+/// registers it under; such files can be loaded by NumPy only after importing ``ml_dtypes``.
+/// \param filename Path to the file to write, used as is without appending ``.npy``.
+/// \param tensor The tensor to save.
+void MAKO_API save(absl::string_view filename, const torch::Tensor &tensor);
+
+/// \brief Loads a tensor from a file in NumPy ``.npy`` format, equivalent to ``np.load`` with ``mmap_mode="c"``.
+/// \param filename Path to the file to read.
+/// \return The tensor backed by a copy-on-write memory mapping of the file.
+torch::Tensor MAKO_API load(absl::string_view filename);
+} // namespace numpy
+} // namespace utils
+} // namespace mako
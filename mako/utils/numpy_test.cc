@@ -0,0 +1,72 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/utils/numpy.h"
+
+#include <filesystem>
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+namespace fs = std::filesystem;
+
+TEST(NumpyTest, SaveLoad) {
+  auto filename = fs::temp_directory_path() / fs::path("numpy_test.npy");
+
+  std::vector<torch::Tensor> tensors = {
+    torch::arange(12, torch::kFloat32).view({3, 4}),
+    torch::arange(5, torch::kInt64),
+    torch::ones({2, 3, 4}, torch::kBFloat16),
+    torch::full({}, 42, torch::kInt8),
+    torch::arange(6, torch::kFloat16).view({2, 3}).t(),
+  };
+  for (const auto &tensor : tensors) {
+    mako::utils::numpy::save(filename.string(), tensor);
+
+    // The raw data must start at a 64-byte boundary to be usable through a memory mapping.
+    EXPECT_EQ((fs::file_size(filename) - tensor.nbytes()) % 64, 0);
+
+    auto loaded = mako::utils::numpy::load(filename.string());
+    EXPECT_EQ(loaded.scalar_type(), tensor.scalar_type());
+    EXPECT_TRUE(torch::equal(loaded, tensor));
+  }
+  fs::remove(filename);
+}
+
+TEST(NumpyTest, FortranOrder) {
+  // np.save(f, np.asfortranarray(np.arange(6, dtype=np.int32).reshape(2, 3)))
+  std::string header = "{'descr': '<i4', 'fortran_order': True, 'shape': (2, 3), }";
+  header.append(64 - (10 + header.size() + 1) % 64, ' ');
+  header.push_back('\n');
+  int32_t data[] = {0, 3, 1, 4, 2, 5};
+
+  auto filename = fs::temp_directory_path() / fs::path("numpy_test_fortran.npy");
+  {
+    auto header_size = static_cast<uint16_t>(header.size());
+    std::ofstream stream(filename, std::ios::binary);
+    stream.write("\x93NUMPY\x01\x00", 8);
+    stream.write(reinterpret_cast<const char *>(&header_size), sizeof(header_size));
+    stream.write(header.data(), header.size());
+    stream.write(reinterpret_cast<const char *>(data), sizeof(data));
+  }
+
+  auto loaded = mako::utils::numpy::load(filename.string());
+  EXPECT_TRUE(torch::equal(loaded, torch::arange(6, torch::kInt32).view({2, 3})));
+  fs::remove(filename);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,87 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/utils/pickle.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <tuple>
+
+#include <caffe2/serialize/inline_container.h>
+#include <caffe2/serialize/read_adapter_interface.h>
+#include <torch/csrc/jit/serialization/unpickler.h>
+
+#include "mako/utils/mapped_file.h"
+
+namespace {
+/// \brief Read adapter that lets ``PyTorchStreamReader`` walk a memory-mapped archive.
+class mapped_file_adapter final : public caffe2::serialize::ReadAdapterInterface {
+ public:
+  explicit mapped_file_adapter(std::shared_ptr<mako::utils::mapped_file> file) : file_(std::move(file)) {}
+
+  size_t size() const override {
+    return file_->size();
+  }
+
+  size_t read(uint64_t pos, void *buf, size_t n, const char *what = "") const override {
+    if (file_->size() <= pos) {
+      return 0;
+    }
+    n = std::min<size_t>(n, file_->size() - pos);
+    std::memcpy(buf, file_->data() + pos, n);
+    return n;
+  }
+
+ private:
+  std::shared_ptr<mako::utils::mapped_file> file_;
+};
+} // namespace
+
+// Adapted from ``torch::jit::readArchiveAndTensors``, which copies every record out of the archive.
+c10::IValue mako::utils::pickle_load(absl::string_view filename) {
+  auto file   = std::make_shared<mapped_file>(filename);
+  auto reader = caffe2::serialize::PyTorchStreamReader(std::make_shared<mapped_file_adapter>(file));
+
+  // The pickle program itself is tiny compared to the weights, so it is the only record to be copied.
+  at::DataPtr pickle_ptr;
+  size_t pickle_size = 0;
+  std::tie(pickle_ptr, pickle_size) = reader.getRecord("data.pkl");
+
+  size_t bytes_read  = 0;
+  auto pickle_reader = [&](char *buffer, size_t len) -> size_t {
+    if (pickle_size <= bytes_read) {
+      return 0;
+    }
+    len = std::min(pickle_size - bytes_read, len);
+    std::memcpy(buffer, static_cast<const char *>(pickle_ptr.get()) + bytes_read, len);
+    bytes_read += len;
+    return len;
+  };
+
+  // Each storage points at its offset in the mapping, and its context holds a reference to the mapping so that the
+  // mapping outlives every tensor created from it.
+  auto read_record = [&](const std::string &name) {
+    auto offset = reader.getRecordOffset("data/" + name);
+    return at::DataPtr(
+      file->data() + offset,
+      new std::shared_ptr<mapped_file>(file),
+      [](void *ctx) { delete static_cast<std::shared_ptr<mapped_file> *>(ctx); },
+      at::Device(at::kCPU));
+  };
+
+  auto unpickler = torch::jit::Unpickler(pickle_reader, nullptr, nullptr, read_record, c10::nullopt);
+  unpickler.set_version(reader.version());
+  return unpickler.parse_ivalue();
+}
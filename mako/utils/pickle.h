@@ -0,0 +1,37 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <absl/strings/string_view.h>
+#include <torch/torch.h>
+
+#include "mako/utils/export.h"
+
+namespace mako {
+namespace utils {
+/// \brief Loads an object saved with ``torch.save`` in place, equivalent to ``torch.load`` with ``mmap=True``.
+///
+/// Unlike ``torch::pickle_load``, which takes the whole archive as a byte vector, this walks the zip archive on top
+/// of a memory mapping of ``filename``. Only ``data.pkl`` is copied out of the archive, and every storage record is
+/// pointed at its offset in the mapping, so no tensor data is read until it is actually used.
+///
+/// NOTE:
+///
+/// ``torch.save`` always stores records uncompressed, which is what makes pointing into the archive possible.
+/// \param filename Path to the archive, e.g., ``pytorch_model.bin``.
+/// \return The unpickled object whose tensors are backed by the memory mapping.
+c10::IValue MAKO_API pickle_load(absl::string_view filename);
+} // namespace utils
+} // namespace mako
@@ -0,0 +1,46 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/utils/pickle.h"
+
+#include <filesystem>
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+namespace fs = std::filesystem;
+
+TEST(PickleLoadTest, StateDict) {
+  // ``torch::pickle_save`` writes the same zip archive as ``torch.save`` does.
+  c10::Dict<std::string, torch::Tensor> state_dict;
+  state_dict.insert("weight", torch::arange(12, torch::kFloat32).view({3, 4}));
+  state_dict.insert("bias", torch::ones({3}, torch::kBFloat16));
+  auto buf = torch::pickle_save(state_dict);
+
+  auto filename = fs::temp_directory_path() / fs::path("pickle_load_test.bin");
+  std::ofstream(filename, std::ios::binary).write(buf.data(), buf.size());
+
+  auto weights = mako::utils::pickle_load(filename.string()).toGenericDict();
+  fs::remove(filename);
+
+  // Removing the file must not invalidate the mapping.
+  EXPECT_EQ(weights.size(), 2);
+  EXPECT_TRUE(torch::equal(weights.at("weight").toTensor(), state_dict.at("weight")));
+  EXPECT_TRUE(torch::equal(weights.at("bias").toTensor(), state_dict.at("bias")));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
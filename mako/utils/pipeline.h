@@ -0,0 +1,222 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <boost/coroutine2/all.hpp>
+
+#include "mako/utils/bounded_queue.h"
+
+namespace mako {
+namespace utils {
+/// \brief Composable stages of a pipeline, built on coroutines.
+///
+/// A stage is a ``source``, i.e., a pull-type coroutine of elements, such as the one ``weight_iterator`` returns, and
+/// the stages are chained by passing one as the input of the next. The last source is iterated, e.g., with a
+/// range-based ``for``, which drives the whole pipeline:
+///
+/// \code{.cpp}
+/// pipeline::source<std::string> lines{[](pipeline::sink<std::string> &yield) { ... }};
+/// auto prompts = pipeline::map(pipeline::prefetch(std::move(lines), 1024), encode, {4, 256});
+/// for (auto &prompt : prompts) {
+///   ...
+/// }
+/// \endcode
+///
+/// Each stage either runs inline on the thread that pulls from it, or is offloaded to threads of its own, with a
+/// bounded buffer between it and the next stage, so that reading, decoding, and consuming overlap without any stage
+/// running arbitrarily far ahead. Exceptions thrown by a stage or its input are rethrown to the consumer in the order
+/// of the elements, and destroying a source halfway stops and joins the threads of its stages.
+namespace pipeline {
+/// \brief A stage, which generates elements of type ``T`` as it is iterated.
+template <typename T>
+using source = typename boost::coroutines2::coroutine<T>::pull_type;
+
+/// \brief The callable a ``source`` yields its elements through.
+template <typename T>
+using sink = typename boost::coroutines2::coroutine<T>::push_type;
+
+/// \brief Options to control how a stage runs.
+struct stage_options {
+  /// \brief The number of threads to run the stage on, or ``0`` to run it on the thread that pulls from it.
+  size_t num_workers = 0;
+
+  /// \brief The maximum number of elements that have been taken from the input but not yet consumed.
+  ///
+  /// Ignored if ``num_workers`` is ``0``.
+  size_t capacity = 16;
+};
+
+/// \brief Threads feeding a queue, which is closed and the threads joined once the pool is destroyed.
+///
+/// A stage whose threads push to a queue its coroutine pops from owns them through a pool, so that if the coroutine
+/// is unwound halfway, e.g., as its consumer has gone, the threads blocked on the full queue are released and joined
+/// rather than left running. The threads must stop once a push to the closed queue fails.
+/// \tparam T The type of elements of the queue.
+template <typename T>
+struct worker_pool {
+  bounded_queue<T> &queue;
+  std::vector<std::thread> threads;
+
+  ~worker_pool() {
+    queue.close();
+    join();
+  }
+
+  void join() {
+    for (auto &thread : threads) {
+      if (thread.joinable()) {
+        thread.join();
+      }
+    }
+  }
+};
+
+/// \brief Applies ``fn`` to each element of ``input``, preserving the order of the elements.
+///
+/// With workers, each worker takes the next element from ``input``, which is advanced by one worker at a time, and
+/// applies ``fn`` to it concurrently with the others. The consumer waits for the results in the order of the input,
+/// so a slow element holds back the ones after it, but never more than ``options.capacity`` of them.
+/// \tparam Source The type of the input stage, i.e., ``source<T>``.
+/// \param input The input stage, which is advanced on the workers.
+/// \param fn The function to apply, which must be safe to call concurrently with workers.
+/// \param options Options to control the workers.
+/// \return The stage generating the results.
+template <
+  typename Source,
+  typename F,
+  typename T = std::decay_t<decltype(std::declval<Source &>().get())>,
+  typename U = std::decay_t<std::invoke_result_t<F &, T>>>
+source<U> map(Source input, F fn, stage_options options = {}) {
+  if (options.num_workers == 0) {
+    return source<U>{[input = std::move(input), fn = std::move(fn)](sink<U> &yield) mutable {
+      for (auto &value : input) {
+        yield(fn(std::move(value)));
+      }
+    }};
+  }
+
+  return source<U>{[input = std::move(input), fn = std::move(fn), options](sink<U> &yield) mutable {
+    // The futures are queued in the order of the input, before their results are computed.
+    bounded_queue<std::future<U>> queue(options.capacity);
+    std::mutex mutex;
+    std::atomic<size_t> running_workers{options.num_workers};
+
+    worker_pool<std::future<U>> pool{queue};
+    for (size_t i = 0; i < options.num_workers; ++i) {
+      pool.threads.emplace_back([&] {
+        for (;;) {
+          std::promise<U> promise;
+          std::optional<T> value;
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!input) {
+              break;
+            }
+            value.emplace(std::move(input.get()));
+            if (!queue.push(promise.get_future())) {
+              // The consumer has gone.
+              break;
+            }
+            try {
+              input();
+            } catch (...) {
+              // The input has ended by the exception, which the consumer gets after the element.
+              std::promise<U> failure;
+              failure.set_exception(std::current_exception());
+              queue.push(failure.get_future());
+            }
+          }
+
+          try {
+            promise.set_value(fn(std::move(*value)));
+          } catch (...) {
+            promise.set_exception(std::current_exception());
+          }
+        }
+
+        if (--running_workers == 0) {
+          queue.close();
+        }
+      });
+    }
+
+    while (auto result = queue.pop()) {
+      yield(result->get());
+    }
+  }};
+}
+
+/// \brief Runs ``input`` ahead of the consumer on a thread of its own.
+///
+/// The elements are passed through a queue bounded by the total cost of the elements, so that, e.g., reading a file
+/// overlaps with what the consumer does with it while capping how much memory is in flight.
+/// \tparam Source The type of the input stage, i.e., ``source<T>``.
+/// \param input The input stage, which is advanced on the thread.
+/// \param capacity The maximum total cost of the elements that have been taken from the input but not yet consumed.
+/// \param cost The function to compute the cost of an element, or ``nullptr`` for a cost of ``1`` each.
+/// \return The stage generating the same elements as ``input``.
+template <
+  typename Source,
+  typename Cost = std::nullptr_t,
+  typename T    = std::decay_t<decltype(std::declval<Source &>().get())>>
+source<T> prefetch(Source input, size_t capacity, Cost cost = nullptr) {
+  return source<T>{[input = std::move(input), capacity, cost = std::move(cost)](sink<T> &yield) mutable {
+    bounded_queue<T> queue(capacity);
+    std::exception_ptr error;
+
+    worker_pool<T> pool{queue};
+    pool.threads.emplace_back([&] {
+      try {
+        for (auto &value : input) {
+          size_t value_cost = 1;
+          if constexpr (!std::is_null_pointer_v<Cost>) {
+            value_cost = cost(value);
+          }
+          if (!queue.push(std::move(value), value_cost)) {
+            // The consumer has gone.
+            break;
+          }
+        }
+      } catch (...) {
+        error = std::current_exception();
+      }
+      queue.close();
+    });
+
+    while (auto value = queue.pop()) {
+      yield(std::move(*value));
+    }
+
+    // The thread has closed the queue, so the error, if any, has been set.
+    pool.join();
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }};
+}
+} // namespace pipeline
+} // namespace utils
+} // namespace mako
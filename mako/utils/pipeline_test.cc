@@ -0,0 +1,162 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/utils/pipeline.h"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "mako/utils/bounded_queue.h"
+
+namespace pipeline = mako::utils::pipeline;
+
+/// \brief Generates the integers in ``[0, __n)``, throwing at ``__throw_at`` if given.
+static inline pipeline::source<int> iota(int __n, int __throw_at = -1) {
+  return pipeline::source<int>{[=](pipeline::sink<int> &yield) {
+    for (auto i = 0; i < __n; ++i) {
+      if (i == __throw_at) {
+        throw std::runtime_error("iota");
+      }
+      yield(i);
+    }
+  }};
+}
+
+TEST(PipelineTest, Map) {
+  for (size_t num_workers : {0, 1, 4}) {
+    // A slow element holds back the ones after it, so the order of the input is kept.
+    auto square = [](int i) {
+      if (i % 7 == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      return std::to_string(i * i);
+    };
+    std::vector<std::string> squares;
+    for (auto &square : pipeline::map(iota(100), square, {num_workers, 8})) {
+      squares.push_back(square);
+    }
+    ASSERT_EQ(squares.size(), 100);
+    for (auto i = 0; i < 100; ++i) {
+      EXPECT_EQ(squares[i], std::to_string(i * i));
+    }
+  }
+}
+
+TEST(PipelineTest, Compose) {
+  auto lengths = pipeline::map(
+    pipeline::map(pipeline::prefetch(iota(50), 4), [](int i) { return std::string(i, 'x'); }, {2, 4}),
+    [](std::string s) { return s.size(); },
+    {3, 4});
+  size_t expected = 0;
+  for (auto length : lengths) {
+    EXPECT_EQ(length, expected++);
+  }
+  EXPECT_EQ(expected, 50);
+}
+
+TEST(PipelineTest, Prefetch) {
+  // The producer runs ahead of the consumer by no more than the capacity.
+  std::atomic<int> produced{0};
+  pipeline::source<int> input{[&](pipeline::sink<int> &yield) {
+    for (auto i = 0; i < 100; ++i) {
+      ++produced;
+      yield(i);
+    }
+  }};
+  auto consumed = 0;
+  for (auto i : pipeline::prefetch(std::move(input), 10, [](const int &) -> size_t { return 2; })) {
+    EXPECT_EQ(i, consumed++);
+    // The queue holds at most five elements, besides the one in hand of the producer and the one being consumed.
+    EXPECT_LE(produced.load(), consumed + 6);
+  }
+  EXPECT_EQ(consumed, 100);
+}
+
+TEST(PipelineTest, Exceptions) {
+  // The elements before an exception are all generated, in order, before the exception is rethrown.
+  for (size_t num_workers : {0, 4}) {
+    auto next = 0;
+    EXPECT_THROW(
+      {
+        for (auto i : pipeline::map(iota(100, 42), [](int i) { return i; }, {num_workers, 8})) {
+          EXPECT_EQ(i, next++);
+        }
+      },
+      std::runtime_error);
+    EXPECT_EQ(next, 42);
+
+    next = 0;
+    auto fail = [](int i) {
+      if (i == 17) {
+        throw std::invalid_argument("fail");
+      }
+      return i;
+    };
+    EXPECT_THROW(
+      {
+        for (auto i : pipeline::map(iota(100), fail, {num_workers, 8})) {
+          EXPECT_EQ(i, next++);
+        }
+      },
+      std::invalid_argument);
+    EXPECT_EQ(next, 17);
+  }
+
+  EXPECT_THROW(
+    {
+      for (auto i : pipeline::prefetch(iota(100, 42), 4)) {
+        static_cast<void>(i);
+      }
+    },
+    std::runtime_error);
+}
+
+TEST(PipelineTest, Abandon) {
+  // Destroying a source halfway releases its workers, even those blocked on a full buffer.
+  for (size_t num_workers : {1, 4}) {
+    auto squares = pipeline::map(pipeline::prefetch(iota(1000000), 2), [](int i) { return i * i; }, {num_workers, 2});
+    EXPECT_EQ(squares.get(), 0);
+    squares();
+    EXPECT_EQ(squares.get(), 1);
+  }
+}
+
+TEST(PipelineTest, WorkerPool) {
+  // Destroying a pool closes its queue, which releases the threads blocked on pushing to it, and joins them.
+  mako::utils::bounded_queue<int> queue(1);
+  std::atomic<int> pushed{0};
+  {
+    pipeline::worker_pool<int> pool{queue};
+    for (auto i = 0; i < 4; ++i) {
+      pool.threads.emplace_back([&] {
+        while (queue.push(0)) {
+          ++pushed;
+        }
+      });
+    }
+    EXPECT_EQ(queue.pop(), 0);
+  }
+  // One element was popped, so at most two were ever pushed.
+  EXPECT_LE(pushed, 2);
+  EXPECT_EQ(queue.pop(), 0);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
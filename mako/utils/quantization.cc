@@ -0,0 +1,114 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/utils/quantization.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <absl/strings/str_format.h>
+
+/// \brief The number of bytes of float32 rows to quantize at a time.
+static constexpr int64_t block_size = int64_t{16} << 20;
+
+/// \brief The largest magnitude of an 8-bit integer, leaving out -128 to keep the range symmetric.
+static constexpr int64_t int8_max = 127;
+
+/// \brief The largest magnitude of a 4-bit integer, with -8 to 7 offset by 8 into an unsigned nibble.
+static constexpr int64_t int4_max    = 7;
+static constexpr int64_t int4_offset = 8;
+
+/// \brief Computes the scales mapping the largest magnitude of each row of ``__x`` onto ``__max``.
+/// \param __x The float32 tensor whose last dimension shares a scale.
+/// \param __max The largest magnitude of the integers.
+/// \return The scales, with the last dimension kept.
+static inline torch::Tensor scales_of(const torch::Tensor &__x, int64_t __max) {
+  // An all-zero row would otherwise get a zero scale, turning the quantized row into NaNs.
+  return __x.abs().amax(-1, /*keepdim=*/true).div(__max).clamp_min(1e-10);
+}
+
+std::pair<torch::Tensor, torch::Tensor> mako::utils::quantization::quantize(
+  const torch::Tensor &weight,
+  scheme scheme,
+  int64_t group_size) {
+  if (weight.dim() != 2 || !weight.is_floating_point()) {
+    throw std::invalid_argument(
+      absl::StrFormat("Expected a 2-dimensional floating-point weight, but got %d dimensions", weight.dim()));
+  }
+  auto out_features = weight.size(0);
+  auto in_features  = weight.size(1);
+  auto rows         = std::max<int64_t>(block_size / (sizeof(float) * std::max<int64_t>(in_features, 1)), 1);
+
+  switch (scheme) {
+  case scheme::int8: {
+    auto qweight = torch::empty({out_features, in_features}, torch::TensorOptions().dtype(torch::kInt8));
+    auto scales  = torch::empty({out_features}, torch::TensorOptions().dtype(torch::kFloat32));
+    for (int64_t begin = 0; begin < out_features; begin += rows) {
+      auto end   = std::min(begin + rows, out_features);
+      auto x     = weight.slice(0, begin, end).to(torch::kCPU, torch::kFloat32);
+      auto scale = scales_of(x, int8_max);
+      qweight.slice(0, begin, end).copy_(x.div(scale).round_().clamp_(-int8_max, int8_max));
+      scales.slice(0, begin, end).copy_(scale.squeeze(-1));
+    }
+    return std::make_pair(qweight, scales);
+  }
+  case scheme::int4: {
+    if (group_size <= 0 || group_size % 2 != 0 || in_features % group_size != 0) {
+      throw std::invalid_argument(absl::StrFormat(
+        "The group size must be a positive even divisor of the number of input features %d, but got %d",
+        in_features,
+        group_size));
+    }
+    auto groups  = in_features / group_size;
+    auto qweight = torch::empty({out_features, in_features / 2}, torch::TensorOptions().dtype(torch::kUInt8));
+    auto scales  = torch::empty({out_features, groups}, torch::TensorOptions().dtype(torch::kFloat32));
+    for (int64_t begin = 0; begin < out_features; begin += rows) {
+      auto end   = std::min(begin + rows, out_features);
+      auto x     = weight.slice(0, begin, end).to(torch::kCPU, torch::kFloat32).view({end - begin, groups, group_size});
+      auto scale = scales_of(x, int4_max);
+      auto q     = x.div(scale).round_().clamp_(-int4_offset, int4_max).add_(int4_offset).to(torch::kUInt8);
+      q          = q.view({end - begin, in_features});
+      auto low   = q.slice(1, 0, in_features, 2);
+      auto high  = q.slice(1, 1, in_features, 2);
+      qweight.slice(0, begin, end).copy_(torch::bitwise_or(low, high.mul(16)));
+      scales.slice(0, begin, end).copy_(scale.squeeze(-1));
+    }
+    return std::make_pair(qweight, scales);
+  }
+  default:
+    throw std::invalid_argument("Cannot quantize with scheme::none");
+  }
+}
+
+torch::Tensor mako::utils::quantization::dequantize(
+  const torch::Tensor &qweight,
+  const torch::Tensor &scales,
+  scheme scheme,
+  torch::Dtype dtype) {
+  switch (scheme) {
+  case scheme::int8:
+    return qweight.to(dtype).mul_(scales.to(dtype).unsqueeze(-1));
+  case scheme::int4: {
+    auto out_features = qweight.size(0);
+    auto in_features  = qweight.size(1) * 2;
+    auto groups       = scales.size(1);
+    auto low          = torch::bitwise_and(qweight, 15);
+    auto high         = torch::bitwise_right_shift(qweight, 4);
+    auto q            = torch::stack({low, high}, -1).view({out_features, groups, in_features / groups});
+    return q.to(dtype).sub_(int4_offset).mul_(scales.to(dtype).unsqueeze(-1)).view({out_features, in_features});
+  }
+  default:
+    throw std::invalid_argument("Cannot dequantize with scheme::none");
+  }
+}
@@ -0,0 +1,73 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <utility>
+
+#include <torch/torch.h>
+
+#include "mako/utils/export.h"
+
+namespace mako {
+namespace utils {
+namespace quantization {
+/// \brief Schemes to quantize the weights of linear layers with.
+///
+/// Both schemes are symmetric, i.e., a weight is the product of an integer and a scale with no zero point.
+enum class scheme {
+  /// \brief No quantization.
+  none,
+
+  /// \brief 8-bit integers with a scale per output channel.
+  int8,
+
+  /// \brief 4-bit integers with a scale per group of input channels, packed two per byte.
+  int4,
+};
+
+/// \brief Quantizes the weight of a linear layer.
+///
+/// For ``scheme::int8``, the integers are an int8 tensor of shape ``[out_features, in_features]`` and the scales are
+/// a float32 tensor of shape ``[out_features]``.
+///
+/// For ``scheme::int4``, the integers are offset by 8 into ``[0, 15]`` and packed into a uint8 tensor of shape
+/// ``[out_features, in_features / 2]``, the even input channel in the low nibble and the odd one in the high nibble.
+/// The scales are a float32 tensor of shape ``[out_features, in_features / group_size]``.
+///
+/// The weight is quantized a block of rows at a time, so that it is never converted to float32 as a whole.
+/// \param weight The weight of shape ``[out_features, in_features]``, in any floating-point dtype.
+/// \param scheme The scheme to quantize with, which must not be ``scheme::none``.
+/// \param group_size The number of input channels sharing a scale, used only for ``scheme::int4``.
+/// \return The pair of the packed integers and the scales.
+std::pair<torch::Tensor, torch::Tensor> MAKO_API quantize(
+  const torch::Tensor &weight,
+  scheme scheme,
+  int64_t group_size = 128);
+
+/// \brief Reconstructs the weight of a linear layer from its quantized form, the inverse of ``quantize``.
+/// \param qweight The packed integers.
+/// \param scales The scales.
+/// \param scheme The scheme ``qweight`` has been quantized with.
+/// \param dtype The dtype of the weight to reconstruct.
+/// \return The weight of shape ``[out_features, in_features]``.
+torch::Tensor MAKO_API dequantize(
+  const torch::Tensor &qweight,
+  const torch::Tensor &scales,
+  scheme scheme,
+  torch::Dtype dtype = torch::kFloat32);
+} // namespace quantization
+} // namespace utils
+} // namespace mako
@@ -0,0 +1,61 @@
+// Copyright 2024 The Mako Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mako/utils/quantization.h"
+
+#include <gtest/gtest.h>
+
+TEST(QuantizationTest, Int8) {
+  auto weight            = torch::randn({64, 256}, torch::kBFloat16);
+  auto [qweight, scales] = mako::utils::quantization::quantize(weight, mako::utils::quantization::scheme::int8);
+  EXPECT_EQ(qweight.scalar_type(), torch::kInt8);
+  EXPECT_EQ(qweight.sizes(), torch::IntArrayRef({64, 256}));
+  EXPECT_EQ(scales.sizes(), torch::IntArrayRef({64}));
+
+  // Rounding to the nearest integer costs at most half a step per element.
+  auto restored = mako::utils::quantization::dequantize(qweight, scales, mako::utils::quantization::scheme::int8);
+  auto error    = restored.sub(weight.to(torch::kFloat32)).abs();
+  EXPECT_TRUE(error.le(scales.unsqueeze(-1).mul(0.5001)).all().item<bool>());
+}
+
+TEST(QuantizationTest, Int4) {
+  auto weight = torch::randn({8, 64}, torch::kFloat16);
+  weight[0].zero_();
+  auto [qweight, scales] = mako::utils::quantization::quantize(weight, mako::utils::quantization::scheme::int4, 16);
+  EXPECT_EQ(qweight.scalar_type(), torch::kUInt8);
+  EXPECT_EQ(qweight.sizes(), torch::IntArrayRef({8, 32}));
+  EXPECT_EQ(scales.sizes(), torch::IntArrayRef({8, 4}));
+
+  auto restored = mako::utils::quantization::dequantize(qweight, scales, mako::utils::quantization::scheme::int4);
+  auto error    = restored.sub(weight.to(torch::kFloat32)).abs().view({8, 4, 16});
+  EXPECT_TRUE(error.le(scales.unsqueeze(-1).mul(0.5001)).all().item<bool>());
+
+  // An all-zero row stays zero rather than turning into NaNs.
+  EXPECT_TRUE(torch::equal(restored[0], torch::zeros({64})));
+}
+
+TEST(QuantizationTest, Int4Packing) {
+  // With a scale of 1, the weight 1 is stored as 9 in the low nibble and -2 as 6 in the high nibble.
+  auto weight            = torch::tensor({7.0f, -7.0f, 1.0f, -2.0f}).view({1, 4});
+  auto [qweight, scales] = mako::utils::quantization::quantize(weight, mako::utils::quantization::scheme::int4, 4);
+  EXPECT_TRUE(torch::equal(qweight, torch::tensor({0x1f, 0x69}, torch::kUInt8).view({1, 2})));
+  EXPECT_THROW(
+    mako::utils::quantization::quantize(weight, mako::utils::quantization::scheme::int4, 3),
+    std::invalid_argument);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}